@@ -0,0 +1,187 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Generates a collision free (perfect) hash table out of extension to
+ * MIME type mapping file. Each extension is placed in its own slot so
+ * that a lookup costs exactly one hash computation and one comparison.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mime_type.h"
+
+#define MAX_ENTRIES 256
+#define MAX_SEED    1000000
+
+static struct {
+	char extension[MIME_TYPE_MAX_EXTENSION + 1];
+	char content_type[128];
+} entries[MAX_ENTRIES];
+
+static int entry_count = 0;
+
+static int
+_read_entries(const char *file)
+{
+	char line[256];
+	FILE *in;
+
+	if ((in = fopen(file, "r")) == NULL) {
+		fprintf(stderr, "Failed to open %s\n", file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), in)) {
+		char ext[64], type[128];
+		int i;
+
+		if (line[0] == '#' || line[0] == '\n') {
+			continue;
+		}
+		if (2 != sscanf(line, "%63s %127s", ext, type)) {
+			fprintf(stderr, "Malformed line: %s", line);
+			goto error;
+		}
+		if (strlen(ext) > MIME_TYPE_MAX_EXTENSION) {
+			fprintf(stderr, "Extension too long: %s\n", ext);
+			goto error;
+		}
+		if (entry_count == MAX_ENTRIES) {
+			fprintf(stderr, "Too many entries\n");
+			goto error;
+		}
+		for (i = 0; ext[i]; i++) {
+			if (ext[i] >= 'A' && ext[i] <= 'Z') {
+				ext[i] += 'a' - 'A';
+			}
+		}
+		for (i = 0; i < entry_count; i++) {
+			if (0 == strcmp(entries[i].extension, ext)) {
+				fprintf(stderr, "Duplicate extension: %s\n", ext);
+				goto error;
+			}
+		}
+		strcpy(entries[entry_count].extension, ext);
+		strcpy(entries[entry_count].content_type, type);
+		entry_count++;
+	}
+
+	fclose(in);
+	return 0;
+
+error:
+	fclose(in);
+	return -1;
+}
+
+/* Returns 0 when seed places every entry in a distinct slot */
+static int
+_try_seed(unsigned int seed, unsigned int size, int *slots)
+{
+	int i;
+
+	for (i = 0; i < size; i++) {
+		slots[i] = -1;
+	}
+
+	for (i = 0; i < entry_count; i++) {
+		const char *ext = entries[i].extension;
+		unsigned int idx = mime_type_hash(seed, ext, strlen(ext)) % size;
+		if (slots[idx] != -1) {
+			return -1;
+		}
+		slots[idx] = i;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned int size, seed = 0;
+	int *slots = NULL;
+	FILE *out;
+	int i;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s input output\n", argv[0]);
+		return 1;
+	}
+
+	if (0 != _read_entries(argv[1])) {
+		return 1;
+	}
+
+	/* Start at twice the number of keys, grow if no seed is found */
+	for (size = 2; size < 2 * entry_count; size *= 2);
+	for (;; size *= 2) {
+		slots = realloc(slots, size * sizeof(int));
+		if (slots == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			return 1;
+		}
+		for (seed = 0; seed < MAX_SEED; seed++) {
+			if (0 == _try_seed(seed, size, slots)) {
+				goto found;
+			}
+		}
+	}
+
+found:
+	if ((out = fopen(argv[2], "w")) == NULL) {
+		fprintf(stderr, "Failed to open %s\n", argv[2]);
+		return 1;
+	}
+
+	fprintf(out, "/*\n * This file was generated by %s\n */\n\n", argv[0]);
+	fprintf(out, "#define MIME_TYPE_HASH_SEED %uu\n", seed);
+	fprintf(out, "#define MIME_TYPE_TABLE_SIZE %u\n\n", size);
+	fprintf(out, "static const struct mime_type_entry {\n"
+	             "\tconst char *extension;\n"
+	             "\tconst char *content_type;\n"
+	             "} mime_type_table[MIME_TYPE_TABLE_SIZE] = {\n");
+	for (i = 0; i < size; i++) {
+		if (slots[i] == -1) {
+			fprintf(out, "\t{ NULL, NULL },\n");
+		} else {
+			fprintf(out, "\t{ \"%s\", \"%s\" },\n",
+			        entries[slots[i]].extension, entries[slots[i]].content_type);
+		}
+	}
+	fprintf(out, "};\n");
+
+	fclose(out);
+	free(slots);
+
+	return 0;
+}
@@ -4,6 +4,7 @@ PRAGMA journal_mode = WAL;
 CREATE TABLE IF NOT EXISTS artists(
 	id		INTEGER PRIMARY KEY,
 	name		TEXT,
+	generation	INTEGER,
 	UNIQUE(name) ON CONFLICT IGNORE
 );
 
@@ -11,6 +12,7 @@ CREATE TABLE IF NOT EXISTS albums(
 	id		INTEGER PRIMARY KEY,
 	name		TEXT,
 	artist_id	INTEGER,
+	generation	INTEGER,
 	FOREIGN KEY(artist_id)	REFERENCES artists(id),
 	CONSTRAINT unq UNIQUE(name, artist_id) ON CONFLICT IGNORE
 );
@@ -19,13 +21,75 @@ CREATE TABLE IF NOT EXISTS songs(
 	id 		INTEGER PRIMARY KEY,
 	title		TEXT,
 	path		TEXT,
-	hash		TEXT,
+	hash		BLOB,
 	track		INTEGER,
 	length		INTEGER,
 	artist_id	INTEGER,
 	album_id	INTEGER,
+	fingerprint	BLOB,
 	FOREIGN KEY(artist_id)	REFERENCES artists(id),
 	FOREIGN KEY(album_id)	REFERENCES albums(id),
 	UNIQUE(path) ON CONFLICT IGNORE,
 	UNIQUE(hash) ON CONFLICT IGNORE
 );
+
+CREATE TABLE IF NOT EXISTS scans(
+	id		INTEGER PRIMARY KEY,
+	root		TEXT,
+	completed	INTEGER
+);
+
+CREATE TABLE IF NOT EXISTS scan_dirs(
+	path		TEXT PRIMARY KEY,
+	mtime		INTEGER,
+	scan		INTEGER
+);
+
+CREATE INDEX IF NOT EXISTS artists_by_generation ON artists(generation);
+
+CREATE INDEX IF NOT EXISTS albums_by_artist ON albums(artist_id, name);
+
+CREATE INDEX IF NOT EXISTS albums_by_generation ON albums(generation);
+
+CREATE INDEX IF NOT EXISTS songs_by_album ON songs(album_id, track);
+
+CREATE INDEX IF NOT EXISTS songs_by_fingerprint ON songs(fingerprint);
+
+CREATE INDEX IF NOT EXISTS scans_by_root ON scans(root, completed);
+
+CREATE INDEX IF NOT EXISTS scan_dirs_by_scan ON scan_dirs(scan);
+
+CREATE VIRTUAL TABLE IF NOT EXISTS songs_fts USING fts5(
+	title,
+	artist,
+	album,
+	prefix = '2 3',
+	tokenize = 'unicode61 remove_diacritics 2'
+);
+
+CREATE TRIGGER IF NOT EXISTS songs_fts_insert AFTER INSERT ON songs BEGIN
+	INSERT INTO songs_fts (rowid, title, artist, album)
+		SELECT new.id, new.title, ar.name, al.name FROM artists ar, albums al
+		WHERE ar.id=new.artist_id AND al.id=new.album_id;
+END;
+
+CREATE TRIGGER IF NOT EXISTS songs_fts_delete AFTER DELETE ON songs BEGIN
+	DELETE FROM songs_fts WHERE rowid=old.id;
+END;
+
+CREATE TRIGGER IF NOT EXISTS songs_fts_update AFTER UPDATE OF title, artist_id, album_id ON songs BEGIN
+	DELETE FROM songs_fts WHERE rowid=old.id;
+	INSERT INTO songs_fts (rowid, title, artist, album)
+		SELECT new.id, new.title, ar.name, al.name FROM artists ar, albums al
+		WHERE ar.id=new.artist_id AND al.id=new.album_id;
+END;
+
+CREATE TRIGGER IF NOT EXISTS songs_fts_artist_update AFTER UPDATE OF name ON artists BEGIN
+	UPDATE songs_fts SET artist=new.name
+		WHERE rowid IN (SELECT id FROM songs WHERE artist_id=new.id);
+END;
+
+CREATE TRIGGER IF NOT EXISTS songs_fts_album_update AFTER UPDATE OF name ON albums BEGIN
+	UPDATE songs_fts SET album=new.name
+		WHERE rowid IN (SELECT id FROM songs WHERE album_id=new.id);
+END;
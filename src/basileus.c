@@ -39,6 +39,9 @@
 
 #include "config.h"
 #include "logger.h"
+#include "evlog.h"
+#include "metrics.h"
+#include "span.h"
 #include "basileus.h"
 #include "scheduler.h"
 #include "music_db.h"
@@ -56,6 +59,9 @@ typedef struct {
 	struct event        *int_evt;
 	struct event        *hup_evt;
 	struct event        *usr1_evt;
+	struct event        *usr2_evt;
+
+	int                  log_level;
 } _basileus_t;
 
 void
@@ -90,6 +96,13 @@ _basileus_sighandler(evutil_socket_t signal, short events, void *user_data)
 			free(e);
 			return;
 		}
+	} else if (signal == SIGUSR2) {
+		if (logger_level != LOG_LEVEL_COMPILED) {
+			logger_level = LOG_LEVEL_COMPILED;
+		} else {
+			logger_level = app->log_level;
+		}
+		log_info("Log level: %s", logger_level_name(logger_level));
 	} else {
 		assert(0);
 	}
@@ -154,6 +167,11 @@ basileus_init(const char *config_path)
 		log_error("Failed to register SIGUSR1 handler!");
 		goto failure;
 	}
+	app->usr2_evt = evsignal_new(evb, SIGUSR2, _basileus_sighandler, app);
+	if (!app->usr2_evt || event_add(app->usr2_evt, NULL) < 0) {
+		log_error("Failed to register SIGUSR2 handler!");
+		goto failure;
+	}
 
 	if (access(config_path, R_OK) != 0) {
 		log_error("Failed to open configuration file: %s\n", config_path);
@@ -162,6 +180,24 @@ basileus_init(const char *config_path)
 	if ((app->config = cfg_init(config_path)) == NULL) {
 		goto failure;
 	}
+	if (logger_configure(cfg_get_str(app->config, CFG_LOG_OVERFLOW),
+	                     atoi(cfg_get_str(app->config, CFG_LOG_BUFFER_SIZE)))) {
+		goto failure;
+	}
+	if (cfg_get_str(app->config, CFG_LOG_LEVEL)[0] != '\0' &&
+	    logger_set_level(cfg_get_str(app->config, CFG_LOG_LEVEL))) {
+		goto failure;
+	}
+	app->log_level = logger_level;
+	metrics_register_func("basileus_log_dropped_total", NULL,
+	                      "Log messages dropped because of full buffers.", logger_dropped);
+	if (cfg_get_str(app->config, CFG_EVENT_LOG)[0] != '\0' &&
+	    evlog_open(cfg_get_str(app->config, CFG_EVENT_LOG),
+	               strtoul(cfg_get_str(app->config, CFG_EVENT_LOG_SIZE), NULL, 10))) {
+		goto failure;
+	}
+	span_configure(strtoul(cfg_get_str(app->config, CFG_TRACE_SPANS_SIZE), NULL, 10));
+	span_enable(atoi(cfg_get_str(app->config, CFG_TRACE_SPANS)));
 	if ((app->scheduler = scheduler_new(app->config, evb)) == NULL) {
 		goto failure;
 	}
@@ -202,6 +238,7 @@ basileus_shutdown(basileus_t *basileus)
 	if (app->scheduler) {
 		scheduler_free(app->scheduler);
 	}
+	evlog_close();
 	if (app->config) {
 		cfg_free(app->config);
 		app->config = NULL;
@@ -218,6 +255,9 @@ basileus_shutdown(basileus_t *basileus)
 	if (app->usr1_evt) {
 		event_free(app->usr1_evt);
 	}
+	if (app->usr2_evt) {
+		event_free(app->usr2_evt);
+	}
 	if (app->ev_base) {
 		event_base_free(app->ev_base);
 	}
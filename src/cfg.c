@@ -42,12 +42,30 @@ static const struct {
 	const char     *key_str;
 	const char     *default_value;
 } options_table[] = {
-	{ CFG_LISTENING_ADDRESS, "listening-address", DEFAULT_LISTENING_ADDRESS },
-	{ CFG_LISTENING_PORT,    "listening-port",    DEFAULT_LISTENING_PORT },
-	{ CFG_DOCUMENT_ROOT,     "document-root",     DEFAULT_DOCUMENT_ROOT },
-	{ CFG_DATABASE_PATH,     "database-path",     DEFAULT_DB_PATH },
-	{ CFG_MUSIC_DIR,         "music-dir",         DEFAULT_MUSIC_DIR },
-	{ CFG_SCHEDULER_THREADS, "scheduler-threads", "0" }
+	{ CFG_LISTENING_ADDRESS,   "listening-address",   DEFAULT_LISTENING_ADDRESS },
+	{ CFG_LISTENING_PORT,      "listening-port",      DEFAULT_LISTENING_PORT },
+	{ CFG_DOCUMENT_ROOT,       "document-root",       DEFAULT_DOCUMENT_ROOT },
+	{ CFG_DATABASE_PATH,       "database-path",       DEFAULT_DB_PATH },
+	{ CFG_MUSIC_DIR,           "music-dir",           DEFAULT_MUSIC_DIR },
+	{ CFG_SCHEDULER_THREADS,   "scheduler-threads",   "0" },
+	{ CFG_MAX_CONNECTIONS,     "max-connections",     "128" },
+	{ CFG_CONNECTION_TIMEOUT,  "connection-timeout",  "30" },
+	{ CFG_MAX_HEADERS_SIZE,    "max-headers-size",    "8192" },
+	{ CFG_MAX_BODY_SIZE,       "max-body-size",       "1024" },
+	{ CFG_MAX_LOOP_LAG,        "max-loop-lag",        "250" },
+	{ CFG_CONTENT_FINGERPRINT, "content-fingerprint", "0" },
+	{ CFG_IGNORE_EXTENSIONS,   "ignore-extensions",   "" },
+	{ CFG_IO_DEPTH,            "io-depth",            "128" },
+	{ CFG_FAST_TAG_SCAN,       "fast-tag-scan",       "1" },
+	{ CFG_LOG_OVERFLOW,        "log-overflow",        "block" },
+	{ CFG_LOG_BUFFER_SIZE,     "log-buffer-size",     "65536" },
+	{ CFG_LOG_LEVEL,           "log-level",           "" },
+	{ CFG_EVENT_LOG,           "event-log",           "" },
+	{ CFG_EVENT_LOG_SIZE,      "event-log-size",      "16777216" },
+	{ CFG_PROFILE_STATEMENTS,  "profile-statements",  "1" },
+	{ CFG_SLOW_STATEMENT_TIME, "slow-statement-time", "100" },
+	{ CFG_TRACE_SPANS,         "trace-spans",         "0" },
+	{ CFG_TRACE_SPANS_SIZE,    "trace-spans-size",    "16384" }
 };
 
 typedef struct {
@@ -100,13 +118,13 @@ _parse_line(_cfg_t *cfg, char *line)
 	for (i = 0; i < CFG_KEY_LAST; ++i) {
 		const char *opt_key = options_table[i].key_str;
 		int key_len = strlen(opt_key);
-		if (key_len >= strlen(key)) {
-			log_error("Configuration key too short: %s", key);
-			return -1;
-		}
 		if (0 != strncmp(key, opt_key, key_len)) {
 			continue;
 		}
+		/* Make sure we don't match on a key prefix */
+		if (key[key_len] != ' ' && key[key_len] != '\t' && key[key_len] != '=') {
+			continue;
+		}
 
 		char *val = strchr(line, '=');
 		if (val == NULL) {
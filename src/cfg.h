@@ -37,6 +37,24 @@ typedef enum {
 	CFG_DATABASE_PATH,
 	CFG_MUSIC_DIR,
 	CFG_SCHEDULER_THREADS,
+	CFG_MAX_CONNECTIONS,
+	CFG_CONNECTION_TIMEOUT,
+	CFG_MAX_HEADERS_SIZE,
+	CFG_MAX_BODY_SIZE,
+	CFG_MAX_LOOP_LAG,
+	CFG_CONTENT_FINGERPRINT,
+	CFG_IGNORE_EXTENSIONS,
+	CFG_IO_DEPTH,
+	CFG_FAST_TAG_SCAN,
+	CFG_LOG_OVERFLOW,
+	CFG_LOG_BUFFER_SIZE,
+	CFG_LOG_LEVEL,
+	CFG_EVENT_LOG,
+	CFG_EVENT_LOG_SIZE,
+	CFG_PROFILE_STATEMENTS,
+	CFG_SLOW_STATEMENT_TIME,
+	CFG_TRACE_SPANS,
+	CFG_TRACE_SPANS_SIZE,
 	CFG_KEY_LAST
 } cfg_key_t;
 
@@ -0,0 +1,335 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _DEFAULT_SOURCE /* DT_DIR, DT_REG and syscall() */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "logger.h"
+#include "dir_walk.h"
+#include "span.h"
+
+/* Size of directory entry buffer, per level of nesting */
+#define DIR_WALK_BUF_SIZE (64 * 1024)
+
+#ifdef __linux__
+/* Record returned by getdents64, glibc only exposes it since 2.30 */
+typedef struct {
+	uint64_t       d_ino;
+	int64_t        d_off;
+	unsigned short d_reclen;
+	unsigned char  d_type;
+	char           d_name[1];
+} _dirent64_t;
+#endif
+
+typedef struct {
+	int     fd;
+	size_t  path_len; /* Length of directory path in walker's path buffer */
+	size_t  name_off; /* Offset of directory name in path */
+	int     error;    /* Some entries at or below directory could not be read */
+#ifdef __linux__
+	char   *buf;
+	size_t  pos;
+	size_t  end;
+#else
+	DIR    *dirp;
+#endif
+} _frame_t;
+
+typedef struct {
+	char     *path;
+	size_t    path_cap;
+	_frame_t  frames[DIR_WALK_MAX_DEPTH];
+	int       depth;
+} _walker_t;
+
+/*
+ * Get next entry of directory on top of the stack.
+ * Returns 1 when entry was read, 0 at the end and -1 on error.
+ */
+#ifdef __linux__
+static int
+_next(_frame_t *f, const char **name, unsigned char *type)
+{
+	_dirent64_t *d = NULL;
+	span_t span;
+	long ret;
+
+	if (f->pos >= f->end) {
+		span = span_begin();
+		do {
+			ret = syscall(SYS_getdents64, f->fd, f->buf, DIR_WALK_BUF_SIZE);
+		} while (ret < 0 && errno == EINTR);
+		span_end(span, "getdents64");
+		if (ret <= 0) {
+			return ret < 0 ? -1 : 0;
+		}
+		f->pos = 0;
+		f->end = ret;
+	}
+
+	d = (_dirent64_t *)(f->buf + f->pos);
+	f->pos += d->d_reclen;
+	*name = d->d_name;
+	*type = d->d_type;
+	return 1;
+}
+#else
+static int
+_next(_frame_t *f, const char **name, unsigned char *type)
+{
+	struct dirent *d = NULL;
+	span_t span = span_begin();
+
+	errno = 0;
+	d = readdir(f->dirp);
+	span_end(span, "readdir");
+	if (d == NULL) {
+		return errno ? -1 : 0;
+	}
+	*name = d->d_name;
+	*type = d->d_type;
+	return 1;
+}
+#endif
+
+static int
+_push(_walker_t *w, int fd, size_t path_len, size_t name_off)
+{
+	_frame_t *f = &w->frames[w->depth];
+
+#ifdef __linux__
+	/* Buffers stay allocated for reuse by following siblings */
+	if (f->buf == NULL && (f->buf = malloc(DIR_WALK_BUF_SIZE)) == NULL) {
+		log_error("Failed to allocate directory buffer!");
+		close(fd);
+		return ENOMEM;
+	}
+	f->pos = f->end = 0;
+#else
+	if ((f->dirp = fdopendir(fd)) == NULL) {
+		log_warning("Failed to read %s: %s", w->path, strerror(errno));
+		close(fd);
+		if (w->depth > 0) {
+			w->frames[w->depth - 1].error = 1;
+		}
+		return 0;
+	}
+#endif
+	f->fd = fd;
+	f->path_len = path_len;
+	f->name_off = name_off;
+	f->error = 0;
+	w->depth++;
+
+	return 0;
+}
+
+static void
+_pop(_walker_t *w)
+{
+	_frame_t *f = &w->frames[--w->depth];
+
+#ifdef __linux__
+	close(f->fd);
+#else
+	closedir(f->dirp);
+#endif
+	f->fd = -1;
+}
+
+/*
+ * Append name to directory path, growing buffer when needed.
+ */
+static int
+_path_append(_walker_t *w, size_t dir_len, const char *name, size_t name_len)
+{
+	size_t len = dir_len + name_len + 2;
+	char *path = NULL;
+
+	if (len > w->path_cap) {
+		if ((path = realloc(w->path, len * 2)) == NULL) {
+			log_error("Failed to allocate buffer for path!");
+			return ENOMEM;
+		}
+		w->path = path;
+		w->path_cap = len * 2;
+	}
+
+	w->path[dir_len] = '/';
+	memcpy(w->path + dir_len + 1, name, name_len + 1);
+	return 0;
+}
+
+int
+dir_walk(const char *root, dir_walk_cb_t cb, void *data)
+{
+	_walker_t w;
+	_frame_t *f = NULL;
+	dir_walk_entry_t entry;
+	const char *name = NULL;
+	unsigned char type;
+	struct stat st;
+	size_t root_len, name_len;
+	int fd, error, ret = 0;
+#ifdef __linux__
+	int i;
+#endif
+
+	memset(&w, 0, sizeof(w));
+
+	/* Trailing slashes would be doubled in reported paths */
+	root_len = strlen(root);
+	while (root_len > 1 && root[root_len - 1] == '/') {
+		root_len--;
+	}
+	w.path_cap = root_len + 256;
+	if ((w.path = malloc(w.path_cap)) == NULL) {
+		log_error("Failed to allocate buffer for path!");
+		return ENOMEM;
+	}
+	memcpy(w.path, root, root_len);
+	w.path[root_len] = '\0';
+
+	if ((fd = open(w.path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+		ret = errno;
+		log_warning("Failed to open %s: %s", w.path, strerror(errno));
+		goto finish;
+	}
+	if ((ret = _push(&w, fd, root_len, 0))) {
+		goto finish;
+	}
+
+	while (w.depth > 0) {
+		f = &w.frames[w.depth - 1];
+
+		if ((ret = _next(f, &name, &type)) <= 0) {
+			w.path[f->path_len] = '\0';
+			if (ret < 0) {
+				log_warning("Failed to read %s: %s", w.path, strerror(errno));
+				f->error = 1;
+			}
+			error = f->error;
+			_pop(&w);
+			if (w.depth == 0) {
+				ret = 0;
+				break;
+			}
+			w.frames[w.depth - 1].error |= error;
+			entry.path = w.path;
+			entry.len = f->path_len;
+			entry.name = w.path + f->name_off;
+			entry.type = DIR_WALK_DIR_DONE;
+			entry.depth = w.depth;
+			entry.dir_fd = w.frames[w.depth - 1].fd;
+			entry.error = error;
+			if ((ret = cb(&entry, data))) {
+				goto finish;
+			}
+			continue;
+		}
+
+		if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+			continue;
+		}
+
+		/* Some file systems (e.g. older XFS, NFS) don't fill in d_type */
+		if (type == DT_UNKNOWN) {
+			if (fstatat(f->fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+				f->error = 1;
+				continue;
+			}
+			type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+		}
+		if (type != DT_DIR && type != DT_REG) {
+			continue;
+		}
+
+		name_len = strlen(name);
+		if ((ret = _path_append(&w, f->path_len, name, name_len))) {
+			goto finish;
+		}
+
+		entry.path = w.path;
+		entry.len = f->path_len + 1 + name_len;
+		entry.name = w.path + f->path_len + 1;
+		entry.type = type == DT_DIR ? DIR_WALK_DIR : DIR_WALK_FILE;
+		entry.depth = w.depth;
+		entry.dir_fd = f->fd;
+		entry.error = 0;
+
+		if ((ret = cb(&entry, data)) == DIR_WALK_PRUNE) {
+			ret = 0;
+			continue;
+		} else if (ret) {
+			goto finish;
+		}
+
+		if (type != DT_DIR) {
+			continue;
+		}
+		if (w.depth == DIR_WALK_MAX_DEPTH) {
+			log_warning("Directory nested too deep, skipping: %s", w.path);
+			continue;
+		}
+		if ((fd = openat(f->fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)) < 0) {
+			log_warning("Failed to open %s: %s", w.path, strerror(errno));
+			f->error = 1;
+			continue;
+		}
+		if ((ret = _push(&w, fd, entry.len, f->path_len + 1))) {
+			goto finish;
+		}
+	}
+
+finish:
+	while (w.depth > 0) {
+		_pop(&w);
+	}
+#ifdef __linux__
+	for (i = 0; i < DIR_WALK_MAX_DEPTH; i++) {
+		free(w.frames[i].buf);
+	}
+#endif
+	free(w.path);
+
+	return ret;
+}
@@ -0,0 +1,81 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _DIR_WALK_H_
+#define _DIR_WALK_H_
+
+#include <stddef.h>
+
+/* Directories nested deeper than this are not descended into */
+#define DIR_WALK_MAX_DEPTH 64
+
+/* Callback return value which stops the walker from entering a directory */
+#define DIR_WALK_PRUNE -1
+
+typedef enum {
+	DIR_WALK_FILE,
+	DIR_WALK_DIR,
+	DIR_WALK_DIR_DONE /* All entries below directory were reported */
+} dir_walk_type_t;
+
+typedef struct {
+	const char      *path;   /* Full path, only valid during the callback */
+	const char      *name;   /* Last component of path */
+	size_t           len;    /* Length of path */
+	dir_walk_type_t  type;
+	int              depth;  /* Directly in root is depth 1 */
+	int              dir_fd; /* Directory containing entry, for *at() calls */
+	int              error;  /* DIR_WALK_DIR_DONE only, some entries at or below
+	                            directory could not be read */
+} dir_walk_entry_t;
+
+/**
+ * Called for each regular file and directory found by dir_walk(), and once
+ * more with DIR_WALK_DIR_DONE after contents of a directory were walked.
+ * A directory that failed to be read, in part or in full, sets error on
+ * its parent's DIR_WALK_DIR_DONE and on those of all its ancestors.
+ * @return 0 to continue, DIR_WALK_PRUNE to skip a directory's contents, any
+ *         other value stops the walk.
+ */
+typedef int (*dir_walk_cb_t)(const dir_walk_entry_t *entry, void *data);
+
+/**
+ * Walk directory tree depth first without recursion. Directories are
+ * opened relative to their parent and read in large batches, symbolic
+ * links are not followed. Unreadable directories are skipped.
+ * @param root Directory to walk, not reported to callback.
+ * @param cb Entry callback.
+ * @param data Passed to callback.
+ * @return 0 on success, errno value when root can't be opened or memory
+ *         allocation fails, otherwise the value that stopped the walk.
+ */
+int
+dir_walk(const char *root, dir_walk_cb_t cb, void *data);
+
+#endif /* !_DIR_WALK_H_ */
@@ -0,0 +1,790 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+#include "evlog.h"
+#include "logger.h"
+
+/* Smallest log file, so that format definitions always fit */
+#define EVLOG_MIN_SIZE  (64 * 1024)
+
+/* Argument types */
+#define ARG_INVALID  0
+#define ARG_INT      1
+#define ARG_LONG     2
+#define ARG_LLONG    3
+#define ARG_SIZE     4
+#define ARG_DOUBLE   5
+#define ARG_PTR      6
+#define ARG_STR      7
+
+typedef struct {
+	const char  *fmt;
+	char         types[EVLOG_MAX_ARGS];
+	int          count;
+	size_t       fixed;   /* Bytes taken by arguments other than strings */
+} _evlog_format_t;
+
+/*
+ * Mapped log file. Writers reserve space by bumping used, writers counts
+ * those between looking up the current map and finishing their copy, so
+ * that it is not unmapped under them.
+ */
+typedef struct {
+	char          *base;
+	size_t         size;
+	unsigned long  used;
+	unsigned long  writers;
+	int            fd;
+} _evlog_map_t;
+
+int evlog_enabled = 0;
+
+static pthread_mutex_t  _evlog_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t  _evlog_intern_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t   _evlog_once = PTHREAD_ONCE_INIT;
+static pthread_key_t    _evlog_thread_key;
+static unsigned int     _evlog_threads = 0;
+
+/* Rotation switches between the two maps */
+static _evlog_map_t     _evlog_maps[2];
+static _evlog_map_t    *_evlog_map = NULL;
+static char            *_evlog_path = NULL;
+static char            *_evlog_old_path = NULL;
+static size_t           _evlog_size = 0;
+
+/* Interned formats, indexed by id */
+static _evlog_format_t  _evlog_formats[EVLOG_MAX_FORMATS];
+static int              _evlog_format_count = 0;
+
+/*
+ * Finds the next conversion in fmt, skipping "%%". Sets *spec to its
+ * start and *type to type of its argument. Returns pointer past the
+ * conversion, or NULL if there are no more.
+ */
+static const char *
+_evlog_conversion(const char *fmt, const char **spec, int *type)
+{
+	const char *p = fmt;
+	int longs = 0, size = 0;
+
+	while ((p = strchr(p, '%')) != NULL && p[1] == '%') {
+		p += 2;
+	}
+	if (p == NULL) {
+		return NULL;
+	}
+
+	*spec = p++;
+	p += strspn(p, "-+ #0123456789.");
+	for (; *p == 'h' || *p == 'l' || *p == 'z'; p++) {
+		longs += *p == 'l';
+		size |= *p == 'z';
+	}
+
+	switch (*p) {
+	case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+		*type = size ? ARG_SIZE : longs > 1 ? ARG_LLONG : longs ? ARG_LONG : ARG_INT;
+		break;
+	case 'f': case 'e': case 'g':
+		*type = ARG_DOUBLE;
+		break;
+	case 'p':
+		*type = ARG_PTR;
+		break;
+	case 's':
+		*type = ARG_STR;
+		break;
+	default:
+		*type = ARG_INVALID;
+		return *p ? p + 1 : p;
+	}
+
+	return p + 1;
+}
+
+static size_t
+_evlog_arg_size(int type)
+{
+	switch (type) {
+	case ARG_INT:
+		return sizeof(int32_t);
+	case ARG_STR:
+		return 1;
+	default:
+		return sizeof(int64_t);
+	}
+}
+
+static void
+_evlog_thread_key_init()
+{
+	(void)pthread_key_create(&_evlog_thread_key, NULL);
+}
+
+static uint32_t
+_evlog_thread()
+{
+	uintptr_t thread = (uintptr_t)pthread_getspecific(_evlog_thread_key);
+
+	if (thread == 0) {
+		thread = __atomic_add_fetch(&_evlog_threads, 1, __ATOMIC_RELAXED);
+		(void)pthread_setspecific(_evlog_thread_key, (void *)thread);
+	}
+	return thread;
+}
+
+static uint64_t
+_evlog_clock(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Records are stamped with the monotonic clock, which wall clock changes
+ * don't move. The file header anchors it to the real time.
+ */
+static uint64_t
+_evlog_now()
+{
+	return _evlog_clock(CLOCK_MONOTONIC);
+}
+
+/* Builds definition record of given format id, returns its padded size */
+static size_t
+_evlog_definition(uint64_t *buf, int id)
+{
+	evlog_record_t *rec = (evlog_record_t *)buf;
+	char *data = (char *)(rec + 1);
+	uint16_t def = id;
+	size_t len = strlen(_evlog_formats[id].fmt) + 1;
+	size_t total = (sizeof(*rec) + sizeof(def) + len + 7) & ~7;
+
+	memset((char *)buf + total - 8, 0, 8);
+	rec->time = _evlog_now();
+	rec->thread = _evlog_thread();
+	rec->id = 0;
+	rec->size = sizeof(def) + len;
+	memcpy(data, &def, sizeof(def));
+	memcpy(data + sizeof(def), _evlog_formats[id].fmt, len);
+
+	return total;
+}
+
+static void
+_evlog_unmap(_evlog_map_t *map)
+{
+	size_t used = map->used < map->size ? map->used : map->size;
+
+	munmap(map->base, map->size);
+	/* Drop the unused, zeroed tail */
+	if (ftruncate(map->fd, used) != 0) {
+		log_warning("Failed to truncate event log: %s", strerror(errno));
+	}
+	close(map->fd);
+	map->base = NULL;
+}
+
+/*
+ * Creates a new log file for given map and writes all format definitions
+ * to it. The map must not be in use.
+ */
+static int
+_evlog_map_file(_evlog_map_t *map)
+{
+	uint64_t buf[EVLOG_MAX_RECORD / sizeof(uint64_t)];
+	evlog_header_t header;
+	void *base = MAP_FAILED;
+	size_t len;
+	int fd, id, count;
+
+	/* Wait for writers which looked the map up before its last use ended */
+	while (__atomic_load_n(&map->writers, __ATOMIC_ACQUIRE) != 0) {
+		sched_yield();
+	}
+
+	fd = open(_evlog_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0 || ftruncate(fd, _evlog_size) != 0 ||
+	    (base = mmap(NULL, _evlog_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                 fd, 0)) == MAP_FAILED) {
+		log_error("Failed to create event log %s: %s", _evlog_path, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+
+#ifdef MADV_POPULATE_WRITE
+	/* Fault the pages in writable now rather than on the first event in each */
+	(void)madvise(base, _evlog_size, MADV_POPULATE_WRITE);
+#endif
+
+	map->fd = fd;
+	map->base = base;
+	map->size = _evlog_size;
+	memcpy(header.magic, EVLOG_MAGIC, sizeof(EVLOG_MAGIC));
+	header.realtime = _evlog_clock(CLOCK_REALTIME);
+	header.monotonic = _evlog_now();
+	memcpy(map->base, &header, sizeof(header));
+	map->used = EVLOG_HEADER_SIZE;
+
+	count = __atomic_load_n(&_evlog_format_count, __ATOMIC_ACQUIRE);
+	for (id = 1; id <= count; id++) {
+		len = _evlog_definition(buf, id);
+		if (map->used + len > map->size) {
+			break;
+		}
+		memcpy(map->base + map->used, buf, len);
+		map->used += len;
+	}
+
+	return 0;
+}
+
+/* Moves the full log aside and starts a new one */
+static void
+_evlog_rotate(_evlog_map_t *old)
+{
+	_evlog_map_t *map = old == &_evlog_maps[0] ? &_evlog_maps[1] : &_evlog_maps[0];
+
+	pthread_mutex_lock(&_evlog_lock);
+	if (__atomic_load_n(&_evlog_map, __ATOMIC_ACQUIRE) != old) {
+		/* Rotated by someone else, or closed */
+		pthread_mutex_unlock(&_evlog_lock);
+		return;
+	}
+
+	if (rename(_evlog_path, _evlog_old_path) != 0) {
+		log_warning("Failed to rename event log: %s", strerror(errno));
+	}
+	if (_evlog_map_file(map) != 0) {
+		evlog_enabled = 0;
+		map = NULL;
+	}
+	__atomic_store_n(&_evlog_map, map, __ATOMIC_SEQ_CST);
+
+	while (__atomic_load_n(&old->writers, __ATOMIC_ACQUIRE) != 0) {
+		sched_yield();
+	}
+	_evlog_unmap(old);
+
+	pthread_mutex_unlock(&_evlog_lock);
+}
+
+static void
+_evlog_append(const void *buf, size_t len)
+{
+	_evlog_map_t *map;
+	unsigned long off;
+
+	for (;;) {
+		map = __atomic_load_n(&_evlog_map, __ATOMIC_ACQUIRE);
+		if (map == NULL) {
+			return;
+		}
+		__atomic_add_fetch(&map->writers, 1, __ATOMIC_SEQ_CST);
+		if (map != __atomic_load_n(&_evlog_map, __ATOMIC_SEQ_CST)) {
+			__atomic_sub_fetch(&map->writers, 1, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		off = __atomic_fetch_add(&map->used, len, __ATOMIC_RELAXED);
+		if (off + len <= map->size) {
+			memcpy(map->base + off, buf, len);
+			__atomic_sub_fetch(&map->writers, 1, __ATOMIC_RELEASE);
+			return;
+		}
+		__atomic_sub_fetch(&map->writers, 1, __ATOMIC_RELEASE);
+		_evlog_rotate(map);
+	}
+}
+
+static int
+_evlog_intern(int *idp, const char *fmt)
+{
+	uint64_t buf[EVLOG_MAX_RECORD / sizeof(uint64_t)];
+	_evlog_format_t *f = NULL;
+	const char *p = fmt, *spec;
+	int id, type;
+
+	pthread_mutex_lock(&_evlog_intern_lock);
+	if ((id = *idp) != 0) {
+		goto finish;
+	}
+
+	id = -1;
+	if (_evlog_format_count + 1 >= EVLOG_MAX_FORMATS) {
+		log_error("Too many event log formats!");
+		goto store;
+	}
+	if (sizeof(evlog_record_t) + sizeof(uint16_t) + strlen(fmt) + 1 > EVLOG_MAX_RECORD) {
+		log_error("Event log format too long: %s", fmt);
+		goto store;
+	}
+
+	f = &_evlog_formats[_evlog_format_count + 1];
+	f->fmt = fmt;
+	f->count = 0;
+	f->fixed = 0;
+	while ((p = _evlog_conversion(p, &spec, &type)) != NULL) {
+		if (type == ARG_INVALID || f->count == EVLOG_MAX_ARGS) {
+			log_error("Unsupported event log format: %s", fmt);
+			goto store;
+		}
+		f->types[f->count++] = type;
+		f->fixed += _evlog_arg_size(type);
+	}
+
+	id = _evlog_format_count + 1;
+	__atomic_store_n(&_evlog_format_count, id, __ATOMIC_RELEASE);
+	_evlog_append(buf, _evlog_definition(buf, id));
+
+store:
+	__atomic_store_n(idp, id, __ATOMIC_RELEASE);
+finish:
+	pthread_mutex_unlock(&_evlog_intern_lock);
+	return id;
+}
+
+void
+evlog_write(int *idp, const char *fmt, ...)
+{
+	uint64_t buf[EVLOG_MAX_RECORD / sizeof(uint64_t)];
+	evlog_record_t *rec = (evlog_record_t *)buf;
+	char *data = (char *)(rec + 1);
+	_evlog_format_t *f;
+	size_t len = 0, room, n;
+	const char *s;
+	va_list vl;
+	int id, i;
+
+	id = __atomic_load_n(idp, __ATOMIC_ACQUIRE);
+	if (id == 0) {
+		id = _evlog_intern(idp, fmt);
+	}
+	if (id < 0) {
+		return;
+	}
+	f = &_evlog_formats[id];
+	room = EVLOG_MAX_RECORD - sizeof(*rec) - f->fixed;
+
+	va_start(vl, fmt);
+	for (i = 0; i < f->count; i++) {
+		switch (f->types[i]) {
+		case ARG_INT: {
+			int32_t v = va_arg(vl, int);
+			memcpy(data + len, &v, sizeof(v));
+			len += sizeof(v);
+			break;
+		}
+		case ARG_LONG: {
+			int64_t v = va_arg(vl, long);
+			memcpy(data + len, &v, sizeof(v));
+			len += sizeof(v);
+			break;
+		}
+		case ARG_LLONG: {
+			int64_t v = va_arg(vl, long long);
+			memcpy(data + len, &v, sizeof(v));
+			len += sizeof(v);
+			break;
+		}
+		case ARG_SIZE: {
+			uint64_t v = va_arg(vl, size_t);
+			memcpy(data + len, &v, sizeof(v));
+			len += sizeof(v);
+			break;
+		}
+		case ARG_PTR: {
+			uint64_t v = (uintptr_t)va_arg(vl, void *);
+			memcpy(data + len, &v, sizeof(v));
+			len += sizeof(v);
+			break;
+		}
+		case ARG_DOUBLE: {
+			double v = va_arg(vl, double);
+			memcpy(data + len, &v, sizeof(v));
+			len += sizeof(v);
+			break;
+		}
+		case ARG_STR:
+			if ((s = va_arg(vl, const char *)) == NULL) {
+				s = "(null)";
+			}
+			n = strlen(s);
+			n = n < EVLOG_MAX_STRING ? n : EVLOG_MAX_STRING;
+			n = n < room ? n : room;
+			room -= n;
+			data[len++] = n;
+			memcpy(data + len, s, n);
+			len += n;
+			break;
+		}
+	}
+	va_end(vl);
+
+	rec->time = _evlog_now();
+	rec->thread = _evlog_thread();
+	rec->id = id;
+	rec->size = len;
+	len = (sizeof(*rec) + len + 7) & ~7;
+	memset(data + rec->size, 0, len - sizeof(*rec) - rec->size);
+
+	_evlog_append(buf, len);
+}
+
+int
+evlog_open(const char *path, size_t size)
+{
+	long page = sysconf(_SC_PAGESIZE);
+
+	evlog_close();
+	pthread_once(&_evlog_once, _evlog_thread_key_init);
+
+	if (size < EVLOG_MIN_SIZE) {
+		size = EVLOG_MIN_SIZE;
+	}
+	if (page > 0) {
+		size = (size + page - 1) / page * page;
+	}
+
+	pthread_mutex_lock(&_evlog_lock);
+	free(_evlog_path);
+	free(_evlog_old_path);
+	_evlog_path = strdup(path);
+	_evlog_old_path = malloc(strlen(path) + 3);
+	if (_evlog_path == NULL || _evlog_old_path == NULL) {
+		log_error("Failed to allocate memory for event log!");
+		goto failure;
+	}
+	sprintf(_evlog_old_path, "%s.1", path);
+	_evlog_size = size;
+
+	if (rename(_evlog_path, _evlog_old_path) != 0 && errno != ENOENT) {
+		log_warning("Failed to rename event log: %s", strerror(errno));
+	}
+	if (_evlog_map_file(&_evlog_maps[0]) != 0) {
+		goto failure;
+	}
+	__atomic_store_n(&_evlog_map, &_evlog_maps[0], __ATOMIC_SEQ_CST);
+	evlog_enabled = 1;
+	pthread_mutex_unlock(&_evlog_lock);
+
+	log_info("Logging events to %s", path);
+
+	return 0;
+
+failure:
+	free(_evlog_path);
+	free(_evlog_old_path);
+	_evlog_path = _evlog_old_path = NULL;
+	pthread_mutex_unlock(&_evlog_lock);
+	return -1;
+}
+
+void
+evlog_close()
+{
+	_evlog_map_t *map;
+
+	pthread_mutex_lock(&_evlog_lock);
+	evlog_enabled = 0;
+	map = __atomic_exchange_n(&_evlog_map, NULL, __ATOMIC_SEQ_CST);
+	if (map != NULL) {
+		while (__atomic_load_n(&map->writers, __ATOMIC_ACQUIRE) != 0) {
+			sched_yield();
+		}
+		_evlog_unmap(map);
+	}
+	pthread_mutex_unlock(&_evlog_lock);
+}
+
+/*
+ * Decoding
+ */
+
+typedef struct {
+	char   *buf;
+	size_t  len;
+	size_t  cap;
+} _evlog_str_t;
+
+static void
+_evlog_str_add(_evlog_str_t *str, const char *s, size_t len)
+{
+	if (str->len + len >= str->cap) {
+		len = str->cap - str->len - 1;
+	}
+	memcpy(str->buf + str->len, s, len);
+	str->len += len;
+	str->buf[str->len] = '\0';
+}
+
+/* Appends literal format text, undoing "%%" escapes */
+static void
+_evlog_str_literal(_evlog_str_t *str, const char *s, const char *end)
+{
+	const char *p;
+
+	while (s < end) {
+		p = s;
+		while (p < end && *p != '%') {
+			p++;
+		}
+		_evlog_str_add(str, s, p - s);
+		if (p < end) {
+			_evlog_str_add(str, "%", 1);
+			p += 2;
+		}
+		s = p;
+	}
+}
+
+static void
+_evlog_str_json(_evlog_str_t *str, const char *s)
+{
+	char esc[8];
+
+	_evlog_str_add(str, "\"", 1);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') {
+			esc[0] = '\\';
+			esc[1] = *s;
+			_evlog_str_add(str, esc, 2);
+		} else if ((unsigned char)*s < 0x20) {
+			_evlog_str_add(str, esc, sprintf(esc, "\\u%04x", *s));
+		} else {
+			_evlog_str_add(str, s, 1);
+		}
+	}
+	_evlog_str_add(str, "\"", 1);
+}
+
+/*
+ * Formats record arguments into text, and into a JSON array when args
+ * is not NULL. Returns -1 if the record doesn't match its format.
+ */
+static int
+_evlog_format(const char *fmt, const char *data, size_t size,
+              _evlog_str_t *text, _evlog_str_t *args)
+{
+	const char *p = fmt, *next, *spec, *end = data + size;
+	char conv[32], raw[EVLOG_MAX_STRING + 1], val[2 * EVLOG_MAX_STRING], num[64];
+	int64_t i64;
+	uint64_t u64;
+	int32_t i32;
+	double d;
+	size_t n;
+	int type, count = 0;
+
+	while ((next = _evlog_conversion(p, &spec, &type)) != NULL) {
+		_evlog_str_literal(text, p, spec);
+		if (type == ARG_INVALID || (size_t)(next - spec) >= sizeof(conv) ||
+		    data + _evlog_arg_size(type) > end) {
+			return -1;
+		}
+		memcpy(conv, spec, next - spec);
+		conv[next - spec] = '\0';
+		num[0] = '\0';
+
+		switch (type) {
+		case ARG_INT:
+			memcpy(&i32, data, sizeof(i32));
+			snprintf(val, sizeof(val), conv, (int)i32);
+			snprintf(num, sizeof(num), "%d", (int)i32);
+			break;
+		case ARG_LONG:
+			memcpy(&i64, data, sizeof(i64));
+			snprintf(val, sizeof(val), conv, (long)i64);
+			snprintf(num, sizeof(num), "%lld", (long long)i64);
+			break;
+		case ARG_LLONG:
+			memcpy(&i64, data, sizeof(i64));
+			snprintf(val, sizeof(val), conv, (long long)i64);
+			snprintf(num, sizeof(num), "%lld", (long long)i64);
+			break;
+		case ARG_SIZE:
+			memcpy(&u64, data, sizeof(u64));
+			snprintf(val, sizeof(val), conv, (size_t)u64);
+			snprintf(num, sizeof(num), "%llu", (unsigned long long)u64);
+			break;
+		case ARG_PTR:
+			memcpy(&u64, data, sizeof(u64));
+			snprintf(val, sizeof(val), "0x%llx", (unsigned long long)u64);
+			break;
+		case ARG_DOUBLE:
+			memcpy(&d, data, sizeof(d));
+			snprintf(val, sizeof(val), conv, d);
+			snprintf(num, sizeof(num), "%.17g", d);
+			break;
+		case ARG_STR:
+			n = (unsigned char)*data;
+			if (data + 1 + n > end) {
+				return -1;
+			}
+			memcpy(raw, data + 1, n);
+			raw[n] = '\0';
+			snprintf(val, sizeof(val), conv, raw);
+			data += n;
+			break;
+		}
+		data += _evlog_arg_size(type);
+		_evlog_str_add(text, val, strlen(val));
+
+		if (args != NULL) {
+			_evlog_str_add(args, count++ ? "," : "[", 1);
+			if (type == ARG_STR) {
+				_evlog_str_json(args, raw);
+			} else if (type == ARG_PTR) {
+				_evlog_str_json(args, val);
+			} else {
+				_evlog_str_add(args, num, strlen(num));
+			}
+		}
+		p = next;
+	}
+	_evlog_str_literal(text, p, p + strlen(p));
+	if (args != NULL) {
+		_evlog_str_add(args, count ? "]" : "[]", count ? 1 : 2);
+	}
+
+	return 0;
+}
+
+/* Prints record stamped at given real time */
+static void
+_evlog_print(FILE *out, const evlog_record_t *rec, uint64_t realtime, const char *fmt, int json)
+{
+	char text_buf[4 * EVLOG_MAX_RECORD], args_buf[4 * EVLOG_MAX_RECORD];
+	char json_buf[8 * EVLOG_MAX_RECORD], stamp[32];
+	_evlog_str_t text = { text_buf, 0, sizeof(text_buf) };
+	_evlog_str_t args = { args_buf, 0, sizeof(args_buf) };
+	_evlog_str_t str = { json_buf, 0, sizeof(json_buf) };
+	time_t sec = realtime / 1000000000;
+	struct tm tm;
+
+	text_buf[0] = args_buf[0] = json_buf[0] = '\0';
+	if (fmt == NULL ||
+	    _evlog_format(fmt, (const char *)(rec + 1), rec->size, &text, json ? &args : NULL)) {
+		text.len = 0;
+		snprintf(text_buf, sizeof(text_buf), "malformed event %u", rec->id);
+		strcpy(args_buf, "[]");
+	}
+
+	if (json) {
+		_evlog_str_json(&str, fmt ? fmt : "");
+		fprintf(out, "{\"time\":%llu,\"thread\":%u,\"event\":%s,",
+		        (unsigned long long)realtime, rec->thread, json_buf);
+		str.len = 0;
+		_evlog_str_json(&str, text_buf);
+		fprintf(out, "\"message\":%s,\"args\":%s}\n", json_buf, args_buf);
+	} else {
+		localtime_r(&sec, &tm);
+		strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+		fprintf(out, "%s.%09lu [%u] %s\n", stamp,
+		        (unsigned long)(realtime % 1000000000), rec->thread, text_buf);
+	}
+}
+
+int
+evlog_decode(FILE *in, FILE *out, int json)
+{
+	uint64_t buf[EVLOG_MAX_RECORD / sizeof(uint64_t)];
+	evlog_record_t *rec = (evlog_record_t *)buf;
+	char *data = (char *)(rec + 1);
+	char header_buf[EVLOG_HEADER_SIZE];
+	evlog_header_t header;
+	char **formats = NULL;
+	uint16_t id;
+	size_t len;
+	int ret = -1;
+
+	if (fread(header_buf, 1, sizeof(header_buf), in) != sizeof(header_buf)) {
+		return -1;
+	}
+	memcpy(&header, header_buf, sizeof(header));
+	if (memcmp(header.magic, EVLOG_MAGIC, sizeof(EVLOG_MAGIC)) != 0) {
+		return -1;
+	}
+	if ((formats = calloc(EVLOG_MAX_FORMATS, sizeof(char *))) == NULL) {
+		return -1;
+	}
+
+	while (fread(rec, sizeof(*rec), 1, in) == 1) {
+		if (rec->time == 0 && rec->size == 0) {
+			/* Unused space at the end */
+			break;
+		}
+		len = ((sizeof(*rec) + rec->size + 7) & ~7) - sizeof(*rec);
+		if (sizeof(*rec) + len > EVLOG_MAX_RECORD || fread(data, 1, len, in) != len) {
+			goto finish;
+		}
+
+		if (rec->id != 0) {
+			/* Unsigned wrap around covers records stamped just before the anchor */
+			_evlog_print(out, rec, header.realtime + (rec->time - header.monotonic),
+			             rec->id < EVLOG_MAX_FORMATS ? formats[rec->id] : NULL, json);
+			continue;
+		}
+		if (rec->size <= sizeof(id)) {
+			goto finish;
+		}
+		memcpy(&id, data, sizeof(id));
+		data[rec->size - 1] = '\0';
+		if (id > 0 && id < EVLOG_MAX_FORMATS) {
+			free(formats[id]);
+			formats[id] = strdup(data + sizeof(id));
+		}
+	}
+	ret = 0;
+
+finish:
+	for (id = 0; id < EVLOG_MAX_FORMATS; id++) {
+		free(formats[id]);
+	}
+	free(formats);
+	return ret;
+}
@@ -0,0 +1,109 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef EVLOG_H
+#define EVLOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Binary event log. Records are appended to a memory mapped file, which
+ * is renamed to <path>.1 and replaced with a new one when full. Each
+ * record has a fixed size header followed by raw printf arguments. The
+ * format string of an event is written to the log once, in a definition
+ * record, the first time the event is logged and at the start of every
+ * new file. Use basileus-evlog to turn the log into text or JSON.
+ *
+ * Supported conversions: d i u x X o c with h, l, ll and z modifiers,
+ * f e g, p and s. Strings are truncated to EVLOG_MAX_STRING bytes.
+ */
+
+#define EVLOG_MAGIC        "BEVLOG2"
+#define EVLOG_HEADER_SIZE  64
+#define EVLOG_MAX_RECORD   1024
+#define EVLOG_MAX_STRING   255
+#define EVLOG_MAX_ARGS     16
+#define EVLOG_MAX_FORMATS  4096
+
+/* Start of file header, padded with zeros to EVLOG_HEADER_SIZE */
+typedef struct {
+	char magic[8];      /* EVLOG_MAGIC */
+	uint64_t realtime;  /* CLOCK_REALTIME nanoseconds when the file was created */
+	uint64_t monotonic; /* CLOCK_MONOTONIC nanoseconds at the same moment */
+} evlog_header_t;
+
+/* Record header, records are padded to 8 bytes */
+typedef struct {
+	uint64_t time;   /* CLOCK_MONOTONIC nanoseconds */
+	uint32_t thread; /* Logging thread number */
+	uint16_t id;     /* Format id, 0 for format definitions */
+	uint16_t size;   /* Size of data following the header */
+} evlog_record_t;
+
+/* Nonzero while the log is open, checked by evlog() */
+extern int evlog_enabled;
+
+/**
+ * Opens event log file of given size. Existing log is moved to
+ * <path>.1. Returns 0 on success, -1 on failure.
+ */
+int
+evlog_open(const char *path, size_t size);
+
+/**
+ * Stops logging events and closes the log file.
+ */
+void
+evlog_close();
+
+/**
+ * Logs an event. Should not be used directly, please use evlog().
+ * Format must be a string literal.
+ */
+void
+evlog_write(int *id, const char *fmt, ...);
+
+/**
+ * Writes events from given log file as text lines, or as JSON objects,
+ * one per line. Returns 0 on success, -1 if the file is not an event log.
+ */
+int
+evlog_decode(FILE *in, FILE *out, int json);
+
+/* Logs an event, costs a single branch when the log is closed. */
+#define evlog(format, args...) \
+	do { \
+		static int _evlog_id = 0; \
+		if (__builtin_expect(evlog_enabled, 0)) { \
+			evlog_write(&_evlog_id, format, ## args); \
+		} \
+	} while (0)
+
+#endif /* EVLOG_H */
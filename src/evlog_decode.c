@@ -0,0 +1,84 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Turns binary event logs written by basileusd into text or JSON lines.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include "evlog.h"
+
+static void
+print_help(const char *progname)
+{
+	printf("Usage: %s [options] <file>...\n"
+	       "  Available options:\n"
+	       "  -j          Print events as JSON objects, one per line\n"
+	       "  -h          Show application help\n",
+	      progname);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f = NULL;
+	int opt, json = 0, ret = 0;
+
+	while ((opt = getopt(argc, argv, "jh")) != -1) {
+		switch (opt) {
+		case 'j':
+			json = 1;
+			break;
+		case 'h':
+		default:
+			print_help(argv[0]);
+			return 0;
+		}
+	}
+	if (optind >= argc) {
+		print_help(argv[0]);
+		return 1;
+	}
+
+	for (; optind < argc; optind++) {
+		if ((f = fopen(argv[optind], "rb")) == NULL) {
+			perror(argv[optind]);
+			ret = 1;
+			continue;
+		}
+		if (0 != evlog_decode(f, stdout, json)) {
+			fprintf(stderr, "%s: Not an event log, or truncated\n", argv[optind]);
+			ret = 1;
+		}
+		fclose(f);
+	}
+
+	return ret;
+}
@@ -0,0 +1,179 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "logger.h"
+#include "mime_type.h"
+#include "file_class.h"
+
+#define FILE_CLASS_MAX_IGNORED 32
+
+/* Content types of audio files, everything else the MIME table knows is ignored */
+static const struct {
+	const char   *content_type;
+	file_class_t  class;
+} audio_types[] = {
+	{ "audio/mpeg",        FILE_CLASS_MPEG },
+	{ "audio/flac",        FILE_CLASS_FLAC },
+	{ "audio/ogg",         FILE_CLASS_OGG },
+	{ "application/ogg",   FILE_CLASS_OGG },
+	{ "audio/mp4",         FILE_CLASS_OTHER },
+	{ "audio/wav",         FILE_CLASS_OTHER },
+	{ "audio/webm",        FILE_CLASS_OTHER },
+	{ "audio/x-ms-wma",    FILE_CLASS_OTHER },
+	{ "audio/aac",         FILE_CLASS_OTHER },
+	{ "audio/x-aiff",      FILE_CLASS_OTHER },
+	{ "audio/x-ape",       FILE_CLASS_OTHER },
+	{ "audio/x-wavpack",   FILE_CLASS_OTHER },
+	{ "audio/x-musepack",  FILE_CLASS_OTHER },
+};
+
+#define AUDIO_TYPES (sizeof(audio_types) / sizeof(audio_types[0]))
+
+static char *ignored_buf = NULL;
+static const char *ignored[FILE_CLASS_MAX_IGNORED];
+static int ignored_count = 0;
+
+int
+file_class_set_ignored(const char *extensions)
+{
+	char *ext = NULL, *save = NULL;
+
+	free(ignored_buf);
+	ignored_count = 0;
+	if ((ignored_buf = strdup(extensions)) == NULL) {
+		log_error("Failed to allocate ignored extension list!");
+		return -1;
+	}
+
+	for (ext = strtok_r(ignored_buf, ", ", &save); ext != NULL;
+	     ext = strtok_r(NULL, ", ", &save)) {
+		if (*ext == '.') {
+			ext++;
+		}
+		if (ignored_count == FILE_CLASS_MAX_IGNORED) {
+			log_warning("Too many ignored extensions, skipping: %s", ext);
+			continue;
+		}
+		ignored[ignored_count++] = ext;
+	}
+
+	return 0;
+}
+
+file_class_t
+file_class_by_name(const char *name)
+{
+	const char *ext = NULL, *type = NULL;
+	int i;
+
+	if ((ext = strrchr(name, '.')) == NULL || strchr(ext, '/') != NULL) {
+		return FILE_CLASS_UNKNOWN;
+	}
+	ext++;
+
+	for (i = 0; i < ignored_count; i++) {
+		if (strcasecmp(ignored[i], ext) == 0) {
+			return FILE_CLASS_IGNORE;
+		}
+	}
+
+	if ((type = mime_type_guess(name)) == NULL) {
+		return FILE_CLASS_UNKNOWN;
+	}
+	for (i = 0; i < AUDIO_TYPES; i++) {
+		if (strcmp(audio_types[i].content_type, type) == 0) {
+			return audio_types[i].class;
+		}
+	}
+
+	/* Images, text, playlists, video */
+	return FILE_CLASS_IGNORE;
+}
+
+file_class_t
+file_class_by_magic(const char *path)
+{
+	unsigned char m[FILE_CLASS_MAGIC_SIZE];
+	ssize_t len;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		log_debug("Failed to open %s: %s", path, strerror(errno));
+		return FILE_CLASS_IGNORE;
+	}
+	do {
+		len = read(fd, m, sizeof(m));
+	} while (len < 0 && errno == EINTR);
+	close(fd);
+
+	return file_class_by_magic_buf(m, len < 0 ? 0 : len);
+}
+
+file_class_t
+file_class_by_magic_buf(const unsigned char *m, size_t len)
+{
+	if (len < FILE_CLASS_MAGIC_SIZE) {
+		return FILE_CLASS_IGNORE;
+	}
+
+	if (memcmp(m, "ID3", 3) == 0 ||
+	    /* MPEG frame sync, valid version, layer, bitrate and sample rate */
+	    (m[0] == 0xff && (m[1] & 0xe0) == 0xe0 && (m[1] & 0x18) != 0x08 &&
+	     (m[1] & 0x06) != 0 && (m[2] & 0xf0) != 0xf0 && (m[2] & 0x0c) != 0x0c)) {
+		return FILE_CLASS_MPEG;
+	}
+	if (memcmp(m, "fLaC", 4) == 0) {
+		return FILE_CLASS_FLAC;
+	}
+	if (memcmp(m, "OggS", 4) == 0) {
+		return FILE_CLASS_OGG;
+	}
+	if ((memcmp(m, "RIFF", 4) == 0 && memcmp(m + 8, "WAVE", 4) == 0) ||
+	    (memcmp(m, "FORM", 4) == 0 && memcmp(m + 8, "AIF", 3) == 0) ||
+	    /* Any MP4 brand, M4A, M4B, mp42, isom, ... may hold audio only */
+	    memcmp(m + 4, "ftyp", 4) == 0 ||
+	    memcmp(m, "\x30\x26\xb2\x75\x8e\x66\xcf\x11", 8) == 0 || /* ASF */
+	    memcmp(m, "\x1a\x45\xdf\xa3", 4) == 0 || /* EBML, Matroska and WebM */
+	    memcmp(m, "MAC ", 4) == 0 ||
+	    memcmp(m, "wvpk", 4) == 0 ||
+	    memcmp(m, "MPCK", 4) == 0 ||
+	    memcmp(m, "TTA1", 4) == 0 ||
+	    memcmp(m, "DSD ", 4) == 0) {
+		return FILE_CLASS_OTHER;
+	}
+
+	return FILE_CLASS_IGNORE;
+}
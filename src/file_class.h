@@ -0,0 +1,78 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _FILE_CLASS_H_
+#define _FILE_CLASS_H_
+
+#include <stddef.h>
+
+/*
+ * Decides which tag reader, if any, should look at a file found by the
+ * scanner. Most files are classified by extension alone, only those with
+ * unknown extensions have their first bytes inspected.
+ */
+typedef enum {
+	FILE_CLASS_IGNORE = 0, /* Not audio, never opened */
+	FILE_CLASS_UNKNOWN,    /* Extension not known, needs a magic number peek */
+	FILE_CLASS_MPEG,
+	FILE_CLASS_FLAC,
+	FILE_CLASS_OGG,
+	FILE_CLASS_OTHER       /* Audio format handled only by the tag backend */
+} file_class_t;
+
+/* Number of bytes inspected by file_class_by_magic() */
+#define FILE_CLASS_MAGIC_SIZE 16
+
+/**
+ * Set extensions which are always ignored, on top of known non-audio ones.
+ * @param extensions Comma separated list of extensions without dots.
+ * @return 0 on success, -1 on failure.
+ */
+int
+file_class_set_ignored(const char *extensions);
+
+/**
+ * Classify file by name, without any I/O.
+ */
+file_class_t
+file_class_by_name(const char *name);
+
+/**
+ * Classify file by its first FILE_CLASS_MAGIC_SIZE bytes.
+ */
+file_class_t
+file_class_by_magic(const char *path);
+
+/**
+ * Classify file by its first bytes, already read by the caller.
+ */
+file_class_t
+file_class_by_magic_buf(const unsigned char *data, size_t len);
+
+#endif /* !_FILE_CLASS_H_ */
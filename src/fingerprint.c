@@ -0,0 +1,168 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "md5.h"
+#include "logger.h"
+#include "fingerprint.h"
+
+/* Size of reads while streaming file contents */
+#define FINGERPRINT_CHUNK (64 * 1024)
+
+static int
+_read_at(int fd, off_t off, unsigned char *buf, size_t len)
+{
+	ssize_t ret;
+
+	do {
+		ret = pread(fd, buf, len, off);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret == (ssize_t)len ? 0 : -1;
+}
+
+/*
+ * Find offset where tags at the beginning of the file end.
+ */
+static off_t
+_payload_start(int fd, off_t size)
+{
+	unsigned char hdr[10];
+	off_t start = 0;
+	int last = 0;
+
+	/* ID3v2, may prefix any format */
+	if (size >= 10 && 0 == _read_at(fd, 0, hdr, 10) && 0 == memcmp(hdr, "ID3", 3)) {
+		start = 10 + ((off_t)(hdr[6] & 0x7f) << 21 | (hdr[7] & 0x7f) << 14 |
+		              (hdr[8] & 0x7f) << 7 | (hdr[9] & 0x7f));
+		if (hdr[5] & 0x10) {
+			/* Footer present */
+			start += 10;
+		}
+	}
+
+	/* FLAC stream marker followed by metadata blocks */
+	if (start + 4 <= size && 0 == _read_at(fd, start, hdr, 4) && 0 == memcmp(hdr, "fLaC", 4)) {
+		start += 4;
+		while (!last && start + 4 <= size && 0 == _read_at(fd, start, hdr, 4)) {
+			last = hdr[0] & 0x80;
+			start += 4 + ((off_t)hdr[1] << 16 | hdr[2] << 8 | hdr[3]);
+		}
+	}
+
+	return start < size ? start : size;
+}
+
+/*
+ * Find offset where tags at the end of the file begin.
+ */
+static off_t
+_payload_end(int fd, off_t start, off_t size)
+{
+	unsigned char ftr[32];
+	off_t end = size;
+	uint32_t len;
+
+	/* ID3v1 */
+	if (end - 128 >= start && 0 == _read_at(fd, end - 128, ftr, 3) &&
+	    0 == memcmp(ftr, "TAG", 3)) {
+		end -= 128;
+	}
+
+	/* APEv2 footer, tag size excludes the optional header */
+	if (end - 32 >= start && 0 == _read_at(fd, end - 32, ftr, 32) &&
+	    0 == memcmp(ftr, "APETAGEX", 8)) {
+		len = ftr[12] | ftr[13] << 8 | ftr[14] << 16 | (uint32_t)ftr[15] << 24;
+		if (ftr[23] & 0x80) {
+			len += 32;
+		}
+		end = end - len >= start ? end - len : start;
+	}
+
+	return end;
+}
+
+int
+fingerprint_file(const char *path, unsigned char *fp)
+{
+	unsigned char buf[FINGERPRINT_CHUNK];
+	md5_ctx_t ctx;
+	struct stat st;
+	off_t off, end;
+	ssize_t len;
+	int fd = -1, ret = -1;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		log_warning("Failed to open %s: %s", path, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) != 0) {
+		log_warning("Failed to stat %s: %s", path, strerror(errno));
+		goto finish;
+	}
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	off = _payload_start(fd, st.st_size);
+	end = _payload_end(fd, off, st.st_size);
+	if (off >= end) {
+		log_debug("No audio payload to fingerprint in %s", path);
+		ret = 1;
+		goto finish;
+	}
+
+	md5_init(&ctx);
+	while (off < end) {
+		len = pread(fd, buf, end - off < sizeof(buf) ? end - off : sizeof(buf), off);
+		if (len < 0 && errno == EINTR) {
+			continue;
+		}
+		if (len <= 0) {
+			log_warning("Failed to read %s: %s", path, len ? strerror(errno) : "Truncated");
+			goto finish;
+		}
+		md5_update(&ctx, buf, len);
+		off += len;
+	}
+	md5_final(fp, &ctx);
+
+	ret = 0;
+
+finish:
+	close(fd);
+	return ret;
+}
@@ -0,0 +1,385 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Multi-buffer MD5. Rather than speeding up a single message, which MD5's
+ * serial dependency chain does not allow, several independent messages are
+ * hashed at once with each one occupying a lane of a SIMD register. Scans
+ * hash every file path they see, so batches are easy to come by.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "hash.h"
+
+#if defined(__GNUC__)
+#define HASH_VECTORS
+typedef uint32_t _v4u32_t __attribute__((vector_size(16)));
+#if defined(__x86_64__) || defined(__i386__)
+#define HASH_AVX2
+typedef uint32_t _v8u32_t __attribute__((vector_size(32)));
+#endif
+#endif
+
+#define F1(x, y, z) (z ^ (x & (y ^ z)))
+#define F2(x, y, z) F1(z, x, y)
+#define F3(x, y, z) (x ^ y ^ z)
+#define F4(x, y, z) (y ^ (x | ~z))
+
+#define MD5STEP(f, w, x, y, z, data, s) \
+	( w += f(x, y, z) + data,  w = w << s | w >> (32 - s),  w += x )
+
+/* Works with both plain integers and GCC vector types */
+#define MD5_ROUNDS(a, b, c, d, in) do { \
+	MD5STEP(F1, a, b, c, d, in[0] + 0xd76aa478, 7); \
+	MD5STEP(F1, d, a, b, c, in[1] + 0xe8c7b756, 12); \
+	MD5STEP(F1, c, d, a, b, in[2] + 0x242070db, 17); \
+	MD5STEP(F1, b, c, d, a, in[3] + 0xc1bdceee, 22); \
+	MD5STEP(F1, a, b, c, d, in[4] + 0xf57c0faf, 7); \
+	MD5STEP(F1, d, a, b, c, in[5] + 0x4787c62a, 12); \
+	MD5STEP(F1, c, d, a, b, in[6] + 0xa8304613, 17); \
+	MD5STEP(F1, b, c, d, a, in[7] + 0xfd469501, 22); \
+	MD5STEP(F1, a, b, c, d, in[8] + 0x698098d8, 7); \
+	MD5STEP(F1, d, a, b, c, in[9] + 0x8b44f7af, 12); \
+	MD5STEP(F1, c, d, a, b, in[10] + 0xffff5bb1, 17); \
+	MD5STEP(F1, b, c, d, a, in[11] + 0x895cd7be, 22); \
+	MD5STEP(F1, a, b, c, d, in[12] + 0x6b901122, 7); \
+	MD5STEP(F1, d, a, b, c, in[13] + 0xfd987193, 12); \
+	MD5STEP(F1, c, d, a, b, in[14] + 0xa679438e, 17); \
+	MD5STEP(F1, b, c, d, a, in[15] + 0x49b40821, 22); \
+	MD5STEP(F2, a, b, c, d, in[1] + 0xf61e2562, 5); \
+	MD5STEP(F2, d, a, b, c, in[6] + 0xc040b340, 9); \
+	MD5STEP(F2, c, d, a, b, in[11] + 0x265e5a51, 14); \
+	MD5STEP(F2, b, c, d, a, in[0] + 0xe9b6c7aa, 20); \
+	MD5STEP(F2, a, b, c, d, in[5] + 0xd62f105d, 5); \
+	MD5STEP(F2, d, a, b, c, in[10] + 0x02441453, 9); \
+	MD5STEP(F2, c, d, a, b, in[15] + 0xd8a1e681, 14); \
+	MD5STEP(F2, b, c, d, a, in[4] + 0xe7d3fbc8, 20); \
+	MD5STEP(F2, a, b, c, d, in[9] + 0x21e1cde6, 5); \
+	MD5STEP(F2, d, a, b, c, in[14] + 0xc33707d6, 9); \
+	MD5STEP(F2, c, d, a, b, in[3] + 0xf4d50d87, 14); \
+	MD5STEP(F2, b, c, d, a, in[8] + 0x455a14ed, 20); \
+	MD5STEP(F2, a, b, c, d, in[13] + 0xa9e3e905, 5); \
+	MD5STEP(F2, d, a, b, c, in[2] + 0xfcefa3f8, 9); \
+	MD5STEP(F2, c, d, a, b, in[7] + 0x676f02d9, 14); \
+	MD5STEP(F2, b, c, d, a, in[12] + 0x8d2a4c8a, 20); \
+	MD5STEP(F3, a, b, c, d, in[5] + 0xfffa3942, 4); \
+	MD5STEP(F3, d, a, b, c, in[8] + 0x8771f681, 11); \
+	MD5STEP(F3, c, d, a, b, in[11] + 0x6d9d6122, 16); \
+	MD5STEP(F3, b, c, d, a, in[14] + 0xfde5380c, 23); \
+	MD5STEP(F3, a, b, c, d, in[1] + 0xa4beea44, 4); \
+	MD5STEP(F3, d, a, b, c, in[4] + 0x4bdecfa9, 11); \
+	MD5STEP(F3, c, d, a, b, in[7] + 0xf6bb4b60, 16); \
+	MD5STEP(F3, b, c, d, a, in[10] + 0xbebfbc70, 23); \
+	MD5STEP(F3, a, b, c, d, in[13] + 0x289b7ec6, 4); \
+	MD5STEP(F3, d, a, b, c, in[0] + 0xeaa127fa, 11); \
+	MD5STEP(F3, c, d, a, b, in[3] + 0xd4ef3085, 16); \
+	MD5STEP(F3, b, c, d, a, in[6] + 0x04881d05, 23); \
+	MD5STEP(F3, a, b, c, d, in[9] + 0xd9d4d039, 4); \
+	MD5STEP(F3, d, a, b, c, in[12] + 0xe6db99e5, 11); \
+	MD5STEP(F3, c, d, a, b, in[15] + 0x1fa27cf8, 16); \
+	MD5STEP(F3, b, c, d, a, in[2] + 0xc4ac5665, 23); \
+	MD5STEP(F4, a, b, c, d, in[0] + 0xf4292244, 6); \
+	MD5STEP(F4, d, a, b, c, in[7] + 0x432aff97, 10); \
+	MD5STEP(F4, c, d, a, b, in[14] + 0xab9423a7, 15); \
+	MD5STEP(F4, b, c, d, a, in[5] + 0xfc93a039, 21); \
+	MD5STEP(F4, a, b, c, d, in[12] + 0x655b59c3, 6); \
+	MD5STEP(F4, d, a, b, c, in[3] + 0x8f0ccc92, 10); \
+	MD5STEP(F4, c, d, a, b, in[10] + 0xffeff47d, 15); \
+	MD5STEP(F4, b, c, d, a, in[1] + 0x85845dd1, 21); \
+	MD5STEP(F4, a, b, c, d, in[8] + 0x6fa87e4f, 6); \
+	MD5STEP(F4, d, a, b, c, in[15] + 0xfe2ce6e0, 10); \
+	MD5STEP(F4, c, d, a, b, in[6] + 0xa3014314, 15); \
+	MD5STEP(F4, b, c, d, a, in[13] + 0x4e0811a1, 21); \
+	MD5STEP(F4, a, b, c, d, in[4] + 0xf7537e82, 6); \
+	MD5STEP(F4, d, a, b, c, in[11] + 0xbd3af235, 10); \
+	MD5STEP(F4, c, d, a, b, in[2] + 0x2ad7d2bb, 15); \
+	MD5STEP(F4, b, c, d, a, in[9] + 0xeb86d391, 21); \
+} while (0)
+
+typedef void (*_md5_lanes_fn)(const hash_job_t **jobs, uint32_t (*state)[4],
+                              const size_t *blocks, size_t upto);
+
+typedef struct {
+	const char    *name;
+	int            lanes;
+	_md5_lanes_fn  transform;
+	int          (*supported)(void);
+} _hash_impl_t;
+
+static pthread_once_t _hash_once = PTHREAD_ONCE_INIT;
+static const _hash_impl_t *_hash_impl = NULL;
+
+static size_t
+_md5_blocks(size_t len)
+{
+	/* Message, 0x80 terminator and 64 bit length, padded to 64 bytes */
+	return (len + 8) / 64 + 1;
+}
+
+/*
+ * Fetch one 64 byte block of padded message as little endian words.
+ */
+static void
+_md5_load(const hash_job_t *job, size_t block, uint32_t *w, int stride)
+{
+	const unsigned char *p = NULL;
+	unsigned char buf[64];
+	uint64_t bits;
+	size_t off = block * 64;
+	int i;
+
+	if (off + 64 <= job->len) {
+		p = (const unsigned char *)job->data + off;
+	} else {
+		memset(buf, 0, sizeof(buf));
+		if (off <= job->len) {
+			memcpy(buf, (const unsigned char *)job->data + off, job->len - off);
+			buf[job->len - off] = 0x80;
+		}
+		if (block == _md5_blocks(job->len) - 1) {
+			bits = (uint64_t)job->len << 3;
+			for (i = 0; i < 8; i++) {
+				buf[56 + i] = (unsigned char)(bits >> (8 * i));
+			}
+		}
+		p = buf;
+	}
+
+	for (i = 0; i < 16; i++, p += 4) {
+		w[i * stride] = (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+		       (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+	}
+}
+
+static void
+_md5_scalar(const hash_job_t *job, uint32_t state[4], size_t from, size_t to)
+{
+	uint32_t a, b, c, d, in[16];
+
+	for (; from < to; from++) {
+		_md5_load(job, from, in, 1);
+		a = state[0];
+		b = state[1];
+		c = state[2];
+		d = state[3];
+		MD5_ROUNDS(a, b, c, d, in);
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+	}
+}
+
+static void
+_md5_x1(const hash_job_t **jobs, uint32_t (*state)[4], const size_t *blocks, size_t upto)
+{
+	_md5_scalar(jobs[0], state[0], 0, upto);
+}
+
+/*
+ * Run first upto blocks of every lane's message through vector transforms.
+ * Message words are transposed so that each vector holds the same word of
+ * all lanes. Lanes whose message ends earlier keep computing, but their
+ * results are masked out of the state.
+ */
+#define MD5_LANES(name, vec_t, lanes, attr) \
+static attr void \
+name(const hash_job_t **jobs, uint32_t (*state)[4], const size_t *blocks, size_t upto) \
+{ \
+	vec_t a, b, c, d, sa, sb, sc, sd, m, in[16]; \
+	uint32_t w[16][lanes]; \
+	size_t blk; \
+	int i, j; \
+\
+	memset(w, 0, sizeof(w)); \
+	for (i = 0; i < lanes; i++) { \
+		sa[i] = state[i][0]; \
+		sb[i] = state[i][1]; \
+		sc[i] = state[i][2]; \
+		sd[i] = state[i][3]; \
+	} \
+	for (blk = 0; blk < upto; blk++) { \
+		for (i = 0; i < lanes; i++) { \
+			m[i] = blk < blocks[i] ? 0xffffffff : 0; \
+			if (blk < blocks[i]) { \
+				_md5_load(jobs[i], blk, &w[0][i], lanes); \
+			} \
+		} \
+		for (j = 0; j < 16; j++) { \
+			memcpy(&in[j], w[j], sizeof(vec_t)); \
+		} \
+		a = sa; \
+		b = sb; \
+		c = sc; \
+		d = sd; \
+		MD5_ROUNDS(a, b, c, d, in); \
+		sa += a & m; \
+		sb += b & m; \
+		sc += c & m; \
+		sd += d & m; \
+	} \
+	for (i = 0; i < lanes; i++) { \
+		state[i][0] = sa[i]; \
+		state[i][1] = sb[i]; \
+		state[i][2] = sc[i]; \
+		state[i][3] = sd[i]; \
+	} \
+}
+
+#ifdef HASH_VECTORS
+/* SSE2 on x86, whatever the target offers elsewhere */
+#define HASH_DEFAULT_TARGET
+MD5_LANES(_md5_x4, _v4u32_t, 4, HASH_DEFAULT_TARGET)
+#endif
+
+#ifdef HASH_AVX2
+MD5_LANES(_md5_x8, _v8u32_t, 8, __attribute__((target("avx2"))))
+
+static int
+_avx2_supported(void)
+{
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+static const _hash_impl_t _hash_impls[] = {
+#ifdef HASH_AVX2
+	{ "x8-avx2", 8, _md5_x8, _avx2_supported },
+#endif
+#ifdef HASH_VECTORS
+	{ "x4",      4, _md5_x4, NULL },
+#endif
+	{ "scalar",  1, _md5_x1, NULL },
+};
+
+#define HASH_IMPLS (sizeof(_hash_impls) / sizeof(_hash_impls[0]))
+
+static void
+_hash_select(void)
+{
+	int i;
+
+	/* Implementations are ordered from the fastest one */
+	for (i = 0; i < HASH_IMPLS; i++) {
+		if (_hash_impls[i].supported == NULL || _hash_impls[i].supported()) {
+			_hash_impl = &_hash_impls[i];
+			return;
+		}
+	}
+}
+
+/*
+ * Hash one group of at most impl->lanes jobs.
+ */
+static void
+_hash_md5_group(const _hash_impl_t *impl, const hash_job_t **group, int count)
+{
+	uint32_t state[HASH_MAX_LANES][4];
+	size_t blocks[HASH_MAX_LANES], upto = 0, longest = 0;
+	int i, j, last = 0;
+
+	for (i = 0; i < impl->lanes; i++) {
+		state[i][0] = 0x67452301;
+		state[i][1] = 0xefcdab89;
+		state[i][2] = 0x98badcfe;
+		state[i][3] = 0x10325476;
+		blocks[i] = i < count ? _md5_blocks(group[i]->len) : 0;
+		if (blocks[i] > longest) {
+			upto = longest;
+			longest = blocks[i];
+			last = i;
+		} else if (blocks[i] > upto) {
+			upto = blocks[i];
+		}
+	}
+
+	/*
+	 * Vectors are worth running while at least two lanes are busy, the
+	 * longest message finishes on its own.
+	 */
+	if (count > 1) {
+		impl->transform(group, state, blocks, upto);
+	}
+	_md5_scalar(group[last], state[last], upto, longest);
+
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < HASH_MD5_SIZE; j++) {
+			group[i]->digest[j] = (unsigned char)(state[i][j / 4] >> (8 * (j % 4)));
+		}
+	}
+}
+
+void
+hash_md5_batch(hash_job_t *jobs, int count)
+{
+	const hash_job_t *group[HASH_MAX_LANES];
+	const _hash_impl_t *impl;
+	int i, n = 0;
+
+	pthread_once(&_hash_once, _hash_select);
+	impl = _hash_impl;
+
+	for (i = 0; i < count; i++) {
+		group[n++] = &jobs[i];
+		if (n == impl->lanes || i == count - 1) {
+			_hash_md5_group(impl, group, n);
+			n = 0;
+		}
+	}
+}
+
+const char *
+hash_md5_impl(void)
+{
+	pthread_once(&_hash_once, _hash_select);
+	return _hash_impl->name;
+}
+
+int
+hash_md5_select(const char *name)
+{
+	int i;
+
+	pthread_once(&_hash_once, _hash_select);
+	for (i = 0; i < HASH_IMPLS; i++) {
+		if (strcmp(_hash_impls[i].name, name) != 0) {
+			continue;
+		}
+		if (_hash_impls[i].supported && !_hash_impls[i].supported()) {
+			return -1;
+		}
+		_hash_impl = &_hash_impls[i];
+		return 0;
+	}
+	return -1;
+}
@@ -0,0 +1,71 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _HASH_H_
+#define _HASH_H_
+
+#include <stddef.h>
+
+/* Size of MD5 digest in bytes */
+#define HASH_MD5_SIZE 16
+
+/* Widest number of messages hashed in parallel by any implementation */
+#define HASH_MAX_LANES 8
+
+typedef struct {
+	const void    *data;
+	size_t         len;
+	unsigned char *digest;
+} hash_job_t;
+
+/**
+ * Compute MD5 digests of several independent messages.
+ * Messages are interleaved in SIMD lanes when the CPU supports it, digests
+ * are identical to those of md5_digest().
+ * @param jobs Messages to hash, each digest must hold HASH_MD5_SIZE bytes.
+ * @param count Number of jobs.
+ */
+void
+hash_md5_batch(hash_job_t *jobs, int count);
+
+/**
+ * Get name of MD5 implementation used by hash_md5_batch.
+ */
+const char *
+hash_md5_impl(void);
+
+/**
+ * Force specific MD5 implementation, meant for benchmarks and tests.
+ * @param name One of "scalar", "x4" or "x8-avx2".
+ * @return 0 on success, -1 when unknown or not supported by this CPU.
+ */
+int
+hash_md5_select(const char *name);
+
+#endif /* !_HASH_H_ */
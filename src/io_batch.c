@@ -0,0 +1,625 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifdef USE_IO_URING
+#define _DEFAULT_SOURCE /* syscall() */
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef USE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#endif
+
+#include "logger.h"
+#include "io_batch.h"
+
+/* Upper limit of threads used when io_uring is not available */
+#define IO_BATCH_MAX_THREADS 32
+
+/* Keeps io_uring within 4096 submission queue entries */
+#define IO_BATCH_MAX_DEPTH 1024
+
+#ifdef USE_IO_URING
+/* Operations issued for every file, kept in low bits of user_data */
+enum {
+	_OP_STATX,
+	_OP_OPEN,
+	_OP_HEAD,
+	_OP_TAIL
+};
+
+typedef struct {
+	int                  fd;
+	unsigned            *sq_head;
+	unsigned            *sq_tail;
+	unsigned            *sq_mask;
+	unsigned            *sq_array;
+	unsigned            *cq_head;
+	unsigned            *cq_tail;
+	unsigned            *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned             tail;   /* Local copy of submission queue tail */
+	unsigned             queued; /* Entries not yet consumed by kernel */
+	void                *ring_ptr;
+	size_t               ring_size;
+	size_t               sqes_size;
+	struct statx        *stx;
+	int                  stx_count;
+} _ring_t;
+#endif
+
+struct io_batch_s {
+	const char      *backend;
+	int              depth;
+
+	/* Thread pool, started on first use with io_uring */
+	pthread_t       *threads;
+	int              thread_count;
+	pthread_mutex_t  mutex;
+	pthread_cond_t   work;
+	pthread_cond_t   done;
+	void           (*job)(void *, void *);
+	void            *arg;
+	char            *items;
+	size_t           item_size;
+	int              count;
+	int              next;
+	int              remaining;
+	int              stop;
+
+#ifdef USE_IO_URING
+	_ring_t          ring;
+#endif
+};
+
+static void
+_file_reset(io_file_t *f)
+{
+	f->fd = -1;
+	f->size = -1;
+	f->head_len = 0;
+	f->tail_len = 0;
+	f->error = 0;
+	f->pending = 0;
+}
+
+/*
+ * Length of tail worth reading once file size is known.
+ */
+static size_t
+_tail_len(off_t size)
+{
+	if (size <= IO_HEAD_SIZE) {
+		return 0;
+	}
+	return size < IO_TAIL_SIZE ? (size_t)size : IO_TAIL_SIZE;
+}
+
+static ssize_t
+_pread_full(int fd, unsigned char *buf, size_t len, off_t off)
+{
+	ssize_t n, done = 0;
+
+	while (done < (ssize_t)len) {
+		n = pread(fd, buf + done, len - done, off + done);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			return -1;
+		}
+		if (n == 0) {
+			break;
+		}
+		done += n;
+	}
+	return done;
+}
+
+/*
+ * Synchronous version of everything io_uring does for a single file.
+ */
+static void
+_read_file(void *data, void *arg)
+{
+	io_file_t *f = data;
+	struct stat st;
+	ssize_t n;
+	size_t len;
+
+	if ((f->fd = open(f->path, O_RDONLY | O_CLOEXEC)) < 0) {
+		f->error = errno;
+		return;
+	}
+	if (fstat(f->fd, &st) != 0) {
+		f->error = errno;
+		return;
+	}
+	f->size = st.st_size;
+
+	if ((n = _pread_full(f->fd, f->head, IO_HEAD_SIZE, 0)) < 0) {
+		f->error = errno;
+		return;
+	}
+	f->head_len = n;
+
+	if ((len = _tail_len(f->size)) > 0) {
+		if ((n = _pread_full(f->fd, f->tail, len, f->size - len)) != (ssize_t)len) {
+			f->error = n < 0 ? errno : EIO;
+			return;
+		}
+		f->tail_len = len;
+	}
+}
+
+static void *
+_worker(void *data)
+{
+	io_batch_t *io = data;
+	void *item = NULL;
+
+	pthread_mutex_lock(&io->mutex);
+	for (;;) {
+		while (!io->stop && io->next >= io->count) {
+			pthread_cond_wait(&io->work, &io->mutex);
+		}
+		if (io->stop) {
+			break;
+		}
+		item = io->items + io->next++ * io->item_size;
+		pthread_mutex_unlock(&io->mutex);
+
+		io->job(item, io->arg);
+
+		pthread_mutex_lock(&io->mutex);
+		if (--io->remaining == 0) {
+			pthread_cond_signal(&io->done);
+		}
+	}
+	pthread_mutex_unlock(&io->mutex);
+
+	return NULL;
+}
+
+static int
+_threads_start(io_batch_t *io)
+{
+	int i, ret;
+
+	io->thread_count = io->depth < IO_BATCH_MAX_THREADS ? io->depth : IO_BATCH_MAX_THREADS;
+	if ((io->threads = calloc(io->thread_count, sizeof(pthread_t))) == NULL) {
+		log_error("Failed to allocate I/O threads!");
+		io->thread_count = 0;
+		return -1;
+	}
+
+	for (i = 0; i < io->thread_count; i++) {
+		if ((ret = pthread_create(&io->threads[i], NULL, _worker, io))) {
+			log_error("Failed to create I/O thread: %d!", ret);
+			io->thread_count = i;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void
+_threads_stop(io_batch_t *io)
+{
+	int i;
+
+	pthread_mutex_lock(&io->mutex);
+	io->stop = 1;
+	pthread_cond_broadcast(&io->work);
+	pthread_mutex_unlock(&io->mutex);
+
+	for (i = 0; i < io->thread_count; i++) {
+		pthread_join(io->threads[i], NULL);
+	}
+	free(io->threads);
+	io->threads = NULL;
+	io->thread_count = 0;
+	io->stop = 0;
+}
+
+static int
+_threads_run(io_batch_t *io, void (*job)(void *, void *), void *arg,
+             void *items, size_t size, int count)
+{
+	if (count == 0) {
+		return 0;
+	}
+	if (io->threads == NULL && _threads_start(io) != 0) {
+		_threads_stop(io);
+		return -1;
+	}
+
+	pthread_mutex_lock(&io->mutex);
+	io->job = job;
+	io->arg = arg;
+	io->items = items;
+	io->item_size = size;
+	io->count = count;
+	io->next = 0;
+	io->remaining = count;
+	pthread_cond_broadcast(&io->work);
+	while (io->remaining > 0) {
+		pthread_cond_wait(&io->done, &io->mutex);
+	}
+	io->items = NULL;
+	io->count = 0;
+	io->next = 0;
+	pthread_mutex_unlock(&io->mutex);
+
+	return 0;
+}
+
+#ifdef USE_IO_URING
+static int
+_ring_setup(_ring_t *r, int depth)
+{
+	struct io_uring_params p;
+	unsigned entries = 1;
+	size_t sq_size, cq_size;
+
+	memset(r, 0, sizeof(_ring_t));
+	r->fd = -1;
+
+	/* Every file needs at most four operations */
+	while (entries < (unsigned)depth * 4) {
+		entries <<= 1;
+	}
+
+	memset(&p, 0, sizeof(p));
+	if ((r->fd = syscall(SYS_io_uring_setup, entries, &p)) < 0) {
+		log_debug("io_uring not available: %s", strerror(errno));
+		return -1;
+	}
+	/* Single mmap and current position reads both predate openat and statx */
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_RW_CUR_POS)) {
+		log_debug("io_uring lacks openat and statx support");
+		goto failure;
+	}
+
+	sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	r->ring_size = sq_size > cq_size ? sq_size : cq_size;
+	r->ring_ptr = mmap(NULL, r->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	                   r->fd, IORING_OFF_SQ_RING);
+	if (r->ring_ptr == MAP_FAILED) {
+		r->ring_ptr = NULL;
+		log_error("Failed to map io_uring: %s", strerror(errno));
+		goto failure;
+	}
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	               r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		log_error("Failed to map io_uring entries: %s", strerror(errno));
+		goto failure;
+	}
+
+	r->sq_head = (unsigned *)((char *)r->ring_ptr + p.sq_off.head);
+	r->sq_tail = (unsigned *)((char *)r->ring_ptr + p.sq_off.tail);
+	r->sq_mask = (unsigned *)((char *)r->ring_ptr + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)((char *)r->ring_ptr + p.sq_off.array);
+	r->cq_head = (unsigned *)((char *)r->ring_ptr + p.cq_off.head);
+	r->cq_tail = (unsigned *)((char *)r->ring_ptr + p.cq_off.tail);
+	r->cq_mask = (unsigned *)((char *)r->ring_ptr + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->ring_ptr + p.cq_off.cqes);
+	r->tail = *r->sq_tail;
+
+	return 0;
+
+failure:
+	if (r->ring_ptr != NULL) {
+		munmap(r->ring_ptr, r->ring_size);
+	}
+	close(r->fd);
+	r->fd = -1;
+	return -1;
+}
+
+static void
+_ring_free(_ring_t *r)
+{
+	if (r->fd < 0) {
+		return;
+	}
+	munmap(r->sqes, r->sqes_size);
+	munmap(r->ring_ptr, r->ring_size);
+	close(r->fd);
+	free(r->stx);
+	r->fd = -1;
+}
+
+static struct io_uring_sqe *
+_ring_sqe(_ring_t *r, int op, int file)
+{
+	unsigned idx = r->tail++ & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = (uint64_t)file << 2 | op;
+	r->sq_array[idx] = idx;
+	r->queued++;
+	return sqe;
+}
+
+static void
+_ring_queue_read(_ring_t *r, io_file_t *f, int file, int op)
+{
+	struct io_uring_sqe *sqe = _ring_sqe(r, op, file);
+
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = f->fd;
+	if (op == _OP_HEAD) {
+		sqe->addr = (uintptr_t)f->head;
+		sqe->len = IO_HEAD_SIZE;
+	} else {
+		sqe->addr = (uintptr_t)f->tail;
+		sqe->len = _tail_len(f->size);
+		sqe->off = f->size - sqe->len;
+	}
+	f->pending++;
+}
+
+static void
+_ring_start(_ring_t *r, io_file_t *f, int file)
+{
+	struct io_uring_sqe *sqe = NULL;
+
+	/* Both are independent of each other, the reads follow */
+	sqe = _ring_sqe(r, _OP_STATX, file);
+	sqe->opcode = IORING_OP_STATX;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)f->path;
+	sqe->len = STATX_SIZE;
+	sqe->off = (uintptr_t)&r->stx[file];
+
+	sqe = _ring_sqe(r, _OP_OPEN, file);
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)f->path;
+	sqe->open_flags = O_RDONLY | O_CLOEXEC;
+
+	f->pending = 2;
+}
+
+/*
+ * Handle completion, queue operations which depended on it.
+ * @return 1 when all operations on the file finished.
+ */
+static int
+_ring_complete(_ring_t *r, io_file_t *files, struct io_uring_cqe *cqe)
+{
+	int file = cqe->user_data >> 2, op = cqe->user_data & 3;
+	io_file_t *f = &files[file];
+
+	if (cqe->res < 0 && f->error == 0) {
+		f->error = -cqe->res;
+	}
+
+	switch (op) {
+	case _OP_STATX:
+		if (cqe->res == 0) {
+			f->size = r->stx[file].stx_size;
+			if (f->fd >= 0 && _tail_len(f->size) > 0) {
+				_ring_queue_read(r, f, file, _OP_TAIL);
+			}
+		}
+		break;
+	case _OP_OPEN:
+		if (cqe->res >= 0) {
+			f->fd = cqe->res;
+			_ring_queue_read(r, f, file, _OP_HEAD);
+			if (f->size >= 0 && _tail_len(f->size) > 0) {
+				_ring_queue_read(r, f, file, _OP_TAIL);
+			}
+		}
+		break;
+	case _OP_HEAD:
+		if (cqe->res >= 0) {
+			f->head_len = cqe->res;
+		}
+		break;
+	case _OP_TAIL:
+		if (cqe->res == (int)_tail_len(f->size)) {
+			f->tail_len = cqe->res;
+		} else if (f->error == 0) {
+			f->error = EIO;
+		}
+		break;
+	}
+
+	return --f->pending == 0;
+}
+
+static int
+_ring_read(io_batch_t *io, io_file_t *files, int count)
+{
+	_ring_t *r = &io->ring;
+	struct io_uring_cqe *cqe = NULL;
+	struct statx *stx = NULL;
+	unsigned head, tail;
+	int started = 0, finished = 0, active = 0, ret;
+
+	if (count > r->stx_count) {
+		if ((stx = realloc(r->stx, count * sizeof(struct statx))) == NULL) {
+			log_error("Failed to allocate statx buffers!");
+			return -1;
+		}
+		r->stx = stx;
+		r->stx_count = count;
+	}
+
+	while (finished < count) {
+		while (started < count && active < io->depth) {
+			_ring_start(r, &files[started], started);
+			started++;
+			active++;
+		}
+
+		__atomic_store_n(r->sq_tail, r->tail, __ATOMIC_RELEASE);
+		do {
+			ret = syscall(SYS_io_uring_enter, r->fd, r->queued, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		} while (ret < 0 && (errno == EINTR || errno == EAGAIN || errno == EBUSY));
+		if (ret < 0) {
+			log_error("Failed to submit I/O: %s", strerror(errno));
+			return -1;
+		}
+		r->queued -= ret;
+
+		head = *r->cq_head;
+		tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			cqe = &r->cqes[head & *r->cq_mask];
+			if (_ring_complete(r, files, cqe)) {
+				finished++;
+				active--;
+			}
+		}
+		__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+#endif
+
+io_batch_t *
+io_batch_new(int depth, const char *backend)
+{
+	io_batch_t *io = NULL;
+
+	if ((io = calloc(1, sizeof(io_batch_t))) == NULL) {
+		log_error("Failed to allocate I/O context!");
+		return NULL;
+	}
+	io->depth = depth < 1 ? 1 : depth > IO_BATCH_MAX_DEPTH ? IO_BATCH_MAX_DEPTH : depth;
+	pthread_mutex_init(&io->mutex, NULL);
+	pthread_cond_init(&io->work, NULL);
+	pthread_cond_init(&io->done, NULL);
+
+#ifdef USE_IO_URING
+	io->ring.fd = -1;
+	if (backend == NULL || strcmp(backend, "io_uring") == 0) {
+		if (_ring_setup(&io->ring, io->depth) == 0) {
+			io->backend = "io_uring";
+			return io;
+		}
+	}
+#endif
+	if (backend != NULL && strcmp(backend, "threads") != 0) {
+		log_error("Unsupported I/O backend: %s", backend);
+		goto failure;
+	}
+	if (_threads_start(io) != 0) {
+		goto failure;
+	}
+	io->backend = "threads";
+
+	return io;
+
+failure:
+	io_batch_free(io);
+	return NULL;
+}
+
+void
+io_batch_free(io_batch_t *io)
+{
+	if (io == NULL) {
+		return;
+	}
+#ifdef USE_IO_URING
+	_ring_free(&io->ring);
+#endif
+	_threads_stop(io);
+	pthread_mutex_destroy(&io->mutex);
+	pthread_cond_destroy(&io->work);
+	pthread_cond_destroy(&io->done);
+	free(io);
+}
+
+const char *
+io_batch_backend(io_batch_t *io)
+{
+	return io->backend;
+}
+
+int
+io_batch_read(io_batch_t *io, io_file_t *files, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		_file_reset(&files[i]);
+	}
+
+#ifdef USE_IO_URING
+	if (io->ring.fd >= 0) {
+		return _ring_read(io, files, count);
+	}
+#endif
+	return _threads_run(io, _read_file, NULL, files, sizeof(io_file_t), count);
+}
+
+int
+io_batch_run(io_batch_t *io, void (*job)(void *, void *), void *arg,
+             void *items, size_t size, int count)
+{
+	return _threads_run(io, job, arg, items, size, count);
+}
+
+void
+io_batch_close(io_file_t *files, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (files[i].fd >= 0) {
+			close(files[i].fd);
+			files[i].fd = -1;
+		}
+	}
+}
@@ -0,0 +1,105 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _IO_BATCH_H_
+#define _IO_BATCH_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Bytes read from the beginning and from the end of every file */
+#define IO_HEAD_SIZE (16 * 1024)
+#define IO_TAIL_SIZE (16 * 1024)
+
+/*
+ * Opens many files at once and reads their first and last bytes, where
+ * tag readers find almost everything they need. On high latency storage
+ * (NFS, SMB) this replaces a chain of synchronous round trips per file
+ * with a few rounds for the whole batch. Uses io_uring when the kernel
+ * supports it, a pool of threads otherwise.
+ */
+typedef struct io_batch_s io_batch_t;
+
+typedef struct {
+	const char    *path;
+	unsigned char *head;     /* IO_HEAD_SIZE bytes buffer, set by caller */
+	unsigned char *tail;     /* IO_TAIL_SIZE bytes buffer, set by caller */
+
+	int            fd;       /* Open file, -1 on failure */
+	off_t          size;
+	size_t         head_len; /* First head_len bytes of file */
+	size_t         tail_len; /* Last tail_len bytes, 0 when head covers them */
+	int            error;    /* errno of first failed operation */
+	int            pending;  /* Internal */
+} io_file_t;
+
+/**
+ * Create I/O context.
+ * @param depth Maximum number of files accessed at once.
+ * @param backend "io_uring", "threads" or NULL to pick the best supported.
+ * @return New context or NULL on failure.
+ */
+io_batch_t *
+io_batch_new(int depth, const char *backend);
+
+void
+io_batch_free(io_batch_t *io);
+
+/**
+ * Get name of backend in use.
+ */
+const char *
+io_batch_backend(io_batch_t *io);
+
+/**
+ * Open and read heads and tails of files. Failures are reported per file.
+ * @return 0 on success, -1 when the backend itself fails.
+ */
+int
+io_batch_read(io_batch_t *io, io_file_t *files, int count);
+
+/**
+ * Run job on every item with the thread pool, at most depth items at once.
+ * Meant for blocking work io_batch_read() doesn't cover, like streaming
+ * whole files. With io_uring the pool is started on first use.
+ * @param job Called with pointer to an item and arg.
+ * @param items Array of count items, size bytes each.
+ * @return 0 once job finished on all items, -1 when threads can't be started.
+ */
+int
+io_batch_run(io_batch_t *io, void (*job)(void *, void *), void *arg,
+             void *items, size_t size, int count);
+
+/**
+ * Close files opened by io_batch_read().
+ */
+void
+io_batch_close(io_file_t *files, int count);
+
+#endif /* !_IO_BATCH_H_ */
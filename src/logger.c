@@ -27,9 +27,15 @@
  * SUCH DAMAGE.
  */
 
+#include <errno.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include <event2/event.h>
 
@@ -39,20 +45,89 @@
 
 #include "logger.h"
 
-/* Format headers used by logger */
-#define INFO_FORMAT      "\e[1;32m[INFO]\e[00m %s"
-#define INFO_FORMAT_NC   "[INFO] %s"
-#define WARN_FORMAT      "\e[1;33m[WARN]\e[00m %s"
-#define WARN_FORMAT_NC   "[WARN] %s"
-#define ERROR_FORMAT     "\e[1;31m[ERROR]\e[00m %s"
-#define ERROR_FORMAT_NC  "[ERROR] %s"
-#define DEBUG_FORMAT     "\e[1;36m[DEBUG]\e[00m %s"
-#define DEBUG_FORMAT_NC  "[DEBUG] %s"
-#define TRACE_FORMAT     "\e[1;36m[TRACE]\e[00m %s"
-#define TRACE_FORMAT_NC  "[TRACE] %s"
+/* Message headers used by logger */
+#define INFO_HEADER      "\e[1;32m[INFO]\e[00m "
+#define INFO_HEADER_NC   "[INFO] "
+#define WARN_HEADER      "\e[1;33m[WARN]\e[00m "
+#define WARN_HEADER_NC   "[WARN] "
+#define ERROR_HEADER     "\e[1;31m[ERROR]\e[00m "
+#define ERROR_HEADER_NC  "[ERROR] "
+#define DEBUG_HEADER     "\e[1;36m[DEBUG]\e[00m "
+#define DEBUG_HEADER_NC  "[DEBUG] "
+#define TRACE_HEADER     "\e[1;36m[TRACE]\e[00m "
+#define TRACE_HEADER_NC  "[TRACE] "
+
+/* Longest message, longer ones are truncated */
+#define LOGGER_MAX_LINE    2048
+/* Per thread ring buffer size limits */
+#define LOGGER_MIN_BUFFER  (2 * LOGGER_MAX_LINE)
+#define LOGGER_MAX_BUFFER  (64 * 1024 * 1024)
+/* Size of a single write() issued by the writer thread */
+#define LOGGER_WRITE_SIZE  (64 * 1024)
+/* How long the writer waits for more messages after draining some */
+#define LOGGER_NAP_NS      (10 * 1000 * 1000)
+
+/* Writer thread states */
+#define WRITER_BUSY        0
+#define WRITER_NAPPING     1
+#define WRITER_SLEEPING    2
+
+/* Ring record header is the message length, high bit marks stderr */
+#define RECORD_STDERR      0x80000000u
+
+/*
+ * Single producer, single consumer ring owned by one logging thread
+ * and drained by the writer thread. Positions grow without wrapping,
+ * the buffer size is a power of two.
+ */
+typedef struct _log_ring {
+	/* Written by the owning thread */
+	unsigned long     tail;
+	unsigned long     head_cache;
+	unsigned long     dropped;
+	int               closed;
+	char              pad[64];
+	/* Written by the writer thread */
+	unsigned long     head;
+	unsigned long     reported;
+	struct _log_ring *next;
+	unsigned long     mask;
+	char              data[1];
+} _log_ring_t;
+
+/* Default runtime log level */
+#ifdef _DEBUG
+#define LOG_LEVEL_DEFAULT  LOG_LEVEL_DEBUG
+#else
+#define LOG_LEVEL_DEFAULT  LOG_LEVEL_INFO
+#endif /* _DEBUG */
+
+static const char *_logger_level_names[] = {
+	"error", "warning", "info", "debug", "trace"
+};
 
 int logger_use_color = 1;
-int logger_show_trace = 0;
+int logger_level = LOG_LEVEL_DEFAULT < LOG_LEVEL_COMPILED ?
+                   LOG_LEVEL_DEFAULT : LOG_LEVEL_COMPILED;
+
+static pthread_mutex_t  _logger_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   _logger_wake_cond = PTHREAD_COND_INITIALIZER;
+static pthread_key_t    _logger_key;
+static int              _logger_key_created = 0;
+static pthread_t        _logger_writer;
+static int              _logger_running = 0;
+static int              _logger_stop = 0;
+static int              _logger_state = WRITER_BUSY;
+static LOGGER_OVERFLOW  _logger_overflow = LOGGER_OVERFLOW_BLOCK;
+static size_t           _logger_buffer_size = 64 * 1024;
+/* Rings in creation order, the writer drains older threads first */
+static _log_ring_t     *_logger_rings = NULL;
+static _log_ring_t    **_logger_rings_end = &_logger_rings;
+static unsigned long    _logger_dropped_reaped = 0;
+
+/* Writer thread output buffers, stdout and stderr */
+static char             _logger_out[2][LOGGER_WRITE_SIZE];
+static size_t           _logger_out_len[2] = { 0, 0 };
 
 static void
 _event_log_fn(int severity, const char *msg)
@@ -81,121 +156,514 @@ _libav_log_fn(void *avcl, int level, const char *fmt, va_list vl)
 {
 	if (level >= AV_LOG_PANIC && level <= AV_LOG_FATAL) {
 		vlog_message(ERROR, 0, fmt, vl);
-	}
-#ifdef _DEBUG
-	else if (level <= AV_LOG_ERROR && logger_show_trace) {
+	} else if (level <= AV_LOG_ERROR && log_enabled(TRACE)) {
 		vlog_message(TRACE, 0, fmt, vl);
 	}
-#endif /* _DEBUG */
 }
 #endif /* _USE_LIBAV */
 
-void
-logger_init()
+static void
+_logger_write(int fd, const char *buf, size_t len)
 {
-	event_set_log_callback(_event_log_fn);
-#ifdef _USE_LIBAV
-	av_log_set_callback(_libav_log_fn);
-#endif /* _USE_LIBAV */
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+		buf += ret;
+		len -= ret;
+	}
+}
+
+static void
+_logger_ring_put(_log_ring_t *ring, unsigned long pos, const void *src, size_t len)
+{
+	size_t off = pos & ring->mask;
+	size_t first = ring->mask + 1 - off;
+
+	if (first >= len) {
+		memcpy(ring->data + off, src, len);
+	} else {
+		memcpy(ring->data + off, src, first);
+		memcpy(ring->data, (const char *)src + first, len - first);
+	}
+}
+
+static void
+_logger_ring_get(_log_ring_t *ring, unsigned long pos, void *dst, size_t len)
+{
+	size_t off = pos & ring->mask;
+	size_t first = ring->mask + 1 - off;
+
+	if (first >= len) {
+		memcpy(dst, ring->data + off, len);
+	} else {
+		memcpy(dst, ring->data + off, first);
+		memcpy((char *)dst + first, ring->data, len - first);
+	}
+}
+
+static void
+_logger_ring_release(void *data)
+{
+	_log_ring_t *ring = data;
+
+	/* The writer frees the ring once it is drained */
+	__atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
 }
 
-static char *
-_make_format(MESSAGE_TYPE type, int add_newline, const char *fmt)
+static _log_ring_t *
+_logger_ring()
 {
-	char* msg_fmt = NULL;
-	const char* fmt_hdr = NULL;
-	int fmt_len = 0;
+	_log_ring_t *ring = pthread_getspecific(_logger_key);
+	size_t size = LOGGER_MIN_BUFFER;
 
+	if (ring != NULL) {
+		return ring;
+	}
+
+	while (size < _logger_buffer_size) {
+		size <<= 1;
+	}
+	ring = calloc(1, offsetof(_log_ring_t, data) + size);
+	if (ring == NULL) {
+		return NULL;
+	}
+	ring->mask = size - 1;
+	if (pthread_setspecific(_logger_key, ring) != 0) {
+		free(ring);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&_logger_lock);
+	__atomic_store_n(_logger_rings_end, ring, __ATOMIC_RELEASE);
+	_logger_rings_end = &ring->next;
+	pthread_mutex_unlock(&_logger_lock);
+
+	return ring;
+}
+
+static void
+_logger_wake()
+{
+	pthread_mutex_lock(&_logger_lock);
+	pthread_cond_signal(&_logger_wake_cond);
+	pthread_mutex_unlock(&_logger_lock);
+}
+
+/* Wakes the writer if it is still in the given state, only once */
+static void
+_logger_kick(int state)
+{
+	if (__atomic_compare_exchange_n(&_logger_state, &state, WRITER_BUSY, 0,
+	                                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+		_logger_wake();
+	}
+}
+
+static void
+_logger_push(int fd, const char *buf, size_t len)
+{
+	_log_ring_t *ring = NULL;
+	unsigned long size, need, tail;
+	unsigned int hdr;
+	int state;
+
+	if (!__atomic_load_n(&_logger_running, __ATOMIC_ACQUIRE) ||
+	    (ring = _logger_ring()) == NULL) {
+		_logger_write(fd, buf, len);
+		return;
+	}
+
+	size = ring->mask + 1;
+	need = sizeof(hdr) + len;
+	tail = ring->tail;
+	while (size - (tail - ring->head_cache) < need) {
+		ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (size - (tail - ring->head_cache) >= need) {
+			break;
+		}
+		if ((state = __atomic_load_n(&_logger_state, __ATOMIC_RELAXED)) != WRITER_BUSY) {
+			_logger_kick(state);
+		}
+		if (_logger_overflow == LOGGER_OVERFLOW_DROP) {
+			__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+			return;
+		}
+		if (!__atomic_load_n(&_logger_running, __ATOMIC_ACQUIRE)) {
+			_logger_write(fd, buf, len);
+			return;
+		}
+		sched_yield();
+	}
+
+	hdr = len | (fd == STDERR_FILENO ? RECORD_STDERR : 0);
+	_logger_ring_put(ring, tail, &hdr, sizeof(hdr));
+	_logger_ring_put(ring, tail + sizeof(hdr), buf, len);
+	__atomic_store_n(&ring->tail, tail + need, __ATOMIC_RELEASE);
+
+	/* Pairs with the fence in _logger_wait() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	state = __atomic_load_n(&_logger_state, __ATOMIC_RELAXED);
+	if (state == WRITER_NAPPING && tail + need - ring->head_cache > size / 2) {
+		ring->head_cache = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (tail + need - ring->head_cache > size / 2) {
+			_logger_kick(state);
+		}
+	} else if (state == WRITER_SLEEPING) {
+		_logger_kick(state);
+	}
+}
+
+static const char *
+_logger_header(MESSAGE_TYPE type)
+{
 	switch (type) {
 	case INFO:
-		fmt_hdr = logger_use_color ? INFO_FORMAT : INFO_FORMAT_NC;
-		break;
+		return logger_use_color ? INFO_HEADER : INFO_HEADER_NC;
 	case WARNING:
-		fmt_hdr = logger_use_color ? WARN_FORMAT : WARN_FORMAT_NC;
-		break;
+		return logger_use_color ? WARN_HEADER : WARN_HEADER_NC;
 	case ERROR:
-		fmt_hdr = logger_use_color ? ERROR_FORMAT : ERROR_FORMAT_NC;
-		break;
-#ifdef _DEBUG
+		return logger_use_color ? ERROR_HEADER : ERROR_HEADER_NC;
 	case DEBUG:
-		fmt_hdr = logger_use_color ? DEBUG_FORMAT : DEBUG_FORMAT_NC;
-		break;
+		return logger_use_color ? DEBUG_HEADER : DEBUG_HEADER_NC;
 	case TRACE:
-		fmt_hdr = logger_use_color ? TRACE_FORMAT : TRACE_FORMAT_NC;
-		break;
-#endif /* DEBUG */
+		return logger_use_color ? TRACE_HEADER : TRACE_HEADER_NC;
 	default:
-		fmt_hdr = "[UNKNOWN] %s";
-		break;
+		return "[UNKNOWN] ";
 	}
+}
 
-	fmt_len = strlen(fmt_hdr) + strlen(fmt);
-	msg_fmt = (char *) malloc(fmt_len);
-	if (msg_fmt == NULL) {
-		return NULL;
+static void
+_logger_flush_out(int out)
+{
+	_logger_write(out ? STDERR_FILENO : STDOUT_FILENO,
+	              _logger_out[out], _logger_out_len[out]);
+	_logger_out_len[out] = 0;
+}
+
+static void
+_logger_out_append(int out, const char *buf, size_t len)
+{
+	if (_logger_out_len[out] + len > LOGGER_WRITE_SIZE) {
+		_logger_flush_out(out);
 	}
-	sprintf(msg_fmt, fmt_hdr, fmt);
+	memcpy(_logger_out[out] + _logger_out_len[out], buf, len);
+	_logger_out_len[out] += len;
+}
 
-	if (add_newline) {
-		msg_fmt[fmt_len - 2] = '\n';
-		msg_fmt[fmt_len - 1] = '\0';
+static size_t
+_logger_drain_ring(_log_ring_t *ring)
+{
+	char msg[LOGGER_MAX_LINE];
+	unsigned long head = ring->head;
+	unsigned long tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	unsigned long dropped;
+	unsigned int hdr;
+	size_t len, count = 0;
+	int out;
+
+	while (head != tail) {
+		_logger_ring_get(ring, head, &hdr, sizeof(hdr));
+		len = hdr & ~RECORD_STDERR;
+		out = (hdr & RECORD_STDERR) ? 1 : 0;
+		if (_logger_out_len[out] + len > LOGGER_WRITE_SIZE) {
+			/* Let the producer go on while we write */
+			__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+			_logger_flush_out(out);
+		}
+		_logger_ring_get(ring, head + sizeof(hdr),
+		                 _logger_out[out] + _logger_out_len[out], len);
+		_logger_out_len[out] += len;
+		head += sizeof(hdr) + len;
+		count++;
 	}
+	__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
 
-	return msg_fmt;
+	dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+	if (dropped != ring->reported) {
+		len = snprintf(msg, sizeof(msg), "%sDropped %lu log messages\n",
+		               _logger_header(WARNING), dropped - ring->reported);
+		_logger_out_append(0, msg, len);
+		ring->reported = dropped;
+		count++;
+	}
+
+	return count;
 }
 
-void
-log_message(MESSAGE_TYPE type, int add_newline, const char *fmt, ...)
+static void
+_logger_reap()
 {
-	char *msg_fmt = NULL;
-	va_list list;
+	_log_ring_t **prev, *ring;
 
-#ifdef _DEBUG
-	if (!logger_show_trace && type == TRACE) {
-		return;
+	pthread_mutex_lock(&_logger_lock);
+	prev = &_logger_rings;
+	while ((ring = *prev) != NULL) {
+		if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE) &&
+		    ring->head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) &&
+		    ring->reported == ring->dropped) {
+			*prev = ring->next;
+			if (_logger_rings_end == &ring->next) {
+				_logger_rings_end = prev;
+			}
+			_logger_dropped_reaped += ring->dropped;
+			free(ring);
+		} else {
+			prev = &ring->next;
+		}
 	}
-#endif
+	pthread_mutex_unlock(&_logger_lock);
+}
 
-	msg_fmt = _make_format(type, add_newline, fmt);
+static size_t
+_logger_drain()
+{
+	_log_ring_t *ring;
+	size_t count = 0;
+	int closed = 0;
 
-	va_start(list, fmt);
+	ring = __atomic_load_n(&_logger_rings, __ATOMIC_ACQUIRE);
+	for (; ring != NULL; ring = __atomic_load_n(&ring->next, __ATOMIC_ACQUIRE)) {
+		count += _logger_drain_ring(ring);
+		closed |= __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE);
+	}
+	if (_logger_out_len[1] > 0) {
+		_logger_flush_out(1);
+	}
+	if (_logger_out_len[0] > 0) {
+		_logger_flush_out(0);
+	}
+	if (closed) {
+		_logger_reap();
+	}
+
+	return count;
+}
+
+static int
+_logger_pending()
+{
+	_log_ring_t *ring;
 
-	if (msg_fmt == NULL) {
-		vfprintf(stderr, fmt, list);
+	ring = __atomic_load_n(&_logger_rings, __ATOMIC_ACQUIRE);
+	for (; ring != NULL; ring = __atomic_load_n(&ring->next, __ATOMIC_ACQUIRE)) {
+		if (ring->head != __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+			return 1;
+		}
 	}
+	return 0;
+}
 
-	if (type == ERROR) {
-		vfprintf(stderr, msg_fmt, list);
-	} else {
-		vfprintf(stdout, msg_fmt, list);
+/*
+ * Napping lets messages pile up so they go out in larger writes,
+ * producers only wake a napping writer when their ring fills up.
+ * A sleeping writer is woken by any new message.
+ */
+static void
+_logger_wait(int state)
+{
+	struct timespec ts;
+
+	pthread_mutex_lock(&_logger_lock);
+	__atomic_store_n(&_logger_state, state, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!_logger_stop && !(state == WRITER_SLEEPING && _logger_pending())) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		if (state == WRITER_NAPPING) {
+			ts.tv_nsec += LOGGER_NAP_NS;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+		} else {
+			ts.tv_sec++;
+		}
+		pthread_cond_timedwait(&_logger_wake_cond, &_logger_lock, &ts);
 	}
-	va_end(list);
+	__atomic_store_n(&_logger_state, WRITER_BUSY, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&_logger_lock);
+}
 
-	free(msg_fmt);
+static void *
+_logger_thread(void *data)
+{
+	for (;;) {
+		if (_logger_drain() > 0) {
+			_logger_wait(WRITER_NAPPING);
+		} else if (__atomic_load_n(&_logger_stop, __ATOMIC_ACQUIRE)) {
+			break;
+		} else {
+			_logger_wait(WRITER_SLEEPING);
+		}
+	}
+	return NULL;
 }
 
 void
-vlog_message(MESSAGE_TYPE type, int add_newline, const char *fmt, va_list vl)
+logger_init()
 {
-	char *msg_fmt = NULL;
+	event_set_log_callback(_event_log_fn);
+#ifdef _USE_LIBAV
+	av_log_set_callback(_libav_log_fn);
+#endif /* _USE_LIBAV */
 
-#ifdef _DEBUG
-	if (!logger_show_trace && type == TRACE) {
+	if (__atomic_load_n(&_logger_running, __ATOMIC_ACQUIRE)) {
 		return;
 	}
-#endif
-
-	msg_fmt = _make_format(type, add_newline, fmt);
+	if (!_logger_key_created) {
+		if (pthread_key_create(&_logger_key, _logger_ring_release) != 0) {
+			log_warning("Failed to create logger thread key, logging synchronously");
+			return;
+		}
+		_logger_key_created = 1;
+		atexit(logger_shutdown);
+	}
 
-	if (msg_fmt == NULL) {
-		vfprintf(stderr, fmt, vl);
+	_logger_stop = 0;
+	if (pthread_create(&_logger_writer, NULL, _logger_thread, NULL) != 0) {
+		log_warning("Failed to start log writer thread, logging synchronously");
+		return;
 	}
+	__atomic_store_n(&_logger_running, 1, __ATOMIC_RELEASE);
+}
 
-	if (type == ERROR) {
-		vfprintf(stderr, msg_fmt, vl);
+int
+logger_configure(const char *overflow, size_t buffer_size)
+{
+	if (strcmp(overflow, "block") == 0) {
+		_logger_overflow = LOGGER_OVERFLOW_BLOCK;
+	} else if (strcmp(overflow, "drop") == 0) {
+		_logger_overflow = LOGGER_OVERFLOW_DROP;
 	} else {
-		vfprintf(stdout, msg_fmt, vl);
+		log_error("Unknown log overflow policy: %s", overflow);
+		return -1;
+	}
+
+	if (buffer_size < LOGGER_MIN_BUFFER) {
+		buffer_size = LOGGER_MIN_BUFFER;
+	} else if (buffer_size > LOGGER_MAX_BUFFER) {
+		buffer_size = LOGGER_MAX_BUFFER;
+	}
+	_logger_buffer_size = buffer_size;
+
+	return 0;
+}
+
+void
+logger_shutdown()
+{
+	if (!__atomic_load_n(&_logger_running, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+
+	pthread_mutex_lock(&_logger_lock);
+	__atomic_store_n(&_logger_stop, 1, __ATOMIC_RELEASE);
+	pthread_cond_signal(&_logger_wake_cond);
+	pthread_mutex_unlock(&_logger_lock);
+	pthread_join(_logger_writer, NULL);
+
+	/* Anything logged from now on is written directly */
+	__atomic_store_n(&_logger_running, 0, __ATOMIC_RELEASE);
+	(void)_logger_drain();
+}
+
+int
+logger_set_level(const char *name)
+{
+	int level;
+
+	for (level = LOG_LEVEL_ERROR; level <= LOG_LEVEL_TRACE; level++) {
+		if (strcmp(name, _logger_level_names[level]) == 0) {
+			break;
+		}
+	}
+	if (level > LOG_LEVEL_TRACE) {
+		log_error("Unknown log level: %s", name);
+		return -1;
+	}
+	if (level > LOG_LEVEL_COMPILED) {
+		log_warning("Log level %s not compiled in, using %s", name,
+		            _logger_level_names[LOG_LEVEL_COMPILED]);
+		level = LOG_LEVEL_COMPILED;
+	}
+	logger_level = level;
+
+	return 0;
+}
+
+const char *
+logger_level_name(int level)
+{
+	if (level < LOG_LEVEL_ERROR || level > LOG_LEVEL_TRACE) {
+		return "unknown";
+	}
+	return _logger_level_names[level];
+}
+
+unsigned long
+logger_dropped()
+{
+	_log_ring_t *ring;
+	unsigned long dropped;
+
+	pthread_mutex_lock(&_logger_lock);
+	dropped = _logger_dropped_reaped;
+	for (ring = _logger_rings; ring != NULL; ring = ring->next) {
+		dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&_logger_lock);
+
+	return dropped;
+}
+
+static size_t
+_logger_format(char *buf, MESSAGE_TYPE type, int add_newline,
+               const char *fmt, va_list vl)
+{
+	const char *hdr = _logger_header(type);
+	size_t len = strlen(hdr);
+	/* Keep room for the newline */
+	size_t avail = LOGGER_MAX_LINE - len - 1;
+	int ret;
+
+	memcpy(buf, hdr, len);
+	ret = vsnprintf(buf + len, avail, fmt, vl);
+	if (ret > 0) {
+		len += (size_t)ret < avail ? (size_t)ret : avail - 1;
+	}
+	if (add_newline) {
+		buf[len++] = '\n';
+	}
+
+	return len;
+}
+
+void
+log_message(MESSAGE_TYPE type, int add_newline, const char *fmt, ...)
+{
+	va_list list;
+
+	va_start(list, fmt);
+	vlog_message(type, add_newline, fmt, list);
+	va_end(list);
+}
+
+void
+vlog_message(MESSAGE_TYPE type, int add_newline, const char *fmt, va_list vl)
+{
+	char buf[LOGGER_MAX_LINE];
+	size_t len;
+
+	if ((int)type > logger_level) {
+		return;
 	}
 
-	free(msg_fmt);
+	len = _logger_format(buf, type, add_newline, fmt, vl);
+	_logger_push(type == ERROR ? STDERR_FILENO : STDOUT_FILENO, buf, len);
 }
@@ -31,24 +31,95 @@
 #define LOGGER_H
 
 #include <stdarg.h>
+#include <stddef.h>
 
-/* Supported message types.*/
-typedef enum {
-	INFO,
-	WARNING,
-	ERROR,
+/* Log levels, from the most to the least important. */
+#define LOG_LEVEL_ERROR   0
+#define LOG_LEVEL_WARNING 1
+#define LOG_LEVEL_INFO    2
+#define LOG_LEVEL_DEBUG   3
+#define LOG_LEVEL_TRACE   4
+
+/*
+ * Most verbose level compiled in. Messages above it are removed by the
+ * compiler, arguments included. Can be set with -DLOG_LEVEL_COMPILED.
+ */
+#ifndef LOG_LEVEL_COMPILED
 #ifdef _DEBUG
-	DEBUG,
-	TRACE,
-#endif /* DEBUG */
+#define LOG_LEVEL_COMPILED LOG_LEVEL_TRACE
+#else
+#define LOG_LEVEL_COMPILED LOG_LEVEL_INFO
+#endif /* _DEBUG */
+#endif /* LOG_LEVEL_COMPILED */
+
+/* Supported message types, same as their log level. */
+typedef enum {
+	ERROR   = LOG_LEVEL_ERROR,
+	WARNING = LOG_LEVEL_WARNING,
+	INFO    = LOG_LEVEL_INFO,
+	DEBUG   = LOG_LEVEL_DEBUG,
+	TRACE   = LOG_LEVEL_TRACE
 } MESSAGE_TYPE;
 
+/* What a thread does when its log buffer is full. */
+typedef enum {
+	LOGGER_OVERFLOW_BLOCK,
+	LOGGER_OVERFLOW_DROP,
+} LOGGER_OVERFLOW;
+
 extern int logger_use_color;
-extern int logger_show_trace;
 
+/*
+ * Most verbose level logged at runtime, read by the log_<type> macros
+ * before their arguments are evaluated. Use logger_set_level() to
+ * change it.
+ */
+extern int logger_level;
+
+/**
+ * Starts the log writer thread. Each logging thread gets its own ring
+ * buffer, which the writer drains into large writes to stdout/stderr.
+ * Messages from one thread keep their order, messages from different
+ * threads may be reordered. Before logger_init() and after
+ * logger_shutdown() messages are written directly by the caller.
+ */
 void
 logger_init();
 
+/**
+ * Sets the overflow policy, "block" or "drop", and the size of ring
+ * buffers created from now on. Returns 0 on success, -1 on failure.
+ */
+int
+logger_configure(const char *overflow, size_t buffer_size);
+
+/**
+ * Writes out all buffered messages and stops the writer thread.
+ * Registered with atexit() by logger_init().
+ */
+void
+logger_shutdown();
+
+/**
+ * Sets runtime log level by name: "error", "warning", "info", "debug" or
+ * "trace". Levels above LOG_LEVEL_COMPILED are clamped to it.
+ * Returns 0 on success, -1 on unknown level name.
+ */
+int
+logger_set_level(const char *name);
+
+/**
+ * Name of given log level.
+ */
+const char *
+logger_level_name(int level);
+
+/**
+ * Number of messages dropped so far because of full ring buffers.
+ */
+unsigned long
+logger_dropped();
+
 /**
  * Main logging routine. Should not be used directly.
  * Please use log_<type> macros.
@@ -63,17 +134,31 @@ log_message(MESSAGE_TYPE type, int add_newline, const char* format, ...);
 void
 vlog_message(MESSAGE_TYPE type, int add_newline, const char *fmt, va_list vl);
 
-/* Logging macros. */
-#define log_info(format, args...)    log_message(INFO, 1, format, ## args)
-#define log_warning(format, args...) log_message(WARNING, 1, format, ## args)
-#define log_error(format, args...)   log_message(ERROR, 1, format, ## args)
-#ifdef _DEBUG
-#define log_debug(format, args...)   log_message(DEBUG, 1, format, ## args)
-#define log_trace(format, args...)   log_message(TRACE, 1, format, ## args)
-#else
-#define log_debug(format, args...)
-#define log_trace(format, args...)
-#endif /* DEBUG */
+/* Whether messages of given type are logged. */
+#define log_enabled(type) \
+	((type) <= LOG_LEVEL_COMPILED && (type) <= logger_level)
+
+/*
+ * Logging macros. Disabled messages cost a single branch, arguments
+ * are not evaluated. Debug and trace are expected to be off.
+ */
+#define _log_if(cond, type, format, args...) \
+	do { \
+		if (cond) { \
+			log_message(type, 1, format, ## args); \
+		} \
+	} while (0)
+
+#define log_error(format, args...) \
+	_log_if(log_enabled(ERROR), ERROR, format, ## args)
+#define log_warning(format, args...) \
+	_log_if(log_enabled(WARNING), WARNING, format, ## args)
+#define log_info(format, args...) \
+	_log_if(log_enabled(INFO), INFO, format, ## args)
+#define log_debug(format, args...) \
+	_log_if(__builtin_expect(log_enabled(DEBUG), 0), DEBUG, format, ## args)
+#define log_trace(format, args...) \
+	_log_if(__builtin_expect(log_enabled(TRACE), 0), TRACE, format, ## args)
 
 #endif /* LOGGER_H */
 
@@ -48,7 +48,7 @@ print_help(const char *progname)
 	       "  -c <file>   Read program configuration from specified file\n"
 	       "  -n          Disable colors in log output\n"
 	       "  -h          Show application help\n"
-#ifdef _DEBUG
+#if LOG_LEVEL_COMPILED >= LOG_LEVEL_TRACE
 	       "  -t          Enable trace logs\n"
 #endif
 	       "  -v          Print application version and exit\n",
@@ -61,7 +61,7 @@ int main(int argc, char **argv)
 	basileus_t *bhnd;
 	int opt;
 
-#ifndef _DEBUG
+#if LOG_LEVEL_COMPILED < LOG_LEVEL_TRACE
 #define _GETOPT_OPTSTR "c:nhv"
 #else
 #define _GETOPT_OPTSTR "c:nhtv"
@@ -87,9 +87,9 @@ int main(int argc, char **argv)
 			print_version();
 			return 0;
 
-#ifdef _DEBUG
+#if LOG_LEVEL_COMPILED >= LOG_LEVEL_TRACE
 		case 't':
-			logger_show_trace = 1;
+			logger_level = LOG_LEVEL_TRACE;
 			break;
 #endif
 
@@ -110,6 +110,7 @@ int main(int argc, char **argv)
 	log_info("Terminating basileus...");
 	basileus_shutdown(bhnd);
 	log_info("Shutdown complete");
+	logger_shutdown();
 
 	return 0;
 }
@@ -24,11 +24,9 @@
 #include <stdarg.h>
 #include <inttypes.h>
 
-typedef struct MD5Context {
-	uint32_t buf[4];
-	uint32_t bits[2];
-	unsigned char in[64];
-} MD5_CTX;
+#include "md5.h"
+
+typedef md5_ctx_t MD5_CTX;
 
 static void bin2str(char *to, const unsigned char *p, size_t len) {
   static const char *hex = "0123456789abcdef";
@@ -227,21 +225,59 @@ static void MD5Final(unsigned char digest[16], MD5_CTX *ctx) {
   memset((char *) ctx, 0, sizeof(*ctx));
 }
 
-void md5(char buf[33], ...)
+static void md5_va(unsigned char digest[16], va_list ap)
 {
-  unsigned char hash[16];
   const char *p;
-  va_list ap;
   MD5_CTX ctx;
 
   MD5Init(&ctx);
-
-  va_start(ap, buf);
   while ((p = va_arg(ap, const char *)) != NULL) {
     MD5Update(&ctx, (const unsigned char *) p, (unsigned) strlen(p));
   }
+  MD5Final(digest, &ctx);
+}
+
+void md5(char buf[33], ...)
+{
+  unsigned char hash[16];
+  va_list ap;
+
+  va_start(ap, buf);
+  md5_va(hash, ap);
   va_end(ap);
 
-  MD5Final(hash, &ctx);
   bin2str(buf, hash, sizeof(hash));
 }
+
+void md5_digest(unsigned char digest[16], ...)
+{
+  va_list ap;
+
+  va_start(ap, digest);
+  md5_va(digest, ap);
+  va_end(ap);
+}
+
+void md5_init(md5_ctx_t *ctx)
+{
+  MD5Init(ctx);
+}
+
+void md5_update(md5_ctx_t *ctx, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+  unsigned chunk;
+
+  /* MD5Update() counts in unsigned, feed large buffers in pieces */
+  while (len > 0) {
+    chunk = len > 0x40000000 ? 0x40000000 : (unsigned) len;
+    MD5Update(ctx, p, chunk);
+    p += chunk;
+    len -= chunk;
+  }
+}
+
+void md5_final(unsigned char digest[16], md5_ctx_t *ctx)
+{
+  MD5Final(digest, ctx);
+}
@@ -23,6 +23,21 @@
 #ifndef _MD5_H_
 #define _MD5_H_
 
+#include <stddef.h>
+#include <inttypes.h>
+
+typedef struct MD5Context {
+	uint32_t buf[4];
+	uint32_t bits[2];
+	unsigned char in[64];
+} md5_ctx_t;
+
 void md5(char buf[33], ...);
+void md5_digest(unsigned char digest[16], ...);
+
+/* Incremental interface, for messages that do not fit in memory */
+void md5_init(md5_ctx_t *ctx);
+void md5_update(md5_ctx_t *ctx, const void *data, size_t len);
+void md5_final(unsigned char digest[16], md5_ctx_t *ctx);
 
 #endif /* !_MD5_H_ */
@@ -0,0 +1,319 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <time.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "logger.h"
+#include "metrics.h"
+
+/* Number of copies of sharded values, threads are assigned round robin */
+#define METRICS_SHARDS  16
+
+/* Sharded values per shard, counters take one, histograms SLOTS_HISTOGRAM */
+#define METRICS_SLOTS   2048
+
+/* Histogram buckets, one for values above the last bound, and the sum */
+#define SLOTS_HISTOGRAM (METRICS_BUCKETS + 2)
+
+struct metric {
+	METRIC_TYPE     type;
+	char            name[METRICS_MAX_NAME];
+	char            labels[METRICS_MAX_LABELS];
+	const char     *help;
+	/* First sharded value, -1 for gauges and function counters */
+	int             slot;
+	int64_t         value;
+	unsigned long (*read)(void);
+};
+
+static const uint64_t _metrics_bounds[METRICS_BUCKETS] = { METRICS_BUCKET_BOUNDS };
+
+static struct metric    _metrics[METRICS_MAX];
+static int              _metrics_count = 0;
+static int              _metrics_slots_used = 0;
+static pthread_mutex_t  _metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t   _metrics_once = PTHREAD_ONCE_INIT;
+static pthread_key_t    _metrics_shard_key;
+static unsigned int     _metrics_threads = 0;
+
+/* Each shard is a multiple of cache line size, so shards never share one */
+static uint64_t _metrics_shards[METRICS_SHARDS][METRICS_SLOTS]
+	__attribute__((aligned(64)));
+
+static void
+_metrics_shard_key_init()
+{
+	(void)pthread_key_create(&_metrics_shard_key, NULL);
+}
+
+static uint64_t *
+_metrics_shard()
+{
+	uintptr_t shard = (uintptr_t)pthread_getspecific(_metrics_shard_key);
+
+	if (shard == 0) {
+		shard = __atomic_fetch_add(&_metrics_threads, 1, __ATOMIC_RELAXED) % METRICS_SHARDS + 1;
+		(void)pthread_setspecific(_metrics_shard_key, (void *)shard);
+	}
+	return _metrics_shards[shard - 1];
+}
+
+static uint64_t
+_metrics_sum(int slot)
+{
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < METRICS_SHARDS; i++) {
+		sum += __atomic_load_n(&_metrics_shards[i][slot], __ATOMIC_RELAXED);
+	}
+	return sum;
+}
+
+static metric_t *
+_metrics_find(const char *name, const char *labels)
+{
+	int i;
+
+	for (i = 0; i < _metrics_count; i++) {
+		if (0 == strcmp(_metrics[i].name, name) &&
+		    0 == strcmp(_metrics[i].labels, labels)) {
+			return &_metrics[i];
+		}
+	}
+	return NULL;
+}
+
+static metric_t *
+_metrics_new(METRIC_TYPE type, const char *name, const char *labels,
+             const char *help, int slots)
+{
+	metric_t *m = NULL;
+
+	if (labels == NULL) {
+		labels = "";
+	}
+
+	pthread_once(&_metrics_once, _metrics_shard_key_init);
+	pthread_mutex_lock(&_metrics_lock);
+
+	if (NULL != (m = _metrics_find(name, labels))) {
+		if (m->type != type || (slots == 0) != (m->slot < 0)) {
+			log_error("Metric %s{%s} registered with different type!", name, labels);
+			m = NULL;
+		}
+		goto finish;
+	}
+
+	if (_metrics_count == METRICS_MAX || _metrics_slots_used + slots > METRICS_SLOTS ||
+	    strlen(name) >= METRICS_MAX_NAME || strlen(labels) >= METRICS_MAX_LABELS) {
+		log_error("Failed to register metric %s{%s}!", name, labels);
+		goto finish;
+	}
+
+	m = &_metrics[_metrics_count];
+	m->type = type;
+	strcpy(m->name, name);
+	strcpy(m->labels, labels);
+	m->help = help;
+	m->slot = slots ? _metrics_slots_used : -1;
+	m->value = 0;
+	m->read = NULL;
+
+	_metrics_slots_used += slots;
+	/* Readers only look at metrics below count */
+	__atomic_store_n(&_metrics_count, _metrics_count + 1, __ATOMIC_RELEASE);
+
+finish:
+	pthread_mutex_unlock(&_metrics_lock);
+	return m;
+}
+
+metric_t *
+metrics_register(METRIC_TYPE type, const char *name, const char *labels,
+                 const char *help)
+{
+	switch (type) {
+	case METRIC_COUNTER:
+		return _metrics_new(type, name, labels, help, 1);
+	case METRIC_HISTOGRAM:
+		return _metrics_new(type, name, labels, help, SLOTS_HISTOGRAM);
+	default:
+		return _metrics_new(type, name, labels, help, 0);
+	}
+}
+
+metric_t *
+metrics_register_func(const char *name, const char *labels, const char *help,
+                      unsigned long (*read)(void))
+{
+	metric_t *m = _metrics_new(METRIC_COUNTER, name, labels, help, 0);
+
+	if (m) {
+		m->read = read;
+	}
+	return m;
+}
+
+void
+metrics_add(metric_t *m, uint64_t n)
+{
+	if (m && m->slot >= 0) {
+		__atomic_fetch_add(&_metrics_shard()[m->slot], n, __ATOMIC_RELAXED);
+	}
+}
+
+void
+metrics_set(metric_t *m, int64_t value)
+{
+	if (m) {
+		__atomic_store_n(&m->value, value, __ATOMIC_RELAXED);
+	}
+}
+
+void
+metrics_gauge_add(metric_t *m, int64_t delta)
+{
+	if (m) {
+		__atomic_fetch_add(&m->value, delta, __ATOMIC_RELAXED);
+	}
+}
+
+void
+metrics_observe(metric_t *m, uint64_t usec)
+{
+	uint64_t *shard;
+	int i;
+
+	if (m == NULL || m->type != METRIC_HISTOGRAM) {
+		return;
+	}
+
+	for (i = 0; i < METRICS_BUCKETS && usec > _metrics_bounds[i]; i++);
+
+	shard = _metrics_shard();
+	__atomic_fetch_add(&shard[m->slot + i], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&shard[m->slot + METRICS_BUCKETS + 1], usec, __ATOMIC_RELAXED);
+}
+
+uint64_t
+metrics_now_us()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Writes name, suffix and labels, with an extra label if given */
+static void
+_metrics_write_name(FILE *out, const metric_t *m, const char *suffix, const char *extra)
+{
+	fprintf(out, "%s%s", m->name, suffix);
+	if (m->labels[0] && extra) {
+		fprintf(out, "{%s,%s} ", m->labels, extra);
+	} else if (m->labels[0] || extra) {
+		fprintf(out, "{%s} ", m->labels[0] ? m->labels : extra);
+	} else {
+		fputc(' ', out);
+	}
+}
+
+static void
+_metrics_write_histogram(FILE *out, const metric_t *m)
+{
+	uint64_t count = 0;
+	char le[32];
+	int i;
+
+	for (i = 0; i < METRICS_BUCKETS; i++) {
+		count += _metrics_sum(m->slot + i);
+		snprintf(le, sizeof(le), "le=\"%g\"", _metrics_bounds[i] / 1e6);
+		_metrics_write_name(out, m, "_bucket", le);
+		fprintf(out, "%llu\n", (unsigned long long)count);
+	}
+	count += _metrics_sum(m->slot + METRICS_BUCKETS);
+	_metrics_write_name(out, m, "_bucket", "le=\"+Inf\"");
+	fprintf(out, "%llu\n", (unsigned long long)count);
+
+	_metrics_write_name(out, m, "_sum", NULL);
+	fprintf(out, "%.6f\n", _metrics_sum(m->slot + METRICS_BUCKETS + 1) / 1e6);
+	_metrics_write_name(out, m, "_count", NULL);
+	fprintf(out, "%llu\n", (unsigned long long)count);
+}
+
+static void
+_metrics_write_value(FILE *out, const metric_t *m)
+{
+	if (m->type == METRIC_HISTOGRAM) {
+		_metrics_write_histogram(out, m);
+		return;
+	}
+
+	_metrics_write_name(out, m, "", NULL);
+	if (m->read) {
+		fprintf(out, "%lu\n", m->read());
+	} else if (m->slot >= 0) {
+		fprintf(out, "%llu\n", (unsigned long long)_metrics_sum(m->slot));
+	} else {
+		fprintf(out, "%lld\n", (long long)__atomic_load_n(&m->value, __ATOMIC_RELAXED));
+	}
+}
+
+int
+metrics_write(FILE *out)
+{
+	static const char *types[] = { "counter", "gauge", "histogram" };
+	int count = __atomic_load_n(&_metrics_count, __ATOMIC_ACQUIRE);
+	int i, j;
+
+	/* Metrics sharing a name are written together, under one header */
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < i && strcmp(_metrics[j].name, _metrics[i].name); j++);
+		if (j < i) {
+			continue;
+		}
+
+		if (_metrics[i].help) {
+			fprintf(out, "# HELP %s %s\n", _metrics[i].name, _metrics[i].help);
+		}
+		fprintf(out, "# TYPE %s %s\n", _metrics[i].name, types[_metrics[i].type]);
+
+		for (j = i; j < count; j++) {
+			if (0 == strcmp(_metrics[j].name, _metrics[i].name)) {
+				_metrics_write_value(out, &_metrics[j]);
+			}
+		}
+	}
+
+	return ferror(out) ? -1 : 0;
+}
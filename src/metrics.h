@@ -0,0 +1,119 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Registry of counters, gauges and histograms, exported in Prometheus
+ * text format. Counters and histograms are sharded: each thread adds to
+ * its own cache line aligned copy, which are summed up when written out.
+ * Gauges are a single value. All update functions accept NULL metric,
+ * so failing to register one does not need to be handled by callers.
+ */
+
+#define METRICS_MAX          256
+#define METRICS_MAX_NAME     64
+#define METRICS_MAX_LABELS   128
+
+/* Histogram bucket upper bounds, in microseconds */
+#define METRICS_BUCKETS      19
+#define METRICS_BUCKET_BOUNDS \
+	10, 25, 50, 100, 250, 500, \
+	1000, 2500, 5000, 10000, 25000, 50000, \
+	100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000
+
+typedef enum {
+	METRIC_COUNTER,
+	METRIC_GAUGE,
+	METRIC_HISTOGRAM,
+} METRIC_TYPE;
+
+typedef struct metric metric_t;
+
+/**
+ * Registers a metric, or returns already registered one with the same
+ * name and labels. Labels are given in exposition format, for example
+ * "route=\"/stream\"", or NULL. Help text is not copied. Histograms
+ * take observations in microseconds and are written out in seconds.
+ * Returns NULL when the registry is full or the metric exists with a
+ * different type.
+ */
+metric_t *
+metrics_register(METRIC_TYPE type, const char *name, const char *labels,
+                 const char *help);
+
+/**
+ * Registers a counter whose value is read from given function when
+ * metrics are written out.
+ */
+metric_t *
+metrics_register_func(const char *name, const char *labels, const char *help,
+                      unsigned long (*read)(void));
+
+/**
+ * Adds to a counter.
+ */
+void
+metrics_add(metric_t *m, uint64_t n);
+
+#define metrics_inc(m) metrics_add(m, 1)
+
+/**
+ * Sets or changes value of a gauge.
+ */
+void
+metrics_set(metric_t *m, int64_t value);
+
+void
+metrics_gauge_add(metric_t *m, int64_t delta);
+
+/**
+ * Records an observation, in microseconds, in a histogram.
+ */
+void
+metrics_observe(metric_t *m, uint64_t usec);
+
+/**
+ * Monotonic clock in microseconds, for timing histogram observations.
+ */
+uint64_t
+metrics_now_us();
+
+/**
+ * Writes all metrics in Prometheus text exposition format.
+ * Returns 0 on success, -1 on write error.
+ */
+int
+metrics_write(FILE *out);
+
+#endif /* METRICS_H */
@@ -0,0 +1,61 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <strings.h>
+
+#include "mime_type.h"
+#include "mime-types.h"
+
+const char *
+mime_type_guess(const char *path)
+{
+	const char *last_period, *extension;
+	const struct mime_type_entry *ent;
+	size_t len;
+
+	last_period = strrchr(path, '.');
+	if (!last_period || strchr(last_period, '/')) {
+		return NULL;
+	}
+
+	extension = last_period + 1;
+	len = strlen(extension);
+	if (len == 0 || len > MIME_TYPE_MAX_EXTENSION) {
+		return NULL;
+	}
+
+	ent = &mime_type_table[mime_type_hash(MIME_TYPE_HASH_SEED, extension, len) %
+	                       MIME_TYPE_TABLE_SIZE];
+	if (ent->extension == NULL || 0 != strcasecmp(ent->extension, extension)) {
+		return NULL;
+	}
+
+	return ent->content_type;
+}
@@ -27,14 +27,13 @@
  * SUCH DAMAGE.
  */
 
-#define _BSD_SOURCE /* We want DT_DIR, DT_REG  */
-
 #include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <dirent.h>
 #include <stddef.h>
 #include <pthread.h>
 #include <inttypes.h>
@@ -44,10 +43,19 @@
 #include <sqlite3.h>
 
 #include "cfg.h"
-#include "md5.h"
+#include "hash.h"
+#include "io_batch.h"
+#include "dir_walk.h"
+#include "evlog.h"
+#include "file_class.h"
+#include "fingerprint.h"
 #include "logger.h"
+#include "metrics.h"
 #include "music_db.h"
+#include "music_db_profile.h"
+#include "music_db_sql.h"
 #include "music_tag.h"
+#include "span.h"
 #include "basileus-music-db.h"
 
 typedef struct {
@@ -57,22 +65,141 @@ typedef struct {
 	cfg_t	        *cfg;
 	scheduler_t     *scheduler;
 
+	/* Fingerprint contents of new files to find duplicates and moves */
+	int              fingerprint;
+	/* Number of files opened at once while scanning */
+	int              io_depth;
+	/* Statements are profiled, see music_db_profile.h */
+	int              profiling;
+
 	pthread_mutex_t	 scan_mutex;
 	pthread_t        scan_thread;
 	int              scan_in_progress : 1;
 	int              scan_terminate : 1;
+	int              scan_files;
+	int64_t          scan_bytes;
+
+	/* Row of current scan in scans table, kept when scan is interrupted */
+	sqlite3_int64    scan_id;
+	/* Generation stamped on rows modified by current scan */
+	sqlite3_int64    scan_generation;
+	/* Most recent generation visible in the database */
+	sqlite3_int64    generation;
+
+	metric_t        *scan_metric;
+	metric_t        *scan_files_metric;
+	metric_t        *scan_rate_metric;
+	metric_t        *scan_bytes_metric;
 } _music_db_t;
 
+/*
+ * Bump whenever basileus-music-db.sql changes in a way that is not
+ * compatible with existing databases. As the database only caches
+ * the contents of music directories, outdated ones are simply dropped
+ * and rebuilt by the next scan.
+ */
+#define MUSIC_DB_SCHEMA_VERSION 5
+
+/* Size of binary song path hashes */
+#define MUSIC_DB_HASH_SIZE HASH_MD5_SIZE
+
+/* Number of scanned files read and stored in a single transaction */
+#define MUSIC_DB_SCAN_BATCH 256
+
+typedef struct {
+	char          *path;
+	music_tag_t   *tag;
+	unsigned char  hash[MUSIC_DB_HASH_SIZE];
+	unsigned char  fingerprint[FINGERPRINT_SIZE];
+	int            fingerprinted;
+	int            known;
+	/* Stored song with the same fingerprint, found before storing */
+	char          *match_path;
+	int            match_exists;
+} _music_db_scan_entry_t;
+
+/* Directory whose whole subtree was scanned */
+typedef struct {
+	char          *path;
+	sqlite3_int64  mtime;
+} _music_db_scan_dir_t;
+
+typedef struct {
+	_music_db_scan_entry_t entries[MUSIC_DB_SCAN_BATCH];
+	int                    count;
+
+	/* Stored in the same transaction as songs found in them */
+	_music_db_scan_dir_t  *dirs;
+	int                    dir_count;
+	int                    dir_cap;
+
+	io_batch_t            *io;
+	io_file_t              files[MUSIC_DB_SCAN_BATCH];
+	unsigned char         *io_buf;
+} _music_db_scan_batch_t;
+
+static const char drop_basileus_db_str[] =
+	"DROP TABLE IF EXISTS songs_fts;"
+	"DROP TABLE IF EXISTS scan_dirs;"
+	"DROP TABLE IF EXISTS scans;"
+	"DROP TABLE IF EXISTS songs;"
+	"DROP TABLE IF EXISTS albums;"
+	"DROP TABLE IF EXISTS artists;";
+
+/* Takes database mutex, time spent waiting for it is traced */
+static void
+_music_db_lock(_music_db_t *mdb)
+{
+	span_t span = span_begin();
+
+	sqlite3_mutex_enter(mdb->db_mutex);
+	span_end(span, "db_mutex wait");
+}
+
+/*
+ * Stamp current scan generation on an artist or album, marking its album
+ * or song listing as changed.
+ */
+static int
+_music_db_touch(_music_db_t *mdb, const char *stmt_txt, sqlite3_int64 id)
+{
+	sqlite3_stmt *stmt = NULL;
+	int ret = -1;
+
+	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, stmt_txt, -1, &stmt, NULL)) {
+		log_error("Failed to prepare sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	if (SQLITE_OK != sqlite3_bind_int64(stmt, 1, mdb->scan_generation)) {
+		log_error("Failed to bind statement integer: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	if (SQLITE_OK != sqlite3_bind_int64(stmt, 2, id)) {
+		log_error("Failed to bind statement integer: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	if (SQLITE_DONE != sqlite3_step(stmt)) {
+		log_error("Failed to step sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+
+	ret = 0;
+
+finish:
+	sqlite3_finalize(stmt);
+	return ret;
+}
+
 static int
 _music_db_add_artist(_music_db_t *mdb, const char *artist, sqlite3_int64 *out_id)
 {
 	sqlite3_stmt *stmt = NULL;
 	int ret = -1;
+	span_t span = span_begin();
 
-	sqlite3_mutex_enter(mdb->db_mutex);
+	_music_db_lock(mdb);
 
-	const char stmt_txt[] = "INSERT INTO artists (name) VALUES (?);";
-	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, stmt_txt, -1, &stmt, NULL)) {
+	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, MUSIC_DB_SQL(INSERT_ARTIST), -1, &stmt, NULL)) {
 		log_error("Failed to prepare sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
 		goto finish;
 	}
@@ -80,6 +207,10 @@ _music_db_add_artist(_music_db_t *mdb, const char *artist, sqlite3_int64 *out_id
 		log_error("Failed to bind statement text: %s", sqlite3_errmsg(mdb->db));
 		goto finish;
 	}
+	if (SQLITE_OK != sqlite3_bind_int64(stmt, 2, mdb->scan_generation)) {
+		log_error("Failed to bind statement integer: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
 	if (SQLITE_DONE != sqlite3_step(stmt)) {
 		log_error("Failed to step sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
 		goto finish;
@@ -91,8 +222,7 @@ _music_db_add_artist(_music_db_t *mdb, const char *artist, sqlite3_int64 *out_id
 	}
 	stmt = NULL;
 
-	const char stmt_txt2[] = "SELECT id from artists WHERE name=?;";
-	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, stmt_txt2, -1, &stmt, NULL)) {
+	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, MUSIC_DB_SQL(ARTIST_ID), -1, &stmt, NULL)) {
 		log_error("Failed to prepare sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
 		goto finish;
 	}
@@ -125,6 +255,7 @@ _music_db_add_artist(_music_db_t *mdb, const char *artist, sqlite3_int64 *out_id
 finish:
 	sqlite3_finalize(stmt);
 	sqlite3_mutex_leave(mdb->db_mutex);
+	span_end(span, "_music_db_add_artist");
 
 	return ret;
 }
@@ -133,12 +264,12 @@ static int
 _music_db_add_album(_music_db_t *mdb, const char *album, sqlite3_int64 artist_id, sqlite3_int64 *out_id)
 {
 	sqlite3_stmt *stmt = NULL;
-	int ret = -1;
+	int ret = -1, added;
+	span_t span = span_begin();
 
-	sqlite3_mutex_enter(mdb->db_mutex);
+	_music_db_lock(mdb);
 
-	const char stmt_txt[] = "INSERT INTO albums (name, artist_id) VALUES (?, ?);";
-	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, stmt_txt, -1, &stmt, NULL)) {
+	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, MUSIC_DB_SQL(INSERT_ALBUM), -1, &stmt, NULL)) {
 		log_error("Failed to prepare sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
 		goto finish;
 	}
@@ -150,10 +281,15 @@ _music_db_add_album(_music_db_t *mdb, const char *album, sqlite3_int64 artist_id
 		log_error("Failed to bind statement integer: %s", sqlite3_errmsg(mdb->db));
 		goto finish;
 	}
+	if (SQLITE_OK != sqlite3_bind_int64(stmt, 3, mdb->scan_generation)) {
+		log_error("Failed to bind statement integer: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
 	if (SQLITE_DONE != sqlite3_step(stmt)) {
 		log_error("Failed to step sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
 		goto finish;
 	}
+	added = sqlite3_changes(mdb->db) > 0;
 	if (SQLITE_OK != sqlite3_finalize(stmt)) {
 		log_error("Failed to finalize sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
 		stmt = NULL;
@@ -161,8 +297,12 @@ _music_db_add_album(_music_db_t *mdb, const char *album, sqlite3_int64 artist_id
 	}
 	stmt = NULL;
 
-	const char stmt_txt2[] = "SELECT id from albums WHERE name=? AND artist_id=?;";
-	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, stmt_txt2, -1, &stmt, NULL)) {
+	/* New album changes artist's album listing */
+	if (added && 0 != _music_db_touch(mdb, MUSIC_DB_SQL(TOUCH_ARTIST), artist_id)) {
+		goto finish;
+	}
+
+	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, MUSIC_DB_SQL(ALBUM_ID), -1, &stmt, NULL)) {
 		log_error("Failed to prepare sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
 		goto finish;
 	}
@@ -199,53 +339,245 @@ _music_db_add_album(_music_db_t *mdb, const char *album, sqlite3_int64 artist_id
 finish:
 	sqlite3_finalize(stmt);
 	sqlite3_mutex_leave(mdb->db_mutex);
+	span_end(span, "_music_db_add_album");
 
 	return ret;
 }
 
+/*
+ * Bind song columns shared by INSERT_SONG and MOVE_SONG.
+ */
 static int
-_music_db_add_song(_music_db_t *mdb, const char *path, music_tag_t *tag, sqlite3_int64 artist_id, sqlite3_int64 album_id)
+_music_db_bind_song(_music_db_t *mdb, sqlite3_stmt *stmt, _music_db_scan_entry_t *entry,
+                    sqlite3_int64 artist_id, sqlite3_int64 album_id)
+{
+	if (SQLITE_OK != sqlite3_bind_text(stmt, 1, entry->tag->title, -1, 0)) {
+		log_error("Failed to bind statement text: %s", sqlite3_errmsg(mdb->db));
+		return -1;
+	}
+	if (SQLITE_OK != sqlite3_bind_text(stmt, 2, entry->path, -1, 0)) {
+		log_error("Failed to bind statement text: %s", sqlite3_errmsg(mdb->db));
+		return -1;
+	}
+	if (SQLITE_OK != sqlite3_bind_blob(stmt, 3, entry->hash, MUSIC_DB_HASH_SIZE, SQLITE_STATIC)) {
+		log_error("Failed to bind statement blob: %s", sqlite3_errmsg(mdb->db));
+		return -1;
+	}
+	if (SQLITE_OK != sqlite3_bind_int(stmt, 4, entry->tag->track)) {
+		log_error("Failed to bind statement integer: %s", sqlite3_errmsg(mdb->db));
+		return -1;
+	}
+	if (SQLITE_OK != sqlite3_bind_int(stmt, 5, entry->tag->length)) {
+		log_error("Failed to bind statement integer: %s", sqlite3_errmsg(mdb->db));
+		return -1;
+	}
+	if (SQLITE_OK != sqlite3_bind_int64(stmt, 6, artist_id)) {
+		log_error("Failed to bind statement integer: %s", sqlite3_errmsg(mdb->db));
+		return -1;
+	}
+	if (SQLITE_OK != sqlite3_bind_int64(stmt, 7, album_id)) {
+		log_error("Failed to bind statement integer: %s", sqlite3_errmsg(mdb->db));
+		return -1;
+	}
+	return 0;
+}
+
+static int
+_music_db_add_song(_music_db_t *mdb, _music_db_scan_entry_t *entry, sqlite3_int64 artist_id,
+                   sqlite3_int64 album_id, int *added)
 {
 	sqlite3_stmt *stmt = NULL;
-	char hash[33];
 	int ret = -1;
+	span_t span = span_begin();
 
-	memset(hash, 0, sizeof(hash));
-	md5(hash, path, NULL);
+	_music_db_lock(mdb);
 
-	sqlite3_mutex_enter(mdb->db_mutex);
+	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, MUSIC_DB_SQL(INSERT_SONG), -1, &stmt, NULL)) {
+		log_error("Failed to prepare sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	if (0 != _music_db_bind_song(mdb, stmt, entry, artist_id, album_id)) {
+		goto finish;
+	}
+	if (entry->fingerprinted &&
+	    SQLITE_OK != sqlite3_bind_blob(stmt, 8, entry->fingerprint, FINGERPRINT_SIZE, SQLITE_STATIC)) {
+		log_error("Failed to bind statement blob: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	if (SQLITE_DONE != sqlite3_step(stmt)) {
+		log_error("Failed to step sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	*added = sqlite3_changes(mdb->db) > 0;
+	if (SQLITE_OK != sqlite3_finalize(stmt)) {
+		log_error("Failed to finalize sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		stmt = NULL;
+		goto finish;
+	}
+	stmt = NULL;
 
-	const char stmt_txt[] = "INSERT INTO songs (title, path, hash, track, length, artist_id, album_id) "
-	                        "VALUES (:1, :2, :3, :4, :5, :6, :7);";
-	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, stmt_txt, -1, &stmt, NULL)) {
+	/* New song changes album's song listing */
+	if (*added && 0 != _music_db_touch(mdb, MUSIC_DB_SQL(TOUCH_ALBUM), album_id)) {
+		goto finish;
+	}
+
+	ret = 0;
+
+finish:
+	sqlite3_finalize(stmt);
+	sqlite3_mutex_leave(mdb->db_mutex);
+	span_end(span, "_music_db_add_song");
+
+	return ret;
+}
+
+/*
+ * Check whether a song is already stored under given path hash.
+ * @return 1 if it is, 0 if not, -1 on error.
+ */
+static int
+_music_db_song_known(_music_db_t *mdb, const unsigned char *hash)
+{
+	sqlite3_stmt *stmt = NULL;
+	int ret = -1;
+
+	_music_db_lock(mdb);
+
+	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, MUSIC_DB_SQL(SONG_ID_BY_HASH), -1, &stmt, NULL)) {
 		log_error("Failed to prepare sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
 		goto finish;
 	}
-	if (SQLITE_OK != sqlite3_bind_text(stmt, 1, tag->title, -1, 0)) {
-		log_error("Failed to bind statement text: %s", sqlite3_errmsg(mdb->db));
+	if (SQLITE_OK != sqlite3_bind_blob(stmt, 1, hash, MUSIC_DB_HASH_SIZE, SQLITE_STATIC)) {
+		log_error("Failed to bind statement blob: %s", sqlite3_errmsg(mdb->db));
 		goto finish;
 	}
-	if (SQLITE_OK != sqlite3_bind_text(stmt, 2, path, -1, 0)) {
-		log_error("Failed to bind statement text: %s", sqlite3_errmsg(mdb->db));
+	switch (sqlite3_step(stmt)) {
+	case SQLITE_ROW:
+		ret = 1;
+		break;
+	case SQLITE_DONE:
+		ret = 0;
+		break;
+	default:
+		log_error("Failed to step sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		break;
+	}
+
+finish:
+	sqlite3_finalize(stmt);
+	sqlite3_mutex_leave(mdb->db_mutex);
+
+	return ret;
+}
+
+/*
+ * Look up a stored song by content fingerprint, its path is copied.
+ * @return 1 when found, 0 when not, -1 on error.
+ */
+static int
+_music_db_song_by_fingerprint(_music_db_t *mdb, const unsigned char *fingerprint,
+                              sqlite3_int64 *song_id, sqlite3_int64 *album_id, char **path)
+{
+	sqlite3_stmt *stmt = NULL;
+	const char *txt = NULL;
+	int ret = -1;
+
+	*path = NULL;
+
+	_music_db_lock(mdb);
+
+	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, MUSIC_DB_SQL(SONG_BY_FINGERPRINT), -1, &stmt, NULL)) {
+		log_error("Failed to prepare sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
 		goto finish;
 	}
-	if (SQLITE_OK != sqlite3_bind_text(stmt, 3, hash, -1, 0)) {
-		log_error("Failed to bind statement text: %s", sqlite3_errmsg(mdb->db));
+	if (SQLITE_OK != sqlite3_bind_blob(stmt, 1, fingerprint, FINGERPRINT_SIZE, SQLITE_STATIC)) {
+		log_error("Failed to bind statement blob: %s", sqlite3_errmsg(mdb->db));
 		goto finish;
 	}
-	if (SQLITE_OK != sqlite3_bind_int(stmt, 4, tag->track)) {
-		log_error("Failed to bind statement integer: %s", sqlite3_errmsg(mdb->db));
+	switch (sqlite3_step(stmt)) {
+	case SQLITE_ROW:
+		break;
+	case SQLITE_DONE:
+		ret = 0;
+		goto finish;
+	default:
+		log_error("Failed to step sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
 		goto finish;
 	}
-	if (SQLITE_OK != sqlite3_bind_int(stmt, 5, tag->length)) {
-		log_error("Failed to bind statement integer: %s", sqlite3_errmsg(mdb->db));
+
+	*song_id = sqlite3_column_int64(stmt, 0);
+	*album_id = sqlite3_column_int64(stmt, 2);
+	if ((txt = (const char *)sqlite3_column_text(stmt, 1)) != NULL &&
+	    (*path = strdup(txt)) == NULL) {
+		log_error("Failed to allocate memory for song path!");
 		goto finish;
 	}
-	if (SQLITE_OK != sqlite3_bind_int(stmt, 6, artist_id)) {
-		log_error("Failed to bind statement integer: %s", sqlite3_errmsg(mdb->db));
+	ret = 1;
+
+finish:
+	sqlite3_finalize(stmt);
+	sqlite3_mutex_leave(mdb->db_mutex);
+
+	return ret;
+}
+
+/*
+ * Look for a stored song with the same contents as entry. If that song's
+ * file still exists the entry is a duplicate and is skipped. Otherwise the
+ * file was moved and the song is updated in place, keeping its id.
+ * Whether the file exists was checked by _music_db_fingerprint_entry(),
+ * without the database locked.
+ * @return 1 when entry was handled, 0 when it should be inserted, -1 on error.
+ */
+static int
+_music_db_match_fingerprint(_music_db_t *mdb, _music_db_scan_entry_t *entry,
+                            sqlite3_int64 artist_id, sqlite3_int64 album_id, int *added)
+{
+	sqlite3_stmt *stmt = NULL;
+	sqlite3_int64 song_id = 0, old_album_id = 0;
+	char *old_path = NULL;
+	int exists, ret = -1;
+
+	*added = 0;
+
+	_music_db_lock(mdb);
+
+	switch (_music_db_song_by_fingerprint(mdb, entry->fingerprint, &song_id, &old_album_id, &old_path)) {
+	case 1:
+		break;
+	case 0:
+		ret = 0;
+		goto finish;
+	default:
 		goto finish;
 	}
-	if (SQLITE_OK != sqlite3_bind_int(stmt, 7, album_id)) {
+
+	/*
+	 * Only this scan stores songs, so a song other than the one checked
+	 * before was stored from this or an earlier batch and its file exists.
+	 */
+	if (old_path == NULL) {
+		exists = 0;
+	} else if (entry->match_path != NULL && strcmp(old_path, entry->match_path) == 0) {
+		exists = entry->match_exists;
+	} else {
+		exists = 1;
+	}
+	if (exists) {
+		log_info("Skipping duplicate of %s: %s", old_path, entry->path);
+		ret = 1;
+		goto finish;
+	}
+	log_info("Song moved to: %s", entry->path);
+
+	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, MUSIC_DB_SQL(MOVE_SONG), -1, &stmt, NULL)) {
+		log_error("Failed to prepare sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	if (0 != _music_db_bind_song(mdb, stmt, entry, artist_id, album_id)) {
+		goto finish;
+	}
+	if (SQLITE_OK != sqlite3_bind_int64(stmt, 8, song_id)) {
 		log_error("Failed to bind statement integer: %s", sqlite3_errmsg(mdb->db));
 		goto finish;
 	}
@@ -253,150 +585,619 @@ _music_db_add_song(_music_db_t *mdb, const char *path, music_tag_t *tag, sqlite3
 		log_error("Failed to step sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
 		goto finish;
 	}
-	if (SQLITE_OK != sqlite3_finalize(stmt)) {
-		log_error("Failed to finalize sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
-		stmt = NULL;
+
+	/* Both the old and the new album's song listings change */
+	if (0 != _music_db_touch(mdb, MUSIC_DB_SQL(TOUCH_ALBUM), old_album_id) ||
+	    0 != _music_db_touch(mdb, MUSIC_DB_SQL(TOUCH_ALBUM), album_id)) {
 		goto finish;
 	}
 
-	stmt = NULL;
-	ret = 0;
+	*added = 1;
+	ret = 1;
 
 finish:
 	sqlite3_finalize(stmt);
 	sqlite3_mutex_leave(mdb->db_mutex);
+	free(old_path);
 
 	return ret;
 }
 
+/*
+ * Runs on I/O threads. Streams the file through the fingerprint, then
+ * looks for a stored song with the same contents and checks whether its
+ * file still exists, so that no filesystem access happens while the
+ * batch is being stored with the database locked.
+ */
+static void
+_music_db_fingerprint_entry(void *data, void *arg)
+{
+	_music_db_scan_entry_t *entry = data;
+	_music_db_t *mdb = arg;
+	sqlite3_int64 song_id, album_id;
+
+	if (entry->known || 0 != fingerprint_file(entry->path, entry->fingerprint)) {
+		return;
+	}
+	entry->fingerprinted = 1;
+
+	switch (_music_db_song_by_fingerprint(mdb, entry->fingerprint, &song_id, &album_id,
+	                                      &entry->match_path)) {
+	case 1:
+		entry->match_exists = entry->match_path != NULL && access(entry->match_path, F_OK) == 0;
+		break;
+	case 0:
+		break;
+	default:
+		log_warning("Storing %s without fingerprint", entry->path);
+		entry->fingerprinted = 0;
+		break;
+	}
+}
+
+/*
+ * Fingerprint files whose paths are not in the database yet. Known paths
+ * are not read again, so rescans stay cheap. Files are read in parallel
+ * on the I/O thread pool.
+ */
 static int
-music_db_add_file(_music_db_t *mdb, const char *path)
+_music_db_batch_fingerprint(_music_db_t *mdb, _music_db_scan_batch_t *batch)
 {
+	int i, known;
+
+	for (i = 0; i < batch->count; i++) {
+		if ((known = _music_db_song_known(mdb, batch->entries[i].hash)) < 0) {
+			return -1;
+		}
+		batch->entries[i].known = known;
+	}
+
+	return io_batch_run(batch->io, _music_db_fingerprint_entry, mdb, batch->entries,
+	                    sizeof(_music_db_scan_entry_t), batch->count);
+}
+
+/*
+ * Scanned files are queued and processed in batches. All files of a batch
+ * are opened and read at once, which hides storage latency on network
+ * mounts. Hashing a whole batch lets hash_md5_batch() interleave paths in
+ * SIMD lanes, and a single transaction per batch spares sqlite a journal
+ * commit for every song. Directories completed by the scan are recorded in
+ * the same transaction, so an interrupted scan can resume after the last
+ * committed batch.
+ */
+static void
+_music_db_batch_clear(_music_db_scan_batch_t *batch)
+{
+	int i;
+
+	for (i = 0; i < batch->count; i++) {
+		free(batch->entries[i].path);
+		free(batch->entries[i].match_path);
+		music_tag_destroy(batch->entries[i].tag);
+	}
+	batch->count = 0;
+
+	for (i = 0; i < batch->dir_count; i++) {
+		free(batch->dirs[i].path);
+	}
+	batch->dir_count = 0;
+}
+
+static int
+_music_db_batch_store_dirs(_music_db_t *mdb, _music_db_scan_batch_t *batch)
+{
+	sqlite3_stmt *stmt = NULL;
+	int i, ret = -1;
+
+	if (batch->dir_count == 0) {
+		return 0;
+	}
+
+	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, MUSIC_DB_SQL(SCAN_DIR_DONE), -1, &stmt, NULL)) {
+		log_error("Failed to prepare sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		return -1;
+	}
+
+	for (i = 0; i < batch->dir_count; i++) {
+		if (SQLITE_OK != sqlite3_bind_text(stmt, 1, batch->dirs[i].path, -1, SQLITE_STATIC) ||
+		    SQLITE_OK != sqlite3_bind_int64(stmt, 2, batch->dirs[i].mtime) ||
+		    SQLITE_OK != sqlite3_bind_int64(stmt, 3, mdb->scan_id)) {
+			log_error("Failed to bind statement values: %s", sqlite3_errmsg(mdb->db));
+			goto finish;
+		}
+		if (SQLITE_DONE != sqlite3_step(stmt)) {
+			log_error("Failed to step sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+			goto finish;
+		}
+		sqlite3_reset(stmt);
+	}
+
+	ret = 0;
+
+finish:
+	sqlite3_finalize(stmt);
+	return ret;
+}
+
+/*
+ * Read tags of queued files, drop those which have none.
+ */
+static int
+_music_db_batch_tag(_music_db_t *mdb, _music_db_scan_batch_t *batch)
+{
+	io_file_t *file = NULL;
+	int64_t bytes = 0;
+	int i, count = 0;
+	span_t span;
+
+	for (i = 0; i < batch->count; i++) {
+		file = &batch->files[i];
+		file->path = batch->entries[i].path;
+		file->head = batch->io_buf + i * (IO_HEAD_SIZE + IO_TAIL_SIZE);
+		file->tail = file->head + IO_HEAD_SIZE;
+	}
+
+	evlog("scan read %d files", batch->count);
+	span = span_begin();
+	if (0 != io_batch_read(batch->io, batch->files, batch->count)) {
+		return -1;
+	}
+	span_end(span, "io_batch_read");
+	evlog("scan tag %d files", batch->count);
+	for (i = 0; i < batch->count; i++) {
+		batch->entries[i].tag = music_tag_create_prefetched(&batch->files[i]);
+		bytes += batch->files[i].head_len + batch->files[i].tail_len;
+	}
+	io_batch_close(batch->files, batch->count);
+
+	pthread_mutex_lock(&mdb->scan_mutex);
+	mdb->scan_bytes += bytes;
+	pthread_mutex_unlock(&mdb->scan_mutex);
+	metrics_add(mdb->scan_bytes_metric, bytes);
+
+	for (i = 0; i < batch->count; i++) {
+		if (batch->entries[i].tag == NULL) {
+			log_debug("No audio metadata found in: %s", batch->entries[i].path);
+			free(batch->entries[i].path);
+		} else {
+			batch->entries[count++] = batch->entries[i];
+		}
+	}
+	batch->count = count;
+
+	return 0;
+}
+
+static int
+_music_db_batch_flush(_music_db_t *mdb, _music_db_scan_batch_t *batch)
+{
+	hash_job_t jobs[MUSIC_DB_SCAN_BATCH];
+	_music_db_scan_entry_t *entry = NULL;
 	sqlite3_int64 artist_id, album_id;
-	music_tag_t *tag = NULL;
-	int ret = -1;
+	char *errmsg = NULL;
+	int i, added = 0, batch_added = 0, transaction = 0, ret = -1;
+	span_t span;
 
-	tag = music_tag_create(path);
-	if (tag == NULL) {
-		log_debug("No audio metadata found in: %s", path);
+	if (0 != _music_db_batch_tag(mdb, batch)) {
+		_music_db_batch_clear(batch);
+		return -1;
+	}
+	if (batch->count == 0 && batch->dir_count == 0) {
 		return 0;
 	}
 
-	log_debug("Adding file to database: %s", path);
+	for (i = 0; i < batch->count; i++) {
+		jobs[i].data = batch->entries[i].path;
+		jobs[i].len = strlen(batch->entries[i].path);
+		jobs[i].digest = batch->entries[i].hash;
+	}
+	span = span_begin();
+	hash_md5_batch(jobs, batch->count);
+	span_end(span, "hash_md5_batch");
 
-	if (0 != _music_db_add_artist(mdb, tag->artist, &artist_id)) {
-		log_error("Failed to add artist \"%s\" to music database!", tag->artist);
+	span = span_begin();
+	if (mdb->fingerprint && 0 != _music_db_batch_fingerprint(mdb, batch)) {
+		_music_db_batch_clear(batch);
+		return -1;
+	}
+	span_end(span, "_music_db_batch_fingerprint");
+
+	evlog("scan store %d songs %d dirs", batch->count, batch->dir_count);
+	span = span_begin();
+	_music_db_lock(mdb);
+
+	if (sqlite3_exec(mdb->db, "BEGIN;", NULL, NULL, &errmsg)) {
+		log_error("Failed to begin transaction: %s", errmsg);
 		goto finish;
 	}
-	if (0 != _music_db_add_album(mdb, tag->album, artist_id, &album_id)) {
-		log_error("Failed to add album \"%s\" to music database!", tag->album);
+	transaction = 1;
+
+	for (i = 0; i < batch->count; i++) {
+		entry = &batch->entries[i];
+		log_debug("Adding file to database: %s", entry->path);
+
+		if (0 != _music_db_add_artist(mdb, entry->tag->artist, &artist_id)) {
+			log_error("Failed to add artist \"%s\" to music database!", entry->tag->artist);
+			goto finish;
+		}
+		if (0 != _music_db_add_album(mdb, entry->tag->album, artist_id, &album_id)) {
+			log_error("Failed to add album \"%s\" to music database!", entry->tag->album);
+			goto finish;
+		}
+		if (entry->fingerprinted) {
+			switch (_music_db_match_fingerprint(mdb, entry, artist_id, album_id, &added)) {
+			case 1:
+				batch_added |= added;
+				continue;
+			case 0:
+				break;
+			default:
+				log_error("Failed to match fingerprint of \"%s\"!", entry->path);
+				goto finish;
+			}
+		}
+		if (0 != _music_db_add_song(mdb, entry, artist_id, album_id, &added)) {
+			log_error("Failed to add song \"%s\" to music database!", entry->tag->title);
+			goto finish;
+		}
+		batch_added |= added;
+	}
+
+	if (0 != _music_db_batch_store_dirs(mdb, batch)) {
+		log_error("Failed to store scan progress!");
 		goto finish;
 	}
-	if (0 != _music_db_add_song(mdb, path, tag, artist_id, album_id)) {
-		log_error("Failed to add song \"%s\" to music database!", tag->title);
+
+	if (sqlite3_exec(mdb->db, "COMMIT;", NULL, NULL, &errmsg)) {
+		log_error("Failed to commit transaction: %s", errmsg);
 		goto finish;
 	}
 
 	ret = 0;
+	evlog("scan stored");
 
 finish:
-	music_tag_destroy(tag);
+	if (ret != 0 && transaction) {
+		sqlite3_exec(mdb->db, "ROLLBACK;", NULL, NULL, NULL);
+	}
+	sqlite3_mutex_leave(mdb->db_mutex);
+	span_end(span, "scan store");
+	sqlite3_free(errmsg);
+	_music_db_batch_clear(batch);
+
+	if (ret == 0 && batch_added) {
+		pthread_mutex_lock(&mdb->scan_mutex);
+		mdb->generation = mdb->scan_generation;
+		pthread_mutex_unlock(&mdb->scan_mutex);
+	}
+
 	return ret;
 }
 
+/*
+ * Queue file for insertion, takes ownership of path.
+ */
 static int
-music_db_scan_directory(_music_db_t *mdb, const char *dir)
+_music_db_batch_add(_music_db_t *mdb, _music_db_scan_batch_t *batch, char *path)
 {
-	struct dirent *entry = NULL, *dirent_buf = NULL;
-	DIR *dirp = NULL;;
-	struct stat st;
-	char *full_path = NULL;
-	int ret = 0, len = 0, name_max = 0;
-
-	if (lstat(dir, &st) != 0) {
-		log_warning("Failed to stat %s: %s", dir, strerror(errno));
+	memset(&batch->entries[batch->count], 0, sizeof(_music_db_scan_entry_t));
+	batch->entries[batch->count].path = path;
+	if (++batch->count < MUSIC_DB_SCAN_BATCH) {
 		return 0;
 	}
 
-	if (!S_ISDIR(st.st_mode)) {
-		log_warning("Failed to scan %s: Not a directory", dir);
+	return _music_db_batch_flush(mdb, batch);
+}
+
+/*
+ * Queue completed directory, takes ownership of path.
+ */
+static int
+_music_db_batch_add_dir(_music_db_t *mdb, _music_db_scan_batch_t *batch, char *path,
+                        sqlite3_int64 mtime)
+{
+	_music_db_scan_dir_t *dirs = NULL;
+	int cap;
+
+	if (batch->dir_count == batch->dir_cap) {
+		cap = batch->dir_cap ? batch->dir_cap * 2 : 64;
+		if ((dirs = realloc(batch->dirs, cap * sizeof(_music_db_scan_dir_t))) == NULL) {
+			log_error("Failed to allocate scanned directory list!");
+			free(path);
+			return ENOMEM;
+		}
+		batch->dirs = dirs;
+		batch->dir_cap = cap;
+	}
+
+	batch->dirs[batch->dir_count].path = path;
+	batch->dirs[batch->dir_count].mtime = mtime;
+	if (++batch->dir_count < MUSIC_DB_SCAN_BATCH) {
 		return 0;
 	}
 
-	name_max = pathconf(dir, _PC_NAME_MAX);
-	if (name_max == -1) {
-		name_max = _POSIX_NAME_MAX;
+	return _music_db_batch_flush(mdb, batch);
+}
+
+/*
+ * Compare directory with the one recorded by previous scans.
+ * @return MUSIC_DB_DIR_* value, -1 on error.
+ */
+#define MUSIC_DB_DIR_CHANGED   0 /* Scan it */
+#define MUSIC_DB_DIR_UNCHANGED 1 /* Files are known, only subdirectories may differ */
+#define MUSIC_DB_DIR_DONE      2 /* Whole subtree already scanned by current scan */
+
+static int
+_music_db_dir_state(_music_db_t *mdb, const char *path, sqlite3_int64 mtime)
+{
+	sqlite3_stmt *stmt = NULL;
+	int ret = -1;
+
+	_music_db_lock(mdb);
+
+	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, MUSIC_DB_SQL(SCAN_DIR), -1, &stmt, NULL)) {
+		log_error("Failed to prepare sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
 	}
+	if (SQLITE_OK != sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC)) {
+		log_error("Failed to bind statement text: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	switch (sqlite3_step(stmt)) {
+	case SQLITE_ROW:
+		if (sqlite3_column_int64(stmt, 0) != mtime) {
+			ret = MUSIC_DB_DIR_CHANGED;
+		} else if (sqlite3_column_int64(stmt, 1) == mdb->scan_id) {
+			ret = MUSIC_DB_DIR_DONE;
+		} else {
+			ret = MUSIC_DB_DIR_UNCHANGED;
+		}
+		break;
+	case SQLITE_DONE:
+		ret = MUSIC_DB_DIR_CHANGED;
+		break;
+	default:
+		log_error("Failed to step sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		break;
+	}
+
+finish:
+	sqlite3_finalize(stmt);
+	sqlite3_mutex_leave(mdb->db_mutex);
+
+	return ret;
+}
+
+typedef struct {
+	_music_db_t            *mdb;
+	_music_db_scan_batch_t *batch;
+
+	/* State of directories being walked, indexed by depth of their entries */
+	sqlite3_int64           mtime[DIR_WALK_MAX_DEPTH + 2];
+	int                     skip_files[DIR_WALK_MAX_DEPTH + 2];
+} _music_db_scan_ctx_t;
+
+static int
+_music_db_scan_dir(_music_db_scan_ctx_t *ctx, const dir_walk_entry_t *entry)
+{
+	struct stat st;
+	sqlite3_int64 mtime = -1;
+	int state = MUSIC_DB_DIR_CHANGED;
 
-	dirent_buf = malloc(offsetof(struct dirent, d_name) + name_max + 1);
-	if (dirent_buf == NULL) {
-		log_error("Failed to allocate dirent buffer!");
-		return 1;
+	if (fstatat(entry->dir_fd, entry->name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+		mtime = (sqlite3_int64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+		if ((state = _music_db_dir_state(ctx->mdb, entry->path, mtime)) < 0) {
+			return EIO;
+		}
 	}
 
-	if ((dirp = opendir(dir)) == NULL) {
-		log_warning("Failed to open %s: %s", dir, strerror(errno));
-		return 1;
+	if (state == MUSIC_DB_DIR_DONE) {
+		log_trace("Skipping scanned directory: %s", entry->path);
+		evlog("scan skip dir %s", entry->path);
+		return DIR_WALK_PRUNE;
 	}
 
-	log_trace("Scanning directory: %s", dir);
+	log_trace("Scanning directory: %s", entry->path);
+	evlog("scan dir %s state %d", entry->path, state);
+	ctx->mtime[entry->depth + 1] = mtime;
+	ctx->skip_files[entry->depth + 1] = state == MUSIC_DB_DIR_UNCHANGED;
 
-	while (0 == readdir_r(dirp, dirent_buf, &entry) && entry != NULL) {
-		if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0)) {
-			continue;
-		}
+	return 0;
+}
+
+static int
+_music_db_scan_entry(const dir_walk_entry_t *entry, void *data)
+{
+	_music_db_scan_ctx_t *ctx = data;
+	_music_db_t *mdb = ctx->mdb;
+	char *path = NULL;
+	int ret = 0;
 
-		len = strlen(dir) + strlen(entry->d_name) + 2;
-		full_path = (char *) malloc(len);
-		if (full_path == NULL) {
+	switch (entry->type) {
+	case DIR_WALK_DIR:
+		if ((ret = _music_db_scan_dir(ctx, entry))) {
+			return ret;
+		}
+		break;
+	case DIR_WALK_DIR_DONE:
+		if (ctx->mtime[entry->depth + 1] < 0) {
+			return 0;
+		}
+		if ((path = strdup(entry->path)) == NULL) {
 			log_error("Failed to allocate buffer for path!");
-			ret = ENOMEM;
-			break;
+			return ENOMEM;
 		}
-		memset(full_path, 0, len);
-		strncat(full_path, dir, strlen(dir));
-		strncat(full_path, "/", 1);
-		strncat(full_path, entry->d_name, strlen(entry->d_name));
-
-		if (entry->d_type == DT_DIR) {
-			if ((ret = music_db_scan_directory(mdb, full_path))) {
-				break;
-			}
-		} else if (entry->d_type == DT_REG) {
-			if ((ret = music_db_add_file(mdb, full_path))) {
-				break;
-			}
+		/*
+		 * Something below was not read, record an mtime no directory has
+		 * so that it is neither skipped as unchanged nor pruned as done,
+		 * and is walked again by the next scan.
+		 */
+		if (entry->error) {
+			log_debug("Not all of directory was scanned: %s", entry->path);
+			return _music_db_batch_add_dir(mdb, ctx->batch, path, -1);
 		}
-		free(full_path);
-		full_path = NULL;
-
-		if ((ret = pthread_mutex_lock(&mdb->scan_mutex))) {
-			log_error("Failed to lock scan mutex: %d!", ret);
+		return _music_db_batch_add_dir(mdb, ctx->batch, path, ctx->mtime[entry->depth + 1]);
+	case DIR_WALK_FILE:
+		if (ctx->skip_files[entry->depth] ||
+		    file_class_by_name(entry->name) == FILE_CLASS_IGNORE) {
 			break;
 		}
-		if (mdb->scan_terminate) {
-			pthread_mutex_unlock(&mdb->scan_mutex);
-			ret = EINTR;
-			break;
+		if ((path = malloc(entry->len + 1)) == NULL) {
+			log_error("Failed to allocate buffer for path!");
+			return ENOMEM;
 		}
-		if ((ret = pthread_mutex_unlock(&mdb->scan_mutex))) {
-			log_error("Failed to unlock scan mutex: %d!", ret);
-			exit(ret);
+		memcpy(path, entry->path, entry->len + 1);
+		if ((ret = _music_db_batch_add(mdb, ctx->batch, path))) {
+			return ret;
 		}
+		break;
 	}
 
-	if (full_path != NULL) {
-		free(full_path);
-		full_path = NULL;
+	if ((ret = pthread_mutex_lock(&mdb->scan_mutex))) {
+		log_error("Failed to lock scan mutex: %d!", ret);
+		return ret;
+	}
+	if (entry->type == DIR_WALK_FILE) {
+		mdb->scan_files++;
+		metrics_inc(mdb->scan_files_metric);
 	}
+	if (mdb->scan_terminate) {
+		pthread_mutex_unlock(&mdb->scan_mutex);
+		return EINTR;
+	}
+	if ((ret = pthread_mutex_unlock(&mdb->scan_mutex))) {
+		log_error("Failed to unlock scan mutex: %d!", ret);
+		exit(ret);
+	}
+
+	return 0;
+}
+
+static int
+music_db_scan_directory(_music_db_t *mdb, _music_db_scan_batch_t *batch, const char *dir)
+{
+	_music_db_scan_ctx_t ctx;
+	span_t span = span_begin();
+	int ret;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.mdb = mdb;
+	ctx.batch = batch;
+
+	ret = dir_walk(dir, _music_db_scan_entry, &ctx);
+	span_end(span, "music_db_scan_directory");
+
+	return ret;
+}
 
-	if (dirent_buf != NULL) {
-		free(dirent_buf);
-		dirent_buf = NULL;
+/*
+ * Resume last interrupted scan of given directory or start a new one.
+ */
+static int
+_music_db_scan_begin(_music_db_t *mdb, const char *dir)
+{
+	sqlite3_stmt *stmt = NULL;
+	int ret = -1;
+
+	_music_db_lock(mdb);
+
+	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, MUSIC_DB_SQL(SCAN_RESUME), -1, &stmt, NULL)) {
+		log_error("Failed to prepare sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	if (SQLITE_OK != sqlite3_bind_text(stmt, 1, dir, -1, SQLITE_STATIC)) {
+		log_error("Failed to bind statement text: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	switch (sqlite3_step(stmt)) {
+	case SQLITE_ROW:
+		mdb->scan_id = sqlite3_column_int64(stmt, 0);
+		log_info("Resuming interrupted scan");
+		ret = 0;
+		goto finish;
+	case SQLITE_DONE:
+		break;
+	default:
+		log_error("Failed to step sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	sqlite3_finalize(stmt);
+
+	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, MUSIC_DB_SQL(SCAN_START), -1, &stmt, NULL)) {
+		log_error("Failed to prepare sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	if (SQLITE_OK != sqlite3_bind_text(stmt, 1, dir, -1, SQLITE_STATIC)) {
+		log_error("Failed to bind statement text: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	if (SQLITE_DONE != sqlite3_step(stmt)) {
+		log_error("Failed to step sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	mdb->scan_id = sqlite3_last_insert_rowid(mdb->db);
+
+	ret = 0;
+
+finish:
+	sqlite3_finalize(stmt);
+	sqlite3_mutex_leave(mdb->db_mutex);
+
+	return ret;
+}
+
+static int
+_music_db_exec_int64(_music_db_t *mdb, const char *stmt_txt, sqlite3_int64 value)
+{
+	sqlite3_stmt *stmt = NULL;
+	int ret = -1;
+
+	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, stmt_txt, -1, &stmt, NULL)) {
+		log_error("Failed to prepare sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	if (SQLITE_OK != sqlite3_bind_int64(stmt, 1, value)) {
+		log_error("Failed to bind statement value: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	if (SQLITE_DONE != sqlite3_step(stmt)) {
+		log_error("Failed to step sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+
+	ret = 0;
+
+finish:
+	sqlite3_finalize(stmt);
+	return ret;
+}
+
+/*
+ * Mark current scan as completed and forget directories it did not see.
+ */
+static int
+_music_db_scan_end(_music_db_t *mdb)
+{
+	int ret = -1;
+
+	_music_db_lock(mdb);
+
+	if (sqlite3_exec(mdb->db, "BEGIN;", NULL, NULL, NULL)) {
+		log_error("Failed to begin transaction: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	if (0 != _music_db_exec_int64(mdb, MUSIC_DB_SQL(SCAN_COMPLETE), mdb->scan_id) ||
+	    0 != _music_db_exec_int64(mdb, MUSIC_DB_SQL(SCAN_FORGET), mdb->scan_id) ||
+	    0 != _music_db_exec_int64(mdb, MUSIC_DB_SQL(SCAN_DIRS_FORGET), mdb->scan_id) ||
+	    sqlite3_exec(mdb->db, "COMMIT;", NULL, NULL, NULL)) {
+		sqlite3_exec(mdb->db, "ROLLBACK;", NULL, NULL, NULL);
+		goto finish;
 	}
 
-	closedir(dirp);
+	ret = 0;
 
+finish:
+	sqlite3_mutex_leave(mdb->db_mutex);
 	return ret;
 }
 
@@ -412,18 +1213,48 @@ static void *
 music_db_scan_thread(void *data)
 {
 	_music_db_t *mdb = data;
+	_music_db_scan_batch_t batch;
+	uint64_t start = metrics_now_us();
 	int ret = 0;
 
+	memset(&batch, 0, sizeof(batch));
+
 	const char *dir = cfg_get_str(mdb->cfg, CFG_MUSIC_DIR);
 	log_info("Scanning music directory: %s", dir);
-	ret = music_db_scan_directory(mdb, dir);
+	evlog("scan start %s", dir);
+	metrics_set(mdb->scan_metric, 1);
+
+	batch.io_buf = malloc(MUSIC_DB_SCAN_BATCH * (IO_HEAD_SIZE + IO_TAIL_SIZE));
+	if (batch.io_buf == NULL || (batch.io = io_batch_new(mdb->io_depth, NULL)) == NULL) {
+		log_error("Failed to set up file access for scan!");
+		ret = ENOMEM;
+	} else if (0 != _music_db_scan_begin(mdb, dir)) {
+		ret = EIO;
+	} else {
+		log_debug("Scanning with %s file access", io_batch_backend(batch.io));
+		ret = music_db_scan_directory(mdb, &batch, dir);
+	}
+	if (ret == 0) {
+		ret = _music_db_batch_flush(mdb, &batch);
+	}
+	if (ret == 0) {
+		ret = _music_db_scan_end(mdb);
+	}
+	_music_db_batch_clear(&batch);
+	io_batch_free(batch.io);
+	free(batch.io_buf);
+	free(batch.dirs);
 	if (ret && ret != EINTR) {
 		log_warning("Failed to scan music directory: %s", dir);
 	}
+	evlog("scan end %s error %d", dir, ret);
 
 	pthread_mutex_lock(&mdb->scan_mutex);
 	mdb->scan_in_progress = 0;
+	metrics_set(mdb->scan_rate_metric,
+	            mdb->scan_files * 1000000LL / (metrics_now_us() - start + 1));
 	pthread_mutex_unlock(&mdb->scan_mutex);
+	metrics_set(mdb->scan_metric, 0);
 
 	if (ret == EINTR) {
 		log_warning("Music collection scan interrupted.");
@@ -449,20 +1280,76 @@ music_db_scan_thread(void *data)
 	pthread_exit(0);
 }
 
-#ifdef SQLITE3_PROFILE
-static void
-_sqlite3_profile(void *d, const char *txt, sqlite3_uint64 time)
-{
-	(void)d;
-	log_trace("[SQLITE3 profile] time: %u ms, statement: %s", time / 1000000, txt);
+static int
+_music_db_get_int64(_music_db_t *mdb, const char *stmt_txt, sqlite3_int64 *out)
+{
+	sqlite3_stmt *stmt = NULL;
+	int ret = -1;
+
+	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, stmt_txt, -1, &stmt, NULL)) {
+		log_error("Failed to prepare sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	if (SQLITE_ROW != sqlite3_step(stmt)) {
+		log_error("Failed to step sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	*out = sqlite3_column_int64(stmt, 0);
+	ret = 0;
+
+finish:
+	sqlite3_finalize(stmt);
+	return ret;
+}
+
+static int
+_music_db_init_schema(_music_db_t *mdb)
+{
+	sqlite3_int64 version = 0;
+	char *errmsg = NULL;
+	char *stmt_txt = NULL;
+	int ret = -1;
+
+	if (0 != _music_db_get_int64(mdb, "PRAGMA user_version;", &version)) {
+		return -1;
+	}
+
+	if (version != MUSIC_DB_SCHEMA_VERSION) {
+		log_info("Music database schema version %d, expected %d. Recreating database.",
+		         (int)version, MUSIC_DB_SCHEMA_VERSION);
+		if (sqlite3_exec(mdb->db, drop_basileus_db_str, NULL, NULL, &errmsg)) {
+			log_error("Failed to drop database: %s!", errmsg);
+			goto finish;
+		}
+	}
+
+	if (sqlite3_exec(mdb->db, create_basileus_db_str, NULL, NULL, &errmsg)) {
+		log_error("Failed to create database: %s!", errmsg);
+		goto finish;
+	}
+
+	stmt_txt = sqlite3_mprintf("PRAGMA user_version = %d;", MUSIC_DB_SCHEMA_VERSION);
+	if (stmt_txt == NULL || sqlite3_exec(mdb->db, stmt_txt, NULL, NULL, &errmsg)) {
+		log_error("Failed to set database schema version!");
+		goto finish;
+	}
+
+	if (0 != _music_db_get_int64(mdb, MUSIC_DB_SQL(GENERATION), &mdb->generation)) {
+		goto finish;
+	}
+
+	ret = 0;
+
+finish:
+	sqlite3_free(stmt_txt);
+	sqlite3_free(errmsg);
+	return ret;
 }
-#endif
 
 music_db_t
 music_db_new(cfg_t *cfg, scheduler_t *sched)
 {
 	_music_db_t *mdb;
-	char *errmsg;
 
 	if (!sqlite3_threadsafe()) {
 		log_error("Sqlite3 is not thread safe, terminating!");
@@ -514,22 +1401,39 @@ music_db_new(cfg_t *cfg, scheduler_t *sched)
 devdb:
 #endif
 
-#ifdef SQLITE3_PROFILE
-	sqlite3_profile(mdb->db, _sqlite3_profile, NULL);
-#endif
+	if (0 != _music_db_init_schema(mdb)) {
+		music_db_free(mdb);
+		return NULL;
+	}
 
-	if (sqlite3_exec(mdb->db, create_basileus_db_str, NULL, NULL, &errmsg)) {
-		log_error("Failed to create database: %s!", errmsg);
-		sqlite3_free(errmsg);
+	/* Schema setup is left out, it would only take up statement slots */
+	music_db_profile_set_slow(atoi(cfg_get_str(cfg, CFG_SLOW_STATEMENT_TIME)));
+	if (0 != music_db_set_profiling(mdb, atoi(cfg_get_str(cfg, CFG_PROFILE_STATEMENTS)))) {
 		music_db_free(mdb);
 		return NULL;
 	}
 
 	mdb->cfg = cfg;
 	mdb->scheduler = sched;
+	mdb->fingerprint = atoi(cfg_get_str(cfg, CFG_CONTENT_FINGERPRINT));
+	mdb->io_depth = atoi(cfg_get_str(cfg, CFG_IO_DEPTH));
+	music_tag_set_fast_scan(atoi(cfg_get_str(cfg, CFG_FAST_TAG_SCAN)));
+	if (0 != file_class_set_ignored(cfg_get_str(cfg, CFG_IGNORE_EXTENSIONS))) {
+		music_db_free(mdb);
+		return NULL;
+	}
 	mdb->scan_in_progress = 0;
 	mdb->scan_terminate = 0;
 
+	mdb->scan_metric = metrics_register(METRIC_GAUGE, "basileus_scan_in_progress",
+		NULL, "Whether music directory scan is running.");
+	mdb->scan_files_metric = metrics_register(METRIC_COUNTER, "basileus_scan_files_total",
+		NULL, "Files visited by music directory scans.");
+	mdb->scan_rate_metric = metrics_register(METRIC_GAUGE, "basileus_scan_files_per_second",
+		NULL, "Files visited per second by the last music directory scan.");
+	mdb->scan_bytes_metric = metrics_register(METRIC_COUNTER, "basileus_scan_read_bytes_total",
+		NULL, "Bytes of file heads and tails read by music directory scans.");
+
 	return mdb;
 }
 
@@ -586,6 +1490,9 @@ music_db_refresh(music_db_t mdb)
 
 	_mdb->scan_in_progress = 1;
 	_mdb->scan_terminate = 0;
+	_mdb->scan_files = 0;
+	_mdb->scan_bytes = 0;
+	_mdb->scan_generation = _mdb->generation + 1;
 
 cleanup:
 	if ((ret = pthread_mutex_unlock(&_mdb->scan_mutex))) {
@@ -596,79 +1503,72 @@ cleanup:
 	return ret;
 }
 
-int
-_get_artists_cb(void *d, int argc, char **argv, char **column_name)
+/*
+ * Wraps a page of catalog items along with the cursor of the next page.
+ * Unlimited listings are returned as plain arrays, like they always were.
+ */
+static struct json_object *
+_music_db_page_new(struct json_object *items, int limit, const char *next)
 {
-	struct json_object *arr = d;
-	struct json_object *artist;
-
-	assert(argc == 1 && argv[0] != NULL);
+	struct json_object *page, *cursor = NULL;
 
-	artist = json_object_new_string(argv[0]);
-	if (artist == NULL) {
-		log_error("Failed to allocate artist JSON string!");
-		return ENOMEM;
+	if (limit < 0) {
+		return items;
 	}
 
-	if (json_object_array_add(arr, artist)) {
-		log_error("Failed to add artist to JSON array!");
-		json_object_put(artist);
-		return ENOMEM;
+	if (NULL == (page = json_object_new_object())) {
+		goto failure;
 	}
-
-	return 0;
-}
-
-struct json_object *
-music_db_get_artists(const music_db_t mdb)
-{
-	_music_db_t *_mdb = mdb;
-	struct json_object *arr;
-	char *errmsg;
-
-	sqlite3_mutex_enter(_mdb->db_mutex);
-
-	arr = json_object_new_array();
-	if (arr == NULL) {
-		log_error("Failed to allocate JSON artists array!");
-		goto finish;
+	if (next && NULL == (cursor = json_object_new_string(next))) {
+		goto failure;
 	}
 
-	if (sqlite3_exec(_mdb->db, "SELECT name from artists;", _get_artists_cb, arr, &errmsg)) {
-		log_error("Failed to get artist names from database: %s", errmsg);
-		sqlite3_free(errmsg);
-		json_object_put(arr);
-		arr = NULL;
-		goto finish;
-	}
+	json_object_object_add(page, "items", items);
+	json_object_object_add(page, "next", cursor);
 
-finish:
-	sqlite3_mutex_leave(_mdb->db_mutex);
-	return arr;
+	return page;
+
+failure:
+	log_error("Failed to allocate JSON page object!");
+	json_object_put(page);
+	json_object_put(items);
+	return NULL;
 }
 
-struct json_object *
-music_db_get_albums(const music_db_t mdb, const char *artist)
+/*
+ * Lists names ordered by name starting after the cursor. Statements take
+ * the listing key as ?1, the cursor as ?2 and the row limit as ?3. One row
+ * more than requested is fetched to tell whether another page follows.
+ */
+static struct json_object *
+_music_db_get_names(_music_db_t *mdb, const char *stmt_txt, const char *key,
+                    const char *cursor, int limit)
 {
-	_music_db_t *_mdb = mdb;
 	struct json_object *arr = NULL;
-	struct json_object *album = NULL;
+	struct json_object *name = NULL;
+	sqlite3_stmt *stmt = NULL;
+	char *next = NULL;
+	int count = 0;
 
 	arr = json_object_new_array();
 	if (arr == NULL) {
-		log_error("Failed to allocate json artists array!");
+		log_error("Failed to allocate JSON names array!");
 		return NULL;
 	}
 
-	sqlite3_mutex_enter(_mdb->db_mutex);
+	_music_db_lock(mdb);
 
-	sqlite3_stmt *stmt = NULL;
-	const char stmt_txt[] = "SELECT name FROM albums WHERE artist_id="
-	                        "(SELECT id FROM artists WHERE name=?);";
-	if (SQLITE_OK != sqlite3_prepare_v2(_mdb->db, stmt_txt, -1, &stmt, NULL)) {
+	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, stmt_txt, -1, &stmt, NULL)) {
+		log_error("Failed to prepare sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
 		goto failure;
 	}
-	if (SQLITE_OK != sqlite3_bind_text(stmt, 1, artist, -1, 0)) {
+	if (key && SQLITE_OK != sqlite3_bind_text(stmt, 1, key, -1, 0)) {
+		goto failure;
+	}
+	if (cursor && SQLITE_OK != sqlite3_bind_text(stmt, 2, cursor, -1, 0)) {
+		goto failure;
+	}
+	if (SQLITE_OK != sqlite3_bind_int(stmt, 3, limit < 0 ? -1 : limit + 1)) {
 		goto failure;
 	}
 	while (1) {
@@ -680,50 +1580,90 @@ music_db_get_albums(const music_db_t mdb, const char *artist)
 		{
 			assert(sqlite3_column_type(stmt, 0) == SQLITE_TEXT);
 			const char *txt = (const char *)sqlite3_column_text(stmt, 0);
-			album = json_object_new_string(txt);
-			if (album == NULL) {
-				log_error("Failed to create albums JSON string!");
+			if (count++ == limit) {
+				/* Last returned name is where the next page starts */
+				name = json_object_array_get_idx(arr, limit - 1);
+				if (limit > 0 && NULL == (next = strdup(json_object_get_string(name)))) {
+					goto failure;
+				}
+				name = NULL;
+				goto done;
+			}
+			name = json_object_new_string(txt);
+			if (name == NULL) {
+				log_error("Failed to create name JSON string!");
 				goto failure;
 			}
-			if (json_object_array_add(arr, album)) {
-				log_error("Failed to add album to JSON array!");
-				json_object_put(album);
+			if (json_object_array_add(arr, name)) {
+				log_error("Failed to add name to JSON array!");
+				json_object_put(name);
 				goto failure;
 			}
 			break;
 		}
 		default:
-			log_error("Sqlite3 step failed: %s", sqlite3_errmsg(_mdb->db));
+			log_error("Sqlite3 step failed: %s", sqlite3_errmsg(mdb->db));
 			goto failure;
 		}
 	}
 done:
 	if (SQLITE_OK != sqlite3_finalize(stmt)) {
-		log_error("Failed to finalize sqlite3 statement: %s", sqlite3_errmsg(_mdb->db));
+		log_error("Failed to finalize sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
 		stmt = NULL;
 		goto failure;
 	}
 
-	sqlite3_mutex_leave(_mdb->db_mutex);
+	sqlite3_mutex_leave(mdb->db_mutex);
+
+	arr = _music_db_page_new(arr, limit, next);
+	free(next);
 	return arr;
 
 failure:
 	if (arr) {
 		json_object_put(arr);
 	}
+	free(next);
 	sqlite3_finalize(stmt);
-	sqlite3_mutex_leave(_mdb->db_mutex);
+	sqlite3_mutex_leave(mdb->db_mutex);
 
 	return NULL;
 }
 
+struct json_object *
+music_db_get_artists(const music_db_t mdb, const char *cursor, int limit)
+{
+	return _music_db_get_names(mdb, cursor ? MUSIC_DB_SQL(ARTISTS_AFTER) : MUSIC_DB_SQL(ARTISTS),
+	                           NULL, cursor, limit);
+}
+
+struct json_object *
+music_db_get_albums(const music_db_t mdb, const char *artist, const char *cursor, int limit)
+{
+	return _music_db_get_names(mdb, cursor ? MUSIC_DB_SQL(ALBUMS_AFTER) : MUSIC_DB_SQL(ALBUMS),
+	                           artist, cursor, limit);
+}
 
+/*
+ * Songs are ordered by track number, which isn't unique, so the song id
+ * breaks ties. Cursor has the "<track>:<id>" form.
+ */
 struct json_object *
-music_db_get_songs(const music_db_t mdb, const char *artist, const char *album)
+music_db_get_songs(const music_db_t mdb, const char *artist, const char *album,
+                   const char *cursor, int limit)
 {
 	_music_db_t *_mdb = mdb;
 	struct json_object *arr = NULL;
 	struct json_object *song = NULL;
+	sqlite3_int64 cursor_id = 0, last_id = 0;
+	int cursor_track = 0, last_track = 0;
+	char next[32] = { 0 };
+	int count = 0;
+
+	if (cursor && 2 != sscanf(cursor, "%d:%lld", &cursor_track, &cursor_id)) {
+		log_warning("Invalid songs cursor: %s", cursor);
+		return NULL;
+	}
 
 	arr = json_object_new_array();
 	if (arr == NULL) {
@@ -731,15 +1671,12 @@ music_db_get_songs(const music_db_t mdb, const char *artist, const char *album)
 		return NULL;
 	}
 
-	sqlite3_mutex_enter(_mdb->db_mutex);
+	_music_db_lock(_mdb);
 
 	sqlite3_stmt *stmt = NULL;
-	const char stmt_txt[] =
-		"SELECT title, length, hash FROM songs s "
-		"LEFT JOIN artists ar ON s.artist_id=ar.id "
-		"LEFT JOIN albums al ON s.album_id=al.id "
-		"WHERE al.name=? AND ar.name=? ORDER BY track";
-	if (SQLITE_OK != sqlite3_prepare_v2(_mdb->db, stmt_txt, -1, &stmt, NULL)) {
+	if (SQLITE_OK != sqlite3_prepare_v2(_mdb->db,
+	                                    cursor ? MUSIC_DB_SQL(SONGS_AFTER) : MUSIC_DB_SQL(SONGS),
+	                                    -1, &stmt, NULL)) {
 		goto failure;
 	}
 	if (SQLITE_OK != sqlite3_bind_text(stmt, 1, album, -1, 0)) {
@@ -748,6 +1685,13 @@ music_db_get_songs(const music_db_t mdb, const char *artist, const char *album)
 	if (SQLITE_OK != sqlite3_bind_text(stmt, 2, artist, -1, 0)) {
 		goto failure;
 	}
+	if (cursor && (SQLITE_OK != sqlite3_bind_int(stmt, 3, cursor_track) ||
+	               SQLITE_OK != sqlite3_bind_int64(stmt, 4, cursor_id))) {
+		goto failure;
+	}
+	if (SQLITE_OK != sqlite3_bind_int(stmt, 5, limit < 0 ? -1 : limit + 1)) {
+		goto failure;
+	}
 	while (1) {
 		switch (sqlite3_step(stmt)) {
 		case SQLITE_DONE:
@@ -755,10 +1699,19 @@ music_db_get_songs(const music_db_t mdb, const char *artist, const char *album)
 			goto done;
 		case SQLITE_ROW:
 		{
-			assert(sqlite3_column_count(stmt) == 3);
+			assert(sqlite3_column_count(stmt) == 4);
 			assert(sqlite3_column_type(stmt, 0) == SQLITE_TEXT);
 			assert(sqlite3_column_type(stmt, 1) == SQLITE_INTEGER);
-			assert(sqlite3_column_type(stmt, 2) == SQLITE_TEXT);
+			assert(sqlite3_column_type(stmt, 2) == SQLITE_INTEGER);
+
+			if (count++ == limit) {
+				if (limit > 0) {
+					snprintf(next, sizeof(next), "%d:%lld", last_track, last_id);
+				}
+				goto done;
+			}
+			last_id = sqlite3_column_int64(stmt, 2);
+			last_track = sqlite3_column_int(stmt, 3);
 
 			song = json_object_new_object();
 			if (song == NULL) {
@@ -778,11 +1731,11 @@ music_db_get_songs(const music_db_t mdb, const char *artist, const char *album)
 			}
 			json_object_object_add(song, "length", length);
 
-			struct json_object *hash = json_object_new_string((const char *)sqlite3_column_text(stmt, 2));
-			if (NULL == hash) {
+			struct json_object *id = json_object_new_int64(last_id);
+			if (NULL == id) {
 				goto failure;
 			}
-			json_object_object_add(song, "hash", hash);
+			json_object_object_add(song, "id", id);
 
 			if (json_object_array_add(arr, song)) {
 				log_error("Failed to add SONG to JSON array!");
@@ -805,7 +1758,7 @@ done:
 
 	sqlite3_mutex_leave(_mdb->db_mutex);
 
-	return arr;
+	return _music_db_page_new(arr, limit, next[0] ? next : NULL);
 
 failure:
 	if (arr) {
@@ -821,22 +1774,209 @@ failure:
 }
 
 
-char *
-music_db_get_song_path(const music_db_t mdb, const char *hash)
+/* Maximum number of search terms taken from a query */
+#define MUSIC_DB_SEARCH_MAX_TERMS 8
+
+/*
+ * Turns free form user input into a FTS5 query. Every whitespace separated
+ * word becomes a quoted prefix term, so that FTS5 operators and syntax
+ * characters typed by the user are matched literally. Returns NULL if
+ * there is nothing to search for.
+ */
+static char *
+_music_db_search_query(const char *text)
+{
+	char *query, *q;
+	int terms = 0;
+
+	/* Worst case every character is a doubled quote */
+	if (NULL == (query = malloc(strlen(text) * 2 + MUSIC_DB_SEARCH_MAX_TERMS * 4 + 1))) {
+		log_error("Failed to allocate search query!");
+		return NULL;
+	}
+	q = query;
+
+	while (*text && terms < MUSIC_DB_SEARCH_MAX_TERMS) {
+		while (*text == ' ' || *text == '\t') {
+			text++;
+		}
+		if (*text == '\0') {
+			break;
+		}
+		if (terms++) {
+			*q++ = ' ';
+		}
+		*q++ = '"';
+		while (*text && *text != ' ' && *text != '\t') {
+			if (*text == '"') {
+				*q++ = '"';
+			}
+			*q++ = *text++;
+		}
+		*q++ = '"';
+		*q++ = '*';
+	}
+	*q = '\0';
+
+	if (terms == 0) {
+		free(query);
+		return NULL;
+	}
+
+	return query;
+}
+
+struct json_object *
+music_db_search(const music_db_t mdb, const char *text, int limit)
 {
 	_music_db_t *_mdb = mdb;
+	struct json_object *arr = NULL;
+	struct json_object *song = NULL;
 	sqlite3_stmt *stmt = NULL;
-	char *path = NULL;
+	char *query = NULL;
+	int i;
+
+	arr = json_object_new_array();
+	if (arr == NULL) {
+		log_error("Failed to create JSON search results array!");
+		return NULL;
+	}
 
-	sqlite3_mutex_enter(_mdb->db_mutex);
+	if (NULL == (query = _music_db_search_query(text))) {
+		return arr;
+	}
+
+	_music_db_lock(_mdb);
 
-	const char stmt_txt[] = "SELECT path FROM songs WHERE hash=?";
-	if (SQLITE_OK != sqlite3_prepare_v2(_mdb->db, stmt_txt, -1, &stmt, NULL)) {
+	/*
+	 * Matches in titles weigh more than in artist or album names. Results
+	 * are ranked before joining songs, so that only returned rows are
+	 * looked up.
+	 */
+	if (SQLITE_OK != sqlite3_prepare_v2(_mdb->db, MUSIC_DB_SQL(SEARCH), -1, &stmt, NULL)) {
+		log_error("Failed to prepare sqlite3 statement: %s", sqlite3_errmsg(_mdb->db));
+		goto failure;
+	}
+	if (SQLITE_OK != sqlite3_bind_text(stmt, 1, query, -1, 0)) {
 		goto failure;
 	}
-	if (SQLITE_OK != sqlite3_bind_text(stmt, 1, hash, -1, 0)) {
+	if (SQLITE_OK != sqlite3_bind_int(stmt, 2, limit)) {
+		goto failure;
+	}
+	while (1) {
+		switch (sqlite3_step(stmt)) {
+		case SQLITE_DONE:
+		case SQLITE_OK:
+			goto done;
+		case SQLITE_ROW:
+		{
+			static const char *keys[] = { "title", "length", "id", "artist", "album" };
+			assert(sqlite3_column_count(stmt) == 5);
+
+			song = json_object_new_object();
+			if (song == NULL) {
+				log_error("Failed to create JSON song object!");
+				goto failure;
+			}
+
+			for (i = 0; i < 5; i++) {
+				struct json_object *val;
+				if (sqlite3_column_type(stmt, i) == SQLITE_INTEGER) {
+					val = json_object_new_int64(sqlite3_column_int64(stmt, i));
+				} else {
+					val = json_object_new_string((const char *)sqlite3_column_text(stmt, i));
+				}
+				if (NULL == val) {
+					goto failure;
+				}
+				json_object_object_add(song, keys[i], val);
+			}
+
+			if (json_object_array_add(arr, song)) {
+				log_error("Failed to add song to JSON array!");
+				goto failure;
+			}
+			song = NULL;
+			break;
+		}
+		default:
+			log_error("Sqlite3 step failed: %s", sqlite3_errmsg(_mdb->db));
+			goto failure;
+		}
+	}
+done:
+	if (SQLITE_OK != sqlite3_finalize(stmt)) {
+		log_error("Failed to finalize sqlite3 statement: %s", sqlite3_errmsg(_mdb->db));
+		stmt = NULL;
 		goto failure;
 	}
+
+	sqlite3_mutex_leave(_mdb->db_mutex);
+	free(query);
+
+	return arr;
+
+failure:
+	if (arr) {
+		json_object_put(arr);
+	}
+	if (song) {
+		json_object_put(song);
+	}
+	sqlite3_finalize(stmt);
+	sqlite3_mutex_leave(_mdb->db_mutex);
+	free(query);
+
+	return NULL;
+}
+
+/*
+ * Song keys are either integer ids or, for compatibility with clients
+ * which still hold old style song references, 32 digit hex path hashes.
+ */
+char *
+music_db_get_song_path(const music_db_t mdb, const char *song)
+{
+	_music_db_t *_mdb = mdb;
+	sqlite3_stmt *stmt = NULL;
+	unsigned char hash[MUSIC_DB_HASH_SIZE];
+	char *path = NULL, *end;
+	sqlite3_int64 id = 0;
+	int i, is_hash;
+
+	is_hash = strlen(song) == MUSIC_DB_HASH_SIZE * 2 &&
+	          strspn(song, "0123456789abcdefABCDEF") == MUSIC_DB_HASH_SIZE * 2;
+	if (is_hash) {
+		for (i = 0; i < MUSIC_DB_HASH_SIZE; i++) {
+			unsigned int byte;
+			sscanf(song + i * 2, "%2x", &byte);
+			hash[i] = byte;
+		}
+	} else {
+		errno = 0;
+		id = strtoll(song, &end, 10);
+		if (errno || end == song || *end != '\0') {
+			return NULL;
+		}
+	}
+
+	_music_db_lock(_mdb);
+
+	if (is_hash) {
+		if (SQLITE_OK != sqlite3_prepare_v2(_mdb->db, MUSIC_DB_SQL(SONG_PATH_BY_HASH), -1, &stmt, NULL)) {
+			goto failure;
+		}
+		if (SQLITE_OK != sqlite3_bind_blob(stmt, 1, hash, sizeof(hash), SQLITE_STATIC)) {
+			goto failure;
+		}
+	} else {
+		if (SQLITE_OK != sqlite3_prepare_v2(_mdb->db, MUSIC_DB_SQL(SONG_PATH), -1, &stmt, NULL)) {
+			goto failure;
+		}
+		if (SQLITE_OK != sqlite3_bind_int64(stmt, 1, id)) {
+			goto failure;
+		}
+	}
 	if (SQLITE_ROW != sqlite3_step(stmt)) {
 		goto failure;
 	}
@@ -857,3 +1997,136 @@ failure:
 
 	return path;
 }
+
+int
+music_db_set_profiling(music_db_t mdb, int enable)
+{
+	_music_db_t *_mdb = mdb;
+
+	if (0 != music_db_profile_enable(_mdb->db, enable)) {
+		return -1;
+	}
+	_mdb->profiling = enable != 0;
+	log_info("Statement profiling %s", enable ? "enabled" : "disabled");
+	return 0;
+}
+
+int
+music_db_get_profiling(const music_db_t mdb)
+{
+	return ((_music_db_t *)mdb)->profiling;
+}
+
+void
+music_db_get_status(const music_db_t mdb, music_db_status_t *status)
+{
+	_music_db_t *_mdb = mdb;
+
+	pthread_mutex_lock(&_mdb->scan_mutex);
+	status->scan_in_progress = _mdb->scan_in_progress ? 1 : 0;
+	status->scan_files = _mdb->scan_files;
+	status->scan_bytes = _mdb->scan_bytes;
+	status->generation = _mdb->generation;
+	pthread_mutex_unlock(&_mdb->scan_mutex);
+}
+
+static int
+_music_db_add_changes(_music_db_t *mdb, struct json_object *arr, const char *stmt_txt,
+                      sqlite3_int64 since)
+{
+	sqlite3_stmt *stmt = NULL;
+	struct json_object *item = NULL;
+	int ret = -1, i, cols;
+
+	if (SQLITE_OK != sqlite3_prepare_v2(mdb->db, stmt_txt, -1, &stmt, NULL)) {
+		log_error("Failed to prepare sqlite3 statement: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+	if (SQLITE_OK != sqlite3_bind_int64(stmt, 1, since)) {
+		log_error("Failed to bind statement integer: %s", sqlite3_errmsg(mdb->db));
+		goto finish;
+	}
+
+	cols = sqlite3_column_count(stmt);
+	while (1) {
+		switch (sqlite3_step(stmt)) {
+		case SQLITE_DONE:
+			ret = 0;
+			goto finish;
+		case SQLITE_ROW:
+			/* Single column rows are added as strings, others as arrays */
+			if (cols == 1) {
+				item = json_object_new_string((const char *)sqlite3_column_text(stmt, 0));
+			} else if (NULL != (item = json_object_new_array())) {
+				for (i = 0; i < cols; i++) {
+					struct json_object *col = json_object_new_string(
+						(const char *)sqlite3_column_text(stmt, i));
+					if (col == NULL || json_object_array_add(item, col)) {
+						json_object_put(col);
+						goto finish;
+					}
+				}
+			}
+			if (item == NULL || json_object_array_add(arr, item)) {
+				log_error("Failed to add change to JSON array!");
+				goto finish;
+			}
+			item = NULL;
+			break;
+		default:
+			log_error("Sqlite3 step failed: %s", sqlite3_errmsg(mdb->db));
+			goto finish;
+		}
+	}
+
+finish:
+	if (item) {
+		json_object_put(item);
+	}
+	sqlite3_finalize(stmt);
+	return ret;
+}
+
+struct json_object *
+music_db_get_changes(const music_db_t mdb, int64_t since)
+{
+	_music_db_t *_mdb = mdb;
+	struct json_object *obj = NULL, *artists = NULL, *albums = NULL, *gen = NULL;
+	music_db_status_t status;
+
+	music_db_get_status(mdb, &status);
+
+	if (NULL == (obj = json_object_new_object()) ||
+	    NULL == (artists = json_object_new_array()) ||
+	    NULL == (albums = json_object_new_array()) ||
+	    NULL == (gen = json_object_new_int64(status.generation))) {
+		log_error("Failed to allocate JSON changes object!");
+		goto failure;
+	}
+
+	_music_db_lock(_mdb);
+
+	if (0 != _music_db_add_changes(_mdb, artists, MUSIC_DB_SQL(CHANGED_ARTISTS), since)) {
+		sqlite3_mutex_leave(_mdb->db_mutex);
+		goto failure;
+	}
+	if (0 != _music_db_add_changes(_mdb, albums, MUSIC_DB_SQL(CHANGED_ALBUMS), since)) {
+		sqlite3_mutex_leave(_mdb->db_mutex);
+		goto failure;
+	}
+
+	sqlite3_mutex_leave(_mdb->db_mutex);
+
+	json_object_object_add(obj, "generation", gen);
+	json_object_object_add(obj, "artists", artists);
+	json_object_object_add(obj, "albums", albums);
+
+	return obj;
+
+failure:
+	json_object_put(gen);
+	json_object_put(albums);
+	json_object_put(artists);
+	json_object_put(obj);
+	return NULL;
+}
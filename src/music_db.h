@@ -30,6 +30,7 @@
 #ifndef _MUSIC_DB_H_
 #define _MUSIC_DB_H_
 
+#include <stdint.h>
 #include <json_object.h>
 
 #include "cfg.h"
@@ -37,6 +38,16 @@
 
 typedef void * music_db_t;
 
+typedef struct {
+	int      scan_in_progress;
+	/* Files processed by the current or last scan */
+	int      scan_files;
+	/* Bytes of files read for tags by the current or last scan */
+	int64_t  scan_bytes;
+	/* Increases each time a scan adds artists, albums or songs */
+	int64_t  generation;
+} music_db_status_t;
+
 music_db_t
 music_db_new(cfg_t *cfg, scheduler_t *sched);
 
@@ -46,16 +57,54 @@ music_db_free(music_db_t);
 int
 music_db_refresh(music_db_t);
 
+/*
+ * Catalog listings. Negative limit returns all items in a JSON array.
+ * Otherwise at most limit items following the cursor (NULL for the first
+ * page) are returned as {"items": [...], "next": cursor or null}.
+ */
+struct json_object *
+music_db_get_artists(const music_db_t, const char *cursor, int limit);
+
 struct json_object *
-music_db_get_artists(const music_db_t);
+music_db_get_albums(const music_db_t, const char *artist, const char *cursor, int limit);
 
 struct json_object *
-music_db_get_albums(const music_db_t, const char *artist);
+music_db_get_songs(const music_db_t, const char *artist, const char *album,
+                   const char *cursor, int limit);
 
+/*
+ * Full text search over song titles, artists and albums. Every word of
+ * the text is matched as a prefix. Returns at most limit best matching
+ * songs.
+ */
 struct json_object *
-music_db_get_songs(const music_db_t, const char *artist, const char *album);
+music_db_search(const music_db_t, const char *text, int limit);
 
+/*
+ * Song is referred to by its id, or by hex encoded path hash as used by
+ * older clients.
+ */
 char *
-music_db_get_song_path(const music_db_t, const char *hash);
+music_db_get_song_path(const music_db_t, const char *song);
+
+void
+music_db_get_status(const music_db_t, music_db_status_t *status);
+
+/*
+ * Statement profiling into per statement latency histograms, see
+ * music_db_profile.h. Returns 0 on success, -1 on failure.
+ */
+int
+music_db_set_profiling(music_db_t, int enable);
+
+int
+music_db_get_profiling(const music_db_t);
+
+/*
+ * Returns artists whose album listing and [artist, album] pairs whose song
+ * listing changed after given library generation.
+ */
+struct json_object *
+music_db_get_changes(const music_db_t, int64_t since);
 
 #endif /* _MUSIC_DB_H_ */
@@ -0,0 +1,354 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "logger.h"
+#include "metrics.h"
+#include "music_db_profile.h"
+#include "music_db_sql.h"
+
+/* Longest normalized statement text used as statement name */
+#define MAX_NAME 96
+
+/* Slots in statement text cache, must be a power of two */
+#define CACHE_SIZE 256
+
+/* Most statements timed at once, those above are not recorded */
+#define MAX_RUNNING 64
+
+typedef struct {
+	metric_t     *latency;
+	char          name[MAX_NAME];
+	uint64_t      last_slow;
+	int           suppressed;
+} _statement_t;
+
+/* Maps hash of statement text to its statement */
+typedef struct {
+	uint64_t      hash;
+	_statement_t *statement;
+} _cache_entry_t;
+
+/* Start time of a statement that is running */
+typedef struct {
+	void         *db;
+	void         *stmt;
+	uint64_t      start;
+} _running_t;
+
+static pthread_mutex_t  _profile_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Last one collects statements above MUSIC_DB_PROFILE_MAX_STATEMENTS */
+static _statement_t     _statements[MUSIC_DB_PROFILE_MAX_STATEMENTS + 1];
+static int              _statement_count = 0;
+static _cache_entry_t   _cache[CACHE_SIZE];
+static _running_t       _running[MAX_RUNNING];
+static unsigned int     _slow_ms = 0;
+static uint64_t         _total_ns = 0;
+
+static int
+_is_word(char c)
+{
+	return isalnum((unsigned char)c) || c == '_';
+}
+
+size_t
+music_db_profile_name(const char *sql, char *out, size_t size)
+{
+	const char *p = sql;
+	size_t n = 0;
+	int i, space = 0;
+
+	for (i = 0; i < MUSIC_DB_SQL_COUNT; i++) {
+		if (0 == strcmp(sql, music_db_sql[i].text)) {
+			snprintf(out, size, "%s", music_db_sql[i].name);
+			return strlen(out);
+		}
+	}
+
+	/* Leave room for "..." and terminating nul */
+	while (*p && n + 4 < size) {
+		if (isspace((unsigned char)*p)) {
+			space = n > 0;
+			p++;
+		} else if (space) {
+			out[n++] = ' ';
+			space = 0;
+		} else if (*p == '\'') {
+			/* String literal, quotes in it are doubled */
+			for (p++; *p; p++) {
+				if (*p == '\'' && *++p != '\'') {
+					break;
+				}
+			}
+			out[n++] = '?';
+		} else if (isdigit((unsigned char)*p) && (n == 0 || !_is_word(out[n - 1]))) {
+			while (_is_word(*p) || *p == '.') {
+				p++;
+			}
+			out[n++] = '?';
+		} else if (*p == '?' || *p == ':' || *p == '@' || *p == '$') {
+			for (p++; _is_word(*p); p++);
+			out[n++] = '?';
+		} else {
+			out[n++] = *p++;
+		}
+	}
+
+	while (n > 0 && (out[n - 1] == ' ' || out[n - 1] == ';')) {
+		n--;
+	}
+	if (*p) {
+		memcpy(out + n, "...", 3);
+		n += 3;
+	}
+	out[n] = '\0';
+
+	return n;
+}
+
+static uint64_t
+_hash(const char *s)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (*s) {
+		h = (h ^ (unsigned char)*s++) * 0x100000001b3ULL;
+	}
+	return h ? h : 1;
+}
+
+static void
+_statement_init(_statement_t *st, const char *name)
+{
+	char labels[METRICS_MAX_LABELS];
+	size_t n;
+
+	snprintf(st->name, sizeof(st->name), "%s", name);
+
+	/* Quotes and backslashes are escaped in label values */
+	n = snprintf(labels, sizeof(labels), "statement=\"");
+	for (; *name && n + 3 < sizeof(labels); name++) {
+		if (*name == '"' || *name == '\\') {
+			labels[n++] = '\\';
+		}
+		labels[n++] = *name;
+	}
+	labels[n++] = '"';
+	labels[n] = '\0';
+
+	st->latency = metrics_register(METRIC_HISTOGRAM,
+		"basileus_sqlite_statement_duration_seconds", labels,
+		"Time spent running music database statements.");
+}
+
+static _statement_t *
+_lookup(const char *sql)
+{
+	uint64_t hash = _hash(sql);
+	_cache_entry_t *c = &_cache[hash & (CACHE_SIZE - 1)];
+	char name[MAX_NAME];
+	int i;
+
+	if (c->hash == hash) {
+		return c->statement;
+	}
+
+	music_db_profile_name(sql, name, sizeof(name));
+	for (i = 0; i < _statement_count; i++) {
+		if (0 == strcmp(_statements[i].name, name)) {
+			break;
+		}
+	}
+	if (i == _statement_count) {
+		if (i < MUSIC_DB_PROFILE_MAX_STATEMENTS) {
+			_statement_init(&_statements[i], name);
+			_statement_count++;
+		} else if (_statements[i].latency == NULL) {
+			_statement_init(&_statements[i], "other");
+		}
+	}
+
+	c->hash = hash;
+	c->statement = &_statements[i];
+	return c->statement;
+}
+
+static uint64_t
+_now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Returns running slot of stmt, or a free one if it's not running */
+static _running_t *
+_running_slot(void *stmt)
+{
+	_running_t *free_slot = NULL;
+	int i;
+
+	for (i = 0; i < MAX_RUNNING; i++) {
+		if (_running[i].stmt == stmt) {
+			return &_running[i];
+		}
+		if (_running[i].stmt == NULL && free_slot == NULL) {
+			free_slot = &_running[i];
+		}
+	}
+	return free_slot;
+}
+
+/*
+ * Statement started running. Also called when a trigger fires, with
+ * text starting with "--", which is timed as part of its statement.
+ */
+static void
+_music_db_profile_start(void *db, void *stmt, const char *text)
+{
+	_running_t *r;
+	uint64_t now;
+
+	if (text != NULL && text[0] == '-' && text[1] == '-') {
+		return;
+	}
+
+	now = _now_ns();
+	pthread_mutex_lock(&_profile_lock);
+	/* Already running statements keep their start time */
+	if ((r = _running_slot(stmt)) != NULL && r->stmt == NULL) {
+		r->db = db;
+		r->stmt = stmt;
+		r->start = now;
+	}
+	pthread_mutex_unlock(&_profile_lock);
+}
+
+/*
+ * Statement finished. SQLite's own time is only precise to a millisecond,
+ * it is used only for statements which could not be timed here.
+ */
+static void
+_music_db_profile_finish(void *stmt, sqlite3_int64 ns)
+{
+	const char *sql = sqlite3_sql(stmt);
+	_statement_t *st;
+	_running_t *r;
+	char *expanded;
+	uint64_t now = _now_ns();
+	int suppressed = -1;
+
+	pthread_mutex_lock(&_profile_lock);
+	if ((r = _running_slot(stmt)) != NULL && r->stmt == stmt) {
+		ns = now - r->start;
+		r->stmt = NULL;
+	}
+	if (sql == NULL) {
+		pthread_mutex_unlock(&_profile_lock);
+		return;
+	}
+	st = _lookup(sql);
+	if (_slow_ms && ns >= _slow_ms * 1000000LL) {
+		now = metrics_now_us() / 1000;
+		if (st->last_slow == 0 || now - st->last_slow >= MUSIC_DB_PROFILE_LOG_INTERVAL) {
+			suppressed = st->suppressed;
+			st->suppressed = 0;
+			st->last_slow = now;
+		} else {
+			st->suppressed++;
+		}
+	}
+	pthread_mutex_unlock(&_profile_lock);
+
+	metrics_observe(st->latency, ns / 1000);
+	__atomic_add_fetch(&_total_ns, ns, __ATOMIC_RELAXED);
+
+	if (suppressed >= 0) {
+		expanded = sqlite3_expanded_sql(stmt);
+		log_warning("Slow SQL statement %s took %d ms (%d similar warnings suppressed): %s",
+		            st->name, (int)(ns / 1000000), suppressed, expanded ? expanded : sql);
+		sqlite3_free(expanded);
+	}
+}
+
+static int
+_music_db_profile(unsigned type, void *data, void *stmt, void *x)
+{
+	if (type == SQLITE_TRACE_STMT) {
+		_music_db_profile_start(data, stmt, x);
+	} else if (type == SQLITE_TRACE_PROFILE) {
+		_music_db_profile_finish(stmt, *(sqlite3_int64 *)x);
+	}
+	return 0;
+}
+
+int
+music_db_profile_enable(sqlite3 *db, int enable)
+{
+	int i;
+
+	if (SQLITE_OK != sqlite3_trace_v2(db, enable ? SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE : 0,
+	                                  enable ? _music_db_profile : NULL, db)) {
+		log_error("Failed to set sqlite3 profile callback: %s", sqlite3_errmsg(db));
+		return -1;
+	}
+
+	/* Statements left running when profiling was stopped are never finished */
+	pthread_mutex_lock(&_profile_lock);
+	for (i = 0; i < MAX_RUNNING; i++) {
+		if (_running[i].db == db) {
+			_running[i].db = NULL;
+			_running[i].stmt = NULL;
+		}
+	}
+	pthread_mutex_unlock(&_profile_lock);
+
+	return 0;
+}
+
+void
+music_db_profile_set_slow(unsigned int ms)
+{
+	pthread_mutex_lock(&_profile_lock);
+	_slow_ms = ms;
+	pthread_mutex_unlock(&_profile_lock);
+}
+
+uint64_t
+music_db_profile_total_us(void)
+{
+	return __atomic_load_n(&_total_ns, __ATOMIC_RELAXED) / 1000;
+}
@@ -0,0 +1,79 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _MUSIC_DB_PROFILE_H_
+#define _MUSIC_DB_PROFILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sqlite3.h>
+
+/*
+ * Statement profiling. Run times of statements are recorded in the
+ * basileus_sqlite_statement_duration_seconds histogram, labelled with the
+ * name of the music_db_sql statement, or normalized text of others. Slow
+ * statements are logged with their bound values, at most once per
+ * MUSIC_DB_PROFILE_LOG_INTERVAL for each statement.
+ */
+
+/* Minimum interval between slow statement messages for a statement (ms) */
+#define MUSIC_DB_PROFILE_LOG_INTERVAL 10000
+
+/* Most statements tracked separately, the rest are counted as "other" */
+#define MUSIC_DB_PROFILE_MAX_STATEMENTS 64
+
+/**
+ * Starts or stops profiling statements run on given connection.
+ * Returns 0 on success, -1 on failure.
+ */
+int
+music_db_profile_enable(sqlite3 *db, int enable);
+
+/**
+ * Sets time above which statements are logged as slow, 0 disables it.
+ */
+void
+music_db_profile_set_slow(unsigned int ms);
+
+/**
+ * Time spent in all profiled statements so far, in microseconds.
+ */
+uint64_t
+music_db_profile_total_us(void);
+
+/**
+ * Writes name of a statement to out: its music_db_sql name, or its text
+ * with whitespace collapsed and literals and parameters replaced with
+ * '?', truncated to fit. Returns length of the name.
+ */
+size_t
+music_db_profile_name(const char *sql, char *out, size_t size);
+
+#endif /* !_MUSIC_DB_PROFILE_H_ */
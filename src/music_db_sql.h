@@ -0,0 +1,134 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _MUSIC_DB_SQL_H_
+#define _MUSIC_DB_SQL_H_
+
+/*
+ * All statements the music database prepares, kept in one place so that
+ * their query plans can be checked by the test suite. Statements flagged
+ * with MUSIC_DB_SQL_RANKED order results by a computed score, so no index
+ * can spare them a sort.
+ */
+#define MUSIC_DB_SQL_RANKED 0x1
+
+#define MUSIC_DB_SQL_STATEMENTS(X) \
+	X(INSERT_ARTIST, 0, \
+	  "INSERT INTO artists (name, generation) VALUES (?, ?);") \
+	X(ARTIST_ID, 0, \
+	  "SELECT id FROM artists WHERE name=?;") \
+	X(TOUCH_ARTIST, 0, \
+	  "UPDATE artists SET generation=? WHERE id=?;") \
+	X(INSERT_ALBUM, 0, \
+	  "INSERT INTO albums (name, artist_id, generation) VALUES (?, ?, ?);") \
+	X(ALBUM_ID, 0, \
+	  "SELECT id FROM albums WHERE name=? AND artist_id=?;") \
+	X(TOUCH_ALBUM, 0, \
+	  "UPDATE albums SET generation=? WHERE id=?;") \
+	X(INSERT_SONG, 0, \
+	  "INSERT INTO songs (title, path, hash, track, length, artist_id, album_id, fingerprint) " \
+	  "VALUES (:1, :2, :3, :4, :5, :6, :7, :8);") \
+	X(MOVE_SONG, 0, \
+	  "UPDATE songs SET title=:1, path=:2, hash=:3, track=:4, length=:5, " \
+	  "artist_id=:6, album_id=:7 WHERE id=:8;") \
+	X(SONG_ID_BY_HASH, 0, \
+	  "SELECT id FROM songs WHERE hash=?;") \
+	X(SONG_BY_FINGERPRINT, 0, \
+	  "SELECT id, path, album_id FROM songs WHERE fingerprint=? LIMIT 1;") \
+	X(SCAN_RESUME, 0, \
+	  "SELECT id FROM scans WHERE root=? AND completed=0 ORDER BY id DESC LIMIT 1;") \
+	X(SCAN_START, 0, \
+	  "INSERT INTO scans (root, completed) VALUES (?, 0);") \
+	X(SCAN_COMPLETE, 0, \
+	  "UPDATE scans SET completed=1 WHERE id=?;") \
+	X(SCAN_FORGET, 0, \
+	  "DELETE FROM scans WHERE id < ?;") \
+	X(SCAN_DIR, 0, \
+	  "SELECT mtime, scan FROM scan_dirs WHERE path=?;") \
+	X(SCAN_DIR_DONE, 0, \
+	  "INSERT OR REPLACE INTO scan_dirs (path, mtime, scan) VALUES (?, ?, ?);") \
+	X(SCAN_DIRS_FORGET, 0, \
+	  "DELETE FROM scan_dirs WHERE scan < ?;") \
+	X(GENERATION, 0, \
+	  "SELECT IFNULL(MAX(generation), 0) FROM albums;") \
+	X(ARTISTS, 0, \
+	  "SELECT name FROM artists ORDER BY name LIMIT ?3;") \
+	X(ARTISTS_AFTER, 0, \
+	  "SELECT name FROM artists WHERE name > ?2 ORDER BY name LIMIT ?3;") \
+	X(ALBUMS, 0, \
+	  "SELECT name FROM albums WHERE artist_id=" \
+	  "(SELECT id FROM artists WHERE name=?1) " \
+	  "ORDER BY name LIMIT ?3;") \
+	X(ALBUMS_AFTER, 0, \
+	  "SELECT name FROM albums WHERE artist_id=" \
+	  "(SELECT id FROM artists WHERE name=?1) " \
+	  "AND name > ?2 ORDER BY name LIMIT ?3;") \
+	X(SONGS, 0, \
+	  "SELECT s.title, s.length, s.id, s.track FROM songs s " \
+	  "WHERE s.album_id=(SELECT al.id FROM albums al " \
+	  "JOIN artists ar ON al.artist_id=ar.id WHERE al.name=?1 AND ar.name=?2) " \
+	  "ORDER BY s.track, s.id LIMIT ?5;") \
+	X(SONGS_AFTER, 0, \
+	  "SELECT s.title, s.length, s.id, s.track FROM songs s " \
+	  "WHERE s.album_id=(SELECT al.id FROM albums al " \
+	  "JOIN artists ar ON al.artist_id=ar.id WHERE al.name=?1 AND ar.name=?2) " \
+	  "AND (s.track, s.id) > (?3, ?4) ORDER BY s.track, s.id LIMIT ?5;") \
+	X(SEARCH, MUSIC_DB_SQL_RANKED, \
+	  "SELECT s.title, s.length, s.id, f.artist, f.album FROM " \
+	  "(SELECT rowid, artist, album, bm25(songs_fts, 4.0, 2.0, 1.0) AS score " \
+	  "FROM songs_fts WHERE songs_fts MATCH ? ORDER BY score LIMIT ?) f " \
+	  "JOIN songs s ON s.id=f.rowid ORDER BY f.score;") \
+	X(SONG_PATH, 0, \
+	  "SELECT path FROM songs WHERE id=?;") \
+	X(SONG_PATH_BY_HASH, 0, \
+	  "SELECT path FROM songs WHERE hash=?;") \
+	X(CHANGED_ARTISTS, 0, \
+	  "SELECT name FROM artists WHERE generation > ?;") \
+	X(CHANGED_ALBUMS, 0, \
+	  "SELECT ar.name, al.name FROM albums al " \
+	  "JOIN artists ar ON al.artist_id=ar.id WHERE al.generation > ?;")
+
+typedef enum {
+#define MUSIC_DB_SQL_ENUM(id, flags, text) MUSIC_DB_SQL_##id,
+	MUSIC_DB_SQL_STATEMENTS(MUSIC_DB_SQL_ENUM)
+#undef MUSIC_DB_SQL_ENUM
+	MUSIC_DB_SQL_COUNT
+} music_db_sql_id_t;
+
+typedef struct {
+	const char *name;
+	const char *text;
+	int         flags;
+} music_db_sql_t;
+
+extern const music_db_sql_t music_db_sql[MUSIC_DB_SQL_COUNT];
+
+#define MUSIC_DB_SQL(id) (music_db_sql[MUSIC_DB_SQL_##id].text)
+
+#endif /* _MUSIC_DB_SQL_H_ */
@@ -0,0 +1,113 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+
+#include "music_tag.h"
+#include "file_class.h"
+#include "span.h"
+
+static int _fast_scan = 1;
+
+static music_tag_t *
+_music_tag_detect(const char *file, const io_file_t *pre)
+{
+	music_tag_t *tag = NULL;
+	file_class_t class;
+
+	if ((class = file_class_by_name(file)) == FILE_CLASS_UNKNOWN) {
+		class = pre != NULL ? file_class_by_magic_buf(pre->head, pre->head_len)
+		                    : file_class_by_magic(file);
+	}
+
+	switch (class) {
+	case FILE_CLASS_IGNORE:
+	case FILE_CLASS_UNKNOWN:
+		return NULL;
+	case FILE_CLASS_MPEG:
+	case FILE_CLASS_FLAC:
+	case FILE_CLASS_OGG:
+		tag = pre != NULL ? music_tag_native_create_prefetched(pre)
+		                  : music_tag_native_create(file);
+		if (tag != NULL) {
+			return tag;
+		}
+		break;
+	case FILE_CLASS_OTHER:
+		break;
+	}
+
+	return music_tag_backend_create(file);
+}
+
+static music_tag_t *
+_music_tag_create(const char *file, const io_file_t *pre)
+{
+	span_t span = span_begin();
+	music_tag_t *tag = _music_tag_detect(file, pre);
+
+	span_end(span, "music_tag_create");
+	return tag;
+}
+
+music_tag_t *
+music_tag_create(const char *file)
+{
+	return _music_tag_create(file, NULL);
+}
+
+music_tag_t *
+music_tag_create_prefetched(const io_file_t *file)
+{
+	/* Let the readers retry on their own whatever went wrong */
+	if (file->fd < 0 || file->error != 0) {
+		return _music_tag_create(file->path, NULL);
+	}
+	return _music_tag_create(file->path, file);
+}
+
+void
+music_tag_destroy(music_tag_t *tag)
+{
+	if (tag != NULL) {
+		tag->destroy(tag);
+	}
+}
+
+void
+music_tag_set_fast_scan(int enabled)
+{
+	_fast_scan = enabled;
+}
+
+int
+music_tag_fast_scan(void)
+{
+	return _fast_scan;
+}
@@ -30,18 +30,56 @@
 #ifndef _MUSIC_TAG_H_
 #define _MUSIC_TAG_H_
 
-typedef struct {
+#include "io_batch.h"
+
+typedef struct music_tag_s music_tag_t;
+
+struct music_tag_s {
 	char   *artist;
 	char   *title;
 	char   *album;
 	int     track;
 	int     length;
-} music_tag_t;
+
+	/* Set by the reader which created the tag */
+	void  (*destroy)(music_tag_t *tag);
+};
 
 music_tag_t *
 music_tag_create(const char *file);
 
+/**
+ * Same as music_tag_create(), but use head and tail of file read by
+ * io_batch_read(). File descriptor is left open.
+ */
+music_tag_t *
+music_tag_create_prefetched(const io_file_t *file);
+
 void
 music_tag_destroy(music_tag_t *tag);
 
+/**
+ * Trust durations found in container headers instead of probing audio
+ * streams. Enabled by default, affects only the libav backend.
+ */
+void
+music_tag_set_fast_scan(int enabled);
+
+int
+music_tag_fast_scan(void);
+
+/*
+ * Tag readers used by music_tag_create(). The native reader handles common
+ * formats with a few small reads, the TagLib or libav backend everything
+ * else.
+ */
+music_tag_t *
+music_tag_native_create(const char *file);
+
+music_tag_t *
+music_tag_native_create_prefetched(const io_file_t *file);
+
+music_tag_t *
+music_tag_backend_create(const char *file);
+
 #endif /* !_MUSIC_TAG_H_ */
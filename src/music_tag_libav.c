@@ -27,9 +27,12 @@
  * SUCH DAMAGE.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <libavformat/avformat.h>
+#include <libavutil/opt.h>
 
 #include "music_tag.h"
 #include "logger.h"
@@ -40,24 +43,9 @@ typedef struct
 	AVFormatContext *ctx;
 } _music_tag_libav_t;
 
-/*
- * Skip files oten found in music directories.
- */
-static int
-_should_skip(const char *file)
-{
-	static const char *skip_ext[] = {
-		".pls\0", ".m3u\0", ".jpeg\0", ".jpg\0", ".ini\0"
-	};
-
-	int i;
-	for (i = 0; i < sizeof(skip_ext) / sizeof(skip_ext[0]); i++) {
-		if (NULL != strstr(file, skip_ext[i])) {
-			return 1;
-		}
-	}
-	return 0;
-}
+/* Stream probing limits in fast scan mode */
+#define LIBAV_FAST_PROBE_SIZE        (64 * 1024)
+#define LIBAV_FAST_ANALYZE_DURATION  (500 * 1000) /* us */
 
 static char *
 _strip_tailing_whitespace(char *str)
@@ -73,13 +61,115 @@ _strip_tailing_whitespace(char *str)
 	return str;
 }
 
+static void
+_music_tag_libav_destroy(music_tag_t *tag)
+{
+	_music_tag_libav_t *t = (_music_tag_libav_t *) tag;
+	avformat_close_input(&(t->ctx));
+	free(t);
+}
+
+static int
+_audio_streams(AVFormatContext *container)
+{
+	int i, count = 0;
+
+	for (i = 0; i < container->nb_streams; i++) {
+		if (container->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO) {
+			count++;
+		}
+	}
+	return count;
+}
+
+/*
+ * Duration in AV_TIME_BASE units. Before stream probing only the demuxers
+ * fill per stream durations, from Xing/VBRI frames, FLAC STREAMINFO or the
+ * last Ogg granule position.
+ */
+static int64_t
+_duration(AVFormatContext *container)
+{
+	AVStream *st = NULL;
+	int i;
+
+	if (container->duration != AV_NOPTS_VALUE) {
+		return container->duration;
+	}
+	for (i = 0; i < container->nb_streams; i++) {
+		st = container->streams[i];
+		if (st->codec->codec_type == AVMEDIA_TYPE_AUDIO && st->duration != AV_NOPTS_VALUE) {
+			return av_rescale(st->duration, (int64_t)st->time_base.num * AV_TIME_BASE,
+			                  st->time_base.den);
+		}
+	}
+	return AV_NOPTS_VALUE;
+}
+
+/*
+ * Open file, probing streams only when needed. In fast mode the container
+ * is opened reading a limited amount of data, and streams are not probed
+ * at all if headers give duration. Otherwise the limits are lifted and
+ * streams are probed on the same container, as without fast mode.
+ */
+static AVFormatContext *
+_open(const char *file)
+{
+	AVFormatContext *container = NULL;
+	AVDictionary *opts = NULL;
+	int64_t probesize = 0, analyzeduration = 0;
+	char value[32];
+	int fast = music_tag_fast_scan();
+
+	if (fast) {
+		if ((container = avformat_alloc_context()) == NULL) {
+			return NULL;
+		}
+		/* Defaults, restored when streams have to be probed */
+		if (av_opt_get_int(container, "probesize", 0, &probesize) < 0 ||
+		    av_opt_get_int(container, "analyzeduration", 0, &analyzeduration) < 0) {
+			avformat_free_context(container);
+			return NULL;
+		}
+		snprintf(value, sizeof(value), "%d", LIBAV_FAST_PROBE_SIZE);
+		av_dict_set(&opts, "probesize", value, 0);
+		snprintf(value, sizeof(value), "%d", LIBAV_FAST_ANALYZE_DURATION);
+		av_dict_set(&opts, "analyzeduration", value, 0);
+	}
+
+	if (avformat_open_input(&container, file, NULL, &opts) < 0) {
+		av_dict_free(&opts);
+		/* Format may not be recognized from the limited amount of data */
+		if (!fast || avformat_open_input(&container, file, NULL, NULL) < 0) {
+			return NULL;
+		}
+		fast = 0;
+	}
+	av_dict_free(&opts);
+
+	if (fast) {
+		if (_audio_streams(container) > 0 && _duration(container) != AV_NOPTS_VALUE) {
+			return container;
+		}
+		av_opt_set_int(container, "probesize", probesize, 0);
+		av_opt_set_int(container, "analyzeduration", analyzeduration, 0);
+	}
+
+	if (avformat_find_stream_info(container, NULL) < 0) {
+		log_trace("Could not find file info: %s", file);
+		avformat_close_input(&container);
+		return NULL;
+	}
+
+	return container;
+}
+
 music_tag_t *
-music_tag_create(const char *file)
+music_tag_backend_create(const char *file)
 {
 	AVFormatContext* container = NULL;
 	AVDictionaryEntry *tag = NULL;
 	_music_tag_libav_t *ret = NULL;
-	int i;
 
 	static int libav_initialized = 0;
 	if (!libav_initialized) {
@@ -87,28 +177,12 @@ music_tag_create(const char *file)
 		libav_initialized = 1;
 	}
 
-	if (_should_skip(file)) {
-		return NULL;
-	}
-
-	if (avformat_open_input(&container, file, NULL, NULL) < 0) {
+	if ((container = _open(file)) == NULL) {
 		log_warning("Could not open file: %s", file);
 		return NULL;
 	}
 
-	if (avformat_find_stream_info(container, NULL) < 0) {
-		log_trace("Could not find file info: %s", file);
-		goto failure;
-	}
-
-	int audio_streams = 0;
-	for (i = 0; i < container->nb_streams; i++) {
-		if (container->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO) {
-			audio_streams++;
-		}
-	}
-
-	if (audio_streams == 0) {
+	if (_audio_streams(container) == 0) {
 		log_trace("No audio streams found in file: %s", file);
 		goto failure;
 	}
@@ -147,8 +221,10 @@ music_tag_create(const char *file)
 		ret->base.track = 0;
 	}
 
-	ret->base.length = (int)(container->duration / AV_TIME_BASE);
+	ret->base.length = _duration(container) != AV_NOPTS_VALUE ?
+	                   (int)(_duration(container) / AV_TIME_BASE) : 0;
 
+	ret->base.destroy = _music_tag_libav_destroy;
 	ret->ctx = container;
 
 	return (music_tag_t *)ret;
@@ -160,11 +236,3 @@ failure:
 	free(ret);
 	return NULL;
 }
-
-void
-music_tag_destroy(music_tag_t *tag)
-{
-	_music_tag_libav_t *t = (_music_tag_libav_t *) tag;
-	avformat_close_input(&(t->ctx));
-	free(t);
-}
@@ -0,0 +1,876 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Built-in reader for the most common audio formats: MP3 with ID3v2 or
+ * ID3v1 tags, FLAC and Ogg Vorbis or Opus. Only tag and stream header
+ * blocks are read, a handful of small pread() calls per file, while the
+ * audio data is never touched. When the scanner has already read the head
+ * and tail of a file, most files need no reads at all. Files it does not
+ * recognise, or whose tags lack title, artist or album, are left for the
+ * TagLib or libav backend.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "music_tag.h"
+#include "logger.h"
+
+/* Size of read buffer, covers headers of most files in one read */
+#define NATIVE_BUF_SIZE (16 * 1024)
+
+/* Largest tag frame or comment block read, cover art is skipped */
+#define NATIVE_MAX_BLOCK (256 * 1024)
+
+/* How far from the end to look for the last Ogg page */
+#define NATIVE_OGG_TAIL (64 * 1024)
+
+typedef struct {
+	const io_file_t *pre; /* Head and tail read ahead by the scanner */
+	int              fd;
+	off_t            size;
+	off_t            buf_off;
+	size_t           buf_len;
+	unsigned char    buf[NATIVE_BUF_SIZE];
+} _reader_t;
+
+/*
+ * Get len bytes at given offset through the read buffer.
+ * @return Pointer valid until the next call, NULL past end of file.
+ */
+static const unsigned char *
+_reader_get(_reader_t *r, off_t off, size_t len)
+{
+	ssize_t n;
+
+	if (off < 0 || len > sizeof(r->buf) || off + (off_t)len > r->size) {
+		return NULL;
+	}
+	if (r->pre != NULL) {
+		if (off + len <= r->pre->head_len) {
+			return r->pre->head + off;
+		}
+		if (r->pre->tail_len > 0 && off >= r->size - (off_t)r->pre->tail_len) {
+			return r->pre->tail + (off - (r->size - r->pre->tail_len));
+		}
+	}
+	if (off >= r->buf_off && off + (off_t)len <= r->buf_off + (off_t)r->buf_len) {
+		return r->buf + (off - r->buf_off);
+	}
+
+	do {
+		n = pread(r->fd, r->buf, sizeof(r->buf), off);
+	} while (n < 0 && errno == EINTR);
+
+	if (n < (ssize_t)len) {
+		r->buf_len = 0;
+		return NULL;
+	}
+	r->buf_off = off;
+	r->buf_len = n;
+	return r->buf;
+}
+
+/*
+ * Read len bytes at given offset into newly allocated buffer.
+ */
+static unsigned char *
+_reader_read(_reader_t *r, off_t off, size_t len)
+{
+	unsigned char *data = NULL;
+	const unsigned char *p = NULL;
+	ssize_t n;
+
+	if (off < 0 || len > NATIVE_MAX_BLOCK || off + (off_t)len > r->size) {
+		return NULL;
+	}
+	if ((data = malloc(len + 1)) == NULL) {
+		return NULL;
+	}
+
+	if (len <= sizeof(r->buf) && (p = _reader_get(r, off, len)) != NULL) {
+		memcpy(data, p, len);
+	} else {
+		do {
+			n = pread(r->fd, data, len, off);
+		} while (n < 0 && errno == EINTR);
+		if (n != (ssize_t)len) {
+			free(data);
+			return NULL;
+		}
+	}
+	data[len] = '\0';
+	return data;
+}
+
+static uint32_t
+_be32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint32_t
+_le32(const unsigned char *p)
+{
+	return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+static uint32_t
+_syncsafe32(const unsigned char *p)
+{
+	return (uint32_t)(p[0] & 0x7f) << 21 | (p[1] & 0x7f) << 14 | (p[2] & 0x7f) << 7 | (p[3] & 0x7f);
+}
+
+/*
+ * Text decoding, everything ends up as UTF-8 with trailing whitespace
+ * stripped.
+ */
+static size_t
+_utf8_put(char *out, uint32_t cp)
+{
+	if (cp < 0x80) {
+		out[0] = cp;
+		return 1;
+	} else if (cp < 0x800) {
+		out[0] = 0xc0 | cp >> 6;
+		out[1] = 0x80 | (cp & 0x3f);
+		return 2;
+	} else if (cp < 0x10000) {
+		out[0] = 0xe0 | cp >> 12;
+		out[1] = 0x80 | (cp >> 6 & 0x3f);
+		out[2] = 0x80 | (cp & 0x3f);
+		return 3;
+	}
+	out[0] = 0xf0 | cp >> 18;
+	out[1] = 0x80 | (cp >> 12 & 0x3f);
+	out[2] = 0x80 | (cp >> 6 & 0x3f);
+	out[3] = 0x80 | (cp & 0x3f);
+	return 4;
+}
+
+static char *
+_strip(char *str)
+{
+	size_t len = strlen(str);
+
+	while (len > 0 && (str[len - 1] == ' ' || str[len - 1] == '\t')) {
+		str[--len] = '\0';
+	}
+	return str;
+}
+
+static char *
+_decode_latin1(const unsigned char *p, size_t len)
+{
+	char *out = NULL;
+	size_t i, n = 0;
+
+	if ((out = malloc(len * 2 + 1)) == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < len && p[i]; i++) {
+		n += _utf8_put(out + n, p[i]);
+	}
+	out[n] = '\0';
+	return _strip(out);
+}
+
+static char *
+_decode_utf8(const unsigned char *p, size_t len)
+{
+	char *out = NULL;
+	size_t n = 0;
+
+	while (n < len && p[n]) {
+		n++;
+	}
+	if ((out = malloc(n + 1)) == NULL) {
+		return NULL;
+	}
+	memcpy(out, p, n);
+	out[n] = '\0';
+	return _strip(out);
+}
+
+static char *
+_decode_utf16(const unsigned char *p, size_t len, int big_endian)
+{
+	char *out = NULL;
+	uint32_t cp, lo;
+	size_t i, n = 0;
+
+	if (len >= 2 && p[0] == 0xff && p[1] == 0xfe) {
+		big_endian = 0;
+		p += 2;
+		len -= 2;
+	} else if (len >= 2 && p[0] == 0xfe && p[1] == 0xff) {
+		big_endian = 1;
+		p += 2;
+		len -= 2;
+	}
+
+	/* At most 3 bytes of UTF-8 per 2 bytes of UTF-16 */
+	if ((out = malloc(len / 2 * 3 + 1)) == NULL) {
+		return NULL;
+	}
+	for (i = 0; i + 1 < len; i += 2) {
+		cp = big_endian ? p[i] << 8 | p[i + 1] : p[i + 1] << 8 | p[i];
+		if (cp == 0) {
+			break;
+		}
+		if (cp >= 0xd800 && cp < 0xdc00 && i + 3 < len) {
+			lo = big_endian ? p[i + 2] << 8 | p[i + 3] : p[i + 3] << 8 | p[i + 2];
+			if (lo >= 0xdc00 && lo < 0xe000) {
+				cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+				i += 2;
+			}
+		}
+		n += _utf8_put(out + n, cp);
+	}
+	out[n] = '\0';
+	return _strip(out);
+}
+
+/*
+ * Store field value unless an earlier tag or frame already provided one.
+ */
+static void
+_set_field(char **field, char *value)
+{
+	if (*field == NULL && value != NULL && *value != '\0') {
+		*field = value;
+	} else {
+		free(value);
+	}
+}
+
+/*
+ * ID3v2 tags (versions 2.2, 2.3 and 2.4).
+ */
+static void
+_id3v2_unsync(unsigned char *data, size_t *len)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < *len; i++) {
+		data[n++] = data[i];
+		if (data[i] == 0xff && i + 1 < *len && data[i + 1] == 0x00) {
+			i++;
+		}
+	}
+	*len = n;
+}
+
+static char *
+_id3v2_text(const unsigned char *data, size_t len)
+{
+	if (len < 1) {
+		return NULL;
+	}
+	switch (data[0]) {
+	case 0:
+		return _decode_latin1(data + 1, len - 1);
+	case 1:
+		return _decode_utf16(data + 1, len - 1, 0);
+	case 2:
+		return _decode_utf16(data + 1, len - 1, 1);
+	case 3:
+		return _decode_utf8(data + 1, len - 1);
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Parse ID3v2 tag at the beginning of file.
+ * @return Offset of the first byte past the tag, 0 when there's none.
+ */
+static off_t
+_id3v2_parse(_reader_t *r, music_tag_t *tag, int *tlen)
+{
+	static const char *ids[][5] = {
+		/* title, artist, album, track, length */
+		{ "TT2",  "TP1",  "TAL",  "TRK",  "TLE" },
+		{ "TIT2", "TPE1", "TALB", "TRCK", "TLEN" },
+	};
+	const unsigned char *h = NULL;
+	unsigned char *data = NULL;
+	char *text = NULL;
+	off_t pos, end;
+	size_t size, hdr_len, id_len;
+	int version, flags, fflags, i;
+
+	if ((h = _reader_get(r, 0, 10)) == NULL || memcmp(h, "ID3", 3) != 0) {
+		return 0;
+	}
+	version = h[3];
+	flags = h[5];
+	end = 10 + (off_t)_syncsafe32(h + 6);
+	if (flags & 0x10) {
+		end += 10;
+	}
+	if (version < 2 || version > 4 || (version == 2 && (flags & 0x40))) {
+		/* Unknown version or compressed 2.2 tag */
+		return end;
+	}
+
+	pos = 10;
+	if (version >= 3 && (flags & 0x40)) {
+		if ((h = _reader_get(r, pos, 4)) == NULL) {
+			return end;
+		}
+		pos += version == 3 ? 4 + _be32(h) : _syncsafe32(h);
+	}
+
+	hdr_len = version == 2 ? 6 : 10;
+	id_len = version == 2 ? 3 : 4;
+
+	while (pos + (off_t)hdr_len <= end && (h = _reader_get(r, pos, hdr_len)) != NULL) {
+		if (h[0] == 0) {
+			/* Padding */
+			break;
+		}
+		if (version == 2) {
+			size = h[3] << 16 | h[4] << 8 | h[5];
+			fflags = 0;
+		} else {
+			size = version == 3 ? _be32(h + 4) : _syncsafe32(h + 4);
+			fflags = h[8] << 8 | h[9];
+		}
+		pos += hdr_len;
+		if (size > end - pos) {
+			break;
+		}
+
+		for (i = 0; i < 5; i++) {
+			if (memcmp(h, ids[version == 2 ? 0 : 1][i], id_len) == 0) {
+				break;
+			}
+		}
+		/* Skip unwanted, compressed and encrypted frames */
+		if (i == 5 || size < 2 ||
+		    (version == 3 && (fflags & 0x00c0)) ||
+		    (version == 4 && (fflags & 0x000c))) {
+			pos += size;
+			continue;
+		}
+
+		if ((data = _reader_read(r, pos, size)) == NULL) {
+			pos += size;
+			continue;
+		}
+		pos += size;
+
+		if ((flags & 0x80) || (version == 4 && (fflags & 0x0002))) {
+			_id3v2_unsync(data, &size);
+		}
+		/* Data length indicator */
+		if (version == 4 && (fflags & 0x0001) && size >= 4) {
+			memmove(data, data + 4, size - 4);
+			size -= 4;
+		}
+
+		text = _id3v2_text(data, size);
+		free(data);
+
+		switch (i) {
+		case 0:
+			_set_field(&tag->title, text);
+			break;
+		case 1:
+			_set_field(&tag->artist, text);
+			break;
+		case 2:
+			_set_field(&tag->album, text);
+			break;
+		case 3:
+			tag->track = text ? atoi(text) : 0;
+			free(text);
+			break;
+		case 4:
+			*tlen = text ? atoi(text) : 0;
+			free(text);
+			break;
+		}
+	}
+
+	return end;
+}
+
+/*
+ * ID3v1 tag in the last 128 bytes of file, fills only missing fields.
+ * @return 1 when the tag is present, 0 otherwise.
+ */
+static int
+_id3v1_parse(_reader_t *r, music_tag_t *tag)
+{
+	const unsigned char *p = NULL;
+
+	if ((p = _reader_get(r, r->size - 128, 128)) == NULL || memcmp(p, "TAG", 3) != 0) {
+		return 0;
+	}
+
+	_set_field(&tag->title, _decode_latin1(p + 3, 30));
+	_set_field(&tag->artist, _decode_latin1(p + 33, 30));
+	_set_field(&tag->album, _decode_latin1(p + 63, 30));
+	/* ID3v1.1 track number */
+	if (tag->track == 0 && p[125] == 0) {
+		tag->track = p[126];
+	}
+
+	return 1;
+}
+
+/*
+ * MPEG audio duration from the first frame header, using Xing or VBRI
+ * frame counts when present and assuming constant bitrate otherwise.
+ */
+static int
+_mpeg_length(_reader_t *r, off_t start, off_t end)
+{
+	static const short bitrates[2][3][15] = {
+		{ /* MPEG 1, layers I, II, III */
+			{ 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448 },
+			{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+			{ 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+		},
+		{ /* MPEG 2 and 2.5 */
+			{ 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+			{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+			{ 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 },
+		},
+	};
+	static const int samplerates[3] = { 44100, 48000, 32000 };
+	const unsigned char *p = NULL;
+	size_t avail, i;
+	int version, layer, lsf, bitrate, samplerate, samples, mono, side;
+	uint32_t frames = 0;
+
+	avail = end - start < NATIVE_BUF_SIZE ? end - start : NATIVE_BUF_SIZE;
+	if (avail < 4 || (p = _reader_get(r, start, avail)) == NULL) {
+		return -1;
+	}
+
+	for (i = 0; i + 4 <= avail; i++) {
+		if (p[i] != 0xff || (p[i + 1] & 0xe0) != 0xe0) {
+			continue;
+		}
+		version = p[i + 1] >> 3 & 3;
+		layer = 4 - (p[i + 1] >> 1 & 3);
+		bitrate = p[i + 2] >> 4;
+		samplerate = p[i + 2] >> 2 & 3;
+		if (version == 1 || layer == 4 || bitrate == 0 || bitrate == 15 || samplerate == 3) {
+			continue;
+		}
+		break;
+	}
+	if (i + 4 > avail) {
+		return -1;
+	}
+
+	lsf = version != 3;
+	bitrate = bitrates[lsf][layer - 1][bitrate];
+	samplerate = samplerates[samplerate] >> (version == 3 ? 0 : version == 2 ? 1 : 2);
+	samples = layer == 1 ? 384 : (layer == 3 && lsf) ? 576 : 1152;
+	mono = (p[i + 3] >> 6) == 3;
+	side = lsf ? (mono ? 9 : 17) : (mono ? 17 : 32);
+
+	if (i + 4 + side + 12 <= avail &&
+	    (memcmp(p + i + 4 + side, "Xing", 4) == 0 || memcmp(p + i + 4 + side, "Info", 4) == 0) &&
+	    (_be32(p + i + 8 + side) & 1)) {
+		frames = _be32(p + i + 12 + side);
+	} else if (i + 4 + 32 + 18 <= avail && memcmp(p + i + 36, "VBRI", 4) == 0) {
+		frames = _be32(p + i + 50);
+	}
+
+	if (frames > 0) {
+		return (int)((uint64_t)frames * samples / samplerate);
+	}
+	return (int)((end - start - (off_t)i) * 8 / (bitrate * 1000));
+}
+
+/*
+ * Vorbis comments, shared by FLAC and Ogg.
+ */
+static void
+_vorbis_comments(const unsigned char *p, size_t len, music_tag_t *tag)
+{
+	static const struct {
+		const char *key;
+		size_t      len;
+	} keys[] = {
+		{ "TITLE=", 6 }, { "ARTIST=", 7 }, { "ALBUM=", 6 }, { "TRACKNUMBER=", 12 },
+	};
+	uint32_t count, n, i;
+	size_t pos = 0;
+	int k;
+
+	if (len < 4 || (n = _le32(p)) > len - 4 || len - 4 - n < 4) {
+		return;
+	}
+	pos = 4 + n;
+	count = _le32(p + pos);
+	pos += 4;
+
+	for (i = 0; i < count && pos + 4 <= len; i++) {
+		n = _le32(p + pos);
+		pos += 4;
+		if (n > len - pos) {
+			break;
+		}
+		for (k = 0; k < 4; k++) {
+			if (n > keys[k].len && strncasecmp((const char *)p + pos, keys[k].key, keys[k].len) == 0) {
+				break;
+			}
+		}
+		switch (k) {
+		case 0:
+			_set_field(&tag->title, _decode_utf8(p + pos + 6, n - 6));
+			break;
+		case 1:
+			_set_field(&tag->artist, _decode_utf8(p + pos + 7, n - 7));
+			break;
+		case 2:
+			_set_field(&tag->album, _decode_utf8(p + pos + 6, n - 6));
+			break;
+		case 3:
+			if (tag->track == 0) {
+				char *text = _decode_utf8(p + pos + 12, n - 12);
+				tag->track = text ? atoi(text) : 0;
+				free(text);
+			}
+			break;
+		}
+		pos += n;
+	}
+}
+
+/*
+ * FLAC metadata blocks following the stream marker at pos.
+ */
+static int
+_flac_parse(_reader_t *r, off_t pos, music_tag_t *tag)
+{
+	const unsigned char *h = NULL;
+	unsigned char *data = NULL;
+	uint64_t total;
+	uint32_t len, rate;
+	int last = 0, type;
+
+	pos += 4;
+	while (!last && (h = _reader_get(r, pos, 4)) != NULL) {
+		last = h[0] & 0x80;
+		type = h[0] & 0x7f;
+		len = h[1] << 16 | h[2] << 8 | h[3];
+		pos += 4;
+
+		if (type == 0 && len >= 18 && (h = _reader_get(r, pos, 18)) != NULL) {
+			/* STREAMINFO */
+			rate = h[10] << 12 | h[11] << 4 | h[12] >> 4;
+			total = (uint64_t)(h[13] & 0x0f) << 32 | _be32(h + 14);
+			tag->length = rate ? (int)(total / rate) : 0;
+		} else if (type == 4 && (data = _reader_read(r, pos, len)) != NULL) {
+			/* VORBIS_COMMENT */
+			_vorbis_comments(data, len, tag);
+			free(data);
+		}
+		pos += len;
+	}
+
+	return 0;
+}
+
+/*
+ * Ogg packets are split into 255 byte segments spread over pages.
+ */
+typedef struct {
+	_reader_t     *r;
+	off_t          next;
+	unsigned char  segs[255];
+	int            nsegs;
+	int            seg;
+} _ogg_t;
+
+static int
+_ogg_page(_ogg_t *o)
+{
+	const unsigned char *h = NULL;
+
+	if ((h = _reader_get(o->r, o->next, 27)) == NULL || memcmp(h, "OggS", 4) != 0) {
+		return -1;
+	}
+	o->nsegs = h[26];
+	if ((h = _reader_get(o->r, o->next + 27, o->nsegs)) == NULL) {
+		return -1;
+	}
+	memcpy(o->segs, h, o->nsegs);
+	o->next += 27 + o->nsegs;
+	o->seg = 0;
+	return 0;
+}
+
+/*
+ * Assemble next packet, truncated to NATIVE_MAX_BLOCK bytes.
+ */
+static unsigned char *
+_ogg_packet(_ogg_t *o, size_t *len)
+{
+	const unsigned char *p = NULL;
+	unsigned char *data = NULL, *tmp = NULL;
+	size_t cap = 0, seg;
+
+	*len = 0;
+	do {
+		/* Pages may carry no segments at all */
+		while (o->seg == o->nsegs) {
+			if (_ogg_page(o) != 0) {
+				free(data);
+				return NULL;
+			}
+		}
+		seg = o->segs[o->seg++];
+		if (seg > 0 && *len + seg <= NATIVE_MAX_BLOCK) {
+			if (*len + seg > cap) {
+				cap = cap ? cap * 2 : 4096;
+				if ((tmp = realloc(data, cap)) == NULL) {
+					free(data);
+					return NULL;
+				}
+				data = tmp;
+			}
+			if ((p = _reader_get(o->r, o->next, seg)) == NULL) {
+				free(data);
+				return NULL;
+			}
+			memcpy(data + *len, p, seg);
+			*len += seg;
+		}
+		o->next += seg;
+	} while (seg == 255);
+
+	return data;
+}
+
+/*
+ * Granule position of the last page in file.
+ */
+static int64_t
+_ogg_last_granule(_reader_t *r)
+{
+	const unsigned char *p = NULL;
+	off_t off, stop;
+	size_t len;
+	int64_t granule;
+	int i, j;
+
+	stop = r->size > NATIVE_OGG_TAIL ? r->size - NATIVE_OGG_TAIL : 0;
+	for (off = r->size; off > stop; off -= NATIVE_BUF_SIZE - 14) {
+		len = off - stop < NATIVE_BUF_SIZE ? off - stop : NATIVE_BUF_SIZE;
+		if ((p = _reader_get(r, off - len, len)) == NULL) {
+			break;
+		}
+		for (i = (int)len - 14; i >= 0; i--) {
+			if (memcmp(p + i, "OggS", 4) != 0) {
+				continue;
+			}
+			granule = 0;
+			for (j = 7; j >= 0; j--) {
+				granule = granule << 8 | p[i + 6 + j];
+			}
+			/* -1 marks pages on which no packet ends */
+			if (granule != -1) {
+				return granule;
+			}
+		}
+	}
+	return -1;
+}
+
+static int
+_ogg_parse(_reader_t *r, music_tag_t *tag)
+{
+	unsigned char *data = NULL;
+	_ogg_t o;
+	size_t len;
+	int64_t granule;
+	uint32_t rate = 0, preskip = 0;
+	int opus, ret = -1;
+
+	memset(&o, 0, sizeof(o));
+	o.r = r;
+
+	/* Identification header */
+	if ((data = _ogg_packet(&o, &len)) == NULL) {
+		return -1;
+	}
+	if (len >= 16 && data[0] == 1 && memcmp(data + 1, "vorbis", 6) == 0) {
+		opus = 0;
+		rate = _le32(data + 12);
+	} else if (len >= 19 && memcmp(data, "OpusHead", 8) == 0) {
+		opus = 1;
+		rate = 48000;
+		preskip = data[10] | data[11] << 8;
+	} else {
+		goto finish;
+	}
+	free(data);
+
+	/* Comment header */
+	if ((data = _ogg_packet(&o, &len)) == NULL) {
+		return -1;
+	}
+	if (!opus && len >= 7 && data[0] == 3 && memcmp(data + 1, "vorbis", 6) == 0) {
+		_vorbis_comments(data + 7, len - 7, tag);
+	} else if (opus && len >= 8 && memcmp(data, "OpusTags", 8) == 0) {
+		_vorbis_comments(data + 8, len - 8, tag);
+	} else {
+		goto finish;
+	}
+
+	granule = _ogg_last_granule(r);
+	if (granule > (int64_t)preskip && rate > 0) {
+		tag->length = (int)((granule - preskip) / rate);
+	}
+
+	ret = 0;
+
+finish:
+	free(data);
+	return ret;
+}
+
+static void
+_music_tag_native_destroy(music_tag_t *tag)
+{
+	free(tag->artist);
+	free(tag->title);
+	free(tag->album);
+	free(tag);
+}
+
+static music_tag_t *
+_native_parse(_reader_t *r, const char *file)
+{
+	const unsigned char *p = NULL;
+	music_tag_t *tag = NULL;
+	off_t start, end;
+	int tlen = 0, ret = -1;
+
+	if ((tag = calloc(1, sizeof(music_tag_t))) == NULL) {
+		return NULL;
+	}
+	tag->destroy = _music_tag_native_destroy;
+
+	/* ID3v2 may prefix any format */
+	start = _id3v2_parse(r, tag, &tlen);
+
+	if ((p = _reader_get(r, start, 4)) == NULL) {
+		goto finish;
+	}
+	if (memcmp(p, "fLaC", 4) == 0) {
+		ret = _flac_parse(r, start, tag);
+	} else if (start == 0 && memcmp(p, "OggS", 4) == 0) {
+		ret = _ogg_parse(r, tag);
+	} else if (start > 0 || (p[0] == 0xff && (p[1] & 0xe0) == 0xe0)) {
+		end = r->size - (_id3v1_parse(r, tag) ? 128 : 0);
+		tag->length = tlen > 0 ? tlen / 1000 : _mpeg_length(r, start, end);
+		ret = tag->length < 0 ? -1 : 0;
+	}
+
+finish:
+	if (ret != 0 || tag->title == NULL || tag->artist == NULL || tag->album == NULL) {
+		_music_tag_native_destroy(tag);
+		return NULL;
+	}
+
+	log_trace("TAG: %s -> (%s, %s, %s, %d, %d)", file, tag->artist, tag->album,
+	          tag->title, tag->length, tag->track);
+
+	return tag;
+}
+
+music_tag_t *
+music_tag_native_create(const char *file)
+{
+	music_tag_t *tag = NULL;
+	_reader_t *r = NULL;
+	struct stat st;
+
+	if ((r = malloc(sizeof(_reader_t))) == NULL) {
+		log_error("Failed to allocate tag reader!");
+		return NULL;
+	}
+	r->pre = NULL;
+	r->buf_off = 0;
+	r->buf_len = 0;
+
+	if ((r->fd = open(file, O_RDONLY)) < 0) {
+		free(r);
+		return NULL;
+	}
+	if (fstat(r->fd, &st) == 0) {
+		r->size = st.st_size;
+		tag = _native_parse(r, file);
+	}
+
+	close(r->fd);
+	free(r);
+
+	return tag;
+}
+
+music_tag_t *
+music_tag_native_create_prefetched(const io_file_t *file)
+{
+	music_tag_t *tag = NULL;
+	_reader_t *r = NULL;
+
+	if ((r = malloc(sizeof(_reader_t))) == NULL) {
+		log_error("Failed to allocate tag reader!");
+		return NULL;
+	}
+	r->pre = file;
+	r->fd = file->fd;
+	r->size = file->size;
+	r->buf_off = 0;
+	r->buf_len = 0;
+
+	tag = _native_parse(r, file->path);
+	free(r);
+
+	return tag;
+}
@@ -39,14 +39,35 @@ typedef struct
 	TagLib_File    *file;
 } music_tag_taglib_t;
 
+static void
+_music_tag_taglib_destroy(music_tag_t *tag)
+{
+	music_tag_taglib_t *_tag = (music_tag_taglib_t *)tag;
+	taglib_free(_tag->base.artist);
+	taglib_free(_tag->base.title);
+	taglib_free(_tag->base.album);
+	taglib_file_free(_tag->file);
+	free(_tag);
+}
+
 music_tag_t *
-music_tag_create(const char *path)
+music_tag_backend_create(const char *path)
 {
 	const TagLib_AudioProperties *props = NULL;
 	TagLib_File *file = NULL;
 	TagLib_Tag *tag = NULL;
 	music_tag_taglib_t *ret = NULL;
 
+	/*
+	 * Scanner keeps a batch of tags alive at a time, strings have to be
+	 * freed per tag rather than all at once by taglib_tag_free_strings().
+	 */
+	static int string_management_disabled = 0;
+	if (!string_management_disabled) {
+		taglib_set_string_management_enabled(0);
+		string_management_disabled = 1;
+	}
+
 	if ((file = taglib_file_new(path)) == NULL || !taglib_file_is_valid(file)) {
 		log_debug("Unrecoginzed file type: %s", path);
 		return NULL;
@@ -63,7 +84,7 @@ music_tag_create(const char *path)
 	}
 
 	ret = malloc(sizeof(music_tag_taglib_t));
-	if (tag == NULL) {
+	if (ret == NULL) {
 		log_error("Failed to allocate memory or music tag!");
 		goto failure;
 	}
@@ -73,6 +94,7 @@ music_tag_create(const char *path)
 	ret->base.album = taglib_tag_album(tag);
 	ret->base.track = taglib_tag_track(tag);
 	ret->base.length = taglib_audioproperties_length(props);
+	ret->base.destroy = _music_tag_taglib_destroy;
 	ret->file = file;
 
 	log_trace("TAG: %s -> (%s, %s, %s, %d, %d)", path, ret->base.artist, ret->base.album,
@@ -84,15 +106,5 @@ failure:
 	if (file) {
 		taglib_file_free(file);
 	}
-	taglib_tag_free_strings();
 	return NULL;
 }
-
-void
-music_tag_destroy(music_tag_t *tag)
-{
-	music_tag_taglib_t *_tag = (music_tag_taglib_t *)tag;
-	taglib_file_free(_tag->file);
-	taglib_tag_free_strings();
-	free(_tag);
-}
@@ -34,8 +34,11 @@
 #include <pthread.h>
 #include <sys/queue.h>
 
+#include "evlog.h"
 #include "logger.h"
+#include "metrics.h"
 #include "scheduler.h"
+#include "span.h"
 
 typedef struct event_queue_elm {
 	SIMPLEQ_ENTRY(event_queue_elm) queue;
@@ -61,6 +64,9 @@ typedef struct {
 	SIMPLEQ_HEAD(,task_queue_elm)   task_queue;
 
 	int terminate;
+
+	metric_t *queued_metric;
+	metric_t *status_metrics[TASK_STATUS_FAILED + 1];
 } _scheduler_t;
 
 static void
@@ -69,6 +75,7 @@ _execute_tasks(_scheduler_t *sched)
 	task_queue_elm_t *elm = NULL;
 	task_status_t status;
 	task_t *task = NULL;
+	span_t span;
 
 	while (!sched->terminate) {
 		pthread_mutex_lock(&sched->mutex);
@@ -80,13 +87,19 @@ _execute_tasks(_scheduler_t *sched)
 
 		elm = SIMPLEQ_FIRST(&sched->task_queue);
 		SIMPLEQ_REMOVE_HEAD(&sched->task_queue, queue);
+		metrics_gauge_add(sched->queued_metric, -1);
 
 		pthread_mutex_unlock(&sched->mutex);
 
 		task = elm->task;
 
 		log_trace("Executing task: %s", task->name);
+		evlog("task run %s", task->name);
+		span = span_begin();
 		status =  task->run(task->user_data);
+		span_end(span, task->name);
+		evlog("task done %s status %d", task->name, status);
+		metrics_inc(sched->status_metrics[status]);
 
 		if (status == TASK_STATUS_FINISHED) {
 			log_trace("Task finished: %s", task->name);
@@ -98,15 +111,19 @@ _execute_tasks(_scheduler_t *sched)
 			log_trace("Task yielded: %s", task->name);
 			pthread_mutex_lock(&sched->mutex);
 			SIMPLEQ_INSERT_TAIL(&sched->task_queue, elm, queue);
+			metrics_gauge_add(sched->queued_metric, 1);
 			pthread_mutex_unlock(&sched->mutex);
 			continue;
 		}
 
+		if (status == TASK_STATUS_CANCELED) {
+			log_trace("Task canceled: %s", task->name);
+		}
+
 		free(elm);
 		free(task);
 
 		if (status == TASK_STATUS_CANCELED) {
-			log_trace("Task canceled: %s", task->name);
 			return;
 		}
 	}
@@ -134,7 +151,8 @@ _worker_thread(void *arg)
 	log_info("Scheduler: Worker thread %d started", id);
 
 	while (!ts->terminate) {
-		if (0 != pthread_cond_wait(&ts->cv, &ts->mutex)) {
+		/* Tasks queued before this thread got here have no wakeup coming */
+		if (SIMPLEQ_EMPTY(&ts->task_queue) && 0 != pthread_cond_wait(&ts->cv, &ts->mutex)) {
 			log_error("Condition variable wait failed!");
 			pthread_exit((void **)-1);
 		}
@@ -179,7 +197,9 @@ _event_handler(evutil_socket_t fd, short event, void *arg)
 		pthread_mutex_unlock(&sch->mutex);
 
 		log_debug("Processing event: %s", elm->event->name);
+		evlog("event run %s", elm->event->name);
 		elm->event->run(elm->event->user_data);
+		evlog("event done %s", elm->event->name);
 		log_debug("Event processed: %s", elm->event->name);
 
 		pthread_mutex_lock(&sch->mutex);
@@ -217,6 +237,23 @@ _get_thread_count(cfg_t *cfg)
 	return 1;
 }
 
+static void
+_register_metrics(_scheduler_t *ts)
+{
+	static const char *help = "Scheduler tasks run, by returned status.";
+
+	ts->queued_metric = metrics_register(METRIC_GAUGE, "basileus_scheduler_queued_tasks",
+		NULL, "Tasks waiting for a worker thread.");
+	ts->status_metrics[TASK_STATUS_FINISHED] = metrics_register(METRIC_COUNTER,
+		"basileus_scheduler_tasks_total", "status=\"finished\"", help);
+	ts->status_metrics[TASK_STATUS_YIELD] = metrics_register(METRIC_COUNTER,
+		"basileus_scheduler_tasks_total", "status=\"yield\"", help);
+	ts->status_metrics[TASK_STATUS_CANCELED] = metrics_register(METRIC_COUNTER,
+		"basileus_scheduler_tasks_total", "status=\"canceled\"", help);
+	ts->status_metrics[TASK_STATUS_FAILED] = metrics_register(METRIC_COUNTER,
+		"basileus_scheduler_tasks_total", "status=\"failed\"", help);
+}
+
 scheduler_t *
 scheduler_new(cfg_t *config, struct event_base *evb)
 {
@@ -233,6 +270,8 @@ scheduler_new(cfg_t *config, struct event_base *evb)
 	SIMPLEQ_INIT(&ts->event_queue);
 	SIMPLEQ_INIT(&ts->task_queue);
 
+	_register_metrics(ts);
+
 	ts->event = event_new(evb, -1, 0, _event_handler, ts);
 	if (NULL == ts->event) {
 		log_error("Failed to create new scheduler event!");
@@ -323,6 +362,8 @@ scheduler_free(scheduler_t *sch)
 		telm = tnx;
 	}
 
+	metrics_set(ts->queued_metric, 0);
+
 	enx = eelm = SIMPLEQ_FIRST(&ts->event_queue);
 	while (enx) {
 		enx = SIMPLEQ_NEXT(eelm, queue);
@@ -357,6 +398,7 @@ scheduler_add_task(scheduler_t *s, task_t *task)
 	pthread_mutex_lock(&sched->mutex);
 
 	SIMPLEQ_INSERT_TAIL(&sched->task_queue, elm, queue);
+	metrics_gauge_add(sched->queued_metric, 1);
 
 	pthread_mutex_unlock(&sched->mutex);
 
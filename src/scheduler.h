@@ -44,6 +44,7 @@ typedef enum {
 } task_status_t;
 
 typedef struct {
+	/* Static string, recorded as span name when tracing */
 	const char     *name;
 	void           *user_data;
 	task_status_t  (*run)       (void *user_data);
@@ -0,0 +1,216 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "span.h"
+
+/* Default number of spans kept per thread */
+#define SPAN_DEFAULT_SIZE 16384
+
+typedef struct {
+	const char *name;
+	uint64_t    start;
+	uint64_t    duration;
+	uint32_t    thread;
+} _span_event_t;
+
+/*
+ * Ring buffer of a thread. Only the owning thread writes to it, readers
+ * detect spans overwritten while they were being copied by looking at
+ * head again. Buffers of exited threads are reused by new ones.
+ */
+typedef struct _span_ring {
+	struct _span_ring *next;
+	int                in_use;
+	uint32_t           thread;
+	unsigned long      head;
+	size_t             size;
+	_span_event_t      events[];
+} _span_ring_t;
+
+int span_enabled = 0;
+
+static pthread_mutex_t  _span_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t   _span_once = PTHREAD_ONCE_INIT;
+static pthread_key_t    _span_key;
+static _span_ring_t    *_span_rings = NULL;
+static size_t           _span_size = SPAN_DEFAULT_SIZE;
+static uint32_t         _span_threads = 0;
+
+static void
+_span_ring_release(void *data)
+{
+	_span_ring_t *ring = data;
+
+	__atomic_store_n(&ring->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void
+_span_key_init()
+{
+	(void)pthread_key_create(&_span_key, _span_ring_release);
+}
+
+static _span_ring_t *
+_span_ring_get()
+{
+	_span_ring_t *ring;
+
+	pthread_once(&_span_once, _span_key_init);
+	if (NULL != (ring = pthread_getspecific(_span_key))) {
+		return ring;
+	}
+
+	pthread_mutex_lock(&_span_lock);
+	for (ring = _span_rings; ring; ring = ring->next) {
+		if (!ring->in_use && ring->size == _span_size) {
+			break;
+		}
+	}
+	if (ring == NULL) {
+		ring = malloc(sizeof(_span_ring_t) + _span_size * sizeof(_span_event_t));
+		if (ring != NULL) {
+			ring->head = 0;
+			ring->size = _span_size;
+			ring->next = _span_rings;
+			_span_rings = ring;
+		}
+	}
+	if (ring != NULL) {
+		ring->in_use = 1;
+		ring->thread = ++_span_threads;
+		(void)pthread_setspecific(_span_key, ring);
+	}
+	pthread_mutex_unlock(&_span_lock);
+
+	return ring;
+}
+
+void
+span_configure(size_t spans)
+{
+	size_t size = 1;
+
+	while (size < spans) {
+		size <<= 1;
+	}
+
+	pthread_mutex_lock(&_span_lock);
+	_span_size = size;
+	pthread_mutex_unlock(&_span_lock);
+}
+
+void
+span_enable(int enable)
+{
+	__atomic_store_n(&span_enabled, enable != 0, __ATOMIC_RELAXED);
+}
+
+uint64_t
+span_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+span_record(const char *name, uint64_t start)
+{
+	_span_ring_t *ring = _span_ring_get();
+	_span_event_t *e;
+
+	if (ring == NULL) {
+		return;
+	}
+
+	e = &ring->events[ring->head & (ring->size - 1)];
+	e->name = name;
+	e->start = start;
+	e->duration = span_now() - start;
+	e->thread = ring->thread;
+	__atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+static void
+_span_write_string(FILE *out, const char *s)
+{
+	fputc('"', out);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\') {
+			fputc('\\', out);
+		}
+		fputc(*s, out);
+	}
+	fputc('"', out);
+}
+
+int
+span_write_json(FILE *out)
+{
+	_span_ring_t *ring;
+	_span_event_t e;
+	unsigned long head, i;
+	int pid = getpid(), first = 1;
+
+	fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+	pthread_mutex_lock(&_span_lock);
+	for (ring = _span_rings; ring; ring = ring->next) {
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		for (i = head > ring->size ? head - ring->size : 0; i < head; i++) {
+			e = ring->events[i & (ring->size - 1)];
+			/* Skip spans overwritten while being copied */
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&ring->head, __ATOMIC_RELAXED) - i >= ring->size) {
+				continue;
+			}
+
+			fprintf(out, "%s\n{\"name\":", first ? "" : ",");
+			_span_write_string(out, e.name);
+			fprintf(out, ",\"cat\":\"basileus\",\"ph\":\"X\",\"ts\":%llu.%03u,"
+			        "\"dur\":%llu.%03u,\"pid\":%d,\"tid\":%u}",
+			        (unsigned long long)(e.start / 1000), (unsigned)(e.start % 1000),
+			        (unsigned long long)(e.duration / 1000), (unsigned)(e.duration % 1000),
+			        pid, e.thread);
+			first = 0;
+		}
+	}
+	pthread_mutex_unlock(&_span_lock);
+
+	fprintf(out, "\n]}\n");
+
+	return ferror(out) ? -1 : 0;
+}
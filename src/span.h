@@ -0,0 +1,98 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef SPAN_H
+#define SPAN_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * Span tracing. Timed sections of code are recorded in per thread ring
+ * buffers, which keep the most recent spans of each thread, and are
+ * written out as Chrome trace event JSON, readable by chrome://tracing
+ * and Perfetto. A span costs a single branch when tracing is disabled.
+ *
+ *	span_t span = span_begin();
+ *	...
+ *	span_end(span, "name");
+ *
+ * Span names are not copied, they must stay valid for the lifetime of
+ * the process.
+ */
+
+typedef uint64_t span_t;
+
+/* Nonzero while spans are recorded, checked by span_begin() */
+extern int span_enabled;
+
+/**
+ * Sets number of spans kept for each thread, rounded up to a power of
+ * two. Applies to buffers of threads which record their first span
+ * afterwards.
+ */
+void
+span_configure(size_t spans);
+
+/**
+ * Starts or stops recording spans.
+ */
+void
+span_enable(int enable);
+
+/**
+ * Writes recorded spans as Chrome trace event JSON.
+ * Returns 0 on success, -1 on write error.
+ */
+int
+span_write_json(FILE *out);
+
+/**
+ * Current time in nanoseconds. Should not be used directly.
+ */
+uint64_t
+span_now();
+
+/**
+ * Records span which started at given time. Should not be used directly.
+ */
+void
+span_record(const char *name, uint64_t start);
+
+#define span_begin() \
+	(__builtin_expect(span_enabled, 0) ? span_now() : 0)
+
+#define span_end(span, name) \
+	do { \
+		if (__builtin_expect((span) != 0, 0)) { \
+			span_record(name, span); \
+		} \
+	} while (0)
+
+#endif /* SPAN_H */
@@ -0,0 +1,216 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "bench_util.h"
+
+double
+bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+unsigned int
+bench_random(unsigned int *state)
+{
+	unsigned int x = *state ? *state : 0x9e3779b9;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+int
+bench_compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+int
+bench_compare_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+	return x < y ? -1 : x > y;
+}
+
+int
+bench_scan(music_db_t mdb, struct event_base *evb, music_db_status_t *status, double *time)
+{
+	struct timespec poll = { 0, 1000000 };
+	music_db_status_t s;
+	double start = bench_now();
+
+	if (0 != music_db_refresh(mdb)) {
+		return -1;
+	}
+	do {
+		nanosleep(&poll, NULL);
+		music_db_get_status(mdb, &s);
+	} while (s.scan_in_progress);
+	if (time) {
+		*time = bench_now() - start;
+	}
+	if (status) {
+		*status = s;
+	}
+
+	while (evb && event_base_loop(evb, EVLOOP_ONCE) == 1) {
+		nanosleep(&poll, NULL);
+	}
+	return 0;
+}
+
+static int
+_evict_file(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	int fd;
+
+	if (type == FTW_F && (fd = open(path, O_RDONLY)) >= 0) {
+		(void)posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+	return 0;
+}
+
+const char *
+bench_evict(const char *path)
+{
+	FILE *f = NULL;
+
+	/* Freshly written pages are dirty, they have to be written out first */
+	sync();
+	if ((f = fopen("/proc/sys/vm/drop_caches", "w")) != NULL) {
+		if (fputs("1\n", f) >= 0 && fclose(f) == 0) {
+			return "drop_caches";
+		}
+	}
+	(void)nftw(path, _evict_file, 64, FTW_PHYS);
+	return "fadvise";
+}
+
+static int
+_add(char ***list, int *count, const char *s)
+{
+	char **tmp = NULL;
+
+	if ((tmp = realloc(*list, (*count + 1) * sizeof(char *))) == NULL) {
+		return -1;
+	}
+	*list = tmp;
+	if (((*list)[*count] = strdup(s)) == NULL) {
+		return -1;
+	}
+	(*count)++;
+	return 0;
+}
+
+int
+bench_load_catalog(music_db_t mdb, bench_catalog_t *catalog)
+{
+	struct json_object *artists = NULL, *albums = NULL, *songs = NULL, *id;
+	const char *artist, *album;
+	int i, j, k, n, ret = -1;
+
+	if ((artists = music_db_get_artists(mdb, NULL, -1)) == NULL) {
+		return -1;
+	}
+	for (i = 0; i < (int)json_object_array_length(artists); i++) {
+		artist = json_object_get_string(json_object_array_get_idx(artists, i));
+		if (0 != _add(&catalog->artists, &catalog->artist_count, artist) ||
+		    (albums = music_db_get_albums(mdb, artist, NULL, -1)) == NULL) {
+			goto finish;
+		}
+		for (j = 0; j < (int)json_object_array_length(albums); j++) {
+			album = json_object_get_string(json_object_array_get_idx(albums, j));
+			n = catalog->album_count;
+			if (0 != _add(&catalog->album_artists, &n, artist) ||
+			    0 != _add(&catalog->albums, &catalog->album_count, album) ||
+			    (songs = music_db_get_songs(mdb, artist, album, NULL, -1)) == NULL) {
+				goto finish;
+			}
+			for (k = 0; k < (int)json_object_array_length(songs); k++) {
+				json_object_object_get_ex(json_object_array_get_idx(songs, k), "id", &id);
+				if (0 != _add(&catalog->ids, &catalog->id_count, json_object_get_string(id))) {
+					goto finish;
+				}
+			}
+			json_object_put(songs);
+			songs = NULL;
+		}
+		json_object_put(albums);
+		albums = NULL;
+	}
+	ret = catalog->id_count > 0 ? 0 : -1;
+
+finish:
+	if (songs) {
+		json_object_put(songs);
+	}
+	if (albums) {
+		json_object_put(albums);
+	}
+	json_object_put(artists);
+	return ret;
+}
+
+static void
+_free_list(char **list, int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		free(list[i]);
+	}
+	free(list);
+}
+
+void
+bench_catalog_free(bench_catalog_t *catalog)
+{
+	_free_list(catalog->artists, catalog->artist_count);
+	_free_list(catalog->albums, catalog->album_count);
+	_free_list(catalog->album_artists, catalog->album_count);
+	_free_list(catalog->ids, catalog->id_count);
+	memset(catalog, 0, sizeof(*catalog));
+}
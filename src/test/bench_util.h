@@ -0,0 +1,105 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _BENCH_UTIL_H_
+#define _BENCH_UTIL_H_
+
+#include <event2/event.h>
+
+#include "music_db.h"
+
+/*
+ * Helpers shared by the benchmarks: timing, a pseudo random generator,
+ * scanning a library, page cache eviction and the scanned catalog.
+ */
+
+/* Artists, albums and song ids of a scanned library */
+typedef struct {
+	char       **artists;
+	char       **albums;
+	char       **album_artists; /* Artist of each album */
+	char       **ids;
+	int          artist_count;
+	int          album_count;
+	int          id_count;
+} bench_catalog_t;
+
+/**
+ * Monotonic time in seconds.
+ */
+double
+bench_now(void);
+
+/**
+ * Next value of xorshift generator with given state.
+ */
+unsigned int
+bench_random(unsigned int *state);
+
+/**
+ * qsort() comparators of doubles and unsigned ints.
+ */
+int
+bench_compare_double(const void *a, const void *b);
+
+int
+bench_compare_uint(const void *a, const void *b);
+
+/**
+ * Runs a scan and waits for it to finish. If evb is not NULL, the event
+ * joining the scan thread is delivered on it too, which has to happen
+ * before the next scan; otherwise some other thread must be running it.
+ * Status after the scan and its time in seconds are stored in status and
+ * time unless they are NULL. Returns 0 on success, -1 on failure.
+ */
+int
+bench_scan(music_db_t mdb, struct event_base *evb, music_db_status_t *status, double *time);
+
+/**
+ * Drops clean pages from the page cache, or when not permitted, pages of
+ * files under path, which may be a file or a directory. Dirty pages are
+ * written out first. Returns the method used, "drop_caches" or "fadvise".
+ */
+const char *
+bench_evict(const char *path);
+
+/**
+ * Loads all artists, albums and song ids from the database.
+ * Returns 0 on success, -1 on failure or if there are no songs.
+ */
+int
+bench_load_catalog(music_db_t mdb, bench_catalog_t *catalog);
+
+/**
+ * Frees everything loaded into catalog and clears it.
+ */
+void
+bench_catalog_free(bench_catalog_t *catalog);
+
+#endif /* !_BENCH_UTIL_H_ */
@@ -0,0 +1,503 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Catalog query benchmark. Populates a database by scanning a synthetic
+ * library (see library_gen.h), or reuses one kept with -k, then times
+ * music_db_get_artists(), music_db_get_albums(), music_db_get_songs() and
+ * music_db_get_song_path() for random artists, albums and songs. Calls
+ * are split into the SQLite part, measured by running the same
+ * statements with the same bindings on a second connection and reading
+ * every column, JSON tree building, which is the rest of the call, and
+ * serialization with json_object_to_json_string(). Allocations made by
+ * the calls and by serialization are counted by wrapping malloc. Cold
+ * runs reopen the database after dropping the page cache, or when that
+ * is not permitted, after evicting the database file with posix_fadvise.
+ * Results are printed as lines of JSON, one per call and cache state.
+ */
+
+#define _XOPEN_SOURCE 700
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <event2/event.h>
+#include <event2/thread.h>
+#include <sqlite3.h>
+
+#include "cfg.h"
+#include "logger.h"
+#include "music_db.h"
+#include "music_db_sql.h"
+#include "scheduler.h"
+#include "bench_util.h"
+#include "library_gen.h"
+
+typedef enum {
+	CALL_ARTISTS = 0,
+	CALL_ALBUMS,
+	CALL_SONGS,
+	CALL_SONG_PATH,
+	CALL_LAST
+} call_t;
+
+static const char *call_names[CALL_LAST] = {
+	"get_artists", "get_albums", "get_songs", "get_song_path"
+};
+
+typedef struct {
+	double  *usec;
+	int      count;
+	double   serialize;
+	double   allocs;
+	double   serialize_allocs;
+	double   bytes;
+} _result_t;
+
+static bench_catalog_t catalog;
+
+static int limit = -1;
+
+#ifdef __GLIBC__
+/*
+ * Every allocation goes through these, json-c and SQLite included
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+static unsigned long allocations = 0;
+
+void *
+malloc(size_t size)
+{
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t n, size_t size)
+{
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(n, size);
+}
+
+void *
+realloc(void *p, size_t size)
+{
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(p, size);
+}
+
+#define ALLOCATIONS() __atomic_load_n(&allocations, __ATOMIC_RELAXED)
+#else
+#define ALLOCATIONS() 0
+#endif /* __GLIBC__ */
+
+static int
+_arguments(call_t call)
+{
+	return call == CALL_ARTISTS ? 1 : call == CALL_ALBUMS ? catalog.artist_count :
+	       call == CALL_SONGS ? catalog.album_count : catalog.id_count;
+}
+
+/*
+ * Same statements and bindings as music_db.c, every column is read
+ */
+static int
+_query(sqlite3 *db, call_t call, int i)
+{
+	static const int columns[CALL_LAST] = { 1, 1, 4, 1 };
+	sqlite3_stmt *stmt = NULL;
+	const char *sql = call == CALL_ARTISTS ? MUSIC_DB_SQL(ARTISTS) :
+	                  call == CALL_ALBUMS ? MUSIC_DB_SQL(ALBUMS) :
+	                  call == CALL_SONGS ? MUSIC_DB_SQL(SONGS) : MUSIC_DB_SQL(SONG_PATH);
+	int c, rc, ret = -1;
+
+	if (SQLITE_OK != sqlite3_prepare_v2(db, sql, -1, &stmt, NULL)) {
+		goto finish;
+	}
+	if (call == CALL_ALBUMS) {
+		rc = sqlite3_bind_text(stmt, 1, catalog.artists[i], -1, 0);
+		rc = rc ? rc : sqlite3_bind_int(stmt, 3, limit < 0 ? -1 : limit + 1);
+	} else if (call == CALL_SONGS) {
+		rc = sqlite3_bind_text(stmt, 1, catalog.albums[i], -1, 0);
+		rc = rc ? rc : sqlite3_bind_text(stmt, 2, catalog.album_artists[i], -1, 0);
+		rc = rc ? rc : sqlite3_bind_int(stmt, 5, limit < 0 ? -1 : limit + 1);
+	} else if (call == CALL_SONG_PATH) {
+		rc = sqlite3_bind_int64(stmt, 1, atoll(catalog.ids[i]));
+	} else {
+		rc = sqlite3_bind_int(stmt, 3, limit < 0 ? -1 : limit + 1);
+	}
+	if (rc != SQLITE_OK) {
+		goto finish;
+	}
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		for (c = 0; c < columns[call]; c++) {
+			if (sqlite3_column_type(stmt, c) == SQLITE_TEXT) {
+				(void)sqlite3_column_text(stmt, c);
+			} else {
+				(void)sqlite3_column_int64(stmt, c);
+			}
+		}
+	}
+	ret = rc == SQLITE_DONE ? 0 : -1;
+
+finish:
+	sqlite3_finalize(stmt);
+	return ret;
+}
+
+/*
+ * Read-only connection in the state music_db_new() leaves its own in,
+ * schema loaded and album generations read
+ */
+static sqlite3 *
+_open_direct(const char *db)
+{
+	sqlite3 *direct = NULL;
+
+	if (SQLITE_OK != sqlite3_open_v2(db, &direct, SQLITE_OPEN_READONLY, NULL) ||
+	    SQLITE_OK != sqlite3_exec(direct, MUSIC_DB_SQL(GENERATION), NULL, NULL, NULL)) {
+		sqlite3_close(direct);
+		return NULL;
+	}
+	return direct;
+}
+
+/*
+ * Times a call and serialization of its result
+ */
+static int
+_call(music_db_t mdb, call_t call, int i, _result_t *r)
+{
+	struct json_object *json = NULL;
+	unsigned long a0, a1, a2;
+	const char *s;
+	char *path = NULL;
+	double t0, t1, t2;
+
+	a0 = ALLOCATIONS();
+	t0 = bench_now();
+	switch (call) {
+	case CALL_ARTISTS:
+		json = music_db_get_artists(mdb, NULL, limit);
+		break;
+	case CALL_ALBUMS:
+		json = music_db_get_albums(mdb, catalog.artists[i], NULL, limit);
+		break;
+	case CALL_SONGS:
+		json = music_db_get_songs(mdb, catalog.album_artists[i], catalog.albums[i], NULL, limit);
+		break;
+	default:
+		path = music_db_get_song_path(mdb, catalog.ids[i]);
+		break;
+	}
+	t1 = bench_now();
+	a1 = ALLOCATIONS();
+	if (json == NULL && path == NULL) {
+		return -1;
+	}
+	if (json) {
+		s = json_object_to_json_string(json);
+		r->bytes += strlen(s);
+	}
+	t2 = bench_now();
+	a2 = ALLOCATIONS();
+	json_object_put(json);
+	free(path);
+
+	r->usec[r->count++] = (t1 - t0) * 1e6;
+	r->serialize += (t2 - t1) * 1e6;
+	r->allocs += a1 - a0;
+	r->serialize_allocs += a2 - a1;
+	return 0;
+}
+
+static void
+_report(FILE *out, call_t call, const char *cache, _result_t *r, double query)
+{
+	double mean = 0;
+	int i;
+
+	qsort(r->usec, r->count, sizeof(double), bench_compare_double);
+	for (i = 0; i < r->count; i++) {
+		mean += r->usec[i] / r->count;
+	}
+	fprintf(out, "{\"benchmark\": \"catalog\", \"call\": \"%s\", \"cache\": \"%s\", "
+	        "\"artists\": %d, \"albums\": %d, \"songs\": %d, \"limit\": %d, \"calls\": %d, "
+	        "\"mean_us\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"query_us\": %.1f, "
+	        "\"build_us\": %.1f, \"serialize_us\": %.1f, \"allocs_per_call\": %.1f, "
+	        "\"serialize_allocs_per_call\": %.1f, \"json_bytes\": %.0f}\n",
+	        call_names[call], cache, catalog.artist_count, catalog.album_count,
+	        catalog.id_count, limit, r->count, mean, r->usec[r->count / 2],
+	        r->usec[(int)(r->count * 0.99)], query, mean > query ? mean - query : 0,
+	        r->serialize / r->count, r->allocs / r->count, r->serialize_allocs / r->count,
+	        r->bytes / r->count);
+	fflush(out);
+}
+
+static void
+_usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-a artists] [-A albums] [-t tracks] [-n calls] "
+	        "[-c cold runs] [-l limit] [-k directory] [-o output]\n", name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char tmpl[] = "/tmp/catalog-bench-XXXXXX";
+	char library[1024], db[1024], conf[1024], cache[32];
+	library_gen_spec_t spec;
+	library_gen_stats_t stats;
+	struct event_base *evb = NULL;
+	scheduler_t *sched = NULL;
+	music_db_t mdb = NULL;
+	sqlite3 *direct = NULL;
+	cfg_t *cfg = NULL;
+	FILE *out = stdout, *f = NULL;
+	_result_t result;
+	struct stat st;
+	const char *keep = NULL;
+	char *dir = NULL;
+	unsigned int state;
+	double t0, query;
+	int calls = 2000, cold = 5, populated, call, i, idx, opt, ret = 1;
+
+	library_gen_defaults(&spec);
+	spec.artists = 200;
+	spec.albums = 5;
+	spec.tracks = 12;
+	spec.junk = 0;
+	/* Only tags matter here */
+	spec.audio_size = 4096;
+	while ((opt = getopt(argc, argv, "a:A:t:n:c:l:k:o:")) != -1) {
+		switch (opt) {
+		case 'a':
+			spec.artists = atoi(optarg);
+			break;
+		case 'A':
+			spec.albums = atoi(optarg);
+			break;
+		case 't':
+			spec.tracks = atoi(optarg);
+			break;
+		case 'n':
+			calls = atoi(optarg);
+			break;
+		case 'c':
+			cold = atoi(optarg);
+			break;
+		case 'l':
+			limit = atoi(optarg);
+			break;
+		case 'k':
+			keep = optarg;
+			break;
+		case 'o':
+			if ((out = fopen(optarg, "a")) == NULL) {
+				fprintf(stderr, "Failed to open %s\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			_usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc || spec.artists < 1 || spec.albums < 1 || spec.tracks < 1 ||
+	    calls < 1 || cold < 0 || limit == 0 || limit < -1) {
+		_usage(argv[0]);
+		return 1;
+	}
+
+	logger_set_level("warning");
+
+	if (keep) {
+		dir = (char *)keep;
+		if (0 != mkdir(dir, 0755) && errno != EEXIST) {
+			fprintf(stderr, "Failed to create %s\n", dir);
+			return 1;
+		}
+	} else if ((dir = mkdtemp(tmpl)) == NULL) {
+		fprintf(stderr, "Failed to create temporary directory\n");
+		return 1;
+	}
+	snprintf(library, sizeof(library), "%s/library", dir);
+	snprintf(db, sizeof(db), "%s/music.db", dir);
+	snprintf(conf, sizeof(conf), "%s/catalog-bench.conf", dir);
+	populated = stat(db, &st) == 0;
+
+	if (!populated) {
+		t0 = bench_now();
+		if (0 != mkdir(library, 0755) || 0 != library_gen(library, &spec, &stats)) {
+			fprintf(stderr, "Failed to generate library in %s: %s\n", library,
+			        strerror(errno));
+			goto finish;
+		}
+		fprintf(stderr, "Generated %d tracks in %.1f s\n", stats.tracks, bench_now() - t0);
+	}
+
+	/* Statement profiling would add to calls, but not to the direct queries */
+	if ((f = fopen(conf, "w")) == NULL) {
+		fprintf(stderr, "Failed to write %s\n", conf);
+		goto finish;
+	}
+	fprintf(f, "music-dir = %s\ndatabase-path = %s\nprofile-statements = 0\n", library, db);
+	fclose(f);
+
+	if (0 != evthread_use_pthreads() || (evb = event_base_new()) == NULL ||
+	    0 != evthread_make_base_notifiable(evb)) {
+		fprintf(stderr, "Failed to create event base\n");
+		goto finish;
+	}
+	if ((cfg = cfg_init(conf)) == NULL || (sched = scheduler_new(cfg, evb)) == NULL ||
+	    (mdb = music_db_new(cfg, sched)) == NULL) {
+		fprintf(stderr, "Failed to open music database\n");
+		goto finish;
+	}
+	if (!populated) {
+		t0 = bench_now();
+		if (0 != bench_scan(mdb, evb, NULL, NULL)) {
+			fprintf(stderr, "Failed to scan library\n");
+			goto finish;
+		}
+		fprintf(stderr, "Scanned in %.1f s\n", bench_now() - t0);
+	}
+	if (0 != bench_load_catalog(mdb, &catalog)) {
+		fprintf(stderr, "Music database is empty\n");
+		goto finish;
+	}
+	if ((direct = _open_direct(db)) == NULL) {
+		fprintf(stderr, "Failed to open %s\n", db);
+		goto finish;
+	}
+
+	memset(&result, 0, sizeof(result));
+	if ((result.usec = malloc((calls > cold ? calls : cold) * sizeof(double))) == NULL) {
+		goto finish;
+	}
+
+	for (call = 0; call < CALL_LAST; call++) {
+		/* Warm up caches, then the same arguments for calls and queries */
+		for (i = 0; i < _arguments(call) && i < 100; i++) {
+			_query(direct, call, i);
+		}
+		result.count = 0;
+		result.serialize = result.allocs = result.serialize_allocs = 0;
+		result.bytes = 0;
+		for (i = 0, state = call + 1; i < calls; i++) {
+			if (0 != _call(mdb, call, bench_random(&state) % _arguments(call), &result)) {
+				fprintf(stderr, "%s failed\n", call_names[call]);
+				goto finish;
+			}
+		}
+		t0 = bench_now();
+		for (i = 0, state = call + 1; i < calls; i++) {
+			if (0 != _query(direct, call, bench_random(&state) % _arguments(call))) {
+				fprintf(stderr, "Query of %s failed\n", call_names[call]);
+				goto finish;
+			}
+		}
+		_report(out, call, "warm", &result, (bench_now() - t0) * 1e6 / calls);
+	}
+
+	/* Both connections have to be gone before sqlite3 is shut down */
+	sqlite3_close(direct);
+	direct = NULL;
+	music_db_free(mdb);
+	mdb = NULL;
+
+	for (call = 0; cold > 0 && call < CALL_LAST; call++) {
+		result.count = 0;
+		result.serialize = result.allocs = result.serialize_allocs = 0;
+		result.bytes = 0;
+		query = 0;
+		for (i = 0, state = call + 1; i < cold; i++) {
+			idx = bench_random(&state) % _arguments(call);
+
+			/* Pages read when opening stay in the connection's own cache */
+			if ((mdb = music_db_new(cfg, sched)) == NULL) {
+				goto finish;
+			}
+			snprintf(cache, sizeof(cache), "cold, %s", bench_evict(db));
+			if (0 != _call(mdb, call, idx, &result)) {
+				fprintf(stderr, "%s failed\n", call_names[call]);
+				goto finish;
+			}
+			music_db_free(mdb);
+			mdb = NULL;
+
+			if ((direct = _open_direct(db)) == NULL) {
+				goto finish;
+			}
+			bench_evict(db);
+			t0 = bench_now();
+			_query(direct, call, idx);
+			query += (bench_now() - t0) * 1e6 / cold;
+			sqlite3_close(direct);
+			direct = NULL;
+			sqlite3_shutdown();
+		}
+		_report(out, call, cache, &result, query);
+	}
+
+	ret = 0;
+
+finish:
+	bench_catalog_free(&catalog);
+	if (direct) {
+		sqlite3_close(direct);
+	}
+	if (mdb) {
+		music_db_free(mdb);
+	}
+	if (sched) {
+		scheduler_free(sched);
+	}
+	if (cfg) {
+		cfg_free(cfg);
+	}
+	if (evb) {
+		event_base_free(evb);
+	}
+	if (out != stdout) {
+		fclose(out);
+	}
+	if (!keep) {
+		library_gen_remove(dir);
+	}
+	return ret;
+}
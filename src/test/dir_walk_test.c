@@ -0,0 +1,327 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Checks the directory walker on a generated tree: a directory larger than
+ * one getdents batch, pruned subtrees, symbolic links which must not be
+ * followed, nesting deeper than the walker's limit and the order of
+ * directory completion events. With -b it walks
+ * given directory a few times and reports entries per second.
+ */
+
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "dir_walk.h"
+
+#define MANY_FILES 5000
+
+typedef struct {
+	int files;
+	int dirs;
+	int done;
+	int open;
+	int max_depth;
+	int bad;
+	int stop_after;
+} _counts_t;
+
+static int failures = 0;
+
+static void
+_mkdir(const char *path)
+{
+	if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+		perror(path);
+		exit(1);
+	}
+}
+
+static void
+_touch(const char *path)
+{
+	int fd;
+
+	if ((fd = open(path, O_WRONLY | O_CREAT, 0644)) < 0) {
+		perror(path);
+		exit(1);
+	}
+	close(fd);
+}
+
+static int
+_count(const dir_walk_entry_t *entry, void *data)
+{
+	_counts_t *c = data;
+	struct stat st;
+
+	/* Reported path, name and type must agree with the file system */
+	if (lstat(entry->path, &st) != 0 || strlen(entry->path) != entry->len ||
+	    strchr(entry->name, '/') != NULL ||
+	    (entry->type != DIR_WALK_FILE) != (S_ISDIR(st.st_mode) != 0) ||
+	    strstr(entry->path, "//") != NULL) {
+		fprintf(stderr, "Bad entry: %s\n", entry->path);
+		c->bad++;
+	}
+
+	if (entry->depth > c->max_depth) {
+		c->max_depth = entry->depth;
+	}
+	if (entry->type == DIR_WALK_DIR) {
+		c->dirs++;
+		if (strcmp(entry->name, "pruned") == 0) {
+			return DIR_WALK_PRUNE;
+		}
+		c->open++;
+	} else if (entry->type == DIR_WALK_DIR_DONE) {
+		c->done++;
+		c->open--;
+		if (fstatat(entry->dir_fd, entry->name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+			fprintf(stderr, "Bad parent directory: %s\n", entry->path);
+			c->bad++;
+		}
+		return 0;
+	} else {
+		c->files++;
+	}
+
+	if (c->stop_after && c->files + c->dirs == c->stop_after) {
+		return 42;
+	}
+	return 0;
+}
+
+/*
+ * Removes directories named "vanishing" as they are found, so that the
+ * walker fails to open them. Counts completed directories with errors.
+ */
+static int
+_vanish(const dir_walk_entry_t *entry, void *data)
+{
+	_counts_t *c = data;
+
+	if (entry->type == DIR_WALK_DIR && strcmp(entry->name, "vanishing") == 0) {
+		if (rmdir(entry->path) != 0) {
+			perror(entry->path);
+			exit(1);
+		}
+	} else if (entry->type == DIR_WALK_DIR_DONE) {
+		c->done++;
+		/* Only x and x/y are above the vanished directory */
+		if (entry->error != (strcmp(entry->name, "x") == 0 || strcmp(entry->name, "y") == 0)) {
+			fprintf(stderr, "Bad error flag %d: %s\n", entry->error, entry->path);
+			c->bad++;
+		}
+	}
+	return 0;
+}
+
+static int
+_count_only(const dir_walk_entry_t *entry, void *data)
+{
+	_counts_t *c = data;
+
+	if (entry->type == DIR_WALK_DIR) {
+		c->dirs++;
+	} else if (entry->type == DIR_WALK_FILE) {
+		c->files++;
+	}
+	return 0;
+}
+
+static void
+_expect(const char *what, int got, int expected)
+{
+	if (got != expected) {
+		fprintf(stderr, "%s: got %d, expected %d\n", what, got, expected);
+		failures++;
+	} else {
+		printf("%s: ok\n", what);
+	}
+}
+
+static void
+_bench(const char *dir, int iterations)
+{
+	struct timespec start, end;
+	_counts_t c;
+	double secs;
+	int i;
+
+	memset(&c, 0, sizeof(c));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++) {
+		if (dir_walk(dir, _count_only, &c) != 0) {
+			fprintf(stderr, "Failed to walk %s\n", dir);
+			exit(1);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%d files, %d directories per walk, %.0f entries/s\n",
+	       c.files / iterations, c.dirs / iterations, (c.files + c.dirs) / secs);
+}
+
+static void
+_remove(const char *path)
+{
+	char cmd[512];
+
+	snprintf(cmd, sizeof(cmd), "rm -rf '%s'", path);
+	if (system(cmd) != 0) {
+		fprintf(stderr, "Failed to remove %s\n", path);
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	char tmpl[] = "/tmp/dir-walk-test-XXXXXX";
+	char path[4096];
+	const char *root = NULL;
+	_counts_t c;
+	size_t len;
+	int i, opt, bench = 0, iterations = 10;
+
+	while ((opt = getopt(argc, argv, "bi:")) != -1) {
+		switch (opt) {
+		case 'b':
+			bench = 1;
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-b] [-i iterations] [directory]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (bench && optind < argc) {
+		_bench(argv[optind], iterations);
+		return 0;
+	}
+
+	if ((root = mkdtemp(tmpl)) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	/* root/many/0..4999, root/a/b/song, root/a/pruned/song, root/link -> a */
+	snprintf(path, sizeof(path), "%s/many", root);
+	_mkdir(path);
+	for (i = 0; i < MANY_FILES; i++) {
+		snprintf(path, sizeof(path), "%s/many/file-with-a-longer-name-%d.mp3", root, i);
+		_touch(path);
+	}
+	snprintf(path, sizeof(path), "%s/a", root);
+	_mkdir(path);
+	snprintf(path, sizeof(path), "%s/a/b", root);
+	_mkdir(path);
+	snprintf(path, sizeof(path), "%s/a/b/song.flac", root);
+	_touch(path);
+	snprintf(path, sizeof(path), "%s/a/pruned", root);
+	_mkdir(path);
+	snprintf(path, sizeof(path), "%s/a/pruned/song.flac", root);
+	_touch(path);
+	snprintf(path, sizeof(path), "%s/link", root);
+	if (symlink("a", path) != 0) {
+		perror(path);
+		return 1;
+	}
+
+	/* root/deep/d/d/... nested past DIR_WALK_MAX_DEPTH */
+	len = snprintf(path, sizeof(path), "%s/deep", root);
+	_mkdir(path);
+	for (i = 0; i < DIR_WALK_MAX_DEPTH + 5; i++) {
+		len += snprintf(path + len, sizeof(path) - len, "/d");
+		_mkdir(path);
+	}
+
+	if (bench) {
+		_bench(root, iterations);
+		_remove(root);
+		return 0;
+	}
+
+	memset(&c, 0, sizeof(c));
+	_expect("walk", dir_walk(root, _count, &c), 0);
+	_expect("files", c.files, MANY_FILES + 1);
+	/* many, a, a/b, a/pruned, deep and nested ones up to the limit */
+	_expect("directories", c.dirs, 5 + DIR_WALK_MAX_DEPTH - 1);
+	_expect("max depth", c.max_depth, DIR_WALK_MAX_DEPTH);
+	/* Pruned and too deep directories are not completed */
+	_expect("completed", c.done, c.dirs - 2);
+	_expect("left open", c.open, 1);
+	_expect("bad entries", c.bad, 0);
+
+	/* Trailing slashes are not repeated in paths */
+	snprintf(path, sizeof(path), "%s/a//", root);
+	memset(&c, 0, sizeof(c));
+	_expect("trailing slash", dir_walk(path, _count, &c), 0);
+	_expect("trailing slash entries", c.files + c.dirs + c.bad, 3);
+
+	memset(&c, 0, sizeof(c));
+	c.stop_after = 100;
+	_expect("stop", dir_walk(root, _count, &c), 42);
+	_expect("stop entries", c.files + c.dirs, 100);
+
+	snprintf(path, sizeof(path), "%s/missing", root);
+	_expect("missing root", dir_walk(path, _count, &c), ENOENT);
+
+	/* root/err/x/y/vanishing, root/err/x/ok, root/err/z */
+	snprintf(path, sizeof(path), "%s/err", root);
+	_mkdir(path);
+	snprintf(path, sizeof(path), "%s/err/x", root);
+	_mkdir(path);
+	snprintf(path, sizeof(path), "%s/err/x/y", root);
+	_mkdir(path);
+	snprintf(path, sizeof(path), "%s/err/x/y/vanishing", root);
+	_mkdir(path);
+	snprintf(path, sizeof(path), "%s/err/x/ok", root);
+	_mkdir(path);
+	snprintf(path, sizeof(path), "%s/err/z", root);
+	_mkdir(path);
+	snprintf(path, sizeof(path), "%s/err", root);
+	memset(&c, 0, sizeof(c));
+	_expect("unreadable directory", dir_walk(path, _vanish, &c), 0);
+	/* x, x/y, x/ok and z, the vanished one is never completed */
+	_expect("unreadable completed", c.done, 4);
+	_expect("unreadable error flags", c.bad, 0);
+
+	_remove(root);
+	return failures ? 1 : 0;
+}
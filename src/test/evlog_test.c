@@ -0,0 +1,301 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Logs events from several threads into a log small enough to be rotated
+ * once, decodes both files and checks that no event is lost or garbled.
+ *
+ * With -b measures the cost of logging an event.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "evlog.h"
+
+#define MAX_THREADS 64
+/* Events take about 64 bytes, size the log so that it is rotated once */
+#define LOG_SIZE(events) ((events) * 48)
+
+static const char *names[] = { "", "artist", "a rather long album name" };
+
+static int failures = 0;
+static int events = 2000;
+
+static void *
+_event_thread(void *data)
+{
+	int id = *(int *)data;
+	int i;
+
+	for (i = 0; i < events; i++) {
+		evlog("thread %d event %d name [%s] value %.2f big %lld size %zu", id, i,
+		      names[i % 3], i / 4.0, (long long)i << 33, (size_t)i);
+	}
+	return NULL;
+}
+
+static void
+_run(int threads)
+{
+	pthread_t tids[MAX_THREADS];
+	int ids[MAX_THREADS];
+	int i;
+
+	for (i = 0; i < threads; i++) {
+		ids[i] = i;
+		if (pthread_create(&tids[i], NULL, _event_thread, &ids[i]) != 0) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(tids[i], NULL);
+	}
+}
+
+static void
+_decode(const char *path, FILE *out, int json)
+{
+	FILE *f;
+
+	if ((f = fopen(path, "rb")) == NULL) {
+		perror(path);
+		exit(1);
+	}
+	if (evlog_decode(f, out, json) != 0) {
+		fprintf(stderr, "%s: failed to decode\n", path);
+		failures++;
+	}
+	fclose(f);
+}
+
+static void
+_check_text(FILE *f, int threads)
+{
+	int next[MAX_THREADS];
+	char line[512], expected[512], *msg;
+	int id, seq, literal = 0;
+
+	memset(next, 0, sizeof(next));
+	rewind(f);
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if ((msg = strstr(line, "] ")) == NULL) {
+			fprintf(stderr, "text: no message: %s", line);
+			failures++;
+			continue;
+		}
+		msg += 2;
+		if (strcmp(msg, "literal % width [   42] [ab  ] (null)\n") == 0) {
+			literal++;
+			continue;
+		}
+		if (sscanf(msg, "thread %d event %d", &id, &seq) != 2 ||
+		    id < 0 || id >= threads || seq != next[id]) {
+			fprintf(stderr, "text: unexpected event: %s", msg);
+			failures++;
+			continue;
+		}
+		snprintf(expected, sizeof(expected),
+		         "thread %d event %d name [%s] value %.2f big %lld size %lu\n",
+		         id, seq, names[seq % 3], seq / 4.0, (long long)seq << 33,
+		         (unsigned long)seq);
+		if (strcmp(msg, expected) != 0) {
+			fprintf(stderr, "text: expected %sgot %s", expected, msg);
+			failures++;
+		}
+		next[id] = seq + 1;
+	}
+
+	for (id = 0; id < threads; id++) {
+		if (next[id] != events) {
+			fprintf(stderr, "text: thread %d: %d of %d events\n", id, next[id], events);
+			failures++;
+		}
+	}
+	if (literal != 1) {
+		fprintf(stderr, "text: literal event found %d times\n", literal);
+		failures++;
+	}
+}
+
+static void
+_check_json(FILE *f)
+{
+	char line[1024];
+	int count = 0;
+	time_t now = time(NULL);
+	time_t sec;
+
+	rewind(f);
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (strncmp(line, "{\"time\":", 8) != 0 || strstr(line, "\"args\":[") == NULL) {
+			fprintf(stderr, "json: unexpected line: %s", line);
+			failures++;
+			continue;
+		}
+		/* Record times are real times, the test runs in well under a minute */
+		sec = strtoull(line + 8, NULL, 10) / 1000000000;
+		if (sec < now - 60 || sec > now + 1) {
+			fprintf(stderr, "json: time %ld is not near %ld: %s", (long)sec, (long)now, line);
+			failures++;
+		} else if (strstr(line, "\"message\":\"literal % width [   42] [ab  ] (null)\"") &&
+		           strstr(line, "\"args\":[42,\"ab\",\"(null)\"]")) {
+			count++;
+		}
+	}
+	if (count != 1) {
+		fprintf(stderr, "json: literal event found %d times\n", count);
+		failures++;
+	}
+}
+
+static void
+_test(int threads)
+{
+	char tmpl[] = "/tmp/evlog-test-XXXXXX";
+	char path[256], old[256];
+	FILE *text, *json;
+	char *dir;
+
+	if ((dir = mkdtemp(tmpl)) == NULL) {
+		perror("mkdtemp");
+		exit(1);
+	}
+	snprintf(path, sizeof(path), "%s/events", dir);
+	snprintf(old, sizeof(old), "%s/events.1", dir);
+
+	if (evlog_open(path, LOG_SIZE(threads * events)) != 0) {
+		fprintf(stderr, "Failed to open event log\n");
+		exit(1);
+	}
+	evlog("literal %% width [%5d] [%-4s] %s", 42, "ab", (const char *)NULL);
+	evlog("unsupported %n", (int *)NULL);
+	_run(threads);
+	evlog_close();
+	evlog("not logged %d", 1);
+
+	if (access(old, R_OK) != 0) {
+		fprintf(stderr, "Event log was not rotated\n");
+		failures++;
+	}
+	if ((text = tmpfile()) == NULL || (json = tmpfile()) == NULL) {
+		perror("tmpfile");
+		exit(1);
+	}
+	_decode(old, text, 0);
+	_decode(path, text, 0);
+	_check_text(text, threads);
+	_decode(old, json, 1);
+	_decode(path, json, 1);
+	_check_json(json);
+	fclose(text);
+	fclose(json);
+
+	unlink(path);
+	unlink(old);
+	rmdir(dir);
+
+	fprintf(stderr, "%d threads, %d events: %s\n", threads, threads * events,
+	        failures ? "failed" : "ok");
+}
+
+static double
+_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+_bench(int threads)
+{
+	char path[] = "/tmp/evlog-bench";
+	char old[] = "/tmp/evlog-bench.1";
+	double start;
+
+	if (evlog_open(path, 16 * 1024 * 1024) != 0) {
+		exit(1);
+	}
+	start = _now();
+	_run(threads);
+	fprintf(stderr, "enabled  %2d threads: %6.1f ns/event\n", threads,
+	        (_now() - start) * 1e9 / ((double)threads * events));
+	evlog_close();
+	unlink(path);
+	unlink(old);
+
+	start = _now();
+	_run(threads);
+	fprintf(stderr, "disabled %2d threads: %6.1f ns/event\n", threads,
+	        (_now() - start) * 1e9 / ((double)threads * events));
+}
+
+int
+main(int argc, char *argv[])
+{
+	int threads = 4, bench = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "bn:t:")) != -1) {
+		switch (opt) {
+		case 'b':
+			bench = 1;
+			break;
+		case 'n':
+			events = atoi(optarg);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-b] [-n events] [-t threads]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (threads < 1 || threads > MAX_THREADS || events < 1) {
+		fprintf(stderr, "Invalid thread or event count\n");
+		return 1;
+	}
+
+	if (bench) {
+		_bench(threads);
+		return 0;
+	}
+
+	_test(threads);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,222 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Checks that every multi-buffer MD5 implementation supported by the CPU
+ * produces the same digests as md5_digest(), including messages whose
+ * length lands on padding boundaries. When run with -b it also compares
+ * throughput on path sized messages, as hashed by the scanner, and on file
+ * sized ones.
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md5.h"
+#include "hash.h"
+
+static const char *impls[] = { "scalar", "x4", "x8-avx2" };
+
+#define IMPLS (sizeof(impls) / sizeof(impls[0]))
+
+static double
+_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Allocate count NUL terminated messages of length between min and max,
+ * md5_digest() only takes strings.
+ */
+static hash_job_t *
+_generate(int count, size_t min, size_t max)
+{
+	hash_job_t *jobs = NULL;
+	char *data;
+	size_t len, j;
+	int i;
+
+	jobs = calloc(count, sizeof(hash_job_t));
+	if (jobs == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < count; i++) {
+		len = min + (max > min ? (size_t)rand() % (max - min + 1) : 0);
+		data = malloc(len + 1);
+		jobs[i].digest = malloc(HASH_MD5_SIZE);
+		if (data == NULL || jobs[i].digest == NULL) {
+			free(data);
+			return NULL;
+		}
+		for (j = 0; j < len; j++) {
+			data[j] = 'a' + rand() % 26;
+		}
+		data[len] = '\0';
+		jobs[i].data = data;
+		jobs[i].len = len;
+	}
+	return jobs;
+}
+
+static int
+_verify(const char *impl, hash_job_t *jobs, int count)
+{
+	unsigned char expected[HASH_MD5_SIZE];
+	int i;
+
+	for (i = 0; i < count; i++) {
+		memset(jobs[i].digest, 0, HASH_MD5_SIZE);
+	}
+	hash_md5_batch(jobs, count);
+	for (i = 0; i < count; i++) {
+		md5_digest(expected, jobs[i].data, NULL);
+		if (memcmp(expected, jobs[i].digest, HASH_MD5_SIZE)) {
+			fprintf(stderr, "%s: digest mismatch for %zu byte message\n",
+			        impl, jobs[i].len);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void
+_time(const char *label, const char *impl, hash_job_t *jobs, int count, int iterations)
+{
+	unsigned char expected[HASH_MD5_SIZE];
+	double start, elapsed;
+	size_t bytes = 0;
+	int i, j;
+
+	for (i = 0; i < count; i++) {
+		bytes += jobs[i].len;
+	}
+
+	start = _now();
+	for (i = 0; i < iterations; i++) {
+		if (impl == NULL) {
+			for (j = 0; j < count; j++) {
+				md5_digest(expected, jobs[j].data, NULL);
+			}
+		} else {
+			hash_md5_batch(jobs, count);
+		}
+	}
+	elapsed = _now() - start;
+
+	printf("%-6s %-10s %9.1f ns/message %8.1f MB/s\n", label, impl ? impl : "md5.c",
+	       elapsed * 1e9 / ((double)iterations * count),
+	       (double)bytes * iterations / elapsed / 1e6);
+}
+
+static void
+_usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-b] [-i iterations]\n", name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	hash_job_t *edges = NULL, *paths = NULL, *files = NULL;
+	int bench = 0, iterations = 200;
+	int i, opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "bi:")) != -1) {
+		switch (opt) {
+		case 'b':
+			bench = 1;
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		default:
+			_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	srand(1);
+
+	/* Every length up to three blocks, covering all padding cases */
+	edges = _generate(193, 192, 192);
+	if (edges == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		goto finish;
+	}
+	for (i = 0; i < 193; i++) {
+		((char *)edges[i].data)[i] = '\0';
+		edges[i].len = i;
+	}
+
+	paths = _generate(4096, 40, 120);
+	files = _generate(8, 1 << 22, 1 << 22);
+	if (paths == NULL || files == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		goto finish;
+	}
+
+	for (i = 0; i < IMPLS; i++) {
+		if (hash_md5_select(impls[i])) {
+			printf("%s: not supported, skipping\n", impls[i]);
+			continue;
+		}
+		if (_verify(impls[i], edges, 193) || _verify(impls[i], edges, 1) ||
+		    _verify(impls[i], paths, 4096) || _verify(impls[i], files, 8)) {
+			goto finish;
+		}
+		printf("%s: ok\n", impls[i]);
+	}
+
+	if (bench) {
+		_time("paths", NULL, paths, 4096, iterations);
+		for (i = 0; i < IMPLS; i++) {
+			if (hash_md5_select(impls[i]) == 0) {
+				_time("paths", impls[i], paths, 4096, iterations);
+			}
+		}
+		_time("files", NULL, files, 8, iterations / 100 + 1);
+		for (i = 0; i < IMPLS; i++) {
+			if (hash_md5_select(impls[i]) == 0) {
+				_time("files", impls[i], files, 8, iterations / 100 + 1);
+			}
+		}
+	}
+
+	ret = 0;
+
+finish:
+	/* Test data is left to the OS */
+	return ret;
+}
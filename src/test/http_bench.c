@@ -0,0 +1,658 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * HTTP load benchmark. Starts the web server in-process on loopback,
+ * against a synthetic library (see library_gen.h) and a document root of
+ * generated static assets, and drives it from keep-alive connections
+ * spread over client threads. Every connection has one request in
+ * flight at a time, picked from a weighted mix of catalog browsing,
+ * ranged /stream requests at random offsets and static files. After a
+ * warm up period, latency from sending a request until its whole reply
+ * arrives is recorded per route. Results are printed as lines of JSON,
+ * one per route and a total with CPU time of the server's event loop
+ * thread and of the whole process per request. Requests shed by
+ * admission control (503) are counted apart from errors.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include <event2/event.h>
+#include <event2/thread.h>
+#include <event2/http.h>
+#include <event2/buffer.h>
+
+#include "cfg.h"
+#include "logger.h"
+#include "music_db.h"
+#include "scheduler.h"
+#include "webserver.h"
+#include "bench_util.h"
+#include "library_gen.h"
+
+typedef enum {
+	ROUTE_ARTISTS = 0,
+	ROUTE_ALBUMS,
+	ROUTE_SONGS,
+	ROUTE_STREAM,
+	ROUTE_STATIC,
+	ROUTE_LAST
+} route_t;
+
+static const char *route_names[ROUTE_LAST] = {
+	"artists", "albums", "songs", "stream", "static"
+};
+
+static const struct {
+	const char *name;
+	size_t      size;
+} assets[] = {
+	{ "index.html", 2 * 1024 },
+	{ "app.js",     96 * 1024 },
+	{ "style.css",  12 * 1024 },
+	{ "logo.png",   24 * 1024 }
+};
+
+#define ASSETS (sizeof(assets) / sizeof(assets[0]))
+
+typedef struct {
+	unsigned int *usec;
+	size_t        count;
+	size_t        cap;
+	int           errors;
+	int           refused;
+} _samples_t;
+
+/* Request URIs derived from the scanned catalog */
+static struct {
+	char        **albums;
+	int           album_count;
+	char        **songs;
+	int           song_count;
+	long long    *ids;
+	int           id_count;
+} uris;
+
+typedef struct _client_s _client_t;
+
+typedef struct {
+	struct evhttp_connection *evcon;
+	_client_t                *client;
+	route_t                   route;
+	double                    start;
+} _connection_t;
+
+struct _client_s {
+	pthread_t           thread;
+	struct event_base  *evb;
+	_connection_t      *connections;
+	int                 count;
+	int                 active;
+	unsigned int        random;
+	_samples_t          samples[ROUTE_LAST];
+};
+
+static int      port = 18090;
+static int      weights[ROUTE_LAST] = { 10, 20, 30, 25, 15 };
+static int      weight_total = 100;
+static size_t   range_size = 32 * 1024;
+static size_t   audio_size = 256 * 1024;
+static int      measuring = 0;
+static int      stopping = 0;
+
+static double
+_cpu(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+_sleep(double seconds)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)seconds;
+	ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+static int
+_record(_samples_t *s, double seconds)
+{
+	unsigned int *tmp = NULL;
+
+	if (s->count == s->cap) {
+		s->cap = s->cap ? s->cap * 2 : 4096;
+		if ((tmp = realloc(s->usec, s->cap * sizeof(*tmp))) == NULL) {
+			return -1;
+		}
+		s->usec = tmp;
+	}
+	s->usec[s->count++] = seconds * 1e6;
+	return 0;
+}
+
+static void _request_done(struct evhttp_request *req, void *arg);
+
+static int
+_request(_connection_t *conn)
+{
+	_client_t *client = conn->client;
+	struct evhttp_request *req = NULL;
+	struct evkeyvalq *headers;
+	char uri[64], range[64];
+	const char *path = uri;
+	unsigned int r = bench_random(&client->random);
+	int w = r % weight_total, route;
+	size_t offset;
+
+	for (route = 0; w >= weights[route]; route++) {
+		w -= weights[route];
+	}
+	r = bench_random(&client->random);
+
+	if ((req = evhttp_request_new(_request_done, conn)) == NULL) {
+		return -1;
+	}
+	headers = evhttp_request_get_output_headers(req);
+	evhttp_add_header(headers, "Host", "127.0.0.1");
+
+	switch (route) {
+	case ROUTE_ARTISTS:
+		path = "/bctl/artists";
+		break;
+	case ROUTE_ALBUMS:
+		path = uris.albums[r % uris.album_count];
+		break;
+	case ROUTE_SONGS:
+		path = uris.songs[r % uris.song_count];
+		break;
+	case ROUTE_STREAM:
+		snprintf(uri, sizeof(uri), "/stream?song=%lld", uris.ids[r % uris.id_count]);
+		offset = audio_size > range_size ? bench_random(&client->random) % (audio_size - range_size) : 0;
+		snprintf(range, sizeof(range), "bytes=%zu-%zu", offset, offset + range_size - 1);
+		evhttp_add_header(headers, "Range", range);
+		break;
+	default:
+		snprintf(uri, sizeof(uri), "/%s", r % ASSETS ? assets[r % ASSETS].name : "");
+		break;
+	}
+
+	conn->route = route;
+	conn->start = bench_now();
+	return evhttp_make_request(conn->evcon, req, EVHTTP_REQ_GET, path);
+}
+
+static void
+_request_done(struct evhttp_request *req, void *arg)
+{
+	_connection_t *conn = arg;
+	_client_t *client = conn->client;
+	_samples_t *s = &client->samples[conn->route];
+	int code = req ? evhttp_request_get_response_code(req) : 0;
+
+	if (__atomic_load_n(&measuring, __ATOMIC_RELAXED) &&
+	    !__atomic_load_n(&stopping, __ATOMIC_RELAXED)) {
+		if (code == 503) {
+			s->refused++;
+		} else if (code != 200 && code != 206) {
+			s->errors++;
+		} else if (0 != _record(s, bench_now() - conn->start)) {
+			s->errors++;
+		}
+	}
+
+	if (__atomic_load_n(&stopping, __ATOMIC_RELAXED) || 0 != _request(conn)) {
+		if (--client->active == 0) {
+			event_base_loopbreak(client->evb);
+		}
+	}
+}
+
+static void *
+_client_thread(void *data)
+{
+	_client_t *client = data;
+	int i;
+
+	for (i = 0; i < client->count; i++) {
+		if (0 == _request(&client->connections[i])) {
+			client->active++;
+		}
+	}
+	if (client->active > 0) {
+		event_base_dispatch(client->evb);
+	}
+	return NULL;
+}
+
+static void *
+_server_thread(void *data)
+{
+	event_base_dispatch(data);
+	return NULL;
+}
+
+static int
+_add_uri(char ***list, int *count, const char *fmt, const char *artist, const char *album)
+{
+	char *a = evhttp_encode_uri(artist), *b = album ? evhttp_encode_uri(album) : NULL;
+	char **tmp = NULL;
+	size_t len;
+	int ret = -1;
+
+	if (a == NULL || (album && b == NULL)) {
+		goto finish;
+	}
+	if ((tmp = realloc(*list, (*count + 1) * sizeof(char *))) == NULL) {
+		goto finish;
+	}
+	*list = tmp;
+	len = strlen(fmt) + strlen(a) + (b ? strlen(b) : 0) + 1;
+	if (((*list)[*count] = malloc(len)) == NULL) {
+		goto finish;
+	}
+	snprintf((*list)[(*count)++], len, fmt, a, b);
+	ret = 0;
+
+finish:
+	free(a);
+	free(b);
+	return ret;
+}
+
+/*
+ * Album and song listing URIs of all artists and albums, and ids of all
+ * songs.
+ */
+static int
+_load_uris(const bench_catalog_t *catalog)
+{
+	int i;
+
+	for (i = 0; i < catalog->artist_count; i++) {
+		if (0 != _add_uri(&uris.albums, &uris.album_count, "/bctl/albums?artist=%s",
+		                  catalog->artists[i], NULL)) {
+			return -1;
+		}
+	}
+	for (i = 0; i < catalog->album_count; i++) {
+		if (0 != _add_uri(&uris.songs, &uris.song_count, "/bctl/songs?artist=%s&album=%s",
+		                  catalog->album_artists[i], catalog->albums[i])) {
+			return -1;
+		}
+	}
+	if ((uris.ids = malloc(catalog->id_count * sizeof(long long))) == NULL) {
+		return -1;
+	}
+	for (i = 0; i < catalog->id_count; i++) {
+		uris.ids[uris.id_count++] = atoll(catalog->ids[i]);
+	}
+	return 0;
+}
+
+static int
+_write_assets(const char *dir)
+{
+	char path[1024];
+	FILE *f = NULL;
+	size_t i, j;
+
+	for (i = 0; i < ASSETS; i++) {
+		snprintf(path, sizeof(path), "%s/%s", dir, assets[i].name);
+		if ((f = fopen(path, "w")) == NULL) {
+			return -1;
+		}
+		for (j = 0; j < assets[i].size; j++) {
+			fputc('a' + j % 26, f);
+		}
+		if (0 != fclose(f)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int
+_parse_mix(const char *mix)
+{
+	char name[16];
+	int i, n, weight;
+
+	memset(weights, 0, sizeof(weights));
+	while (*mix) {
+		if (2 != sscanf(mix, "%15[a-z]=%d%n", name, &weight, &n) || weight < 0) {
+			return -1;
+		}
+		for (i = 0; i < ROUTE_LAST && strcmp(name, route_names[i]) != 0; i++);
+		if (i == ROUTE_LAST) {
+			return -1;
+		}
+		weights[i] = weight;
+		mix += n;
+		if (*mix == ',') {
+			mix++;
+		}
+	}
+	for (i = 0, weight_total = 0; i < ROUTE_LAST; i++) {
+		weight_total += weights[i];
+	}
+	return weight_total > 0 ? 0 : -1;
+}
+
+static double
+_percentile(const _samples_t *s, double p)
+{
+	size_t i = (size_t)(s->count * p);
+	return s->count ? s->usec[i < s->count ? i : s->count - 1] / 1000.0 : 0;
+}
+
+static void
+_report(FILE *out, const char *route, _samples_t *s, double seconds, int connections)
+{
+	qsort(s->usec, s->count, sizeof(s->usec[0]), bench_compare_uint);
+	fprintf(out, "{\"benchmark\": \"http\", \"route\": \"%s\", \"connections\": %d, "
+	        "\"requests\": %zu, \"errors\": %d, \"refused\": %d, "
+	        "\"requests_per_second\": %.0f, \"p50_ms\": %.3f, \"p99_ms\": %.3f, "
+	        "\"p999_ms\": %.3f", route, connections, s->count, s->errors, s->refused,
+	        s->count / seconds, _percentile(s, 0.5), _percentile(s, 0.99),
+	        _percentile(s, 0.999));
+}
+
+static void
+_usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-a artists] [-A albums] [-t tracks] [-s audio KB] "
+	        "[-c connections] [-T client threads] [-d seconds] [-W warm up seconds] "
+	        "[-m artists=10,albums=20,songs=30,stream=25,static=15] [-r range KB] "
+	        "[-p port] [-o output]\n", name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char tmpl[] = "/tmp/http-bench-XXXXXX";
+	char library[1024], docroot[1024], db[1024], conf[1024];
+	library_gen_spec_t spec;
+	library_gen_stats_t stats;
+	bench_catalog_t catalog = { NULL };
+	struct event_base *evb = NULL;
+	scheduler_t *sched = NULL;
+	music_db_t mdb = NULL;
+	webserver_t ws = NULL;
+	cfg_t *cfg = NULL;
+	FILE *out = stdout, *f = NULL;
+	_client_t *clients = NULL;
+	_samples_t total;
+	pthread_t server;
+	clockid_t server_clock;
+	struct rusage ru;
+	char *dir = NULL;
+	double duration = 10, warmup = 1, start, elapsed, server_cpu, process_cpu;
+	int connections = 64, threads = 2, running = 0, i, j, r, opt, ret = 1;
+
+	library_gen_defaults(&spec);
+	spec.audio_size = audio_size;
+	while ((opt = getopt(argc, argv, "a:A:t:s:c:T:d:W:m:r:p:o:")) != -1) {
+		switch (opt) {
+		case 'a':
+			spec.artists = atoi(optarg);
+			break;
+		case 'A':
+			spec.albums = atoi(optarg);
+			break;
+		case 't':
+			spec.tracks = atoi(optarg);
+			break;
+		case 's':
+			spec.audio_size = audio_size = atoi(optarg) * 1024;
+			break;
+		case 'c':
+			connections = atoi(optarg);
+			break;
+		case 'T':
+			threads = atoi(optarg);
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		case 'W':
+			warmup = atof(optarg);
+			break;
+		case 'm':
+			if (0 != _parse_mix(optarg)) {
+				_usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'r':
+			range_size = atoi(optarg) * 1024;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'o':
+			if ((out = fopen(optarg, "a")) == NULL) {
+				fprintf(stderr, "Failed to open %s\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			_usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc || spec.artists < 1 || spec.albums < 1 || spec.tracks < 1 ||
+	    connections < 1 || threads < 1 || threads > connections || duration <= 0 ||
+	    range_size < 1) {
+		_usage(argv[0]);
+		return 1;
+	}
+
+	logger_set_level("warning");
+
+	if ((dir = mkdtemp(tmpl)) == NULL) {
+		fprintf(stderr, "Failed to create temporary directory\n");
+		return 1;
+	}
+	snprintf(library, sizeof(library), "%s/library", dir);
+	snprintf(docroot, sizeof(docroot), "%s/www", dir);
+	snprintf(db, sizeof(db), "%s/music.db", dir);
+	snprintf(conf, sizeof(conf), "%s/http-bench.conf", dir);
+
+	if (0 != mkdir(library, 0755) || 0 != library_gen(library, &spec, &stats) ||
+	    0 != mkdir(docroot, 0755) || 0 != _write_assets(docroot)) {
+		fprintf(stderr, "Failed to generate files in %s: %s\n", dir, strerror(errno));
+		goto finish;
+	}
+
+	if ((f = fopen(conf, "w")) == NULL) {
+		fprintf(stderr, "Failed to write %s\n", conf);
+		goto finish;
+	}
+	fprintf(f, "listening-address = 127.0.0.1\nlistening-port = %d\ndocument-root = %s\n"
+	        "music-dir = %s\ndatabase-path = %s\nmax-connections = %d\n",
+	        port, docroot, library, db, connections + 16);
+	fclose(f);
+
+	if (0 != evthread_use_pthreads() || (evb = event_base_new()) == NULL ||
+	    0 != evthread_make_base_notifiable(evb)) {
+		fprintf(stderr, "Failed to create event base\n");
+		goto finish;
+	}
+	if ((cfg = cfg_init(conf)) == NULL || (sched = scheduler_new(cfg, evb)) == NULL ||
+	    (mdb = music_db_new(cfg, sched)) == NULL ||
+	    (ws = webserver_init(cfg, mdb, evb)) == NULL) {
+		fprintf(stderr, "Failed to start server on port %d\n", port);
+		goto finish;
+	}
+	if (0 != pthread_create(&server, NULL, _server_thread, evb)) {
+		fprintf(stderr, "Failed to start server thread\n");
+		goto finish;
+	}
+	running = 1;
+
+	/* Scan thread is joined on the server thread */
+	if (0 != bench_scan(mdb, NULL, NULL, NULL)) {
+		goto finish;
+	}
+	if (0 != bench_load_catalog(mdb, &catalog) || 0 != _load_uris(&catalog)) {
+		fprintf(stderr, "Scanned library is empty\n");
+		goto finish;
+	}
+	fprintf(stderr, "Serving %d artists, %d albums, %d songs\n", uris.album_count,
+	        uris.song_count, uris.id_count);
+
+	if ((clients = calloc(threads, sizeof(_client_t))) == NULL) {
+		goto finish;
+	}
+	for (i = 0; i < threads; i++) {
+		clients[i].count = connections / threads + (i < connections % threads);
+		clients[i].random = 2654435761u * (i + 1);
+		clients[i].connections = calloc(clients[i].count, sizeof(_connection_t));
+		if (clients[i].connections == NULL || (clients[i].evb = event_base_new()) == NULL) {
+			goto finish;
+		}
+		for (j = 0; j < clients[i].count; j++) {
+			clients[i].connections[j].client = &clients[i];
+			clients[i].connections[j].evcon = evhttp_connection_base_new(clients[i].evb,
+				NULL, "127.0.0.1", port);
+			if (clients[i].connections[j].evcon == NULL) {
+				goto finish;
+			}
+		}
+	}
+	for (i = 0; i < threads; i++) {
+		if (0 != pthread_create(&clients[i].thread, NULL, _client_thread, &clients[i])) {
+			fprintf(stderr, "Failed to start client thread\n");
+			__atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+			threads = i;
+			break;
+		}
+	}
+
+	_sleep(warmup);
+	pthread_getcpuclockid(server, &server_clock);
+	server_cpu = _cpu(server_clock);
+	process_cpu = _cpu(CLOCK_PROCESS_CPUTIME_ID);
+	start = bench_now();
+	__atomic_store_n(&measuring, 1, __ATOMIC_RELAXED);
+
+	_sleep(duration);
+	__atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+	elapsed = bench_now() - start;
+	server_cpu = _cpu(server_clock) - server_cpu;
+	process_cpu = _cpu(CLOCK_PROCESS_CPUTIME_ID) - process_cpu;
+
+	for (i = 0; i < threads; i++) {
+		pthread_join(clients[i].thread, NULL);
+	}
+
+	memset(&total, 0, sizeof(total));
+	for (r = 0; r < ROUTE_LAST; r++) {
+		for (i = 1; i < threads; i++) {
+			for (j = 0; j < (int)clients[i].samples[r].count; j++) {
+				_record(&clients[0].samples[r], clients[i].samples[r].usec[j] / 1e6);
+			}
+			clients[0].samples[r].errors += clients[i].samples[r].errors;
+			clients[0].samples[r].refused += clients[i].samples[r].refused;
+		}
+		for (j = 0; j < (int)clients[0].samples[r].count; j++) {
+			_record(&total, clients[0].samples[r].usec[j] / 1e6);
+		}
+		total.errors += clients[0].samples[r].errors;
+		total.refused += clients[0].samples[r].refused;
+		if (weights[r]) {
+			_report(out, route_names[r], &clients[0].samples[r], elapsed, connections);
+			fprintf(out, "}\n");
+		}
+	}
+	getrusage(RUSAGE_SELF, &ru);
+	_report(out, "total", &total, elapsed, connections);
+	fprintf(out, ", \"server_cpu_us_per_request\": %.1f, \"process_cpu_us_per_request\": %.1f, "
+	        "\"peak_rss_kb\": %ld}\n", server_cpu * 1e6 / (total.count ? total.count : 1),
+	        process_cpu * 1e6 / (total.count ? total.count : 1), ru.ru_maxrss);
+	free(total.usec);
+
+	ret = total.errors ? 1 : 0;
+
+finish:
+	bench_catalog_free(&catalog);
+	for (i = 0; clients && i < threads; i++) {
+		for (j = 0; clients[i].connections && j < clients[i].count; j++) {
+			if (clients[i].connections[j].evcon) {
+				evhttp_connection_free(clients[i].connections[j].evcon);
+			}
+		}
+		for (r = 0; r < ROUTE_LAST; r++) {
+			free(clients[i].samples[r].usec);
+		}
+		free(clients[i].connections);
+		if (clients[i].evb) {
+			event_base_free(clients[i].evb);
+		}
+	}
+	free(clients);
+	if (running) {
+		event_base_loopbreak(evb);
+		pthread_join(server, NULL);
+	}
+	if (ws) {
+		webserver_shutdown(ws);
+	}
+	if (mdb) {
+		music_db_free(mdb);
+	}
+	if (sched) {
+		scheduler_free(sched);
+	}
+	if (cfg) {
+		cfg_free(cfg);
+	}
+	if (evb) {
+		event_base_free(evb);
+	}
+	if (out != stdout) {
+		fclose(out);
+	}
+	library_gen_remove(dir);
+	return ret;
+}
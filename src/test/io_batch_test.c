@@ -0,0 +1,207 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Reads heads and tails of files around the head and tail buffer sizes with
+ * every I/O backend available, and compares them with file contents. Also
+ * checks that missing files fail on their own without failing the batch,
+ * and that io_batch_run() runs a job on every item exactly once.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "io_batch.h"
+
+static const size_t sizes[] = {
+	0, 1, 100, IO_HEAD_SIZE, IO_HEAD_SIZE + 1, IO_HEAD_SIZE + IO_TAIL_SIZE + 7, 1000000
+};
+
+#define FILES (sizeof(sizes) / sizeof(sizes[0]))
+
+/* More files than depth, to exercise refilling the queue */
+#define COPIES 50
+
+static int failures = 0;
+
+static unsigned char
+_byte(size_t i)
+{
+	return (unsigned char)(i * 7 + i / 251);
+}
+
+static void
+_check(const char *backend, const io_file_t *f, size_t size)
+{
+	size_t i, head = size < IO_HEAD_SIZE ? size : IO_HEAD_SIZE;
+	size_t tail = size <= IO_HEAD_SIZE ? 0 : size < IO_TAIL_SIZE ? size : IO_TAIL_SIZE;
+
+	if (f->error != 0 || f->fd < 0 || f->size != (off_t)size ||
+	    f->head_len != head || f->tail_len != tail) {
+		fprintf(stderr, "%s: %s: error %d, size %ld, head %lu, tail %lu\n", backend,
+		        f->path, f->error, (long)f->size, (unsigned long)f->head_len,
+		        (unsigned long)f->tail_len);
+		failures++;
+		return;
+	}
+	for (i = 0; i < head; i++) {
+		if (f->head[i] != _byte(i)) {
+			fprintf(stderr, "%s: %s: head differs at %lu\n", backend, f->path, (unsigned long)i);
+			failures++;
+			return;
+		}
+	}
+	for (i = 0; i < tail; i++) {
+		if (f->tail[i] != _byte(size - tail + i)) {
+			fprintf(stderr, "%s: %s: tail differs at %lu\n", backend, f->path, (unsigned long)i);
+			failures++;
+			return;
+		}
+	}
+}
+
+static void
+_job(void *item, void *arg)
+{
+	*(int *)item += *(int *)arg;
+}
+
+static void
+_test(const char *backend, io_file_t *files, int count)
+{
+	io_batch_t *io = NULL;
+	int items[COPIES], i, arg = 3;
+
+	if ((io = io_batch_new(8, backend)) == NULL) {
+		printf("%s: not supported, skipped\n", backend);
+		return;
+	}
+
+	if (io_batch_read(io, files, count) != 0) {
+		fprintf(stderr, "%s: batch failed\n", backend);
+		failures++;
+	} else {
+		for (i = 0; i < count - 1; i++) {
+			_check(backend, &files[i], sizes[i % FILES]);
+		}
+		if (files[i].fd >= 0 || files[i].error != ENOENT) {
+			fprintf(stderr, "%s: missing file: fd %d, error %d\n", backend,
+			        files[i].fd, files[i].error);
+			failures++;
+		}
+		io_batch_close(files, count);
+		printf("%s: ok\n", backend);
+	}
+
+	for (i = 0; i < COPIES; i++) {
+		items[i] = i;
+	}
+	if (io_batch_run(io, _job, &arg, items, sizeof(int), COPIES) != 0) {
+		fprintf(stderr, "%s: run failed\n", backend);
+		failures++;
+	} else {
+		for (i = 0; i < COPIES; i++) {
+			if (items[i] != i + arg) {
+				fprintf(stderr, "%s: run item %d is %d\n", backend, i, items[i]);
+				failures++;
+				break;
+			}
+		}
+	}
+
+	io_batch_free(io);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char tmpl[] = "/tmp/io-batch-test-XXXXXX";
+	char path[256];
+	unsigned char *data = NULL, *bufs = NULL;
+	char *dir = NULL, *paths = NULL;
+	io_file_t files[FILES * COPIES + 1];
+	FILE *f = NULL;
+	size_t i;
+	int count = FILES * COPIES + 1;
+
+	if ((dir = mkdtemp(tmpl)) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	data = malloc(sizes[FILES - 1]);
+	bufs = malloc(count * (IO_HEAD_SIZE + IO_TAIL_SIZE));
+	paths = malloc(count * sizeof(path));
+	if (data == NULL || bufs == NULL || paths == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < sizes[FILES - 1]; i++) {
+		data[i] = _byte(i);
+	}
+
+	for (i = 0; i < FILES; i++) {
+		snprintf(path, sizeof(path), "%s/%lu", dir, (unsigned long)i);
+		if ((f = fopen(path, "wb")) == NULL || fwrite(data, 1, sizes[i], f) != sizes[i]) {
+			fprintf(stderr, "Failed to write %s\n", path);
+			return 1;
+		}
+		fclose(f);
+	}
+
+	memset(files, 0, sizeof(files));
+	for (i = 0; i < (size_t)count; i++) {
+		if (i == (size_t)count - 1) {
+			snprintf(paths + i * sizeof(path), sizeof(path), "%s/missing", dir);
+		} else {
+			snprintf(paths + i * sizeof(path), sizeof(path), "%s/%lu", dir,
+			         (unsigned long)(i % FILES));
+		}
+		files[i].path = paths + i * sizeof(path);
+		files[i].head = bufs + i * (IO_HEAD_SIZE + IO_TAIL_SIZE);
+		files[i].tail = files[i].head + IO_HEAD_SIZE;
+	}
+
+	_test("io_uring", files, count);
+	_test("threads", files, count);
+
+	for (i = 0; i < FILES; i++) {
+		snprintf(path, sizeof(path), "%s/%lu", dir, (unsigned long)i);
+		unlink(path);
+	}
+	rmdir(dir);
+	free(data);
+	free(bufs);
+	free(paths);
+
+	return failures ? 1 : 0;
+}
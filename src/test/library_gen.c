@@ -0,0 +1,543 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "library_gen.h"
+
+/* Bytes of audio per second, as in a 128 kbps MP3 */
+#define BYTES_PER_SECOND 16000
+
+#define SAMPLE_RATE 44100
+
+/* Audio payload of Ogg pages */
+#define OGG_PAGE_SIZE 4096
+
+#define MAX_PATH 1024
+
+typedef struct {
+	unsigned char *data;
+	size_t         len;
+	size_t         cap;
+} _buf_t;
+
+/* Words of names, some of them with non-ASCII characters */
+static const char *_words[] = {
+	"Black", "Silver", "Night", "River", "Electric", "Mot\xc3\xb6r", "Ocean", "Glass",
+	"Sound", "Orchestra", "Dream", "Stone", "Caf\xc3\xa9", "Fire", "Winter", "Machine",
+	"Garden", "Echo", "Velvet", "\xc3\x9c" "ber", "Signal", "Harbor", "Neon", "Paper"
+};
+
+#define WORDS (sizeof(_words) / sizeof(_words[0]))
+
+static const struct {
+	const char *name;
+	int         format;
+} _formats[] = {
+	{ "mp3",  LIBRARY_GEN_MP3 },
+	{ "flac", LIBRARY_GEN_FLAC },
+	{ "ogg",  LIBRARY_GEN_OGG }
+};
+
+#define FORMATS (sizeof(_formats) / sizeof(_formats[0]))
+
+static unsigned int
+_random(unsigned int *state)
+{
+	unsigned int x = *state ? *state : 0x9e3779b9;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *state = x;
+}
+
+static int
+_put(_buf_t *b, const void *data, size_t len)
+{
+	unsigned char *tmp = NULL;
+	size_t cap;
+
+	if (b->len + len > b->cap) {
+		cap = (b->len + len) * 2;
+		if ((tmp = realloc(b->data, cap)) == NULL) {
+			return -1;
+		}
+		b->data = tmp;
+		b->cap = cap;
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+	return 0;
+}
+
+static int
+_put_be(_buf_t *b, uint64_t v, int bytes)
+{
+	unsigned char tmp[8];
+	int i;
+
+	for (i = 0; i < bytes; i++) {
+		tmp[i] = v >> (8 * (bytes - 1 - i));
+	}
+	return _put(b, tmp, bytes);
+}
+
+static int
+_put_le(_buf_t *b, uint64_t v, int bytes)
+{
+	unsigned char tmp[8];
+	int i;
+
+	for (i = 0; i < bytes; i++) {
+		tmp[i] = v >> (8 * i);
+	}
+	return _put(b, tmp, bytes);
+}
+
+static int
+_put_syncsafe(_buf_t *b, uint32_t v)
+{
+	return _put_be(b, (v & 0x7f) | (v & 0x3f80) << 1 | (v & 0x1fc000) << 2 |
+	               (v & 0xfe00000) << 3, 4);
+}
+
+static int
+_put_random(_buf_t *b, size_t len, unsigned int *state)
+{
+	unsigned int r;
+	size_t n;
+
+	while (len > 0) {
+		r = _random(state);
+		n = len < sizeof(r) ? len : sizeof(r);
+		if (0 != _put(b, &r, n)) {
+			return -1;
+		}
+		len -= n;
+	}
+	return 0;
+}
+
+static void
+_name(char *out, size_t size, const char *kind, int number, unsigned int seed)
+{
+	unsigned int state = seed ^ (number + 1) * 2654435761u;
+
+	snprintf(out, size, "%s %s %s %d", _words[_random(&state) % WORDS],
+	         _words[_random(&state) % WORDS], kind, number);
+}
+
+/*
+ * ID3v2.4 tag with UTF-8 text frames and some padding, then constant
+ * bitrate MPEG 1 layer III frames.
+ */
+static int
+_mp3(_buf_t *b, const char **tags, size_t audio_size, unsigned int *state)
+{
+	static const char *ids[] = { "TIT2", "TPE1", "TALB", "TRCK" };
+	size_t size = 256, i, frames;
+
+	for (i = 0; i < 4; i++) {
+		size += 10 + 1 + strlen(tags[i]);
+	}
+	if (0 != _put(b, "ID3\4\0\0", 6) || 0 != _put_syncsafe(b, size)) {
+		return -1;
+	}
+	for (i = 0; i < 4; i++) {
+		if (0 != _put(b, ids[i], 4) || 0 != _put_syncsafe(b, 1 + strlen(tags[i])) ||
+		    0 != _put_be(b, 0, 2) || 0 != _put_be(b, 3, 1) ||
+		    0 != _put(b, tags[i], strlen(tags[i]))) {
+			return -1;
+		}
+	}
+	for (i = 0; i < 256; i++) {
+		if (0 != _put_be(b, 0, 1)) {
+			return -1;
+		}
+	}
+	frames = audio_size / 417 ? audio_size / 417 : 1;
+	for (i = 0; i < frames; i++) {
+		if (0 != _put_be(b, 0xfffb9000, 4) || 0 != _put_random(b, 413, state)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int
+_vorbis_comment(_buf_t *b, const char **tags)
+{
+	static const char *keys[] = { "TITLE=", "ARTIST=", "ALBUM=", "TRACKNUMBER=" };
+	int i;
+
+	if (0 != _put_le(b, 13, 4) || 0 != _put(b, "library_gen 1", 13) || 0 != _put_le(b, 4, 4)) {
+		return -1;
+	}
+	for (i = 0; i < 4; i++) {
+		if (0 != _put_le(b, strlen(keys[i]) + strlen(tags[i]), 4) ||
+		    0 != _put(b, keys[i], strlen(keys[i])) || 0 != _put(b, tags[i], strlen(tags[i]))) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int
+_flac(_buf_t *b, const char **tags, size_t audio_size, unsigned int *state)
+{
+	uint64_t samples = (uint64_t)(audio_size / BYTES_PER_SECOND) * SAMPLE_RATE;
+	_buf_t comment;
+	int ret = -1;
+
+	memset(&comment, 0, sizeof(comment));
+	if (0 != _vorbis_comment(&comment, tags)) {
+		goto finish;
+	}
+
+	/* STREAMINFO: block sizes, frame sizes, rate, 2 channels, 16 bits */
+	if (0 != _put(b, "fLaC", 4) || 0 != _put_be(b, 34, 4) ||
+	    0 != _put_be(b, 4096, 2) || 0 != _put_be(b, 4096, 2) || 0 != _put_be(b, 0, 6) ||
+	    0 != _put_be(b, (uint64_t)SAMPLE_RATE << 44 | 1ULL << 41 | 15ULL << 36 | samples, 8) ||
+	    0 != _put_be(b, 0, 8) || 0 != _put_be(b, 0, 8)) {
+		goto finish;
+	}
+	if (0 != _put_be(b, 0x84000000 | comment.len, 4) || 0 != _put(b, comment.data, comment.len)) {
+		goto finish;
+	}
+	if (0 != _put_be(b, 0xfff8, 2) || 0 != _put_random(b, audio_size, state)) {
+		goto finish;
+	}
+	ret = 0;
+
+finish:
+	free(comment.data);
+	return ret;
+}
+
+/*
+ * Ogg page holding a single packet, or a piece of one. CRC is left zero,
+ * the native reader does not check it.
+ */
+static int
+_ogg_page(_buf_t *b, const unsigned char *data, size_t len, int flags, int64_t granule,
+          int *seq)
+{
+	size_t segs = len / 255 + 1, i;
+
+	if (0 != _put(b, "OggS", 4) || 0 != _put_be(b, 0, 1) || 0 != _put_be(b, flags, 1) ||
+	    0 != _put_le(b, granule, 8) || 0 != _put_le(b, 1, 4) || 0 != _put_le(b, (*seq)++, 4) ||
+	    0 != _put_le(b, 0, 4) || 0 != _put_be(b, segs, 1)) {
+		return -1;
+	}
+	for (i = 0; i < segs; i++) {
+		if (0 != _put_be(b, i < segs - 1 ? 255 : len % 255, 1)) {
+			return -1;
+		}
+	}
+	return _put(b, data, len);
+}
+
+static int
+_ogg(_buf_t *b, const char **tags, size_t audio_size, unsigned int *state)
+{
+	int64_t samples = (int64_t)(audio_size / BYTES_PER_SECOND) * SAMPLE_RATE;
+	size_t pages = audio_size / OGG_PAGE_SIZE ? audio_size / OGG_PAGE_SIZE : 1, i;
+	_buf_t pkt;
+	int seq = 0, ret = -1;
+
+	memset(&pkt, 0, sizeof(pkt));
+
+	/* Identification header: version, channels, rate, bitrates, block sizes */
+	if (0 != _put(&pkt, "\1vorbis", 7) || 0 != _put_le(&pkt, 0, 4) ||
+	    0 != _put_le(&pkt, 2, 1) || 0 != _put_le(&pkt, SAMPLE_RATE, 4) ||
+	    0 != _put_le(&pkt, 0, 4) || 0 != _put_le(&pkt, 128000, 4) || 0 != _put_le(&pkt, 0, 4) ||
+	    0 != _put_be(&pkt, 0xb8, 1) || 0 != _put_be(&pkt, 1, 1) ||
+	    0 != _ogg_page(b, pkt.data, pkt.len, 0x02, 0, &seq)) {
+		goto finish;
+	}
+	pkt.len = 0;
+	if (0 != _put(&pkt, "\3vorbis", 7) || 0 != _vorbis_comment(&pkt, tags) ||
+	    0 != _put_be(&pkt, 1, 1) || 0 != _ogg_page(b, pkt.data, pkt.len, 0, 0, &seq)) {
+		goto finish;
+	}
+	for (i = 0; i < pages; i++) {
+		pkt.len = 0;
+		if (0 != _put_random(&pkt, OGG_PAGE_SIZE, state) ||
+		    0 != _ogg_page(b, pkt.data, pkt.len, i == pages - 1 ? 0x04 : 0,
+		                   samples * (int64_t)(i + 1) / (int64_t)pages, &seq)) {
+			goto finish;
+		}
+	}
+	ret = 0;
+
+finish:
+	free(pkt.data);
+	return ret;
+}
+
+static int
+_write_file(const char *path, _buf_t *b, library_gen_stats_t *stats)
+{
+	size_t done = 0;
+	ssize_t n;
+	int fd;
+
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		return -1;
+	}
+	while (done < b->len) {
+		if ((n = write(fd, b->data + done, b->len - done)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			close(fd);
+			return -1;
+		}
+		done += n;
+	}
+	stats->bytes += b->len;
+	return close(fd);
+}
+
+static int
+_mkdir(const char *path, library_gen_stats_t *stats)
+{
+	if (0 != mkdir(path, 0755)) {
+		return errno == EEXIST ? 0 : -1;
+	}
+	stats->dirs++;
+	return 0;
+}
+
+/*
+ * Cover art and notes are skipped by the scanner because of their
+ * extensions. Files without extension are peeked into.
+ */
+static int
+_junk(const char *dir, int index, library_gen_stats_t *stats, unsigned int *state)
+{
+	static const unsigned char jpeg[] = { 0xff, 0xd8, 0xff, 0xe0, 0, 16, 'J', 'F', 'I', 'F', 0 };
+	static const char text[] = "Ripped from the original release, see the booklet.\n";
+	char path[MAX_PATH];
+	_buf_t b;
+	int ret = -1;
+
+	memset(&b, 0, sizeof(b));
+
+	switch (index % 3) {
+	case 0:
+		snprintf(path, sizeof(path), "%s/cover%d.jpg", dir, index);
+		if (0 != _put(&b, jpeg, sizeof(jpeg)) || 0 != _put_random(&b, 32 * 1024, state)) {
+			goto finish;
+		}
+		break;
+	case 1:
+		snprintf(path, sizeof(path), "%s/notes%d.txt", dir, index);
+		if (0 != _put(&b, text, sizeof(text) - 1)) {
+			goto finish;
+		}
+		break;
+	default:
+		snprintf(path, sizeof(path), "%s/folder%d", dir, index);
+		if (0 != _put(&b, "[ViewState]\nMode=\nVid=\n", 23)) {
+			goto finish;
+		}
+		break;
+	}
+	if (0 != _write_file(path, &b, stats)) {
+		goto finish;
+	}
+	stats->junk++;
+	ret = 0;
+
+finish:
+	free(b.data);
+	return ret;
+}
+
+static int
+_album(char *path, size_t len, const library_gen_spec_t *spec, const char *artist,
+       const char *album, int format, library_gen_stats_t *stats)
+{
+	static const char *extensions[] = { "", "mp3", "flac", "", "ogg" };
+	unsigned int state = spec->seed ^ (stats->tracks + 1) * 2246822519u;
+	char title[128], track[16];
+	const char *tags[4];
+	_buf_t b;
+	int i, ret = -1;
+
+	memset(&b, 0, sizeof(b));
+	tags[0] = title;
+	tags[1] = artist;
+	tags[2] = album;
+	tags[3] = track;
+
+	for (i = 0; i < spec->tracks; i++) {
+		_name(title, sizeof(title), "Song", stats->tracks, spec->seed);
+		snprintf(track, sizeof(track), "%d/%d", i + 1, spec->tracks);
+		snprintf(path + len, MAX_PATH - len, "/%02d %s.%s", i + 1, title, extensions[format]);
+
+		b.len = 0;
+		if (format == LIBRARY_GEN_MP3) {
+			ret = _mp3(&b, tags, spec->audio_size, &state);
+		} else if (format == LIBRARY_GEN_FLAC) {
+			ret = _flac(&b, tags, spec->audio_size, &state);
+		} else {
+			ret = _ogg(&b, tags, spec->audio_size, &state);
+		}
+		if (ret != 0 || 0 != (ret = _write_file(path, &b, stats))) {
+			goto finish;
+		}
+		stats->tracks++;
+	}
+
+	path[len] = '\0';
+	for (i = 0; i < spec->junk; i++) {
+		if (0 != (ret = _junk(path, i, stats, &state))) {
+			goto finish;
+		}
+	}
+	ret = 0;
+
+finish:
+	path[len] = '\0';
+	free(b.data);
+	return ret;
+}
+
+void
+library_gen_defaults(library_gen_spec_t *spec)
+{
+	memset(spec, 0, sizeof(*spec));
+	spec->artists = 50;
+	spec->albums = 4;
+	spec->tracks = 10;
+	spec->depth = 1;
+	spec->junk = 2;
+	spec->formats = LIBRARY_GEN_ALL;
+	spec->audio_size = 64 * 1024;
+	spec->seed = 1;
+}
+
+int
+library_gen_formats(const char *names)
+{
+	const char *p = names, *end;
+	size_t i;
+	int mask = 0;
+
+	while (*p) {
+		end = strchr(p, ',');
+		if (end == NULL) {
+			end = p + strlen(p);
+		}
+		for (i = 0; i < FORMATS; i++) {
+			if (strlen(_formats[i].name) == (size_t)(end - p) &&
+			    strncmp(_formats[i].name, p, end - p) == 0) {
+				mask |= _formats[i].format;
+				break;
+			}
+		}
+		if (i == FORMATS) {
+			return 0;
+		}
+		p = *end ? end + 1 : end;
+	}
+	return mask;
+}
+
+int
+library_gen(const char *dir, const library_gen_spec_t *spec, library_gen_stats_t *stats)
+{
+	char path[MAX_PATH], artist[128], album[128];
+	int formats[FORMATS], format_count = 0, next = 0;
+	int a, al, l, len;
+	size_t i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < FORMATS; i++) {
+		if (spec->formats & _formats[i].format) {
+			formats[format_count++] = _formats[i].format;
+		}
+	}
+	if (format_count == 0 || spec->depth < 0 || spec->depth > 7) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (a = 0; a < spec->artists; a++) {
+		_name(artist, sizeof(artist), "Band", a, spec->seed);
+		len = snprintf(path, sizeof(path), "%s", dir);
+		for (l = 0; l < spec->depth; l++) {
+			len += snprintf(path + len, sizeof(path) - len, "/%x", (a >> (4 * l)) & 15);
+			if (0 != _mkdir(path, stats)) {
+				return -1;
+			}
+		}
+		len += snprintf(path + len, sizeof(path) - len, "/%s", artist);
+		if (0 != _mkdir(path, stats)) {
+			return -1;
+		}
+
+		for (al = 0; al < spec->albums; al++) {
+			_name(album, sizeof(album), "Album", a * spec->albums + al, spec->seed);
+			i = len + snprintf(path + len, sizeof(path) - len, "/%s", album);
+			if (i >= sizeof(path) || 0 != _mkdir(path, stats) ||
+			    0 != _album(path, i, spec, artist, album, formats[next], stats)) {
+				return -1;
+			}
+			next = (next + 1) % format_count;
+			path[len] = '\0';
+		}
+	}
+
+	return 0;
+}
+
+static int
+_remove(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	return remove(path);
+}
+
+int
+library_gen_remove(const char *dir)
+{
+	return nftw(dir, _remove, 64, FTW_DEPTH | FTW_PHYS);
+}
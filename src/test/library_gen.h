@@ -0,0 +1,96 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LIBRARY_GEN_H_
+#define _LIBRARY_GEN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Tag formats of generated tracks */
+#define LIBRARY_GEN_MP3  0x1 /* ID3v2.3 followed by MPEG frames */
+#define LIBRARY_GEN_FLAC 0x2 /* STREAMINFO and VORBIS_COMMENT blocks */
+#define LIBRARY_GEN_OGG  0x4 /* Vorbis identification and comment packets */
+#define LIBRARY_GEN_ALL  (LIBRARY_GEN_MP3 | LIBRARY_GEN_FLAC | LIBRARY_GEN_OGG)
+
+/*
+ * Synthetic music library for benchmarks. Albums are laid out as
+ * <dir>/<depth levels>/<artist>/<album>/, depth levels spread artists
+ * over 16 subdirectories each. Every album is in one of the enabled
+ * formats, taken in turn, and holds given number of junk files next to
+ * its tracks: cover art and notes, which the scanner skips by extension,
+ * and files without extension, which it has to peek into. Contents are
+ * a function of the spec alone, so equal specs give equal libraries.
+ */
+typedef struct {
+	int          artists;
+	int          albums;     /* Per artist */
+	int          tracks;     /* Per album */
+	int          depth;
+	int          junk;       /* Per album */
+	int          formats;    /* LIBRARY_GEN_* mask */
+	size_t       audio_size; /* Bytes of audio payload per track */
+	unsigned int seed;
+} library_gen_spec_t;
+
+typedef struct {
+	int          tracks;
+	int          junk;
+	int          dirs;
+	uint64_t     bytes;
+} library_gen_stats_t;
+
+/**
+ * Fill spec with defaults: 50 artists with 4 albums of 10 tracks, depth
+ * 1, 2 junk files per album, all formats and 64 KB of audio per track.
+ */
+void
+library_gen_defaults(library_gen_spec_t *spec);
+
+/**
+ * Parse comma separated list of format names, "mp3", "flac" or "ogg".
+ * Returns LIBRARY_GEN_* mask, or 0 when a name is not known.
+ */
+int
+library_gen_formats(const char *names);
+
+/**
+ * Generate library in given directory, which must exist.
+ * Returns 0 on success, -1 on failure with errno set.
+ */
+int
+library_gen(const char *dir, const library_gen_spec_t *spec, library_gen_stats_t *stats);
+
+/**
+ * Remove directory tree. Returns 0 on success, -1 on failure.
+ */
+int
+library_gen_remove(const char *dir);
+
+#endif /* !_LIBRARY_GEN_H_ */
@@ -0,0 +1,284 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Logs from several threads into a temporary file with both overflow
+ * policies and checks that every thread's messages come out whole and
+ * in order, and that dropped messages are all accounted for. Checks that
+ * arguments of disabled messages are not evaluated.
+ *
+ * With -b measures the cost of a log call with messages going to
+ * /dev/null, synchronously and through the writer thread, and of a
+ * disabled one.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "logger.h"
+
+#define MAX_THREADS 64
+
+static int failures = 0;
+static int messages = 20000;
+static int evaluated = 0;
+
+static void *
+_log_thread(void *data)
+{
+	int id = *(int *)data;
+	int i;
+
+	for (i = 0; i < messages; i++) {
+		log_info("thread %d message %d of the logger test", id, i);
+	}
+	return NULL;
+}
+
+static int
+_arg()
+{
+	return ++evaluated;
+}
+
+static void
+_test_levels()
+{
+	int level = logger_level;
+
+	logger_level = LOG_LEVEL_WARNING;
+	log_info("Not logged %d", _arg());
+	log_debug("Not logged %d", _arg());
+	log_trace("Not logged %d", _arg());
+	if (evaluated != 0) {
+		fprintf(stderr, "levels: %d disabled message arguments evaluated\n", evaluated);
+		failures++;
+	}
+	log_warning("Logged %d", _arg());
+	if (evaluated != 1) {
+		fprintf(stderr, "levels: enabled message arguments not evaluated\n");
+		failures++;
+	}
+
+	if (logger_set_level("verbose") == 0 ||
+	    logger_set_level("error") != 0 || logger_level != LOG_LEVEL_ERROR ||
+	    logger_set_level("trace") != 0 || logger_level != LOG_LEVEL_COMPILED) {
+		fprintf(stderr, "levels: logger_set_level() failed\n");
+		failures++;
+	}
+	logger_level = level;
+}
+
+static void
+_run(int threads)
+{
+	pthread_t tids[MAX_THREADS];
+	int ids[MAX_THREADS];
+	int i;
+
+	for (i = 0; i < threads; i++) {
+		ids[i] = i;
+		if (pthread_create(&tids[i], NULL, _log_thread, &ids[i]) != 0) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(tids[i], NULL);
+	}
+}
+
+static void
+_check(const char *policy, const char *path, int threads, unsigned long dropped)
+{
+	int next[MAX_THREADS];
+	char line[256];
+	unsigned long lines = 0, reported = 0, n;
+	FILE *f;
+	int id, seq;
+
+	memset(next, 0, sizeof(next));
+	if ((f = fopen(path, "r")) == NULL) {
+		perror(path);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "[WARN] Dropped %lu log messages", &n) == 1) {
+			reported += n;
+		} else if (sscanf(line, "[INFO] thread %d message %d", &id, &seq) == 2 &&
+		           id >= 0 && id < threads && seq >= next[id]) {
+			if (strcmp(policy, "block") == 0 && seq != next[id]) {
+				fprintf(stderr, "%s: thread %d: expected message %d, got %d\n",
+				        policy, id, next[id], seq);
+				failures++;
+			}
+			next[id] = seq + 1;
+			lines++;
+		} else {
+			fprintf(stderr, "%s: unexpected line: %s", policy, line);
+			failures++;
+		}
+	}
+	fclose(f);
+
+	if (lines + dropped != (unsigned long)threads * messages || reported != dropped) {
+		fprintf(stderr, "%s: %lu messages, %lu dropped, %lu reported, expected %lu\n",
+		        policy, lines, dropped, reported, (unsigned long)threads * messages);
+		failures++;
+	} else {
+		fprintf(stderr, "%s: %lu messages, %lu dropped\n", policy, lines, dropped);
+	}
+}
+
+static void
+_test(const char *policy, int threads)
+{
+	char path[] = "/tmp/logger-test-XXXXXX";
+	unsigned long dropped;
+	int fd;
+
+	if ((fd = mkstemp(path)) < 0) {
+		perror("mkstemp");
+		exit(1);
+	}
+
+	/* Smallest buffers, so that threads actually run out of space */
+	if (logger_configure(policy, 0) != 0) {
+		failures++;
+		return;
+	}
+	dropped = logger_dropped();
+	fflush(stdout);
+	dup2(fd, STDOUT_FILENO);
+
+	logger_init();
+	_run(threads);
+	logger_shutdown();
+
+	_check(policy, path, threads, logger_dropped() - dropped);
+	close(fd);
+	unlink(path);
+}
+
+static double
+_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+_bench(const char *name, const char *policy, int threads)
+{
+	unsigned long dropped = logger_dropped();
+	double start;
+
+	if (policy != NULL) {
+		(void)logger_configure(policy, 64 * 1024);
+		logger_init();
+	}
+	start = _now();
+	_run(threads);
+	logger_shutdown();
+
+	fprintf(stderr, "%-6s %2d threads: %7.1f ns/message, %lu dropped\n", name, threads,
+	        (_now() - start) * 1e9 / ((double)threads * messages),
+	        logger_dropped() - dropped);
+}
+
+static void
+_bench_disabled()
+{
+	int i, count = messages * 100;
+	double start;
+
+	logger_level = LOG_LEVEL_WARNING;
+	start = _now();
+	for (i = 0; i < count; i++) {
+		log_info("thread %d message %d of the logger test", 0, i);
+	}
+	fprintf(stderr, "disabled:           %7.1f ns/message\n", (_now() - start) * 1e9 / count);
+	logger_level = LOG_LEVEL_INFO;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int threads = 8, bench = 0;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "bn:t:")) != -1) {
+		switch (opt) {
+		case 'b':
+			bench = 1;
+			break;
+		case 'n':
+			messages = atoi(optarg);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-b] [-n messages] [-t threads]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (threads < 1 || threads > MAX_THREADS || messages < 1) {
+		fprintf(stderr, "Invalid thread or message count\n");
+		return 1;
+	}
+
+	logger_use_color = 0;
+
+	if (bench) {
+		if ((fd = open("/dev/null", O_WRONLY)) < 0) {
+			perror("/dev/null");
+			return 1;
+		}
+		dup2(fd, STDOUT_FILENO);
+		_bench("direct", NULL, threads);
+		_bench("block", "block", threads);
+		_bench("drop", "drop", threads);
+		_bench_disabled();
+		return 0;
+	}
+
+	_test_levels();
+	_test("block", threads);
+	_test("drop", threads);
+
+	return failures ? 1 : 0;
+}
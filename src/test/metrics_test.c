@@ -0,0 +1,266 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Updates metrics from several threads and checks the totals and the
+ * Prometheus text written out.
+ *
+ * With -b measures the cost of sharded updates, and of adding to a single
+ * shared counter for comparison.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "metrics.h"
+
+#define MAX_THREADS 64
+
+static int failures = 0;
+static int updates = 100000;
+
+static metric_t *counter;
+static metric_t *gauge;
+static metric_t *histogram;
+static uint64_t shared = 0;
+
+static void *
+_update_thread(void *data)
+{
+	int i;
+
+	for (i = 0; i < updates; i++) {
+		metrics_inc(counter);
+		metrics_gauge_add(gauge, 1);
+		/* 5 us, 300 us and 20 s: first bucket, 500 us and +Inf */
+		metrics_observe(histogram, i % 3 == 0 ? 5 : i % 3 == 1 ? 300 : 20000000);
+		metrics_gauge_add(gauge, -1);
+	}
+	return NULL;
+}
+
+static void *
+_counter_thread(void *data)
+{
+	int i;
+
+	for (i = 0; i < updates; i++) {
+		metrics_inc(counter);
+	}
+	return NULL;
+}
+
+static void *
+_observe_thread(void *data)
+{
+	int i;
+
+	for (i = 0; i < updates; i++) {
+		metrics_observe(histogram, i & 0xffff);
+	}
+	return NULL;
+}
+
+static void *
+_shared_thread(void *data)
+{
+	int i;
+
+	for (i = 0; i < updates; i++) {
+		__atomic_fetch_add(&shared, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static void
+_run(int threads, void *(*fn)(void *))
+{
+	pthread_t tids[MAX_THREADS];
+	int i;
+
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&tids[i], NULL, fn, NULL) != 0) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(tids[i], NULL);
+	}
+}
+
+static void
+_expect(const char *text, const char *line)
+{
+	if (strstr(text, line) == NULL) {
+		fprintf(stderr, "Missing line: %s", line);
+		failures++;
+	}
+}
+
+static void
+_register()
+{
+	counter = metrics_register(METRIC_COUNTER, "test_updates_total", "thread=\"all\"",
+	                           "Updates made.");
+	gauge = metrics_register(METRIC_GAUGE, "test_busy", NULL, NULL);
+	histogram = metrics_register(METRIC_HISTOGRAM, "test_duration_seconds", NULL,
+	                             "Observed durations.");
+	if (counter == NULL || gauge == NULL || histogram == NULL) {
+		fprintf(stderr, "Failed to register metrics\n");
+		exit(1);
+	}
+}
+
+static void
+_test(int threads)
+{
+	long long total = (long long)threads * updates;
+	long long n = (long long)threads * ((updates + 2) / 3);
+	char *text = NULL;
+	size_t len = 0;
+	char line[256];
+	FILE *out;
+
+	_register();
+	if (metrics_register(METRIC_COUNTER, "test_updates_total", "thread=\"all\"", NULL) != counter) {
+		fprintf(stderr, "Registering a metric again did not return it\n");
+		failures++;
+	}
+	if (metrics_register(METRIC_GAUGE, "test_updates_total", "thread=\"all\"", NULL) != NULL) {
+		fprintf(stderr, "Registering a metric with different type succeeded\n");
+		failures++;
+	}
+
+	_run(threads, _update_thread);
+
+	if ((out = open_memstream(&text, &len)) == NULL || metrics_write(out) != 0) {
+		perror("metrics_write");
+		exit(1);
+	}
+	fclose(out);
+
+	_expect(text, "# HELP test_updates_total Updates made.\n");
+	_expect(text, "# TYPE test_updates_total counter\n");
+	snprintf(line, sizeof(line), "test_updates_total{thread=\"all\"} %lld\n", total);
+	_expect(text, line);
+	_expect(text, "# TYPE test_busy gauge\ntest_busy 0\n");
+	_expect(text, "# TYPE test_duration_seconds histogram\n");
+	snprintf(line, sizeof(line), "test_duration_seconds_bucket{le=\"1e-05\"} %lld\n", n);
+	_expect(text, line);
+	snprintf(line, sizeof(line), "test_duration_seconds_bucket{le=\"0.00025\"} %lld\n", n);
+	_expect(text, line);
+	n += (long long)threads * ((updates + 1) / 3);
+	snprintf(line, sizeof(line), "test_duration_seconds_bucket{le=\"0.0005\"} %lld\n", n);
+	_expect(text, line);
+	snprintf(line, sizeof(line), "test_duration_seconds_bucket{le=\"10\"} %lld\n", n);
+	_expect(text, line);
+	snprintf(line, sizeof(line), "test_duration_seconds_bucket{le=\"+Inf\"} %lld\n", total);
+	_expect(text, line);
+	snprintf(line, sizeof(line), "test_duration_seconds_count %lld\n", total);
+	_expect(text, line);
+
+	free(text);
+
+	fprintf(stderr, "%d threads, %lld updates: %s\n", threads, total,
+	        failures ? "failed" : "ok");
+}
+
+static double
+_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+_bench(int threads)
+{
+	double start;
+
+	_register();
+
+	start = _now();
+	_run(threads, _counter_thread);
+	fprintf(stderr, "counter   %2d threads: %6.1f ns/update\n", threads,
+	        (_now() - start) * 1e9 / ((double)threads * updates));
+
+	start = _now();
+	_run(threads, _observe_thread);
+	fprintf(stderr, "histogram %2d threads: %6.1f ns/update\n", threads,
+	        (_now() - start) * 1e9 / ((double)threads * updates));
+
+	start = _now();
+	_run(threads, _shared_thread);
+	fprintf(stderr, "shared    %2d threads: %6.1f ns/update\n", threads,
+	        (_now() - start) * 1e9 / ((double)threads * updates));
+}
+
+int
+main(int argc, char *argv[])
+{
+	int threads = 4, bench = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "bn:t:")) != -1) {
+		switch (opt) {
+		case 'b':
+			bench = 1;
+			break;
+		case 'n':
+			updates = atoi(optarg);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-b] [-n updates] [-t threads]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (threads < 1 || threads > MAX_THREADS || updates < 1) {
+		fprintf(stderr, "Invalid thread or update count\n");
+		return 1;
+	}
+
+	if (bench) {
+		_bench(threads);
+		return 0;
+	}
+
+	_test(threads);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,189 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Compares the perfect hash MIME type lookup with the linear table scan it
+ * replaced, over a request mix resembling a listening session: mostly
+ * audio streams with occasional WebUI assets and unknown files.
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <event2/util.h>
+
+#include "mime_type.h"
+
+static const struct table_entry {
+	const char *extension;
+	const char *content_type;
+} linear_table[] = {
+	{ "html", "text/html" },
+	{ "htm",  "text/html" },
+	{ "css",  "text/css" },
+	{ "gif",  "image/gif" },
+	{ "jpg",  "image/jpeg" },
+	{ "jpeg", "image/jpeg" },
+	{ "png",  "image/png" },
+	{ "ico",  "image/x-icon" },
+	{ "svg",  "image/svg+xml" },
+	{ "js",   "application/javascript" },
+	{ "eot",  "application/vnd.ms-fontobject" },
+	{ "woff", "application/font-woff" },
+	{ "mp3",  "audio/mpeg" },
+	{ "ogg",  "application/ogg" },
+	{ "ogx",  "application/ogx" },
+	{ "oga",  "audio/ogg" },
+	{ "opus", "audio/ogg" },
+	{ "flac", "audio/flac" },
+	{ "m4a",  "audio/mp4" },
+	{ "wav",  "audio/wav" },
+	{ "webm", "audio/webm" },
+	{ NULL,   NULL },
+};
+
+static const char *
+_linear_guess(const char *path)
+{
+	const char *last_period, *extension = NULL;
+	const struct table_entry *ent;
+
+	last_period = strrchr(path, '.');
+	if (!last_period || strchr(last_period, '/'))
+		return NULL;
+	extension = last_period + 1;
+	for (ent = &linear_table[0]; ent->extension; ++ent) {
+		if (!evutil_ascii_strcasecmp(ent->extension, extension))
+			return ent->content_type;
+	}
+	return NULL;
+}
+
+static const struct {
+	const char *path;
+	int         weight;
+} request_mix[] = {
+	{ "/media/music/Artist/Album/01 - Track.mp3",         30 },
+	{ "/media/music/Artist/Album/02 - Track.flac",        25 },
+	{ "/media/music/Artist/Album/03 - Track.ogg",         10 },
+	{ "/media/music/Artist/Album/04 - Track.m4a",         10 },
+	{ "/media/music/Artist/Album/05 - Track.opus",         5 },
+	{ "/media/music/Artist/Album/06 - Track.MP3",          5 },
+	{ "/media/music/Artist/Album/07 - Track.wav",          2 },
+	{ "/usr/share/basileus/www/index.html",                1 },
+	{ "/usr/share/basileus/www/basileus.css",              1 },
+	{ "/usr/share/basileus/www/javascript/core.js",        1 },
+	{ "/usr/share/basileus/www/javascript/ui.js",          1 },
+	{ "/usr/share/basileus/www/basileus.png",              2 },
+	{ "/usr/share/basileus/www/favicon.ico",               2 },
+	{ "/usr/share/basileus/www/font-awesome/font/fontawesome-webfont.woff", 1 },
+	{ "/usr/share/basileus/www/robots.txt",                2 },
+	{ "/media/music/Artist/Album/07 - Track.wma",          2 },
+};
+
+#define MIX_SIZE (sizeof(request_mix) / sizeof(request_mix[0]))
+
+static double
+_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+_run(const char *(*guess)(const char *), const char **paths, int count, int iterations)
+{
+	volatile unsigned long sink = 0;
+	double start;
+	int i, j;
+
+	start = _now();
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < count; j++) {
+			const char *type = guess(paths[j]);
+			sink += type ? type[0] : 0;
+		}
+	}
+	return (_now() - start) * 1e9 / ((double)iterations * count);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int iterations = 100000;
+	const char **paths = NULL;
+	int i, j, count = 0;
+
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+	}
+
+	for (i = 0; i < MIX_SIZE; i++) {
+		count += request_mix[i].weight;
+	}
+	paths = malloc(count * sizeof(char *));
+	if (paths == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	/* Interleave requests so the branch predictor can't learn the order */
+	srand(1);
+	for (i = 0, count = 0; i < MIX_SIZE; i++) {
+		for (j = 0; j < request_mix[i].weight; j++) {
+			paths[count++] = request_mix[i].path;
+		}
+	}
+	for (i = count - 1; i > 0; i--) {
+		const char *tmp = paths[i];
+		j = rand() % (i + 1);
+		paths[i] = paths[j];
+		paths[j] = tmp;
+	}
+
+	/* Both implementations must agree */
+	for (i = 0; i < count; i++) {
+		const char *a = _linear_guess(paths[i]);
+		const char *b = mime_type_guess(paths[i]);
+		if ((a == NULL) != (b == NULL) || (a && strcmp(a, b))) {
+			fprintf(stderr, "Lookup mismatch for %s\n", paths[i]);
+			return 1;
+		}
+	}
+
+	printf("requests: %d, iterations: %d\n", count, iterations);
+	printf("linear scan:  %6.1f ns/lookup\n", _run(_linear_guess, paths, count, iterations));
+	printf("perfect hash: %6.1f ns/lookup\n", _run(mime_type_guess, paths, count, iterations));
+
+	free(paths);
+	return 0;
+}
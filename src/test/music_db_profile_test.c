@@ -0,0 +1,167 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Checks statement names used by the profiler, and that profiled
+ * statements end up in histograms labelled with them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sqlite3.h>
+
+#include "metrics.h"
+#include "music_db_profile.h"
+#include "music_db_sql.h"
+#include "basileus-music-db.h"
+
+static int failures = 0;
+
+static const struct {
+	const char *sql;
+	const char *name;
+} names[] = {
+	{ "SELECT id FROM artists WHERE name=?;", "ARTIST_ID" },
+	{ "PRAGMA user_version = 5;", "PRAGMA user_version = ?" },
+	{ "  SELECT *\n\tFROM t  WHERE a='it''s' AND b=12.5e3 AND c=x1;",
+	  "SELECT * FROM t WHERE a=? AND b=? AND c=x1" },
+	{ "UPDATE t SET a=:1, b=?2, c=@c, d=$d;", "UPDATE t SET a=?, b=?, c=?, d=?" },
+	{ "SELECT 'unterminated", "SELECT ?" },
+	{ "SELECT aaaaaaaaaa, bbbbbbbbbb, cccccccccc, dddddddddd, eeeeeeeeee FROM t;",
+	  "SELECT aaaaaaaaaa, bbbbbbbbbb, cccccccccc, dddddddddd, eeeee..." },
+};
+
+static void
+_test_names()
+{
+	char name[64];
+	int i;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		music_db_profile_name(names[i].sql, name, sizeof(name));
+		if (strcmp(name, names[i].name)) {
+			fprintf(stderr, "Name of \"%s\" is \"%s\", expected \"%s\"\n",
+			        names[i].sql, name, names[i].name);
+			failures++;
+		}
+	}
+}
+
+static void
+_run(sqlite3 *db, const char *sql, int times)
+{
+	sqlite3_stmt *stmt = NULL;
+
+	if (SQLITE_OK != sqlite3_prepare_v2(db, sql, -1, &stmt, NULL)) {
+		fprintf(stderr, "Failed to prepare %s: %s\n", sql, sqlite3_errmsg(db));
+		exit(1);
+	}
+	while (times--) {
+		sqlite3_bind_text(stmt, 1, "artist", -1, SQLITE_STATIC);
+		while (SQLITE_ROW == sqlite3_step(stmt));
+		sqlite3_reset(stmt);
+	}
+	sqlite3_finalize(stmt);
+}
+
+static void
+_expect(const char *text, const char *line, int present)
+{
+	if ((strstr(text, line) != NULL) != present) {
+		fprintf(stderr, "%s line: %s\n", present ? "Missing" : "Unexpected", line);
+		failures++;
+	}
+}
+
+static void
+_test_profile()
+{
+	sqlite3 *db = NULL;
+	char *text = NULL;
+	size_t len = 0;
+	FILE *out;
+
+	if (SQLITE_OK != sqlite3_open(":memory:", &db) ||
+	    SQLITE_OK != sqlite3_exec(db, create_basileus_db_str, NULL, NULL, NULL)) {
+		fprintf(stderr, "Failed to create database: %s\n", sqlite3_errmsg(db));
+		exit(1);
+	}
+
+	/* Not profiled yet */
+	_run(db, MUSIC_DB_SQL(ARTIST_ID), 1);
+
+	if (0 != music_db_profile_enable(db, 1)) {
+		exit(1);
+	}
+	_run(db, MUSIC_DB_SQL(ARTIST_ID), 3);
+	_run(db, MUSIC_DB_SQL(INSERT_ARTIST), 1);
+	_run(db, "SELECT count(*) FROM songs WHERE track > 3;", 2);
+	/* Statements taking microseconds are timed, not rounded to milliseconds */
+	if (music_db_profile_total_us() == 0 || music_db_profile_total_us() > 100000) {
+		fprintf(stderr, "Unexpected time of fast statements: %llu us\n",
+		        (unsigned long long)music_db_profile_total_us());
+		failures++;
+	}
+	/* Logged as slow once, the second run is suppressed */
+	music_db_profile_set_slow(1);
+	_run(db, "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n "
+	         "WHERE i < 100000) SELECT count(*) FROM n;", 2);
+	music_db_profile_set_slow(0);
+
+	music_db_profile_enable(db, 0);
+	_run(db, MUSIC_DB_SQL(INSERT_ARTIST), 1);
+	sqlite3_close(db);
+
+	if ((out = open_memstream(&text, &len)) == NULL || metrics_write(out) != 0) {
+		perror("metrics_write");
+		exit(1);
+	}
+	fclose(out);
+
+	_expect(text, "basileus_sqlite_statement_duration_seconds_count{statement=\"ARTIST_ID\"} 3\n", 1);
+	_expect(text, "basileus_sqlite_statement_duration_seconds_count{statement=\"INSERT_ARTIST\"} 1\n", 1);
+	_expect(text, "basileus_sqlite_statement_duration_seconds_count"
+	        "{statement=\"SELECT count(*) FROM songs WHERE track > ?\"} 2\n", 1);
+	_expect(text, "statement=\"CREATE", 0);
+
+	free(text);
+}
+
+int
+main(int argc, char *argv[])
+{
+	_test_names();
+	_test_profile();
+
+	fprintf(stderr, "%s\n", failures ? "failed" : "ok");
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,324 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Query plan regression suite for the music database statements. Every
+ * statement from music_db_sql.h is run through EXPLAIN QUERY PLAN against
+ * the real schema and the suite fails if any of them resorts to a full
+ * table scan, or to a temporary sort where an index should provide the
+ * order. When run with -b it also generates a library of given size
+ * (1M songs by default) and reports how long each statement takes.
+ */
+
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sqlite3.h>
+
+#include "music_db_sql.h"
+#include "basileus-music-db.h"
+
+#define MAX_MATERIALIZED 8
+
+static double
+_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Returns number of problems found in the plan of given statement. Scans
+ * are only acceptable when done over an index, a virtual table or a
+ * subquery materialized by the plan itself.
+ */
+static int
+_check_plan(sqlite3 *db, const music_db_sql_t *sql)
+{
+	char materialized[MAX_MATERIALIZED][64];
+	int n_materialized = 0, problems = 0, i;
+	sqlite3_stmt *stmt = NULL;
+	char *txt;
+
+	txt = sqlite3_mprintf("EXPLAIN QUERY PLAN %s", sql->text);
+	if (txt == NULL || SQLITE_OK != sqlite3_prepare_v2(db, txt, -1, &stmt, NULL)) {
+		fprintf(stderr, "%s: failed to prepare: %s\n", sql->name, sqlite3_errmsg(db));
+		sqlite3_free(txt);
+		return 1;
+	}
+	sqlite3_free(txt);
+
+	printf("%s\n", sql->name);
+	while (SQLITE_ROW == sqlite3_step(stmt)) {
+		const char *detail = (const char *)sqlite3_column_text(stmt, 3);
+		const char *problem = NULL;
+
+		if (0 == strncmp(detail, "MATERIALIZE ", 12) && n_materialized < MAX_MATERIALIZED) {
+			snprintf(materialized[n_materialized++], 64, "%s", detail + 12);
+		} else if (0 == strncmp(detail, "SCAN ", 5) &&
+		           NULL == strstr(detail, " USING ") &&
+		           NULL == strstr(detail, " VIRTUAL TABLE ")) {
+			problem = "full table scan";
+			for (i = 0; i < n_materialized; i++) {
+				if (0 == strcmp(detail + 5, materialized[i])) {
+					problem = NULL;
+				}
+			}
+		} else if (strstr(detail, "USE TEMP B-TREE") && !(sql->flags & MUSIC_DB_SQL_RANKED)) {
+			problem = "temporary sort";
+		}
+
+		printf("    %s%s%s\n", detail, problem ? "  <-- " : "", problem ? problem : "");
+		problems += problem != NULL;
+	}
+
+	sqlite3_finalize(stmt);
+	return problems;
+}
+
+/*
+ * Sample parameters used to time each statement. Numbers are bound as
+ * integers, "x:" prefixed hex strings as blobs and everything else as text.
+ */
+static const struct {
+	music_db_sql_id_t id;
+	const char       *params[5];
+} samples[] = {
+	{ MUSIC_DB_SQL_ARTIST_ID,       { "Artist 004711" } },
+	{ MUSIC_DB_SQL_ALBUM_ID,        { "Album 0047110", "4712" } },
+	{ MUSIC_DB_SQL_GENERATION,      { NULL } },
+	{ MUSIC_DB_SQL_ARTISTS,         { NULL, NULL, "100" } },
+	{ MUSIC_DB_SQL_ARTISTS_AFTER,   { NULL, "Artist 004711", "100" } },
+	{ MUSIC_DB_SQL_ALBUMS,          { "Artist 004711", NULL, "100" } },
+	{ MUSIC_DB_SQL_ALBUMS_AFTER,    { "Artist 004711", "Album 0047110", "100" } },
+	{ MUSIC_DB_SQL_SONGS,           { "Album 0047110", "Artist 004711", NULL, NULL, "100" } },
+	{ MUSIC_DB_SQL_SONGS_AFTER,     { "Album 0047110", "Artist 004711", "3", "1", "100" } },
+	{ MUSIC_DB_SQL_SEARCH,          { "\"nig\"* \"47\"*", "50" } },
+	{ MUSIC_DB_SQL_SONG_PATH,       { "47111" } },
+	{ MUSIC_DB_SQL_SONG_PATH_BY_HASH, { "x:0000000000000000000000000000b806" } },
+	{ MUSIC_DB_SQL_CHANGED_ARTISTS, { "1" } },
+	{ MUSIC_DB_SQL_CHANGED_ALBUMS,  { "1" } },
+};
+
+#define SAMPLES_SIZE (sizeof(samples) / sizeof(samples[0]))
+
+static const char *words[] = {
+	"love", "night", "blue", "dream", "fire", "heart", "rain", "summer",
+	"road", "light", "city", "dance", "black", "time", "world", "star",
+};
+
+#define WORDS_SIZE (sizeof(words) / sizeof(words[0]))
+
+/* Ten albums per artist and ten songs per album, all in last generation */
+static int
+_generate(sqlite3 *db, int songs)
+{
+	sqlite3_stmt *stmt = NULL;
+	unsigned char hash[16];
+	char txt[128];
+	int i;
+
+	sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL);
+
+	for (i = 0; i < songs; i++) {
+		if (i % 100 == 0) {
+			snprintf(txt, sizeof(txt), "INSERT INTO artists (id, name, generation) "
+			         "VALUES (%d, 'Artist %06d', 1);", i / 100 + 1, i / 100);
+			if (SQLITE_OK != sqlite3_exec(db, txt, NULL, NULL, NULL)) {
+				goto failure;
+			}
+		}
+		if (i % 10 == 0) {
+			snprintf(txt, sizeof(txt), "INSERT INTO albums (id, name, artist_id, generation) "
+			         "VALUES (%d, 'Album %07d', %d, 1);", i / 10 + 1, i / 10, i / 100 + 1);
+			if (SQLITE_OK != sqlite3_exec(db, txt, NULL, NULL, NULL)) {
+				goto failure;
+			}
+		}
+
+		sqlite3_reset(stmt);
+		if (stmt == NULL &&
+		    SQLITE_OK != sqlite3_prepare_v2(db, music_db_sql[MUSIC_DB_SQL_INSERT_SONG].text,
+		                                    -1, &stmt, NULL)) {
+			goto failure;
+		}
+		snprintf(txt, sizeof(txt), "%s %s %d", words[i % WORDS_SIZE],
+		         words[(i / WORDS_SIZE) % WORDS_SIZE], i);
+		memset(hash, 0, sizeof(hash));
+		hash[14] = i >> 8;
+		hash[15] = i & 0xff;
+		hash[13] = i >> 16;
+		sqlite3_bind_text(stmt, 1, txt, -1, SQLITE_TRANSIENT);
+		snprintf(txt, sizeof(txt), "/media/music/%d.mp3", i);
+		sqlite3_bind_text(stmt, 2, txt, -1, SQLITE_TRANSIENT);
+		sqlite3_bind_blob(stmt, 3, hash, sizeof(hash), SQLITE_TRANSIENT);
+		sqlite3_bind_int(stmt, 4, i % 10 + 1);
+		sqlite3_bind_int(stmt, 5, 180);
+		sqlite3_bind_int(stmt, 6, i / 100 + 1);
+		sqlite3_bind_int(stmt, 7, i / 10 + 1);
+		if (SQLITE_DONE != sqlite3_step(stmt)) {
+			goto failure;
+		}
+	}
+
+	sqlite3_finalize(stmt);
+	return sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) == SQLITE_OK ? 0 : -1;
+
+failure:
+	fprintf(stderr, "Failed to generate library: %s\n", sqlite3_errmsg(db));
+	sqlite3_finalize(stmt);
+	return -1;
+}
+
+static int
+_time_statements(sqlite3 *db, int iterations)
+{
+	sqlite3_stmt *stmt = NULL;
+	unsigned char blob[64];
+	double start, elapsed;
+	int i, j, k, rows;
+	unsigned int byte;
+
+	for (i = 0; i < SAMPLES_SIZE; i++) {
+		const music_db_sql_t *sql = &music_db_sql[samples[i].id];
+
+		if (SQLITE_OK != sqlite3_prepare_v2(db, sql->text, -1, &stmt, NULL)) {
+			fprintf(stderr, "%s: failed to prepare: %s\n", sql->name, sqlite3_errmsg(db));
+			return -1;
+		}
+		for (k = 0; k < 5; k++) {
+			const char *p = samples[i].params[k];
+			if (p == NULL) {
+				continue;
+			}
+			if (0 == strncmp(p, "x:", 2)) {
+				for (j = 0; p[2 + j * 2] && j < sizeof(blob); j++) {
+					sscanf(p + 2 + j * 2, "%2x", &byte);
+					blob[j] = byte;
+				}
+				sqlite3_bind_blob(stmt, k + 1, blob, j, SQLITE_TRANSIENT);
+			} else if (strspn(p, "0123456789") == strlen(p)) {
+				sqlite3_bind_int64(stmt, k + 1, atoll(p));
+			} else {
+				sqlite3_bind_text(stmt, k + 1, p, -1, SQLITE_STATIC);
+			}
+		}
+
+		rows = 0;
+		start = _now();
+		for (j = 0; j < iterations; j++) {
+			sqlite3_reset(stmt);
+			while (SQLITE_ROW == sqlite3_step(stmt)) {
+				rows++;
+			}
+		}
+		elapsed = _now() - start;
+
+		printf("%-16s %10.1f us/query %8d rows/query\n", sql->name,
+		       elapsed * 1e6 / iterations, rows / iterations);
+		sqlite3_finalize(stmt);
+	}
+
+	return 0;
+}
+
+static void
+_usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-b] [-s songs] [-i iterations] [-d database]\n", name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *path = ":memory:";
+	int bench = 0, songs = 1000000, iterations = 100;
+	int i, opt, problems = 0;
+	sqlite3 *db = NULL;
+	char *errmsg = NULL;
+
+	while ((opt = getopt(argc, argv, "bs:i:d:")) != -1) {
+		switch (opt) {
+		case 'b':
+			bench = 1;
+			break;
+		case 's':
+			songs = atoi(optarg);
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		case 'd':
+			path = optarg;
+			break;
+		default:
+			_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (SQLITE_OK != sqlite3_open(path, &db)) {
+		fprintf(stderr, "Failed to open database %s\n", path);
+		return 1;
+	}
+
+	if (SQLITE_OK != sqlite3_exec(db, create_basileus_db_str, NULL, NULL, &errmsg)) {
+		fprintf(stderr, "Failed to create database: %s\n", errmsg);
+		sqlite3_free(errmsg);
+		sqlite3_close(db);
+		return 1;
+	}
+
+	for (i = 0; i < MUSIC_DB_SQL_COUNT; i++) {
+		problems += _check_plan(db, &music_db_sql[i]);
+	}
+
+	if (bench && problems == 0) {
+		double start = _now();
+		if (0 != _generate(db, songs)) {
+			sqlite3_close(db);
+			return 1;
+		}
+		printf("\nGenerated %d songs in %.1f s\n\n", songs, _now() - start);
+		_time_statements(db, iterations);
+	}
+
+	sqlite3_close(db);
+
+	if (problems) {
+		fprintf(stderr, "%d query plan regression(s) found\n", problems);
+		return 1;
+	}
+
+	return 0;
+}
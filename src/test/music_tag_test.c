@@ -0,0 +1,549 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Checks the native tag reader against synthetic files: ID3v2.2, 2.3 and
+ * 2.4 tags in various text encodings, ID3v1, Xing and constant bitrate
+ * MP3 durations, FLAC and Ogg Vorbis or Opus streams with large cover art
+ * blocks in front of the interesting comments, and Ogg pages without
+ * segments. With -k the files are kept
+ * in given directory, as a small corpus for tag-bench. Also checks the
+ * extension and magic number prefilter in front of the tag readers.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "file_class.h"
+#include "music_tag.h"
+
+typedef struct {
+	unsigned char *data;
+	size_t         len;
+	size_t         cap;
+} _buf_t;
+
+static void
+_put(_buf_t *b, const void *data, size_t len)
+{
+	if (b->len + len > b->cap) {
+		b->cap = (b->len + len) * 2;
+		b->data = realloc(b->data, b->cap);
+		if (b->data == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+}
+
+static void
+_put_fill(_buf_t *b, int c, size_t len)
+{
+	unsigned char tmp[256];
+	size_t n;
+
+	memset(tmp, c, sizeof(tmp));
+	while (len > 0) {
+		n = len < sizeof(tmp) ? len : sizeof(tmp);
+		_put(b, tmp, n);
+		len -= n;
+	}
+}
+
+static void
+_put_be(_buf_t *b, unsigned long v, int bytes)
+{
+	unsigned char tmp[8];
+	int i;
+
+	for (i = 0; i < bytes; i++) {
+		tmp[i] = v >> (8 * (bytes - 1 - i));
+	}
+	_put(b, tmp, bytes);
+}
+
+static void
+_put_le(_buf_t *b, unsigned long long v, int bytes)
+{
+	unsigned char tmp[8];
+	int i;
+
+	for (i = 0; i < bytes; i++) {
+		tmp[i] = v >> (8 * i);
+	}
+	_put(b, tmp, bytes);
+}
+
+static void
+_put_syncsafe(_buf_t *b, unsigned long v)
+{
+	_put_be(b, (v & 0x7f) | (v & 0x3f80) << 1 | (v & 0x1fc000) << 2 | (v & 0xfe00000) << 3, 4);
+}
+
+/*
+ * ID3v2 frame with given encoding byte and raw text.
+ */
+static void
+_id3_frame(_buf_t *b, int version, const char *id, int enc, const void *text, size_t len)
+{
+	_put(b, id, version == 2 ? 3 : 4);
+	if (version == 2) {
+		_put_be(b, len + 1, 3);
+	} else if (version == 3) {
+		_put_be(b, len + 1, 4);
+		_put_be(b, 0, 2);
+	} else {
+		_put_syncsafe(b, len + 1);
+		_put_be(b, 0, 2);
+	}
+	_put_be(b, enc, 1);
+	_put(b, text, len);
+}
+
+static void
+_id3_header(_buf_t *b, int version, size_t size)
+{
+	_put(b, "ID3", 3);
+	_put_be(b, version, 1);
+	_put_be(b, 0, 2);
+	_put_syncsafe(b, size);
+}
+
+/*
+ * MPEG 1 layer III, 128 kbps, 44.1 kHz, stereo frame header, optionally
+ * followed by a Xing header with frame count.
+ */
+static void
+_mpeg_frame(_buf_t *b, unsigned long xing_frames)
+{
+	size_t start = b->len;
+
+	_put_be(b, 0xfffb9000, 4);
+	if (xing_frames) {
+		_put_fill(b, 0, 32);
+		_put(b, "Xing", 4);
+		_put_be(b, 1, 4);
+		_put_be(b, xing_frames, 4);
+	}
+	_put_fill(b, 0, 417 - (b->len - start));
+}
+
+static void
+_vorbis_comment(_buf_t *b, const char **comments, int count)
+{
+	int i;
+
+	_put_le(b, 4, 4);
+	_put(b, "test", 4);
+	_put_le(b, count, 4);
+	for (i = 0; i < count; i++) {
+		_put_le(b, strlen(comments[i]), 4);
+		_put(b, comments[i], strlen(comments[i]));
+	}
+}
+
+/*
+ * Write Ogg pages carrying a packet, it starts on a new page.
+ */
+static void
+_ogg_packet(_buf_t *b, const unsigned char *data, size_t len, long long granule, int *seq)
+{
+	size_t lacing = len / 255 + 1, done = 0, pos = 0, segs, n, i;
+
+	while (done < lacing) {
+		segs = lacing - done > 255 ? 255 : lacing - done;
+		_put(b, "OggS", 4);
+		_put_be(b, 0, 1);
+		_put_be(b, done ? 1 : 0, 1);
+		/* Only the page on which the packet ends gets granule position */
+		_put_le(b, done + segs == lacing ? granule : -1LL, 8);
+		_put_le(b, 1, 4);
+		_put_le(b, (*seq)++, 4);
+		_put_le(b, 0, 4);
+		_put_be(b, segs, 1);
+		for (i = 0, n = 0; i < segs; i++) {
+			_put_be(b, done + i < lacing - 1 ? 255 : len % 255, 1);
+			n += done + i < lacing - 1 ? 255 : len % 255;
+		}
+		_put(b, data + pos, n);
+		pos += n;
+		done += segs;
+	}
+}
+
+/*
+ * Write an Ogg page without segments.
+ */
+static void
+_ogg_empty_page(_buf_t *b, int *seq)
+{
+	_put(b, "OggS", 4);
+	_put_be(b, 0, 2);
+	_put_le(b, -1LL, 8);
+	_put_le(b, 1, 4);
+	_put_le(b, (*seq)++, 4);
+	_put_le(b, 0, 4);
+	_put_be(b, 0, 1);
+}
+
+/*
+ * Fake backend, only the native reader is tested
+ */
+music_tag_t *
+music_tag_backend_create(const char *file)
+{
+	return NULL;
+}
+
+static const char *dir = NULL;
+static int keep = 0;
+static int failures = 0;
+
+static music_tag_t *
+_read(const char *name, _buf_t *b)
+{
+	char path[256];
+	music_tag_t *tag = NULL;
+	FILE *f = NULL;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if ((f = fopen(path, "wb")) == NULL || fwrite(b->data, 1, b->len, f) != b->len) {
+		fprintf(stderr, "Failed to write %s\n", path);
+		exit(1);
+	}
+	fclose(f);
+
+	tag = music_tag_native_create(path);
+	if (!keep) {
+		unlink(path);
+	}
+	free(b->data);
+	memset(b, 0, sizeof(_buf_t));
+	return tag;
+}
+
+static void
+_check(const char *name, music_tag_t *tag, const char *title, const char *artist,
+       const char *album, int track, int length)
+{
+	if (tag == NULL) {
+		fprintf(stderr, "%s: not recognized\n", name);
+		failures++;
+		return;
+	}
+	if (strcmp(tag->title, title) || strcmp(tag->artist, artist) ||
+	    strcmp(tag->album, album) || tag->track != track || tag->length != length) {
+		fprintf(stderr, "%s: got (%s, %s, %s, %d, %d), expected (%s, %s, %s, %d, %d)\n",
+		        name, tag->title, tag->artist, tag->album, tag->track, tag->length,
+		        title, artist, album, track, length);
+		failures++;
+	} else {
+		printf("%s: ok\n", name);
+	}
+	music_tag_destroy(tag);
+}
+
+static void
+_check_class(const char *name, file_class_t class, file_class_t expected)
+{
+	if (class != expected) {
+		fprintf(stderr, "%s: class %d, expected %d\n", name, class, expected);
+		failures++;
+	} else {
+		printf("%s: ok\n", name);
+	}
+}
+
+static file_class_t
+_classify(const char *name, const void *data, size_t len)
+{
+	char path[256];
+	file_class_t class;
+	FILE *f = NULL;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if ((f = fopen(path, "wb")) == NULL || fwrite(data, 1, len, f) != len) {
+		fprintf(stderr, "Failed to write %s\n", path);
+		exit(1);
+	}
+	fclose(f);
+
+	class = file_class_by_magic(path);
+	unlink(path);
+	return class;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const unsigned char utf16[] = {
+		0xff, 0xfe, 'S', 0, 0xf3, 0, 'n', 0, 0x3d, 0xd8, 0xb5, 0xdc, 0, 0
+	};
+	const char *comments[] = {
+		"ENCODER=test", "title=Vorbis Title", "ARTIST=Vorbis Artist",
+		"ALBUM=Vorbis Album", "TRACKNUMBER=7"
+	};
+	char tmpl[] = "/tmp/music-tag-test-XXXXXX";
+	char long_title[301];
+	unsigned char *picture = NULL;
+	_buf_t b, frames, pkt;
+	int i, opt, seq = 0;
+
+	while ((opt = getopt(argc, argv, "k:")) != -1) {
+		switch (opt) {
+		case 'k':
+			dir = optarg;
+			keep = 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-k directory]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	memset(&b, 0, sizeof(b));
+	memset(&frames, 0, sizeof(frames));
+	memset(&pkt, 0, sizeof(pkt));
+
+	if (dir == NULL && (dir = mkdtemp(tmpl)) == NULL) {
+		fprintf(stderr, "Failed to create temporary directory\n");
+		return 1;
+	}
+
+	/* ID3v2.3, UTF-16 with surrogate pair, Latin-1, Xing frame count */
+	_id3_frame(&frames, 3, "TIT2", 1, utf16, sizeof(utf16));
+	_id3_frame(&frames, 3, "TPE1", 0, "Mot\xf6rhead", 9);
+	_id3_frame(&frames, 3, "APIC", 0, "", 0);
+	_id3_frame(&frames, 3, "TALB", 0, "Album  ", 7);
+	_id3_frame(&frames, 3, "TRCK", 0, "3/12", 4);
+	_id3_header(&b, 3, frames.len + 100);
+	_put(&b, frames.data, frames.len);
+	_put_fill(&b, 0, 100);
+	_mpeg_frame(&b, 1000);
+	free(frames.data);
+	memset(&frames, 0, sizeof(frames));
+	_check("id3v2.3", _read("a.mp3", &b), "S\xc3\xb3n\xf0\x9f\x92\xb5", "Mot\xc3\xb6rhead",
+	       "Album", 3, 26);
+
+	/* ID3v2.4, UTF-8, frame size past 127 bytes, constant bitrate */
+	memset(long_title, 'x', 300);
+	long_title[300] = '\0';
+	_id3_frame(&frames, 4, "TIT2", 3, long_title, 300);
+	_id3_frame(&frames, 4, "TPE1", 3, "Artist", 6);
+	_id3_frame(&frames, 4, "TALB", 3, "Album", 5);
+	_id3_header(&b, 4, frames.len);
+	_put(&b, frames.data, frames.len);
+	free(frames.data);
+	memset(&frames, 0, sizeof(frames));
+	for (i = 0; i < 16000 * 10 / 417; i++) {
+		_mpeg_frame(&b, 0);
+	}
+	_check("id3v2.4", _read("b.mp3", &b), long_title, "Artist", "Album", 0, 9);
+
+	/* ID3v2.2 with TLE length in milliseconds */
+	_id3_frame(&frames, 2, "TT2", 0, "Old", 3);
+	_id3_frame(&frames, 2, "TP1", 0, "Artist", 6);
+	_id3_frame(&frames, 2, "TAL", 0, "Album", 5);
+	_id3_frame(&frames, 2, "TLE", 0, "61000", 5);
+	_id3_header(&b, 2, frames.len);
+	_put(&b, frames.data, frames.len);
+	free(frames.data);
+	memset(&frames, 0, sizeof(frames));
+	_mpeg_frame(&b, 0);
+	_check("id3v2.2", _read("c.mp3", &b), "Old", "Artist", "Album", 0, 61);
+
+	/* Bare MPEG stream with ID3v1.1 */
+	_mpeg_frame(&b, 500);
+	_put(&b, "TAG", 3);
+	_put(&b, "Title v1", 8);
+	_put_fill(&b, ' ', 22);
+	_put(&b, "Artist v1", 9);
+	_put_fill(&b, 0, 21);
+	_put(&b, "Album v1", 8);
+	_put_fill(&b, 0, 22 + 4 + 28);
+	_put_be(&b, 0, 1);
+	_put_be(&b, 5, 1);
+	_put_be(&b, 0, 1);
+	_check("id3v1", _read("d.mp3", &b), "Title v1", "Artist v1", "Album v1", 5, 13);
+
+	/* FLAC, 10 s at 44.1 kHz, cover art before comments */
+	_put(&b, "fLaC", 4);
+	_put_be(&b, 0, 1);
+	_put_be(&b, 34, 3);
+	_put_fill(&b, 0, 10);
+	_put_be(&b, 44100 << 12 | 2 << 9 | 15 << 4, 4);
+	_put_be(&b, 441000, 4);
+	_put_fill(&b, 0, 16);
+	_put_be(&b, 6, 1);
+	_put_be(&b, 300000, 3);
+	_put_fill(&b, 0xab, 300000);
+	_vorbis_comment(&pkt, comments, 5);
+	_put_be(&b, 0x84, 1);
+	_put_be(&b, pkt.len, 3);
+	_put(&b, pkt.data, pkt.len);
+	free(pkt.data);
+	memset(&pkt, 0, sizeof(pkt));
+	_put_fill(&b, 0, 1000);
+	_check("flac", _read("e.flac", &b), "Vorbis Title", "Vorbis Artist", "Vorbis Album", 7, 10);
+
+	/* Ogg Vorbis, comment packet spanning several pages */
+	_put_be(&pkt, 1, 1);
+	_put(&pkt, "vorbis", 6);
+	_put_le(&pkt, 0, 4);
+	_put_be(&pkt, 2, 1);
+	_put_le(&pkt, 44100, 4);
+	_put_fill(&pkt, 0, 13);
+	_ogg_packet(&b, pkt.data, pkt.len, 0, &seq);
+	free(pkt.data);
+	memset(&pkt, 0, sizeof(pkt));
+	picture = malloc(100001);
+	memcpy(picture, "METADATA_BLOCK_PICTURE=", 23);
+	memset(picture + 23, 'A', 100000 - 23);
+	picture[100000] = '\0';
+	comments[0] = (const char *)picture;
+	_put_be(&pkt, 3, 1);
+	_put(&pkt, "vorbis", 6);
+	_vorbis_comment(&pkt, comments, 5);
+	_ogg_packet(&b, pkt.data, pkt.len, 0, &seq);
+	free(pkt.data);
+	memset(&pkt, 0, sizeof(pkt));
+	_put_fill(&pkt, 0, 100);
+	_ogg_packet(&b, pkt.data, pkt.len, 44100 * 30, &seq);
+	free(pkt.data);
+	memset(&pkt, 0, sizeof(pkt));
+	_check("vorbis", _read("f.ogg", &b), "Vorbis Title", "Vorbis Artist", "Vorbis Album", 7, 30);
+
+	/* Ogg Opus, granule includes pre-skip */
+	_put(&pkt, "OpusHead", 8);
+	_put_be(&pkt, 1, 1);
+	_put_be(&pkt, 2, 1);
+	_put_le(&pkt, 312, 2);
+	_put_le(&pkt, 44100, 4);
+	_put_fill(&pkt, 0, 3);
+	_ogg_packet(&b, pkt.data, pkt.len, 0, &seq);
+	free(pkt.data);
+	memset(&pkt, 0, sizeof(pkt));
+	_put(&pkt, "OpusTags", 8);
+	comments[0] = "ENCODER=test";
+	_vorbis_comment(&pkt, comments, 5);
+	_ogg_packet(&b, pkt.data, pkt.len, 0, &seq);
+	free(pkt.data);
+	memset(&pkt, 0, sizeof(pkt));
+	_put_fill(&pkt, 0, 100);
+	_ogg_packet(&b, pkt.data, pkt.len, 48000 * 5 + 312, &seq);
+	free(pkt.data);
+	memset(&pkt, 0, sizeof(pkt));
+	_check("opus", _read("g.opus", &b), "Vorbis Title", "Vorbis Artist", "Vorbis Album", 7, 5);
+
+	/* Ogg Opus, pages without segments between and after the headers */
+	_put(&pkt, "OpusHead", 8);
+	_put_be(&pkt, 1, 1);
+	_put_be(&pkt, 2, 1);
+	_put_le(&pkt, 0, 2);
+	_put_le(&pkt, 48000, 4);
+	_put_fill(&pkt, 0, 3);
+	_ogg_packet(&b, pkt.data, pkt.len, 0, &seq);
+	free(pkt.data);
+	memset(&pkt, 0, sizeof(pkt));
+	_ogg_empty_page(&b, &seq);
+	_ogg_empty_page(&b, &seq);
+	_put(&pkt, "OpusTags", 8);
+	_vorbis_comment(&pkt, comments, 5);
+	_ogg_packet(&b, pkt.data, pkt.len, 0, &seq);
+	free(pkt.data);
+	memset(&pkt, 0, sizeof(pkt));
+	_ogg_empty_page(&b, &seq);
+	_put_fill(&pkt, 0, 100);
+	_ogg_packet(&b, pkt.data, pkt.len, 48000 * 4, &seq);
+	free(pkt.data);
+	memset(&pkt, 0, sizeof(pkt));
+	_check("ogg empty pages", _read("i.opus", &b), "Vorbis Title", "Vorbis Artist",
+	       "Vorbis Album", 7, 4);
+
+	/* Anything else is left to the backend */
+	_put(&b, "#EXTM3U\n", 8);
+	if (_read("h.m3u", &b) != NULL) {
+		fprintf(stderr, "m3u: unexpectedly recognized\n");
+		failures++;
+	} else {
+		printf("m3u: ok\n");
+	}
+
+	/* Prefilter, by extension first */
+	if (file_class_set_ignored("log, .bak") != 0) {
+		return 1;
+	}
+	_check_class("Cover.JPG", file_class_by_name("/music/Cover.JPG"), FILE_CLASS_IGNORE);
+	_check_class("album.cue", file_class_by_name("album.cue"), FILE_CLASS_IGNORE);
+	_check_class("list.m3u", file_class_by_name("list.m3u"), FILE_CLASS_IGNORE);
+	_check_class("rip.log", file_class_by_name("rip.log"), FILE_CLASS_IGNORE);
+	_check_class("song.bak", file_class_by_name("song.bak"), FILE_CLASS_IGNORE);
+	_check_class("song.mp3", file_class_by_name("song.mp3"), FILE_CLASS_MPEG);
+	_check_class("song.flac", file_class_by_name("song.flac"), FILE_CLASS_FLAC);
+	_check_class("song.opus", file_class_by_name("song.opus"), FILE_CLASS_OGG);
+	_check_class("song.m4a", file_class_by_name("song.m4a"), FILE_CLASS_OTHER);
+	_check_class("song", file_class_by_name("dir.d/song"), FILE_CLASS_UNKNOWN);
+	_check_class("song.xyz", file_class_by_name("song.xyz"), FILE_CLASS_UNKNOWN);
+
+	/* then by magic number for unknown extensions */
+	_check_class("magic id3", _classify("a.xyz", "ID3\x03\0\0\0\0\0\0\0\0\0\0\0\0", 16),
+	             FILE_CLASS_MPEG);
+	_check_class("magic mpeg", _classify("b.xyz", "\xff\xfb\x90\x64\0\0\0\0\0\0\0\0\0\0\0\0", 16),
+	             FILE_CLASS_MPEG);
+	_check_class("magic flac", _classify("c.xyz", "fLaC\0\0\0\x22\0\0\0\0\0\0\0\0", 16),
+	             FILE_CLASS_FLAC);
+	_check_class("magic ogg", _classify("d.xyz", "OggS\0\x02\0\0\0\0\0\0\0\0\0\0", 16),
+	             FILE_CLASS_OGG);
+	_check_class("magic wav", _classify("e.xyz", "RIFF\0\0\0\0WAVEfmt ", 16),
+	             FILE_CLASS_OTHER);
+	_check_class("magic m4b", _classify("h.xyz", "\0\0\0\x20" "ftypM4B \0\0\0\0", 16),
+	             FILE_CLASS_OTHER);
+	_check_class("magic mp42", _classify("i.xyz", "\0\0\0\x1c" "ftypmp42\0\0\0\0", 16),
+	             FILE_CLASS_OTHER);
+	_check_class("magic ebml", _classify("j.xyz",
+	             "\x1a\x45\xdf\xa3\x9f\x42\x86\x81\x01\x42\xf7\x81\x01\x42\xf2\x81", 16),
+	             FILE_CLASS_OTHER);
+	_check_class("magic tta", _classify("k.xyz", "TTA1\x01\0\x02\0\x10\0\x44\xac\0\0\0\0", 16),
+	             FILE_CLASS_OTHER);
+	_check_class("magic dsf", _classify("l.xyz", "DSD \x1c\0\0\0\0\0\0\0\0\0\0\0", 16),
+	             FILE_CLASS_OTHER);
+	_check_class("magic text", _classify("f.xyz", "Exact Audio Copy", 16),
+	             FILE_CLASS_IGNORE);
+	_check_class("magic short", _classify("g.xyz", "fLaC", 4), FILE_CLASS_IGNORE);
+
+	free(picture);
+	if (!keep) {
+		rmdir(dir);
+	}
+	return failures ? 1 : 0;
+}
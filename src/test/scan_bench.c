@@ -0,0 +1,245 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * End to end scan benchmark. Generates a synthetic library, see
+ * library_gen.h, and scans it with music_db_refresh() into an empty
+ * database with file contents evicted from the page cache, then again
+ * with the database populated and files cached. Each scan is reported as
+ * a line of JSON with files per second, bytes read for tags, time spent
+ * in SQLite statements and peak RSS of the process so far. With -o the
+ * lines are appended to a file, for regression tracking.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include <event2/event.h>
+#include <event2/thread.h>
+
+#include "cfg.h"
+#include "logger.h"
+#include "music_db.h"
+#include "music_db_profile.h"
+#include "scheduler.h"
+#include "bench_util.h"
+#include "library_gen.h"
+
+static void
+_report(FILE *out, const char *run, const library_gen_spec_t *spec, const char *formats,
+        const music_db_status_t *status, double time, double sqlite_time)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	fprintf(out, "{\"benchmark\": \"scan\", \"run\": \"%s\", \"artists\": %d, \"albums\": %d, "
+	        "\"tracks\": %d, \"depth\": %d, \"junk\": %d, \"formats\": \"%s\", "
+	        "\"audio_size\": %zu, \"files\": %d, \"seconds\": %.3f, "
+	        "\"files_per_second\": %.0f, \"bytes_read\": %lld, \"sqlite_seconds\": %.3f, "
+	        "\"peak_rss_kb\": %ld}\n", run, spec->artists, spec->albums, spec->tracks,
+	        spec->depth, spec->junk, formats, spec->audio_size, status->scan_files, time,
+	        status->scan_files / time, (long long)status->scan_bytes, sqlite_time, ru.ru_maxrss);
+	fflush(out);
+}
+
+static void
+_usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-a artists] [-A albums] [-t tracks] [-d depth] [-j junk] "
+	        "[-f mp3,flac,ogg] [-s audio KB] [-S seed] [-w warm runs] [-q io depth] [-F] "
+	        "[-k library directory] [-o output]\n", name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	char tmpl[] = "/tmp/scan-bench-XXXXXX";
+	char library[1024], db[1024], conf[1024];
+	const char *formats = "mp3,flac,ogg", *keep = NULL, *io_depth = "128";
+	library_gen_spec_t spec;
+	library_gen_stats_t stats;
+	music_db_status_t status;
+	bench_catalog_t catalog = { NULL };
+	struct event_base *evb = NULL;
+	scheduler_t *sched = NULL;
+	music_db_t mdb = NULL;
+	cfg_t *cfg = NULL;
+	FILE *out = stdout, *f = NULL;
+	char *dir = NULL;
+	double start, time, sqlite_time;
+	int warm = 3, fingerprint = 0, i, opt, ret = 1;
+
+	library_gen_defaults(&spec);
+	while ((opt = getopt(argc, argv, "a:A:t:d:j:f:s:S:w:q:Fk:o:")) != -1) {
+		switch (opt) {
+		case 'a':
+			spec.artists = atoi(optarg);
+			break;
+		case 'A':
+			spec.albums = atoi(optarg);
+			break;
+		case 't':
+			spec.tracks = atoi(optarg);
+			break;
+		case 'd':
+			spec.depth = atoi(optarg);
+			break;
+		case 'j':
+			spec.junk = atoi(optarg);
+			break;
+		case 'f':
+			formats = optarg;
+			break;
+		case 's':
+			spec.audio_size = atoi(optarg) * 1024;
+			break;
+		case 'S':
+			spec.seed = atoi(optarg);
+			break;
+		case 'w':
+			warm = atoi(optarg);
+			break;
+		case 'q':
+			io_depth = optarg;
+			break;
+		case 'F':
+			fingerprint = 1;
+			break;
+		case 'k':
+			keep = optarg;
+			break;
+		case 'o':
+			if ((out = fopen(optarg, "a")) == NULL) {
+				fprintf(stderr, "Failed to open %s\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			_usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc || (spec.formats = library_gen_formats(formats)) == 0 ||
+	    spec.artists < 1 || spec.albums < 1 || spec.tracks < 1 || warm < 0) {
+		_usage(argv[0]);
+		return 1;
+	}
+
+	/* Keep JSON lines on stdout clear of scan progress messages */
+	logger_set_level("warning");
+
+	if ((dir = mkdtemp(tmpl)) == NULL) {
+		fprintf(stderr, "Failed to create temporary directory\n");
+		return 1;
+	}
+	snprintf(library, sizeof(library), "%s/library", dir);
+	snprintf(db, sizeof(db), "%s/music.db", dir);
+	snprintf(conf, sizeof(conf), "%s/scan-bench.conf", dir);
+	if (keep) {
+		snprintf(library, sizeof(library), "%s", keep);
+	}
+
+	start = bench_now();
+	if ((0 != mkdir(library, 0755) && errno != EEXIST) ||
+	    0 != library_gen(library, &spec, &stats)) {
+		fprintf(stderr, "Failed to generate library in %s: %s\n", library, strerror(errno));
+		goto finish;
+	}
+	fprintf(stderr, "Generated %d tracks and %d junk files in %d directories, %.1f MB "
+	        "in %.1f s\n", stats.tracks, stats.junk, stats.dirs, stats.bytes / 1e6,
+	        bench_now() - start);
+
+	if ((f = fopen(conf, "w")) == NULL) {
+		fprintf(stderr, "Failed to write %s\n", conf);
+		goto finish;
+	}
+	fprintf(f, "music-dir = %s\ndatabase-path = %s\ncontent-fingerprint = %d\n"
+	        "io-depth = %s\nprofile-statements = 1\nslow-statement-time = 0\n",
+	        library, db, fingerprint, io_depth);
+	fclose(f);
+
+	if (0 != evthread_use_pthreads() || (evb = event_base_new()) == NULL ||
+	    0 != evthread_make_base_notifiable(evb)) {
+		fprintf(stderr, "Failed to create event base\n");
+		goto finish;
+	}
+	if ((cfg = cfg_init(conf)) == NULL || (sched = scheduler_new(cfg, evb)) == NULL ||
+	    (mdb = music_db_new(cfg, sched)) == NULL) {
+		fprintf(stderr, "Failed to set up music database\n");
+		goto finish;
+	}
+
+	bench_evict(library);
+	for (i = 0; i <= warm; i++) {
+		sqlite_time = music_db_profile_total_us();
+		if (0 != bench_scan(mdb, evb, &status, &time)) {
+			fprintf(stderr, "Failed to start scan\n");
+			goto finish;
+		}
+		sqlite_time = (music_db_profile_total_us() - sqlite_time) / 1e6;
+		_report(out, i == 0 ? "cold" : "warm", &spec, formats, &status, time, sqlite_time);
+
+		/* Albums of every format were recognized */
+		if (i == 0 && (0 != bench_load_catalog(mdb, &catalog) ||
+		               catalog.album_count != spec.artists * spec.albums)) {
+			fprintf(stderr, "Scan found %d albums, %d generated\n", catalog.album_count,
+			        spec.artists * spec.albums);
+			goto finish;
+		}
+	}
+
+	ret = 0;
+
+finish:
+	bench_catalog_free(&catalog);
+	if (mdb) {
+		music_db_free(mdb);
+	}
+	if (sched) {
+		scheduler_free(sched);
+	}
+	if (cfg) {
+		cfg_free(cfg);
+	}
+	if (evb) {
+		event_base_free(evb);
+	}
+	if (out != stdout) {
+		fclose(out);
+	}
+	library_gen_remove(dir);
+	return ret;
+}
@@ -0,0 +1,593 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Scheduler microbenchmarks, each run with a range of worker thread
+ * counts:
+ *  tiny   - many tasks finishing on their first run, queued at once;
+ *  yield  - long tasks yielding after a little work each time, for a
+ *           fixed time;
+ *  burst  - external producer threads queueing bursts of tiny tasks with
+ *           pauses in between, so workers go idle and have to be woken;
+ *  events - producer threads flooding the main loop with
+ *           scheduler_add_event().
+ * Reported are operations (task runs or events) per second, latency from
+ * queueing until the task or event starts running, or between two runs of
+ * a yielding task, and Jain's fairness index: over steps of yielding
+ * tasks, over events delivered per producer when half of them were
+ * delivered, and over tasks run per worker thread otherwise. Only the
+ * scheduler.h interface is used, the implementation is picked with the
+ * SCHEDULER_BENCH_SOURCE CMake variable and labelled in the results.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <event2/event.h>
+#include <event2/thread.h>
+
+#include "cfg.h"
+#include "logger.h"
+#include "scheduler.h"
+
+#ifndef SCHEDULER_IMPL
+#define SCHEDULER_IMPL "scheduler.c"
+#endif
+
+/* Latency histogram, four buckets per power of two nanoseconds */
+#define BUCKETS 256
+
+#define MAX_WORKERS 256
+#define MAX_PRODUCERS 64
+
+/* Tasks and events are freed by the scheduler, along with these */
+typedef struct {
+	task_t      task;
+	uint64_t    queued;
+	int         id;
+} _task_t;
+
+typedef struct {
+	event_t     event;
+	uint64_t    queued;
+	int         producer;
+} _event_t;
+
+static char             threads_str[16] = "1";
+static int              task_count = 100000;
+static int              yield_tasks = 16;
+static int              producers = 2;
+static int              burst_size = 64;
+static double           duration = 1;
+
+/* State of the current run, reset before each */
+static unsigned long    latency[BUCKETS];
+static unsigned long    worker_ops[MAX_WORKERS];
+static int              worker_count;
+static unsigned long    delivered[MAX_PRODUCERS];
+static unsigned long   *steps;
+static uint64_t        *last_run;
+static int              target;
+static int              done;
+static int              stop;
+static uint64_t         end;
+static unsigned long    ops;
+static double           fairness;
+
+static pthread_key_t     worker_key;
+static struct event_base *bench_evb;
+
+/*
+ * Fake configuration, only the thread count is read
+ */
+const char *
+cfg_get_str(cfg_t *cfg, cfg_key_t key)
+{
+	return key == CFG_SCHEDULER_THREADS ? threads_str : "";
+}
+
+static uint64_t
+_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+_sleep_us(long us)
+{
+	struct timespec ts = { us / 1000000, us % 1000000 * 1000 };
+	while (nanosleep(&ts, &ts) != 0 && errno == EINTR);
+}
+
+static void
+_latency_add(uint64_t ns)
+{
+	int b, i;
+
+	if (ns < 4) {
+		i = ns;
+	} else {
+		b = 63 - __builtin_clzll(ns);
+		i = b * 4 + (ns >> (b - 2) & 3);
+	}
+	__atomic_add_fetch(&latency[i], 1, __ATOMIC_RELAXED);
+}
+
+/* Upper bound of latency below which given fraction of samples fall (us) */
+static double
+_latency_percentile(double p)
+{
+	unsigned long total = 0, sum = 0;
+	int i;
+
+	for (i = 0; i < BUCKETS; i++) {
+		total += latency[i];
+	}
+	for (i = 0; i < BUCKETS - 1; i++) {
+		sum += latency[i];
+		if (total && sum >= total * p) {
+			break;
+		}
+	}
+	i++;
+	return (i < 4 ? i : (uint64_t)(4 + i % 4) << (i / 4 - 2)) / 1000.0;
+}
+
+static double
+_jain(const unsigned long *x, int n)
+{
+	double sum = 0, squares = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		sum += x[i];
+		squares += (double)x[i] * x[i];
+	}
+	return squares > 0 ? sum * sum / (n * squares) : 1;
+}
+
+static void
+_worker_op()
+{
+	uintptr_t id = (uintptr_t)pthread_getspecific(worker_key);
+
+	/* Worker threads are new for each run, ids start from 1 */
+	if (id == 0) {
+		id = __atomic_add_fetch(&worker_count, 1, __ATOMIC_RELAXED);
+		pthread_setspecific(worker_key, (void *)id);
+	}
+	if (id <= MAX_WORKERS) {
+		__atomic_add_fetch(&worker_ops[id - 1], 1, __ATOMIC_RELAXED);
+	}
+}
+
+static void
+_task_done(void *data)
+{
+	if (__atomic_add_fetch(&done, 1, __ATOMIC_RELAXED) == target) {
+		__atomic_store_n(&end, _now(), __ATOMIC_RELAXED);
+	}
+}
+
+static void
+_task_failed(void *data)
+{
+	fprintf(stderr, "Task failed\n");
+	exit(1);
+}
+
+static task_status_t
+_tiny_run(void *data)
+{
+	_task_t *t = data;
+
+	_latency_add(_now() - t->queued);
+	_worker_op();
+	return TASK_STATUS_FINISHED;
+}
+
+static void
+_add_task(scheduler_t *sched, task_status_t (*run)(void *), int id)
+{
+	_task_t *t = malloc(sizeof(_task_t));
+
+	if (t == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	memset(t, 0, sizeof(*t));
+	t->task.name = "bench";
+	t->task.user_data = t;
+	t->task.run = run;
+	t->task.finished = _task_done;
+	t->task.failed = _task_failed;
+	t->id = id;
+	t->queued = _now();
+	if (0 != scheduler_add_task(sched, &t->task)) {
+		fprintf(stderr, "Failed to add task\n");
+		exit(1);
+	}
+}
+
+static void
+_wait_done()
+{
+	while (__atomic_load_n(&done, __ATOMIC_RELAXED) < target) {
+		_sleep_us(100);
+	}
+}
+
+static void
+_tiny(scheduler_t *sched)
+{
+	int i;
+
+	target = task_count;
+	for (i = 0; i < target; i++) {
+		_add_task(sched, _tiny_run, i);
+	}
+	_wait_done();
+	ops = target;
+	fairness = _jain(worker_ops, worker_count);
+}
+
+/*
+ * A few microseconds of work per step, then back to the queue
+ */
+static task_status_t
+_yield_run(void *data)
+{
+	_task_t *t = data;
+	uint64_t now = _now();
+	volatile unsigned long x = 0;
+	int i;
+
+	if (__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		return TASK_STATUS_FINISHED;
+	}
+	if (last_run[t->id]) {
+		_latency_add(now - last_run[t->id]);
+	}
+	for (i = 0; i < 1000; i++) {
+		x += i;
+	}
+	steps[t->id]++;
+	_worker_op();
+	last_run[t->id] = _now();
+	return TASK_STATUS_YIELD;
+}
+
+static void
+_yield(scheduler_t *sched)
+{
+	int i;
+
+	target = yield_tasks;
+	steps = calloc(target, sizeof(*steps));
+	last_run = calloc(target, sizeof(*last_run));
+	if (steps == NULL || last_run == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < target; i++) {
+		_add_task(sched, _yield_run, i);
+	}
+	_sleep_us(duration * 1e6);
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	end = _now();
+	_wait_done();
+
+	/* Steps are counted until stop, finishing the tasks is left out */
+	fairness = _jain(steps, target);
+	for (i = 0, ops = 0; i < target; i++) {
+		ops += steps[i];
+	}
+	free(steps);
+	free(last_run);
+}
+
+static void *
+_burst_producer(void *data)
+{
+	scheduler_t *sched = data;
+	int i, queued = 0, total = target / producers;
+
+	while (queued < total) {
+		for (i = 0; i < burst_size && queued < total; i++, queued++) {
+			_add_task(sched, _tiny_run, queued);
+		}
+		/* Long enough for workers to go back to sleep */
+		_sleep_us(1000);
+	}
+	return NULL;
+}
+
+static void
+_burst(scheduler_t *sched)
+{
+	pthread_t threads[MAX_PRODUCERS];
+	int i;
+
+	target = task_count / producers * producers;
+	for (i = 0; i < producers; i++) {
+		if (0 != pthread_create(&threads[i], NULL, _burst_producer, sched)) {
+			fprintf(stderr, "Failed to start producer\n");
+			exit(1);
+		}
+	}
+	for (i = 0; i < producers; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	_wait_done();
+	ops = target;
+	fairness = _jain(worker_ops, worker_count);
+}
+
+/*
+ * Runs on the main loop thread
+ */
+static void
+_event_run(void *data)
+{
+	_event_t *e = data;
+
+	_latency_add(_now() - e->queued);
+	delivered[e->producer]++;
+	if (++done == target / 2) {
+		fairness = _jain(delivered, producers);
+	}
+	if (done == target) {
+		end = _now();
+		event_base_loopbreak(bench_evb);
+	}
+}
+
+static void *
+_event_producer(void *data)
+{
+	scheduler_t *sched = data;
+	_event_t *e = NULL;
+	int i, producer;
+
+	producer = __atomic_fetch_add(&worker_count, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < target / producers; i++) {
+		if ((e = malloc(sizeof(_event_t))) == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+		e->event.name = "bench";
+		e->event.user_data = e;
+		e->event.run = _event_run;
+		e->producer = producer;
+		e->queued = _now();
+		if (0 != scheduler_add_event(sched, &e->event)) {
+			fprintf(stderr, "Failed to add event\n");
+			exit(1);
+		}
+	}
+	return NULL;
+}
+
+static void
+_keepalive(evutil_socket_t fd, short events, void *data)
+{
+}
+
+static void
+_events(scheduler_t *sched)
+{
+	pthread_t threads[MAX_PRODUCERS];
+	struct timeval tv = { 1, 0 };
+	struct event *timer;
+	int i;
+
+	/* Keeps the loop running until the first event is queued */
+	timer = event_new(bench_evb, -1, EV_PERSIST, _keepalive, NULL);
+	if (timer == NULL || 0 != event_add(timer, &tv)) {
+		fprintf(stderr, "Failed to set up main loop\n");
+		exit(1);
+	}
+
+	target = task_count / producers * producers;
+	for (i = 0; i < producers; i++) {
+		if (0 != pthread_create(&threads[i], NULL, _event_producer, sched)) {
+			fprintf(stderr, "Failed to start producer\n");
+			exit(1);
+		}
+	}
+	event_base_dispatch(bench_evb);
+	for (i = 0; i < producers; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	event_free(timer);
+	ops = target;
+}
+
+static const struct {
+	const char *name;
+	void      (*run)(scheduler_t *sched);
+} scenarios[] = {
+	{ "tiny",   _tiny },
+	{ "yield",  _yield },
+	{ "burst",  _burst },
+	{ "events", _events }
+};
+
+#define SCENARIOS (sizeof(scenarios) / sizeof(scenarios[0]))
+
+static int
+_run(FILE *out, int scenario, int threads)
+{
+	scheduler_t *sched = NULL;
+	uint64_t start;
+
+	memset(latency, 0, sizeof(latency));
+	memset(worker_ops, 0, sizeof(worker_ops));
+	memset(delivered, 0, sizeof(delivered));
+	worker_count = 0;
+	done = stop = 0;
+	end = 0;
+	ops = 0;
+	fairness = 1;
+
+	snprintf(threads_str, sizeof(threads_str), "%d", threads);
+	if ((sched = scheduler_new(NULL, bench_evb)) == NULL) {
+		return -1;
+	}
+	start = _now();
+	scenarios[scenario].run(sched);
+	scheduler_free(sched);
+
+	fprintf(out, "{\"benchmark\": \"scheduler\", \"impl\": \"%s\", \"scenario\": \"%s\", "
+	        "\"threads\": %d, \"ops\": %lu, \"seconds\": %.3f, \"ops_per_second\": %.0f, "
+	        "\"latency_p50_us\": %.1f, \"latency_p99_us\": %.1f, \"latency_p999_us\": %.1f, "
+	        "\"fairness\": %.3f}\n", SCHEDULER_IMPL, scenarios[scenario].name, threads, ops,
+	        (end - start) / 1e9, ops * 1e9 / (end - start), _latency_percentile(0.5),
+	        _latency_percentile(0.99), _latency_percentile(0.999), fairness);
+	fflush(out);
+	return 0;
+}
+
+static void
+_usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-s tiny,yield,burst,events] [-t thread counts] [-n tasks] "
+	        "[-y yielding tasks] [-d yield seconds] [-p producers] [-b burst size] "
+	        "[-o output]\n", name);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *list = "tiny,yield,burst,events", *thread_list = "1,2,4", *p;
+	int selected[SCENARIOS], threads[16];
+	int selected_count = 0, thread_count = 0;
+	char name[16];
+	FILE *out = stdout;
+	int n, opt, i, j, ret = 1;
+
+	while ((opt = getopt(argc, argv, "s:t:n:y:d:p:b:o:")) != -1) {
+		switch (opt) {
+		case 's':
+			list = optarg;
+			break;
+		case 't':
+			thread_list = optarg;
+			break;
+		case 'n':
+			task_count = atoi(optarg);
+			break;
+		case 'y':
+			yield_tasks = atoi(optarg);
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		case 'p':
+			producers = atoi(optarg);
+			break;
+		case 'b':
+			burst_size = atoi(optarg);
+			break;
+		case 'o':
+			if ((out = fopen(optarg, "a")) == NULL) {
+				fprintf(stderr, "Failed to open %s\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			_usage(argv[0]);
+			return 1;
+		}
+	}
+
+	for (p = list; optind == argc && *p && selected_count < SCENARIOS; p += n) {
+		if (1 != sscanf(p, "%15[a-z]%n", name, &n)) {
+			break;
+		}
+		for (i = 0; i < SCENARIOS && strcmp(name, scenarios[i].name) != 0; i++);
+		if (i == SCENARIOS) {
+			break;
+		}
+		selected[selected_count++] = i;
+		n += p[n] == ',';
+	}
+	for (p = thread_list; optind == argc && *p && thread_count < 16; p += n) {
+		if (1 != sscanf(p, "%d%n", &threads[thread_count], &n) ||
+		    threads[thread_count] < 1) {
+			break;
+		}
+		thread_count++;
+		n += p[n] == ',';
+	}
+	if (optind != argc || *p || selected_count == 0 || thread_count == 0 ||
+	    task_count < 2 || yield_tasks < 1 || duration <= 0 || producers < 1 ||
+	    producers > MAX_PRODUCERS || burst_size < 1 || task_count < producers * 2) {
+		_usage(argv[0]);
+		goto finish;
+	}
+
+	logger_set_level("warning");
+
+	if (0 != evthread_use_pthreads() || (bench_evb = event_base_new()) == NULL ||
+	    0 != evthread_make_base_notifiable(bench_evb) ||
+	    0 != pthread_key_create(&worker_key, NULL)) {
+		fprintf(stderr, "Failed to set up main loop\n");
+		goto finish;
+	}
+
+	for (i = 0; i < selected_count; i++) {
+		for (j = 0; j < thread_count; j++) {
+			if (0 != _run(out, selected[i], threads[j])) {
+				fprintf(stderr, "Failed to create scheduler\n");
+				goto finish;
+			}
+		}
+	}
+	ret = 0;
+
+finish:
+	if (bench_evb) {
+		event_base_free(bench_evb);
+	}
+	if (out != stdout) {
+		fclose(out);
+	}
+	return ret;
+}
@@ -150,7 +150,7 @@ main(int argc, char *argv[])
 	int ret = 0;
 
 	logger_init();
-	logger_show_trace = 0;
+	logger_level = LOG_LEVEL_INFO;
 
 #ifndef _VALGRIND
 	event_enable_debug_mode();
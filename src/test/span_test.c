@@ -0,0 +1,205 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Records spans from several threads into small buffers and checks that
+ * the most recent ones of each thread are written out, and that nothing
+ * is recorded while tracing is disabled. The oldest span of a full
+ * buffer may be being overwritten, so it is never written out.
+ *
+ * With -b measures the cost of a span.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "span.h"
+
+#define MAX_THREADS 64
+#define BUFFER_SIZE 64
+
+static int failures = 0;
+static int spans = 1000;
+
+/* Keeps threads alive until all are done, so they don't share buffers */
+static pthread_barrier_t barrier;
+
+static void *
+_span_thread(void *data)
+{
+	int i;
+
+	for (i = 0; i < spans; i++) {
+		span_t span = span_begin();
+		span_end(span, i < spans - BUFFER_SIZE ? "old" : "recent \"span\"");
+	}
+	pthread_barrier_wait(&barrier);
+	return NULL;
+}
+
+static void
+_run(int threads)
+{
+	pthread_t tids[MAX_THREADS];
+	int i;
+
+	pthread_barrier_init(&barrier, NULL, threads);
+	for (i = 0; i < threads; i++) {
+		if (pthread_create(&tids[i], NULL, _span_thread, NULL) != 0) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(tids[i], NULL);
+	}
+	pthread_barrier_destroy(&barrier);
+}
+
+static int
+_count(const char *text, const char *what)
+{
+	int count = 0;
+
+	while ((text = strstr(text, what)) != NULL) {
+		text += strlen(what);
+		count++;
+	}
+	return count;
+}
+
+static void
+_test(int threads)
+{
+	char *text = NULL;
+	size_t len = 0;
+	FILE *out;
+	int count;
+
+	span_configure(BUFFER_SIZE - 1);
+
+	_run(threads);
+	span_enable(1);
+	_run(threads);
+	span_enable(0);
+	_run(threads);
+
+	if ((out = open_memstream(&text, &len)) == NULL || span_write_json(out) != 0) {
+		perror("span_write_json");
+		exit(1);
+	}
+	fclose(out);
+
+	if (strncmp(text, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", 39) ||
+	    strcmp(text + len - 4, "\n]}\n")) {
+		fprintf(stderr, "Malformed trace: %s\n", text);
+		failures++;
+	}
+	if ((count = _count(text, "\"ph\":\"X\"")) != threads * (BUFFER_SIZE - 1)) {
+		fprintf(stderr, "Got %d spans, expected %d\n", count, threads * (BUFFER_SIZE - 1));
+		failures++;
+	}
+	if ((count = _count(text, "{\"name\":\"recent \\\"span\\\"\"")) != threads * (BUFFER_SIZE - 1)) {
+		fprintf(stderr, "Got %d recent spans, expected %d\n", count, threads * (BUFFER_SIZE - 1));
+		failures++;
+	}
+
+	free(text);
+
+	fprintf(stderr, "%d threads, %d spans: %s\n", threads, threads * spans,
+	        failures ? "failed" : "ok");
+}
+
+static double
+_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+_bench(int threads)
+{
+	double start;
+
+	span_enable(1);
+	start = _now();
+	_run(threads);
+	fprintf(stderr, "enabled  %2d threads: %6.1f ns/span\n", threads,
+	        (_now() - start) * 1e9 / ((double)threads * spans));
+
+	span_enable(0);
+	start = _now();
+	_run(threads);
+	fprintf(stderr, "disabled %2d threads: %6.1f ns/span\n", threads,
+	        (_now() - start) * 1e9 / ((double)threads * spans));
+}
+
+int
+main(int argc, char *argv[])
+{
+	int threads = 4, bench = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "bn:t:")) != -1) {
+		switch (opt) {
+		case 'b':
+			bench = 1;
+			break;
+		case 'n':
+			spans = atoi(optarg);
+			break;
+		case 't':
+			threads = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-b] [-n spans] [-t threads]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (threads < 1 || threads > MAX_THREADS || spans < BUFFER_SIZE) {
+		fprintf(stderr, "Invalid thread or span count\n");
+		return 1;
+	}
+
+	if (bench) {
+		_bench(threads);
+		return 0;
+	}
+
+	_test(threads);
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,280 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Times tag extraction over a directory of music files, grouped by file
+ * extension. Tags can be read through the full music_tag_create() path,
+ * or through the native reader or the TagLib/libav backend alone. With -p
+ * the libav backend probes audio streams even when container headers
+ * provide duration. Mode "batch" reads files the way the scanner does, in
+ * groups through io_batch, with -q setting the I/O depth and -o the I/O
+ * backend. Files are read once before timing, so results reflect parsing
+ * cost rather than disk speed. With -c they are not, which after dropping
+ * the page cache shows how storage latency is hidden.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <ftw.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include "music_tag.h"
+
+#define MAX_EXTENSIONS 32
+
+/* Same as scanner's batch size */
+#define BATCH 256
+
+static struct {
+	char   **paths;
+	int      count;
+	int      cap;
+} files;
+
+static struct {
+	char     name[16];
+	int      files;
+	int      recognized;
+	double   time;
+} extensions[MAX_EXTENSIONS];
+
+static int extension_count = 0;
+
+static double
+_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+_collect(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+	char **tmp = NULL;
+
+	if (type != FTW_F) {
+		return 0;
+	}
+	if (files.count == files.cap) {
+		files.cap = files.cap ? files.cap * 2 : 1024;
+		if ((tmp = realloc(files.paths, files.cap * sizeof(char *))) == NULL) {
+			return -1;
+		}
+		files.paths = tmp;
+	}
+	if ((files.paths[files.count] = strdup(path)) == NULL) {
+		return -1;
+	}
+	files.count++;
+	return 0;
+}
+
+static int
+_extension(const char *path)
+{
+	const char *ext = strrchr(path, '.');
+	int i;
+
+	if (ext == NULL || strchr(ext, '/') || strlen(ext + 1) >= sizeof(extensions[0].name)) {
+		ext = ".";
+	}
+	for (i = 0; i < extension_count; i++) {
+		if (strcasecmp(extensions[i].name, ext + 1) == 0) {
+			return i;
+		}
+	}
+	if (extension_count == MAX_EXTENSIONS) {
+		return MAX_EXTENSIONS - 1;
+	}
+	strcpy(extensions[extension_count].name, ext + 1);
+	return extension_count++;
+}
+
+static void
+_usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-m auto|native|backend|batch] [-q depth] [-o io_uring|threads] "
+	        "[-p] [-c] [-i iterations] directory\n", name);
+}
+
+/*
+ * Read tags of files in batches, time is split evenly between files.
+ */
+static void
+_run_batch(io_batch_t *io, unsigned char *bufs, io_file_t *batch, int timed)
+{
+	music_tag_t *tag = NULL;
+	double start, time;
+	int i, j, count, e;
+
+	for (i = 0; i < files.count; i += BATCH) {
+		count = files.count - i < BATCH ? files.count - i : BATCH;
+		for (j = 0; j < count; j++) {
+			batch[j].path = files.paths[i + j];
+			batch[j].head = bufs + j * (IO_HEAD_SIZE + IO_TAIL_SIZE);
+			batch[j].tail = batch[j].head + IO_HEAD_SIZE;
+		}
+
+		start = _now();
+		if (io_batch_read(io, batch, count) != 0) {
+			fprintf(stderr, "Failed to read files\n");
+			exit(1);
+		}
+		for (j = 0; j < count; j++) {
+			tag = music_tag_create_prefetched(&batch[j]);
+			if (timed) {
+				e = _extension(batch[j].path);
+				extensions[e].files++;
+				extensions[e].recognized += tag != NULL;
+			}
+			music_tag_destroy(tag);
+		}
+		io_batch_close(batch, count);
+		time = _now() - start;
+
+		for (j = 0; timed && j < count; j++) {
+			extensions[_extension(batch[j].path)].time += time / count;
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	music_tag_t *(*create)(const char *) = music_tag_create;
+	const char *mode = "auto", *backend = NULL;
+	io_batch_t *io = NULL;
+	io_file_t batch[BATCH];
+	unsigned char *bufs = NULL;
+	music_tag_t *tag = NULL;
+	double start, total = 0;
+	int iterations = 1, recognized = 0, depth = 128, cold = 0;
+	int i, j, e, opt;
+
+	while ((opt = getopt(argc, argv, "m:q:o:pci:")) != -1) {
+		switch (opt) {
+		case 'm':
+			mode = optarg;
+			break;
+		case 'q':
+			depth = atoi(optarg);
+			break;
+		case 'o':
+			backend = optarg;
+			break;
+		case 'p':
+			music_tag_set_fast_scan(0);
+			break;
+		case 'c':
+			cold = 1;
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		default:
+			_usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc - 1 || iterations < 1) {
+		_usage(argv[0]);
+		return 1;
+	}
+
+	if (strcmp(mode, "native") == 0) {
+		create = music_tag_native_create;
+	} else if (strcmp(mode, "backend") == 0) {
+		create = music_tag_backend_create;
+	} else if (strcmp(mode, "batch") == 0) {
+		bufs = malloc(BATCH * (IO_HEAD_SIZE + IO_TAIL_SIZE));
+		if (bufs == NULL || (io = io_batch_new(depth, backend)) == NULL) {
+			fprintf(stderr, "Failed to set up I/O\n");
+			return 1;
+		}
+	} else if (strcmp(mode, "auto") != 0) {
+		_usage(argv[0]);
+		return 1;
+	}
+
+	if (nftw(argv[optind], _collect, 64, FTW_PHYS) != 0 || files.count == 0) {
+		fprintf(stderr, "Failed to list files in %s\n", argv[optind]);
+		return 1;
+	}
+
+	/* Warm up page cache */
+	for (i = 0; !cold && io == NULL && i < files.count; i++) {
+		music_tag_destroy(create(files.paths[i]));
+	}
+	if (!cold && io != NULL) {
+		_run_batch(io, bufs, batch, 0);
+	}
+
+	for (j = 0; j < iterations; j++) {
+		if (io != NULL) {
+			_run_batch(io, bufs, batch, 1);
+			continue;
+		}
+		for (i = 0; i < files.count; i++) {
+			e = _extension(files.paths[i]);
+			start = _now();
+			tag = create(files.paths[i]);
+			music_tag_destroy(tag);
+			extensions[e].time += _now() - start;
+			extensions[e].files++;
+			extensions[e].recognized += tag != NULL;
+		}
+	}
+
+	printf("mode: %s%s, files: %d, iterations: %d\n", mode,
+	       music_tag_fast_scan() ? "" : " (full probe)", files.count, iterations);
+	if (io != NULL) {
+		printf("io: %s, depth %d\n", io_batch_backend(io), depth);
+	}
+	printf("%-8s %8s %10s %12s\n", "ext", "files", "recognized", "us/file");
+	for (i = 0; i < extension_count; i++) {
+		printf("%-8s %8d %10d %12.1f\n", extensions[i].name, extensions[i].files / iterations,
+		       extensions[i].recognized / iterations,
+		       extensions[i].time * 1e6 / extensions[i].files);
+		total += extensions[i].time;
+		recognized += extensions[i].recognized;
+	}
+	printf("total: %.0f files/s, %d recognized\n", files.count * iterations / total,
+	       recognized / iterations);
+
+	io_batch_free(io);
+	free(bufs);
+
+	return 0;
+}
@@ -0,0 +1,251 @@
+/*-
+ * Copyright (c) 2013 Peter Tworek
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the author nor the names of any co-contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Checks that events pushed by the webserver reach every open event
+ * stream: two clients subscribe to /bctl/events, a scan adds songs to
+ * the library, and both must be told about the new library generation.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <event2/event.h>
+#include <event2/thread.h>
+#include <event2/http.h>
+#include <event2/buffer.h>
+
+#include "cfg.h"
+#include "logger.h"
+#include "music_db.h"
+#include "scheduler.h"
+#include "webserver.h"
+#include "library_gen.h"
+
+#define PORT 18191
+
+#define SUBSCRIBERS 2
+
+/* Time given to the scan and to pushing its events (s) */
+#define TIMEOUT 20
+
+typedef struct {
+	struct evhttp_connection *evcon;
+	int                       library_events;
+	int                       errors;
+} _subscriber_t;
+
+static _subscriber_t subscribers[SUBSCRIBERS];
+static struct event_base *evb = NULL;
+static music_db_t mdb = NULL;
+static int refreshed = 0;
+
+static int
+_done()
+{
+	int i;
+
+	for (i = 0; i < SUBSCRIBERS; i++) {
+		if (subscribers[i].library_events < 2 && subscribers[i].errors == 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Counts library events, the first comes with the stream headers */
+static void
+_chunk(struct evhttp_request *req, void *arg)
+{
+	_subscriber_t *s = arg;
+	struct evbuffer *in = evhttp_request_get_input_buffer(req);
+	size_t len = evbuffer_get_length(in);
+	const char *p, *end;
+	char *data;
+	int i;
+
+	if ((data = malloc(len + 1)) == NULL) {
+		s->errors++;
+		return;
+	}
+	evbuffer_remove(in, data, len);
+	data[len] = '\0';
+	end = data + len;
+	for (p = data; p < end && (p = strstr(p, "event: library\n")) != NULL; p++) {
+		s->library_events++;
+	}
+	free(data);
+
+	/* Library changes once everyone listens */
+	for (i = 0; i < SUBSCRIBERS && subscribers[i].library_events > 0; i++);
+	if (i == SUBSCRIBERS && !refreshed) {
+		refreshed = 1;
+		if (0 != music_db_refresh(mdb)) {
+			fprintf(stderr, "Failed to start scan\n");
+			event_base_loopbreak(evb);
+		}
+	}
+	if (_done()) {
+		event_base_loopbreak(evb);
+	}
+}
+
+static void
+_closed(struct evhttp_request *req, void *arg)
+{
+	_subscriber_t *s = arg;
+
+	if (req == NULL || evhttp_request_get_response_code(req) != 200) {
+		s->errors++;
+	}
+	if (_done()) {
+		event_base_loopbreak(evb);
+	}
+}
+
+static int
+_subscribe(_subscriber_t *s)
+{
+	struct evhttp_request *req = NULL;
+
+	if ((s->evcon = evhttp_connection_base_new(evb, NULL, "127.0.0.1", PORT)) == NULL ||
+	    (req = evhttp_request_new(_closed, s)) == NULL) {
+		return -1;
+	}
+	evhttp_request_set_chunked_cb(req, _chunk);
+	return evhttp_make_request(s->evcon, req, EVHTTP_REQ_GET, "/bctl/events");
+}
+
+int
+main(int argc, char *argv[])
+{
+	char tmpl[] = "/tmp/webserver-test-XXXXXX";
+	char library[1024], db[1024], conf[1024];
+	struct timeval timeout = { TIMEOUT, 0 };
+	library_gen_spec_t spec;
+	library_gen_stats_t stats;
+	scheduler_t *sched = NULL;
+	webserver_t ws = NULL;
+	cfg_t *cfg = NULL;
+	FILE *f = NULL;
+	char *dir = NULL;
+	int i, failures = 0;
+
+	logger_set_level("warning");
+
+	if ((dir = mkdtemp(tmpl)) == NULL) {
+		fprintf(stderr, "Failed to create temporary directory\n");
+		return 1;
+	}
+	snprintf(library, sizeof(library), "%s/library", dir);
+	snprintf(db, sizeof(db), "%s/music.db", dir);
+	snprintf(conf, sizeof(conf), "%s/webserver-test.conf", dir);
+
+	library_gen_defaults(&spec);
+	spec.artists = 1;
+	spec.albums = 1;
+	spec.tracks = 2;
+	spec.audio_size = 4096;
+	if (0 != mkdir(library, 0755) || 0 != library_gen(library, &spec, &stats)) {
+		fprintf(stderr, "Failed to generate library in %s: %s\n", library, strerror(errno));
+		failures++;
+		goto finish;
+	}
+
+	if ((f = fopen(conf, "w")) == NULL) {
+		fprintf(stderr, "Failed to write %s\n", conf);
+		failures++;
+		goto finish;
+	}
+	fprintf(f, "listening-address = 127.0.0.1\nlistening-port = %d\ndocument-root = %s\n"
+	        "music-dir = %s\ndatabase-path = %s\n", PORT, dir, library, db);
+	fclose(f);
+
+	/* Scan thread is joined by an event posted from it */
+	if (0 != evthread_use_pthreads() || (evb = event_base_new()) == NULL ||
+	    0 != evthread_make_base_notifiable(evb) ||
+	    (cfg = cfg_init(conf)) == NULL || (sched = scheduler_new(cfg, evb)) == NULL ||
+	    (mdb = music_db_new(cfg, sched)) == NULL ||
+	    (ws = webserver_init(cfg, mdb, evb)) == NULL) {
+		fprintf(stderr, "Failed to start server on port %d\n", PORT);
+		failures++;
+		goto finish;
+	}
+
+	for (i = 0; i < SUBSCRIBERS; i++) {
+		if (0 != _subscribe(&subscribers[i])) {
+			fprintf(stderr, "Failed to subscribe to events\n");
+			failures++;
+			goto finish;
+		}
+	}
+	event_base_loopexit(evb, &timeout);
+	event_base_dispatch(evb);
+
+	for (i = 0; i < SUBSCRIBERS; i++) {
+		if (subscribers[i].errors || subscribers[i].library_events < 2) {
+			fprintf(stderr, "Subscriber %d got %d library events, %d errors\n", i,
+			        subscribers[i].library_events, subscribers[i].errors);
+			failures++;
+		}
+	}
+
+finish:
+	for (i = 0; i < SUBSCRIBERS; i++) {
+		if (subscribers[i].evcon) {
+			evhttp_connection_free(subscribers[i].evcon);
+		}
+	}
+	if (ws) {
+		webserver_shutdown(ws);
+	}
+	if (mdb) {
+		music_db_free(mdb);
+	}
+	if (sched) {
+		scheduler_free(sched);
+	}
+	if (cfg) {
+		cfg_free(cfg);
+	}
+	if (evb) {
+		event_base_free(evb);
+	}
+	library_gen_remove(dir);
+
+	fprintf(stderr, "%d subscribers: %s\n", SUBSCRIBERS, failures ? "failed" : "ok");
+
+	return failures ? 1 : 0;
+}
@@ -29,24 +29,61 @@
 
 #include <fcntl.h>
 #include <errno.h>
+#include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <inttypes.h>
 
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/queue.h>
 
 #include <event2/http.h>
 #include <event2/event.h>
 #include <event2/buffer.h>
+#include <event2/bufferevent.h>
 #include <event2/keyvalq_struct.h>
 
+#include "evlog.h"
 #include "logger.h"
+#include "metrics.h"
 #include "music_db.h"
+#include "mime_type.h"
+#include "span.h"
 #include "webserver.h"
 
+/* Interval at which event loop responsiveness is sampled (ms) */
+#define LOOP_LAG_PROBE_INTERVAL 100
+
+/* Interval at which library state changes are pushed to event streams (ms) */
+#define EVENTS_PUSH_INTERVAL 1000
+
+/* Interval between event stream heartbeats (ms) */
+#define EVENTS_HEARTBEAT_INTERVAL 15000
+
+/* Reconnection delay suggested to event stream clients (ms) */
+#define EVENTS_RETRY_INTERVAL 10000
+
+struct _webserver;
+
 typedef struct {
+	metric_t *requests;
+	metric_t *latency;
+} _route_metrics_t;
+
+typedef struct _connection {
+	LIST_ENTRY(_connection)   entries;
+	struct evhttp_connection *evcon;
+	struct bufferevent       *bev;
+	struct _webserver        *ws;
+	/* Chunked reply of an event stream, if any is running on connection */
+	struct evhttp_request    *stream;
+} _connection_t;
+
+typedef struct _webserver {
 	cfg_t      *cfg;
 	music_db_t *music_db;
 
@@ -54,49 +91,252 @@ typedef struct {
 
 	struct evhttp              *ev_http;
 	struct evhttp_bound_socket *ev_sock;
+
+	int                         max_connections;
+	int                         connection_count;
+	LIST_HEAD(,_connection)     connections;
+	/* Accepted in this loop iteration, evhttp connection not known yet */
+	LIST_HEAD(,_connection)     accepted;
+	struct event               *accept_event;
+
+	int                         max_loop_lag;
+	int                         loop_lag;
+	int64_t                     lag_probe_deadline;
+	struct event               *lag_probe;
+
+	int                         stream_count;
+	music_db_status_t           pushed_status;
+	int64_t                     last_heartbeat;
+	struct event               *events_push;
+
+	/* Indexed like request_table, followed by documents */
+	_route_metrics_t           *route_metrics;
+	metric_t                   *connections_metric;
+	metric_t                   *refused_limit_metric;
+	metric_t                   *refused_lag_metric;
+	metric_t                   *stream_bytes_metric;
+	metric_t                   *document_bytes_metric;
 } _webserver_t;
 
-static const struct table_entry {
-	const char *extension;
-	const char *content_type;
-} content_type_table[] = {
-	{ "html", "text/html" },
-	{ "htm",  "text/htm" },
-	{ "css",  "text/css" },
-	{ "gif",  "image/gif" },
-	{ "jpg",  "image/jpeg" },
-	{ "jpeg", "image/jpeg" },
-	{ "png",  "image/png" },
-	{ "ico",  "image/x-icon" },
-	{ "svg",  "image/svg+xml" },
-	{ "js",   "application/javascript" },
-	{ "eot",  "application/vnd.ms-fontobject" },
-	{ "woff", "application/font-woff" },
-	{ "mp3",  "audio/mpeg" },
-	{ "ogg",  "application/ogg" },
-	{ "ogx",  "application/ogx" },
-	{ NULL,   NULL },
-};
+static int64_t
+_now_ms()
+{
+	struct timeval tv;
+	evutil_gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/* Minimum interval between unknown MIME type warnings (ms) */
+#define MIME_WARNING_INTERVAL 60000
 
 static const char *
 _guess_content_type(const char *path)
 {
-	const char *last_period, *extension = NULL;
-	const struct table_entry *ent;
-	last_period = strrchr(path, '.');
-	if (!last_period || strchr(last_period, '/'))
-		goto not_found;
-	extension = last_period + 1;
-	for (ent = &content_type_table[0]; ent->extension; ++ent) {
-		if (!evutil_ascii_strcasecmp(ent->extension, extension))
-			return ent->content_type;
+	static int64_t last_warning = 0;
+	static int suppressed = 0;
+	const char *type;
+	int64_t now;
+
+	if (NULL != (type = mime_type_guess(path))) {
+		return type;
+	}
+
+	/* Don't flood the log when clients keep requesting unknown files */
+	now = _now_ms();
+	if (now - last_warning >= MIME_WARNING_INTERVAL) {
+		log_warning("No MIME type for: %s (%d similar warnings suppressed)", path, suppressed);
+		last_warning = now;
+		suppressed = 0;
+	} else {
+		suppressed++;
 	}
 
-not_found:
-	log_warning("No MIME type for: %s", extension);
 	return "application/octet-stream";
 }
 
+static void
+_lag_probe_schedule(_webserver_t *ws)
+{
+	struct timeval interval = { 0, LOOP_LAG_PROBE_INTERVAL * 1000 };
+
+	ws->lag_probe_deadline = _now_ms() + LOOP_LAG_PROBE_INTERVAL;
+	if (0 != evtimer_add(ws->lag_probe, &interval)) {
+		log_error("Failed to schedule event loop lag probe!");
+	}
+}
+
+/*
+ * Catalog queries are serviced synchronously on the event loop, so the delay
+ * with which this timer fires is the best measure of how far behind we are.
+ */
+static void
+_lag_probe_cb(evutil_socket_t fd, short events, void *arg)
+{
+	_webserver_t *ws = arg;
+	int64_t now = _now_ms();
+	int was_overloaded = ws->loop_lag > ws->max_loop_lag;
+
+	ws->loop_lag = now > ws->lag_probe_deadline ? now - ws->lag_probe_deadline : 0;
+
+	if (!was_overloaded && ws->loop_lag > ws->max_loop_lag) {
+		log_warning("Event loop lagging by %d ms, shedding catalog requests", ws->loop_lag);
+	} else if (was_overloaded && ws->loop_lag <= ws->max_loop_lag) {
+		log_info("Event loop lag back to %d ms, accepting catalog requests", ws->loop_lag);
+	}
+
+	_lag_probe_schedule(ws);
+}
+
+static void
+_connection_closed(struct evhttp_connection *evcon, void *arg)
+{
+	_connection_t *conn = arg;
+
+	if (conn->stream) {
+		/*
+		 * When the peer went away libevent detaches the unfinished reply
+		 * from the connection and leaves it for us to free. Otherwise the
+		 * server is being shut down and the request is freed along with
+		 * the connection.
+		 */
+		if (evhttp_request_get_connection(conn->stream) == NULL) {
+			evhttp_send_reply_end(conn->stream);
+		}
+		conn->ws->stream_count--;
+	}
+
+	LIST_REMOVE(conn, entries);
+	conn->ws->connection_count--;
+	metrics_gauge_add(conn->ws->connections_metric, -1);
+	free(conn);
+}
+
+static void
+_send_unavailable(struct evhttp_request *req, int close)
+{
+	struct evkeyvalq *out_headers = evhttp_request_get_output_headers(req);
+
+	/* Unlike evhttp_send_error() this keeps the connection alive if asked */
+	evhttp_add_header(out_headers, "Retry-After", "1");
+	if (close) {
+		evhttp_add_header(out_headers, "Connection", "close");
+	}
+	evhttp_send_reply(req, 503, "Service Unavailable", NULL);
+}
+
+/*
+ * Called by evhttp for every accepted socket, before it creates the
+ * connection. The bufferevent is created here so that the connection can
+ * be recognized by _accept_cb, which runs once evhttp is done with it.
+ */
+static struct bufferevent *
+_accept_bev(struct event_base *evb, void *arg)
+{
+	_webserver_t *ws = arg;
+	struct bufferevent *bev;
+	_connection_t *conn;
+
+	if (NULL == (bev = bufferevent_socket_new(evb, -1, BEV_OPT_CLOSE_ON_FREE))) {
+		log_error("Failed to create bufferevent for connection!");
+		return NULL;
+	}
+	if (NULL == (conn = malloc(sizeof(_connection_t)))) {
+		/* Left untracked, its requests are refused */
+		log_error("Failed to allocate memory for connection!");
+		return bev;
+	}
+	conn->evcon = NULL;
+	conn->bev = bev;
+	conn->ws = ws;
+	conn->stream = NULL;
+	/* Kept until _accept_cb, in case evhttp fails and frees it */
+	bufferevent_incref(bev);
+	LIST_INSERT_HEAD(&ws->accepted, conn, entries);
+	event_active(ws->accept_event, EV_TIMEOUT, 1);
+
+	return bev;
+}
+
+/*
+ * Admission of accepted connections. They are tracked until closed and
+ * dropped right away once max-connections is reached, so that idle
+ * sockets can't get around the limit.
+ */
+static void
+_accept_cb(evutil_socket_t fd, short events, void *arg)
+{
+	_webserver_t *ws = arg;
+	_connection_t *conn;
+	void *evcon;
+
+	while (NULL != (conn = LIST_FIRST(&ws->accepted))) {
+		LIST_REMOVE(conn, entries);
+
+		/* evhttp sets the connection as argument of bufferevent callbacks */
+		bufferevent_getcb(conn->bev, NULL, NULL, NULL, &evcon);
+		bufferevent_decref(conn->bev);
+		if (evcon == NULL) {
+			free(conn);
+			continue;
+		}
+		if (ws->connection_count >= ws->max_connections) {
+			log_debug("Connection limit reached, refusing connection");
+			metrics_inc(ws->refused_limit_metric);
+			evhttp_connection_free(evcon);
+			free(conn);
+			continue;
+		}
+		conn->evcon = evcon;
+		LIST_INSERT_HEAD(&ws->connections, conn, entries);
+		ws->connection_count++;
+		metrics_gauge_add(ws->connections_metric, 1);
+		evhttp_connection_set_closecb(evcon, _connection_closed, conn);
+	}
+}
+
+/* Tracked connection of evcon, NULL if it isn't tracked */
+static _connection_t *
+_find_connection(_webserver_t *ws, struct evhttp_connection *evcon)
+{
+	_connection_t *conn;
+
+	/* Bounded by max-connections, so a linear lookup is cheap enough */
+	LIST_FOREACH(conn, &ws->connections, entries) {
+		if (conn->evcon == evcon) {
+			break;
+		}
+	}
+
+	return conn;
+}
+
+/*
+ * Admission control run before any request is serviced. Requests on
+ * connections that couldn't be tracked are refused. Requests marked as
+ * sheddable are refused when the event loop falls behind by more than
+ * max-loop-lag. Returns 0 when the request may be serviced, otherwise
+ * the request has already been replied to.
+ */
+static int
+_admit_request(_webserver_t *ws, struct evhttp_request *req, int sheddable)
+{
+	struct evhttp_connection *evcon = evhttp_request_get_connection(req);
+	_connection_t *conn = _find_connection(ws, evcon);
+
+	if (conn == NULL) {
+		_send_unavailable(req, 1);
+		return -1;
+	}
+
+	if (sheddable && ws->loop_lag > ws->max_loop_lag) {
+		metrics_inc(ws->refused_lag_metric);
+		_send_unavailable(req, 0);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int
 _send_json(struct evhttp_request *req, struct json_object *json)
 {
@@ -135,8 +375,9 @@ done:
 	return ret;
 }
 
+/* Sends file, or its requested range, adding its length to sent counter */
 static int
-_send_file(struct evhttp_request *req, const char *path)
+_send_file(struct evhttp_request *req, const char *path, metric_t *sent)
 {
 	struct evkeyvalq *in_headers = evhttp_request_get_input_headers(req);
 	struct evkeyvalq *out_headers = evhttp_request_get_output_headers(req);
@@ -194,6 +435,7 @@ _send_file(struct evhttp_request *req, const char *path)
 		}
 		evhttp_send_reply(req, 200, "OK", buf);
 	}
+	metrics_add(sent, content_length);
 
 	goto done;
 
@@ -235,14 +477,122 @@ done:
 	}
 }
 
+/* Sends reply generated by writer */
+static int
+_send_generated(struct evhttp_request *req, const char *type, int (*writer)(FILE *))
+{
+	struct evbuffer *buf = NULL;
+	char *text = NULL;
+	size_t len = 0;
+	FILE *out = NULL;
+	int ret = 0;
+
+	if (NULL == (out = open_memstream(&text, &len))) {
+		goto error;
+	}
+	ret = writer(out);
+	if (0 != fclose(out) || 0 != ret) {
+		goto error;
+	}
+
+	if (NULL == (buf = evbuffer_new())) {
+		goto error;
+	}
+
+	if (0 != evbuffer_add(buf, text, len)) {
+		goto error;
+	}
+
+	if (0 != evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type", type)) {
+		goto error;
+	}
+
+	evhttp_send_reply(req, 200, "OK", buf);
+
+	goto done;
+
+error:
+	ret = -1;
+done:
+	if (buf) {
+		evbuffer_free(buf);
+	}
+	free(text);
+	return ret;
+}
+
+static void
+_metrics_request(struct evhttp_request *req, void *arg)
+{
+	if (0 != _send_generated(req, "text/plain; version=0.0.4", metrics_write)) {
+		evhttp_send_error(req, 500, "Internal Server Error");
+		log_error("Failed to service metrics request");
+	}
+}
+
+static void
+_trace_request(struct evhttp_request *req, void *arg)
+{
+	if (0 != _send_generated(req, "application/json", span_write_json)) {
+		evhttp_send_error(req, 500, "Internal Server Error");
+		log_error("Failed to service trace request");
+	}
+}
+
+/*
+ * Parses optional listing pagination parameters. Listing is unlimited
+ * unless limit is given, in which case it's capped at MAX_PAGE_SIZE.
+ */
+#define MAX_PAGE_SIZE 1000
+
+static int
+_parse_page(struct evkeyvalq *q, const char **cursor, int *limit)
+{
+	const char *limit_str = evhttp_find_header(q, "limit");
+	char *end;
+	long l;
+
+	*cursor = evhttp_find_header(q, "cursor");
+	*limit = -1;
+
+	if (limit_str == NULL) {
+		return *cursor ? -1 : 0;
+	}
+
+	l = strtol(limit_str, &end, 10);
+	if (*end != '\0' || l < 1) {
+		return -1;
+	}
+	*limit = l > MAX_PAGE_SIZE ? MAX_PAGE_SIZE : l;
+
+	return 0;
+}
+
 static void
 _artists_request(struct evhttp_request *req, void *arg)
 {
+	struct json_object *artists = NULL;
 	_webserver_t *ws = arg;
+	const struct evhttp_uri *uri = evhttp_request_get_evhttp_uri(req);
+	const char *query_str = NULL;
+	const char *cursor = NULL;
+	int limit = -1;
+	struct evkeyvalq q;
+
+	TAILQ_INIT(&q);
 
 	log_trace("Got artists listing request");
 
-	struct json_object *artists = music_db_get_artists(ws->music_db);
+	query_str = evhttp_uri_get_query(uri);
+	if (query_str) {
+		if (0 != evhttp_parse_query_str(query_str, &q) ||
+		    0 != _parse_page(&q, &cursor, &limit)) {
+			evhttp_send_error(req, HTTP_BADREQUEST, "Bad request");
+			goto done;
+		}
+	}
+
+	artists = music_db_get_artists(ws->music_db, cursor, limit);
 	if (artists == NULL) {
 		goto error;
 	}
@@ -257,6 +607,7 @@ error:
 	evhttp_send_error(req, 500, "Internal Server Error");
 	log_error("Failed to service artists listing request!");
 done:
+	evhttp_clear_headers(&q);
 	if (artists) {
 		json_object_put(artists);
 	}
@@ -268,14 +619,13 @@ _albums_request(struct evhttp_request *req, void *arg)
 {
 	struct json_object *albums = NULL;
 	_webserver_t *ws = arg;
-	struct evhttp_uri *uri;
+	const struct evhttp_uri *uri = evhttp_request_get_evhttp_uri(req);
 	const char *query_str = NULL;
+	const char *cursor = NULL;
+	int limit = -1;
 	struct evkeyvalq q;
 
-	uri = evhttp_uri_parse(evhttp_request_get_uri(req));
-	if (NULL == uri) {
-		goto error;
-	}
+	TAILQ_INIT(&q);
 
 	query_str = evhttp_uri_get_query(uri);
 	if (NULL == query_str) {
@@ -291,9 +641,13 @@ _albums_request(struct evhttp_request *req, void *arg)
 		goto error;
 	}
 
+	if (0 != _parse_page(&q, &cursor, &limit)) {
+		goto error;
+	}
+
 	log_trace("Got albums listing request, artist: \"%s\"", artist);
 
-	albums = music_db_get_albums(ws->music_db, artist);
+	albums = music_db_get_albums(ws->music_db, artist, cursor, limit);
 	if (NULL == albums) {
 		goto error;
 	}
@@ -309,9 +663,6 @@ error:
 	log_error("Failed to service albums listing request!");
 done:
 	evhttp_clear_headers(&q);
-	if (uri) {
-		evhttp_uri_free(uri);
-	}
 	if (albums) {
 		json_object_put(albums);
 	}
@@ -323,14 +674,13 @@ _songs_request(struct evhttp_request *req, void *arg)
 {
 	struct json_object *songs = NULL;
 	_webserver_t *ws = arg;
-	struct evhttp_uri *uri;
+	const struct evhttp_uri *uri = evhttp_request_get_evhttp_uri(req);
 	const char *query_str = NULL;
+	const char *cursor = NULL;
+	int limit = -1;
 	struct evkeyvalq q;
 
-	uri = evhttp_uri_parse(evhttp_request_get_uri(req));
-	if (NULL == uri) {
-		goto error;
-	}
+	TAILQ_INIT(&q);
 
 	query_str = evhttp_uri_get_query(uri);
 	if (NULL == query_str) {
@@ -351,9 +701,13 @@ _songs_request(struct evhttp_request *req, void *arg)
 		goto error;
 	}
 
+	if (0 != _parse_page(&q, &cursor, &limit)) {
+		goto error;
+	}
+
 	log_trace("Got songs listing request, artist: \"%s\", album: \"%s\"", artist, album);
 
-	songs = music_db_get_songs(ws->music_db, artist, album);
+	songs = music_db_get_songs(ws->music_db, artist, album, cursor, limit);
 	if (songs == NULL) {
 		goto error;
 	}
@@ -369,29 +723,84 @@ error:
 	log_error("Failed to service songs listing request!");
 done:
 	evhttp_clear_headers(&q);
-	if (uri) {
-		evhttp_uri_free(uri);
-	}
 	if (songs) {
 		json_object_put(songs);
 	}
 	return;
 }
 
+/* Number of search results returned unless limit is given */
+#define DEFAULT_SEARCH_LIMIT 50
+
 static void
-_stream_request(struct evhttp_request *req, void *arg)
+_search_request(struct evhttp_request *req, void *arg)
 {
+	struct json_object *results = NULL;
 	_webserver_t *ws = arg;
-	struct evhttp_uri *uri;
+	const struct evhttp_uri *uri = evhttp_request_get_evhttp_uri(req);
 	const char *query_str = NULL;
-	char *song_path = NULL;
+	const char *cursor = NULL;
+	int limit = -1;
 	struct evkeyvalq q;
 
-	uri = evhttp_uri_parse(evhttp_request_get_uri(req));
-	if (NULL == uri) {
+	TAILQ_INIT(&q);
+
+	query_str = evhttp_uri_get_query(uri);
+	if (NULL == query_str) {
+		goto error;
+	}
+
+	if (0 != evhttp_parse_query_str(query_str, &q)) {
+		goto error;
+	}
+
+	const char *text = evhttp_find_header(&q, "q");
+	if (NULL == text) {
 		goto error;
 	}
 
+	/* Search results are ranked, there is no cursor to continue from */
+	if (0 != _parse_page(&q, &cursor, &limit) || cursor != NULL) {
+		goto error;
+	}
+	if (limit < 0) {
+		limit = DEFAULT_SEARCH_LIMIT;
+	}
+
+	log_trace("Got search request: \"%s\"", text);
+
+	results = music_db_search(ws->music_db, text, limit);
+	if (NULL == results) {
+		goto error;
+	}
+
+	if (0 != _send_json(req, results)) {
+		goto error;
+	}
+
+	goto done;
+
+error:
+	evhttp_send_error(req, HTTP_BADREQUEST, "Bad request");
+	log_error("Failed to service search request!");
+done:
+	evhttp_clear_headers(&q);
+	if (results) {
+		json_object_put(results);
+	}
+}
+
+static void
+_stream_request(struct evhttp_request *req, void *arg)
+{
+	_webserver_t *ws = arg;
+	const struct evhttp_uri *uri = evhttp_request_get_evhttp_uri(req);
+	const char *query_str = NULL;
+	char *song_path = NULL;
+	struct evkeyvalq q;
+
+	TAILQ_INIT(&q);
+
 	query_str = evhttp_uri_get_query(uri);
 	if (NULL == query_str) {
 		goto error;
@@ -413,7 +822,7 @@ _stream_request(struct evhttp_request *req, void *arg)
 
 	log_trace("Got streaming request for song: %s", song_path);
 
-	if (0 != _send_file(req, song_path)) {
+	if (0 != _send_file(req, song_path, ws->stream_bytes_metric)) {
 		goto error;
 	}
 
@@ -424,48 +833,285 @@ error:
 	log_error("Failed to service songs streaming request!");
 done:
 	evhttp_clear_headers(&q);
-	if (uri) {
-		evhttp_uri_free(uri);
-	}
 	if (song_path) {
 		free(song_path);
 	}
 	return;
 }
 
-static const struct {
-	const char  *path;
-	void       (*callback) (struct evhttp_request *, void *);
-} request_table[] = {
-	{ "/bctl/status",  _status_request  },
-	{ "/bctl/artists", _artists_request },
-	{ "/bctl/albums",  _albums_request  },
-	{ "/bctl/songs",   _songs_request   },
-	{ "/stream",       _stream_request  },
-};
+static int
+_add_scan_event(struct evbuffer *buf, const music_db_status_t *status)
+{
+	return evbuffer_add_printf(buf, "event: scan\ndata: {\"scanning\":%s,\"files\":%d}\n\n",
+	                           status->scan_in_progress ? "true" : "false", status->scan_files);
+}
+
+static int
+_add_library_event(struct evbuffer *buf, const music_db_status_t *status)
+{
+	return evbuffer_add_printf(buf, "event: library\ndata: {\"generation\":%" PRId64 "}\n\n",
+	                           status->generation);
+}
+
+/*
+ * Sending a chunk drains its buffer, so every stream gets its own copy
+ * of the events in buf.
+ */
+static void
+_events_broadcast(_webserver_t *ws, struct evbuffer *buf)
+{
+	_connection_t *conn;
+	struct evbuffer *chunk;
+	size_t len = evbuffer_get_length(buf);
+	unsigned char *data;
+
+	if (NULL == (data = evbuffer_pullup(buf, -1)) || NULL == (chunk = evbuffer_new())) {
+		log_error("Failed to allocate event stream buffer!");
+		return;
+	}
+
+	LIST_FOREACH(conn, &ws->connections, entries) {
+		if (conn->stream) {
+			if (0 != evbuffer_add(chunk, data, len)) {
+				log_error("Failed to copy events to stream!");
+				break;
+			}
+			evhttp_send_reply_chunk(conn->stream, chunk);
+		}
+	}
+
+	evbuffer_free(chunk);
+}
+
+/*
+ * Pushes scan progress and library generation changes to all event streams.
+ * Heartbeats let clients tell a dead server from an idle one.
+ */
+static void
+_events_push_cb(evutil_socket_t fd, short events, void *arg)
+{
+	_webserver_t *ws = arg;
+	music_db_status_t status;
+	struct evbuffer *buf;
+	int64_t now;
+
+	music_db_get_status(ws->music_db, &status);
+	if (ws->stream_count == 0) {
+		ws->pushed_status = status;
+		return;
+	}
+
+	if (NULL == (buf = evbuffer_new())) {
+		log_error("Failed to allocate event stream buffer!");
+		return;
+	}
+
+	now = _now_ms();
+
+	if (status.scan_in_progress != ws->pushed_status.scan_in_progress ||
+	    status.scan_files != ws->pushed_status.scan_files) {
+		_add_scan_event(buf, &status);
+	}
+	if (status.generation != ws->pushed_status.generation) {
+		_add_library_event(buf, &status);
+	}
+	if (evbuffer_get_length(buf) == 0 &&
+	    now - ws->last_heartbeat >= EVENTS_HEARTBEAT_INTERVAL) {
+		evbuffer_add_printf(buf, "event: heartbeat\ndata: {}\n\n");
+	}
+
+	if (evbuffer_get_length(buf) > 0) {
+		/* Any event proves liveness, so it doubles as a heartbeat */
+		ws->last_heartbeat = now;
+		_events_broadcast(ws, buf);
+	}
+
+	ws->pushed_status = status;
+	evbuffer_free(buf);
+}
+
+static void
+_events_request(struct evhttp_request *req, void *arg)
+{
+	_webserver_t *ws = arg;
+	struct evhttp_connection *evcon = evhttp_request_get_connection(req);
+	struct evkeyvalq *out_headers = evhttp_request_get_output_headers(req);
+	struct evbuffer *buf = NULL;
+	struct timeval write_tv;
+	music_db_status_t status;
+	_connection_t *conn;
+
+	log_trace("Got event stream request");
+
+	conn = _find_connection(ws, evcon);
+	if (conn == NULL || conn->stream != NULL) {
+		goto error;
+	}
+
+	if (NULL == (buf = evbuffer_new())) {
+		goto error;
+	}
+
+	if (0 != evhttp_add_header(out_headers, "Content-Type", "text/event-stream") ||
+	    0 != evhttp_add_header(out_headers, "Cache-Control", "no-cache")) {
+		goto error;
+	}
+
+	music_db_get_status(ws->music_db, &status);
+	if (0 > evbuffer_add_printf(buf, "retry: %d\n\n", EVENTS_RETRY_INTERVAL) ||
+	    0 > _add_scan_event(buf, &status) ||
+	    0 > _add_library_event(buf, &status)) {
+		goto error;
+	}
+
+	/*
+	 * Stream stays open until the client goes away, so it must not be
+	 * subject to the idle read timeout. Writes keep their timeout so that
+	 * stalled clients are still dropped.
+	 */
+	write_tv.tv_sec = atoi(cfg_get_str(ws->cfg, CFG_CONNECTION_TIMEOUT));
+	write_tv.tv_usec = 0;
+	bufferevent_set_timeouts(evhttp_connection_get_bufferevent(evcon), NULL, &write_tv);
+
+	evhttp_send_reply_start(req, 200, "OK");
+	evhttp_send_reply_chunk(req, buf);
+
+	conn->stream = req;
+	ws->stream_count++;
+
+	goto done;
+
+error:
+	evhttp_send_error(req, 500, "Internal Server Error");
+	log_error("Failed to service event stream request!");
+done:
+	if (buf) {
+		evbuffer_free(buf);
+	}
+}
+
+static void
+_changes_request(struct evhttp_request *req, void *arg)
+{
+	struct json_object *changes = NULL;
+	_webserver_t *ws = arg;
+	const struct evhttp_uri *uri = evhttp_request_get_evhttp_uri(req);
+	const char *query_str = NULL;
+	struct evkeyvalq q;
+
+	TAILQ_INIT(&q);
+
+	query_str = evhttp_uri_get_query(uri);
+	if (NULL == query_str) {
+		goto error;
+	}
+
+	if (0 != evhttp_parse_query_str(query_str, &q)) {
+		goto error;
+	}
+
+	const char *since = evhttp_find_header(&q, "since");
+	if (NULL == since) {
+		goto error;
+	}
+
+	log_trace("Got library changes request, since: %s", since);
+
+	changes = music_db_get_changes(ws->music_db, strtoll(since, NULL, 10));
+	if (NULL == changes) {
+		goto error;
+	}
+
+	if (0 != _send_json(req, changes)) {
+		goto error;
+	}
+
+	goto done;
+
+error:
+	evhttp_send_error(req, HTTP_BADREQUEST, "Bad request");
+	log_error("Failed to service library changes request!");
+done:
+	evhttp_clear_headers(&q);
+	if (changes) {
+		json_object_put(changes);
+	}
+}
+
+/*
+ * Reports which profiling is enabled, switching it first when asked
+ * with statements=0 or 1 and spans=0 or 1.
+ */
+static void
+_profile_request(struct evhttp_request *req, void *arg)
+{
+	struct json_object *result = NULL, *value = NULL, *spans = NULL;
+	_webserver_t *ws = arg;
+	const struct evhttp_uri *uri = evhttp_request_get_evhttp_uri(req);
+	const char *query_str = NULL;
+	struct evkeyvalq q;
+
+	TAILQ_INIT(&q);
+
+	query_str = evhttp_uri_get_query(uri);
+	if (query_str && 0 != evhttp_parse_query_str(query_str, &q)) {
+		goto error;
+	}
+
+	const char *statements = evhttp_find_header(&q, "statements");
+	if (statements && 0 != music_db_set_profiling(ws->music_db, atoi(statements))) {
+		goto error;
+	}
+	const char *enable_spans = evhttp_find_header(&q, "spans");
+	if (enable_spans) {
+		span_enable(atoi(enable_spans));
+	}
+
+	if (NULL == (result = json_object_new_object()) ||
+	    NULL == (value = json_object_new_boolean(music_db_get_profiling(ws->music_db))) ||
+	    NULL == (spans = json_object_new_boolean(span_enabled))) {
+		goto error;
+	}
+	json_object_object_add(result, "statements", value);
+	json_object_object_add(result, "spans", spans);
+	value = spans = NULL;
+
+	if (0 != _send_json(req, result)) {
+		goto error;
+	}
+
+	goto done;
+
+error:
+	evhttp_send_error(req, HTTP_BADREQUEST, "Bad request");
+	log_error("Failed to service profile request!");
+done:
+	evhttp_clear_headers(&q);
+	if (value) {
+		json_object_put(value);
+	}
+	if (spans) {
+		json_object_put(spans);
+	}
+	if (result) {
+		json_object_put(result);
+	}
+}
 
 static void
 _document_request(struct evhttp_request *req, void *arg)
 {
 	_webserver_t *ws = arg;
-	const char *uri = evhttp_request_get_uri(req);
-	struct evhttp_uri *decoded = NULL;
+	const struct evhttp_uri *uri = evhttp_request_get_evhttp_uri(req);
 	struct stat st;
 	const char *path;
 	char *full_path = NULL;
-	char *decoded_path;
+	char *decoded_path = NULL;
 	int len;
 
-	log_trace("Content request: %s", uri);
-
-	decoded = evhttp_uri_parse(uri);
-	if (!decoded) {
-		log_warning("Got bad URI request!");
-		evhttp_send_error(req, HTTP_BADREQUEST, 0);
-		return;
-	}
+	log_trace("Content request: %s", evhttp_request_get_uri(req));
 
-	path = evhttp_uri_get_path(decoded);
+	path = evhttp_uri_get_path(uri);
 	if (!path) {
 		path = "/";
 	} else if (strlen(path) == 1) {
@@ -495,7 +1141,7 @@ _document_request(struct evhttp_request *req, void *arg)
 		goto error;
 	}
 
-	if (0 != _send_file(req, full_path)) {
+	if (0 != _send_file(req, full_path, ws->document_bytes_metric)) {
 		goto error;
 	}
 
@@ -505,9 +1151,6 @@ error:
 	evhttp_send_error(req, 404, "Document not found");
 
 cleanup:
-	if (decoded) {
-		evhttp_uri_free(decoded);
-	}
 	if (decoded_path) {
 		free(decoded_path);
 	}
@@ -516,6 +1159,130 @@ cleanup:
 	}
 }
 
+/*
+ * Control requests dispatch table. Must be kept sorted by path as it's
+ * searched with bsearch(). Sheddable requests may be refused when the
+ * server is overloaded.
+ */
+static const struct route {
+	const char  *path;
+	void       (*callback) (struct evhttp_request *, void *);
+	int          sheddable;
+} request_table[] = {
+	{ "/bctl/albums",  _albums_request,  1 },
+	{ "/bctl/artists", _artists_request, 1 },
+	{ "/bctl/changes", _changes_request, 1 },
+	{ "/bctl/events",  _events_request,  0 },
+	{ "/bctl/metrics", _metrics_request, 0 },
+	{ "/bctl/profile", _profile_request, 0 },
+	{ "/bctl/search",  _search_request,  1 },
+	{ "/bctl/songs",   _songs_request,   1 },
+	{ "/bctl/status",  _status_request,  0 },
+	{ "/bctl/trace",   _trace_request,   0 },
+	{ "/stream",       _stream_request,  0 },
+};
+
+#define REQUEST_TABLE_SIZE (sizeof(request_table) / sizeof(request_table[0]))
+
+static int
+_route_cmp(const void *path, const void *route)
+{
+	return strcmp(path, ((const struct route *)route)->path);
+}
+
+/*
+ * Single entry point for all requests. Replaces evhttp per path callbacks,
+ * which are matched by a linear scan over decoded copies of request path.
+ * Routes are matched against the decoded path as well, but it's only
+ * copied when it has anything to decode.
+ */
+static void
+_dispatch_request(struct evhttp_request *req, void *arg)
+{
+	_webserver_t *ws = arg;
+	const char *path = evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req));
+	const struct route *route = NULL;
+	char *decoded_path = NULL;
+	_route_metrics_t *rm;
+	uint64_t start = metrics_now_us();
+	span_t span;
+
+	if (path != NULL && strchr(path, '%') != NULL) {
+		if (NULL == (decoded_path = evhttp_uridecode(path, 0, NULL))) {
+			evhttp_send_error(req, 500, "Internal Server Error");
+			return;
+		}
+		path = decoded_path;
+	}
+	if (path != NULL) {
+		route = bsearch(path, request_table, REQUEST_TABLE_SIZE,
+		                sizeof(request_table[0]), _route_cmp);
+	}
+
+	evlog("http request %s", path);
+	if (0 != _admit_request(ws, req, route ? route->sheddable : 0)) {
+		evlog("http refused %s", path);
+		goto done;
+	}
+
+	rm = &ws->route_metrics[route ? route - request_table : REQUEST_TABLE_SIZE];
+	metrics_inc(rm->requests);
+
+	span = span_begin();
+	if (route) {
+		route->callback(req, ws);
+	} else {
+		_document_request(req, ws);
+	}
+	span_end(span, route ? route->path : "document");
+	evlog("http handled %s", path);
+
+	/* Time until reply is queued, files and event streams are sent later */
+	metrics_observe(rm->latency, metrics_now_us() - start);
+
+done:
+	free(decoded_path);
+}
+
+static int
+_register_metrics(_webserver_t *ws)
+{
+	char labels[METRICS_MAX_LABELS];
+	int i;
+
+	ws->route_metrics = calloc(REQUEST_TABLE_SIZE + 1, sizeof(_route_metrics_t));
+	if (ws->route_metrics == NULL) {
+		return -1;
+	}
+
+	for (i = 0; i <= REQUEST_TABLE_SIZE; i++) {
+		snprintf(labels, sizeof(labels), "route=\"%s\"",
+		         i < REQUEST_TABLE_SIZE ? request_table[i].path : "document");
+		ws->route_metrics[i].requests = metrics_register(METRIC_COUNTER,
+			"basileus_http_requests_total", labels, "Serviced HTTP requests.");
+		ws->route_metrics[i].latency = metrics_register(METRIC_HISTOGRAM,
+			"basileus_http_request_duration_seconds", labels,
+			"Time spent handling HTTP requests, until reply is queued.");
+	}
+
+	ws->connections_metric = metrics_register(METRIC_GAUGE,
+		"basileus_http_connections", NULL, "Open HTTP connections.");
+	ws->refused_limit_metric = metrics_register(METRIC_COUNTER,
+		"basileus_http_refused_total", "reason=\"max-connections\"",
+		"HTTP connections and requests refused by admission control.");
+	ws->refused_lag_metric = metrics_register(METRIC_COUNTER,
+		"basileus_http_refused_total", "reason=\"max-loop-lag\"",
+		"HTTP connections and requests refused by admission control.");
+	ws->stream_bytes_metric = metrics_register(METRIC_COUNTER,
+		"basileus_http_sent_bytes_total", "route=\"/stream\"",
+		"Bytes of files queued for sending.");
+	ws->document_bytes_metric = metrics_register(METRIC_COUNTER,
+		"basileus_http_sent_bytes_total", "route=\"document\"",
+		"Bytes of files queued for sending.");
+
+	return 0;
+}
+
 webserver_t
 webserver_init(cfg_t *cfg, music_db_t *db, struct event_base *evb)
 {
@@ -529,22 +1296,62 @@ webserver_init(cfg_t *cfg, music_db_t *db, struct event_base *evb)
 	}
 	memset(ws, 0, sizeof(_webserver_t));
 
+	LIST_INIT(&ws->connections);
+	LIST_INIT(&ws->accepted);
+
 	ws->ev_http = evhttp_new(evb);
 	if (!ws->ev_http) {
 		log_error("Failed to create evhttp!");
 		goto failure;
 	}
 
-	for (i = 0; i < sizeof(request_table) / sizeof(request_table[0]); i++) {
-		log_trace("Registering callback for: %s", request_table[i].path);
-		if (0 != evhttp_set_cb(ws->ev_http, request_table[i].path, request_table[i].callback, ws)) {
-			log_error("Failed to register control callback!");
-			goto failure;
-		}
+	for (i = 1; i < REQUEST_TABLE_SIZE; i++) {
+		assert(strcmp(request_table[i - 1].path, request_table[i].path) < 0);
+	}
+
+	if (0 != _register_metrics(ws)) {
+		log_error("Failed to allocate memory for request metrics!");
+		goto failure;
 	}
 
 	evhttp_set_allowed_methods(ws->ev_http, EVHTTP_REQ_GET);
-	evhttp_set_gencb(ws->ev_http, _document_request, ws);
+	evhttp_set_gencb(ws->ev_http, _dispatch_request, ws);
+
+	ws->accept_event = event_new(evb, -1, 0, _accept_cb, ws);
+	if (!ws->accept_event) {
+		log_error("Failed to create connection admission event!");
+		goto failure;
+	}
+	evhttp_set_bevcb(ws->ev_http, _accept_bev, ws);
+
+	evhttp_set_timeout(ws->ev_http, atoi(cfg_get_str(cfg, CFG_CONNECTION_TIMEOUT)));
+	evhttp_set_max_headers_size(ws->ev_http, atoi(cfg_get_str(cfg, CFG_MAX_HEADERS_SIZE)));
+	evhttp_set_max_body_size(ws->ev_http, atoi(cfg_get_str(cfg, CFG_MAX_BODY_SIZE)));
+
+	ws->max_connections = atoi(cfg_get_str(cfg, CFG_MAX_CONNECTIONS));
+	if (ws->max_connections < 1) {
+		log_warning("Invalid connection limit, assuming 1");
+		ws->max_connections = 1;
+	}
+	ws->max_loop_lag = atoi(cfg_get_str(cfg, CFG_MAX_LOOP_LAG));
+
+	ws->lag_probe = evtimer_new(evb, _lag_probe_cb, ws);
+	if (!ws->lag_probe) {
+		log_error("Failed to create event loop lag probe!");
+		goto failure;
+	}
+	_lag_probe_schedule(ws);
+
+	ws->events_push = event_new(evb, -1, EV_PERSIST, _events_push_cb, ws);
+	if (!ws->events_push) {
+		log_error("Failed to create event stream timer!");
+		goto failure;
+	}
+	struct timeval push_interval = { EVENTS_PUSH_INTERVAL / 1000, 0 };
+	if (0 != event_add(ws->events_push, &push_interval)) {
+		log_error("Failed to schedule event stream timer!");
+		goto failure;
+	}
 
 	const char *address = cfg_get_str(cfg, CFG_LISTENING_ADDRESS);
 	int port = atoi(cfg_get_str(cfg, CFG_LISTENING_PORT));
@@ -558,18 +1365,29 @@ webserver_init(cfg_t *cfg, music_db_t *db, struct event_base *evb)
 	ws->cfg = cfg;
 	ws->music_db = db;
 	ws->doc_root = cfg_get_str(cfg, CFG_DOCUMENT_ROOT);
+	music_db_get_status(db, &ws->pushed_status);
 
 	log_info("Web server started (using libevent %s)", event_get_version());
 
 	return ws;
 
 failure:
+	if (ws->accept_event) {
+		event_free(ws->accept_event);
+	}
+	if (ws->events_push) {
+		event_free(ws->events_push);
+	}
+	if (ws->lag_probe) {
+		event_free(ws->lag_probe);
+	}
 	if (ws->ev_http) {
 		evhttp_free(ws->ev_http);
 	}
 	if (ws->ev_sock) {
 		evhttp_del_accept_socket(ws->ev_http, ws->ev_sock);
 	}
+	free(ws->route_metrics);
 	free(ws);
 	return NULL;
 }
@@ -578,7 +1396,20 @@ void
 webserver_shutdown(webserver_t ws)
 {
 	_webserver_t *_ws = ws;
+	_connection_t *conn;
+
+	event_free(_ws->events_push);
+	event_free(_ws->lag_probe);
 	evhttp_del_accept_socket(_ws->ev_http, _ws->ev_sock);
+	/* Invokes _connection_closed for all tracked connections */
 	evhttp_free(_ws->ev_http);
+	/* Accepted during the last loop iteration, freed along with evhttp */
+	while (NULL != (conn = LIST_FIRST(&_ws->accepted))) {
+		LIST_REMOVE(conn, entries);
+		bufferevent_decref(conn->bev);
+		free(conn);
+	}
+	event_free(_ws->accept_event);
+	free(_ws->route_metrics);
 	free(_ws);
 }
@@ -1,102 +1,312 @@
 function BasileusCore()
 {
 	POLL_INTERVAL = 10000;
+	PAGE_SIZE = 100;
+	SEARCH_LIMIT = 100;
+	/* Server sends heartbeats every 15 seconds */
+	EVENTS_TIMEOUT = 40000;
 
 	onconnected = null;
 	ondisconnected = null;
+	onscanprogress = null;
+	onlibrarychanged = null;
 
 	_connected = false;
+	_events = null;
+	_events_watchdog = null;
+	_generation = undefined;
 	_artists = undefined;
 	_albums = {};
 	_songs = {};
 }
 
+BasileusCore.prototype.SetConnected = function(connected)
+{
+	if (connected && !_connected && this.onconnected) {
+		this.onconnected();
+	} else if (!connected && this.ondisconnected) {
+		this.ondisconnected();
+	}
+	_connected = connected;
+}
+
+/*
+ * Listens for server pushed events. Falls back to polling server status
+ * on browsers without EventSource support.
+ */
+BasileusCore.prototype.Connect = function()
+{
+	var _thiz = this;
+
+	if (typeof(EventSource) == "undefined") {
+		this.Poll();
+		return;
+	}
+
+	_events = new EventSource("/bctl/events");
+	_events.onopen = function() {
+		_thiz.SetConnected(true);
+		_thiz.ResetWatchdog();
+	}
+	_events.onerror = function() {
+		/* EventSource reconnects on its own */
+		_thiz.SetConnected(false);
+	}
+	_events.addEventListener("heartbeat", function() {
+		_thiz.ResetWatchdog();
+	});
+	_events.addEventListener("scan", function(e) {
+		_thiz.ResetWatchdog();
+		if (_thiz.onscanprogress) {
+			_thiz.onscanprogress(JSON.parse(e.data));
+		}
+	});
+	_events.addEventListener("library", function(e) {
+		_thiz.ResetWatchdog();
+		_thiz.UpdateGeneration(JSON.parse(e.data)["generation"]);
+	});
+}
+
+BasileusCore.prototype.ResetWatchdog = function()
+{
+	var _thiz = this;
+	if (_events_watchdog) {
+		window.clearTimeout(_events_watchdog);
+	}
+	_events_watchdog = window.setTimeout(function() {
+		/* Connection silently died, start over */
+		_events_watchdog = null;
+		_events.close();
+		_thiz.SetConnected(false);
+		_thiz.Connect();
+	}, EVENTS_TIMEOUT);
+}
+
+BasileusCore.prototype.ResetCaches = function()
+{
+	_artists = undefined;
+	_albums = {};
+	_songs = {};
+}
+
+BasileusCore.prototype.UpdateGeneration = function(generation)
+{
+	var _thiz = this;
+
+	if (_generation == undefined || generation == _generation) {
+		_generation = generation;
+		return;
+	}
+
+	if (generation < _generation) {
+		/* Database was recreated, nothing cached can be trusted */
+		_generation = generation;
+		this.ResetCaches();
+		if (this.onlibrarychanged) {
+			this.onlibrarychanged(null);
+		}
+		return;
+	}
+
+	var r = new XMLHttpRequest();
+	r.open("GET", "/bctl/changes?since=" + _generation);
+	r.onload = function() {
+		if (r.status != 200) {
+			return;
+		}
+		var changes = JSON.parse(r.responseText);
+		_thiz.InvalidateCaches(changes);
+		_generation = changes["generation"];
+		if (_thiz.onlibrarychanged) {
+			_thiz.onlibrarychanged(changes);
+		}
+	}
+	r.send();
+}
+
+BasileusCore.prototype.InvalidateCaches = function(changes)
+{
+	var artists = changes["artists"];
+	var albums = changes["albums"];
+
+	for (var i = 0; i < artists.length; i++) {
+		delete _albums[artists[i]];
+		if (_artists && _artists.items.indexOf(artists[i]) < 0 &&
+		    _artists.Covers(artists[i])) {
+			/* New artist among the pages already shown */
+			_artists = undefined;
+		}
+	}
+	for (var i = 0; i < albums.length; i++) {
+		if (_songs[albums[i][0]]) {
+			delete _songs[albums[i][0]][albums[i][1]];
+		}
+	}
+}
+
 BasileusCore.prototype.Poll = function()
 {
 	var r = new XMLHttpRequest();
 	var _thiz = this;
 	r.open("GET", "/bctl/status");
 	r.onload = function() {
-		if (_thiz.onconnected && !_connected) {
-			_thiz.onconnected();
-		}
-		_connected = true;
+		_thiz.SetConnected(true);
 		window.setTimeout(function() { _thiz.Poll(); }, POLL_INTERVAL);
 	}
 	r.onerror = function() {
+		_thiz.SetConnected(false);
+		window.setTimeout(function() { _thiz.Poll(); }, POLL_INTERVAL);
+	}
+	r.send();
+}
+
+/*
+ * Catalog listing fetched from the server page by page. Pages are appended
+ * to items as they arrive, complete is set once there are no more.
+ */
+function BasileusListing(uri)
+{
+	this.uri = uri;
+	this.items = [];
+	this.next = null;
+	this.complete = false;
+	this.waiting = [];
+}
+
+/*
+ * Tells whether name sorts within the part of the listing fetched so far.
+ * Names past the cursor come with the later pages anyway.
+ */
+BasileusListing.prototype.Covers = function(name)
+{
+	if (this.complete) {
+		return true;
+	}
+	return this.next != null && name < this.next;
+}
+
+/*
+ * Fetches next page of the listing. Callback gets the listing and index of
+ * the first newly added item.
+ */
+BasileusCore.prototype.FetchPage = function(listing, _cb)
+{
+	var _thiz = this;
+
+	if (listing.complete) {
+		_cb(listing, listing.items.length);
+		return;
+	}
+
+	listing.waiting.push(_cb);
+	if (listing.waiting.length > 1) {
+		/* Page already on its way */
+		return;
+	}
+
+	var uri = listing.uri + "limit=" + PAGE_SIZE;
+	if (listing.next != null) {
+		uri += "&cursor=" + encodeURIComponent(listing.next);
+	}
+
+	var r = new XMLHttpRequest();
+	r.open("GET", uri);
+	r.onload = function() {
+		var waiting = listing.waiting;
+		var start = listing.items.length;
+		var page = JSON.parse(r.responseText);
+
+		listing.items = listing.items.concat(page["items"]);
+		listing.next = page["next"];
+		listing.complete = (listing.next == null);
+		listing.waiting = [];
+
+		for (var i = 0; i < waiting.length; i++) {
+			waiting[i](listing, start);
+		}
+	}
+	r.onerror = function() {
+		listing.waiting = [];
 		if (_thiz.ondisconnected) {
 			_thiz.ondisconnected();
 		}
-		_connected = false;
-		window.setTimeout(function() { _thiz.Poll(); }, POLL_INTERVAL);
 	}
 	r.send();
 }
 
-BasileusCore.prototype.GetArtists = function(_cb)
+BasileusCore.prototype.FetchAll = function(listing, _cb)
 {
 	var _thiz = this;
-	if (_artists != null) {
+	if (listing.complete) {
+		_cb(listing);
+	} else {
+		this.FetchPage(listing, function() {
+			_thiz.FetchAll(listing, _cb);
+		});
+	}
+}
+
+/* Returns artists listing with at least the first page fetched */
+BasileusCore.prototype.GetArtists = function(_cb)
+{
+	if (_artists == undefined) {
+		_artists = new BasileusListing("/bctl/artists?");
+	}
+	if (_artists.items.length > 0 || _artists.complete) {
 		_cb(_artists);
 	} else {
-		var r = new XMLHttpRequest();
-		r.open("GET", "/bctl/artists");
-		r.onload = function() {
-			_artists = JSON.parse(r.responseText);
-			_cb(_artists);
-		};
-		r.error = function() {
-			if (_thiz.ondisconnected) {
-				_thiz.ondisconnected();
-			}
-		}
-		r.send();
+		this.FetchPage(_artists, _cb);
 	}
 }
 
+/* Returns albums listing with at least the first page fetched */
 BasileusCore.prototype.GetAlbums = function(artist, _cb)
 {
-	var _thiz = this;
-	if (_albums[artist]) {
-		_cb(_albums[artist]);
+	if (_albums[artist] == undefined) {
+		_albums[artist] = new BasileusListing("/bctl/albums?artist=" +
+		                                      encodeURIComponent(artist) + "&");
+	}
+	var listing = _albums[artist];
+	if (listing.items.length > 0 || listing.complete) {
+		_cb(listing);
 	} else {
-		var r = new XMLHttpRequest();
-		r.open("GET", "/bctl/albums?artist=" + encodeURIComponent(artist));
-		r.onload = function() {
-			_albums[artist] = JSON.parse(r.responseText);
-			_cb(_albums[artist]);
-		}
-		r.onerror = function() {
-			if (_thiz.ondisconnected) {
-				_thiz.ondisconnected();
-			}
-		}
-		r.send();
+		this.FetchPage(listing, _cb);
 	}
 }
 
+/* Returns all songs of an album, albums are short enough to fetch at once */
 BasileusCore.prototype.GetSongs = function(artist, album, _cb)
+{
+	if (_songs[artist] == undefined) {
+		_songs[artist] = new Object();
+	}
+	if (_songs[artist][album] == undefined) {
+		_songs[artist][album] = new BasileusListing("/bctl/songs?artist=" +
+		                                            encodeURIComponent(artist) + "&album=" +
+		                                            encodeURIComponent(album) + "&");
+	}
+	this.FetchAll(_songs[artist][album], function(listing) {
+		_cb(listing.items);
+	});
+}
+
+/* Full text search, results are not cached as they're cheap to get */
+BasileusCore.prototype.Search = function(text, _cb)
 {
 	var _thiz = this;
-	if (_songs[artist] && _songs[artist][album]) {
-		_cb(_songs[artist][album]);
-	} else {
-		var r = new XMLHttpRequest();
-		r.open("GET", "/bctl/songs?artist=" + encodeURIComponent(artist) + "&album=" + encodeURIComponent(album));
-		r.onload = function() {
-			if (_songs[artist] == undefined) {
-				_songs[artist] = new Object();
-			}
-			_songs[artist][album] = JSON.parse(r.responseText);
-			_cb(_songs[artist][album]);
+	var r = new XMLHttpRequest();
+	r.open("GET", "/bctl/search?q=" + encodeURIComponent(text) + "&limit=" + SEARCH_LIMIT);
+	r.onload = function() {
+		if (r.status == 200) {
+			_cb(JSON.parse(r.responseText));
 		}
-		r.onerror = function() {
-			if (_thiz.ondisconnected) {
-				_thiz.ondisconnected();
-			}
+	}
+	r.onerror = function() {
+		if (_thiz.ondisconnected) {
+			_thiz.ondisconnected();
 		}
-		r.send();
 	}
+	r.send();
 }
 
 BasileusCore.prototype.GetSongURI = function(song_id)
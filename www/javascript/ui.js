@@ -2,6 +2,10 @@ function BasileusUI()
 {
 	PLAY_TIMEOUT = 750;
 	PROGRESS_BAR_UPDATE_INTERVAL = 1000;
+	/* Distance from media browser bottom at which next page is fetched (px) */
+	LOAD_MORE_DISTANCE = 200;
+	/* Delay between last keystroke and search request (ms) */
+	SEARCH_DELAY = 250;
 
 	_core = new BasileusCore();
 	_thiz = this;
@@ -16,9 +20,26 @@ function BasileusUI()
 		document.getElementById('server-status').textContent = "Disconnected";
 	}
 
-	_core.Poll();
+	_core.onscanprogress = function(scan)
+	{
+		var status = "Connected";
+		if (scan["scanning"]) {
+			status += " (scanning, " + scan["files"] + " files)";
+		}
+		document.getElementById('server-status').textContent = status;
+	}
+
+	_core.onlibrarychanged = function(changes)
+	{
+		_thiz.RefreshView(changes);
+	}
+
+	_core.Connect();
 
 	_selectedArtist = null;
+	_view = { "type": "artists" };
+	_load_more = null;
+	_search_timer = null;
 
 	_player = undefined;
 	_playlist = [];
@@ -112,6 +133,25 @@ BasileusUI.prototype.OnLoad = function()
 		_thiz.PreviewPosition(evt.clientX);
 	});
 
+	document.getElementById("media-search").addEventListener('input', function() {
+		var text = this.value;
+		if (_search_timer) {
+			window.clearTimeout(_search_timer);
+		}
+		_search_timer = window.setTimeout(function() {
+			_search_timer = null;
+			if (text.trim().length > 0) {
+				_thiz.Search(text);
+			} else {
+				_thiz.ShowArtistsList();
+			}
+		}, SEARCH_DELAY);
+	});
+
+	document.getElementById("media-browser").addEventListener('scroll', function() {
+		_thiz.OnMediaBrowserScroll();
+	});
+
 	window.addEventListener('resize', function() {
 		_thiz.UpdateBufferedBar();
 	});
@@ -119,8 +159,46 @@ BasileusUI.prototype.OnLoad = function()
 	this.ShowArtistsList();
 }
 
+/*
+ * Redraws media browser if library changes affect what it currently shows.
+ * Null changes mean the whole library was replaced.
+ */
+BasileusUI.prototype.RefreshView = function(changes)
+{
+	var affected = (changes == null) || _view["type"] == "search";
+
+	if (!affected && _view["type"] == "artists") {
+		affected = changes["artists"].length > 0;
+	} else if (!affected && _view["type"] == "albums") {
+		affected = changes["artists"].indexOf(_view["artist"]) >= 0;
+	} else if (!affected && _view["type"] == "songs") {
+		for (var i = 0; i < changes["albums"].length; i++) {
+			if (changes["albums"][i][0] == _view["artist"] &&
+			    changes["albums"][i][1] == _view["album"]) {
+				affected = true;
+				break;
+			}
+		}
+	}
+
+	if (!affected) {
+		return;
+	}
+
+	if (_view["type"] == "search") {
+		this.Search(_view["text"]);
+	} else if (_view["type"] == "albums") {
+		this.SelectArtist(_view["artist"]);
+	} else if (_view["type"] == "songs") {
+		this.SelectAlbum(_view["artist"], _view["album"]);
+	} else {
+		this.ShowArtistsList();
+	}
+}
+
 BasileusUI.prototype.ShowArtistsList = function()
 {
+	_view = { "type": "artists" };
 	_core.GetArtists(function(artists) {
 		var list = document.getElementById("media-browser");
 		var hdr = document.getElementById("media-browser-header");
@@ -131,10 +209,10 @@ BasileusUI.prototype.ShowArtistsList = function()
 			list.removeChild(list.lastChild);
 		}
 
-		for (var i = 0; i < artists.length; i++) {
+		_thiz.ShowListing(artists, 0, function(artist, i) {
 			var item = document.createElement("div");
 			var text = document.createElement("div");
-			var txt = document.createTextNode(artists[i]);
+			var txt = document.createTextNode(artist);
 
 			if (i % 2) {
 				item.className = "media-browser-item rounded-box odd-item";
@@ -151,13 +229,48 @@ BasileusUI.prototype.ShowArtistsList = function()
 			});
 
 			list.appendChild(item);
-		}
+		});
 	});
 }
 
+/*
+ * Renders listing items starting at given index and arranges for the next
+ * page to be fetched once media browser is scrolled to the bottom.
+ */
+BasileusUI.prototype.ShowListing = function(listing, start, render)
+{
+	var view = _view;
+
+	for (var i = start; i < listing.items.length; i++) {
+		render(listing.items[i], i);
+	}
+
+	_load_more = null;
+	if (!listing.complete) {
+		_load_more = function() {
+			_load_more = null;
+			_core.FetchPage(listing, function(listing, start) {
+				/* User may have navigated away meanwhile */
+				if (_view == view) {
+					_thiz.ShowListing(listing, start, render);
+				}
+			});
+		}
+	}
+}
+
+BasileusUI.prototype.OnMediaBrowserScroll = function()
+{
+	var list = document.getElementById("media-browser");
+	if (_load_more && list.scrollTop + list.clientHeight >= list.scrollHeight - LOAD_MORE_DISTANCE) {
+		_load_more();
+	}
+}
+
 BasileusUI.prototype.SelectArtist = function(artist)
 {
 	_selectedArtist = artist;
+	_view = { "type": "albums", "artist": artist };
 	_core.GetAlbums(artist, function(albums) {
 		var list = document.getElementById("media-browser");
 		var hdr = document.getElementById("media-browser-header");
@@ -179,11 +292,11 @@ BasileusUI.prototype.SelectArtist = function(artist)
 		});
 		list.appendChild(up);
 
-		for (var i = 0; i < albums.length; i++) {
+		_thiz.ShowListing(albums, 0, function(album, i) {
 			var item = document.createElement("div");
 			var text = document.createElement("div");
 			var add = document.createElement("i");
-			var txt = document.createTextNode(albums[i]);
+			var txt = document.createTextNode(album);
 
 			if (i % 2) {
 				item.className = "media-browser-item rounded-box odd-item";
@@ -210,12 +323,59 @@ BasileusUI.prototype.SelectArtist = function(artist)
 				});
 			});
 			list.appendChild(item);
+		});
+	});
+}
+
+BasileusUI.prototype.Search = function(text)
+{
+	var view = { "type": "search", "text": text };
+	_view = view;
+	_load_more = null;
+	_core.Search(text, function(songs) {
+		/* Results of a stale search may arrive late */
+		if (_view != view) {
+			return;
+		}
+
+		var list = document.getElementById("media-browser");
+		var hdr = document.getElementById("media-browser-header");
+
+		hdr.textContent = "Search Results";
+
+		while (list.lastChild) {
+			list.removeChild(list.lastChild);
+		}
+
+		for (var i = 0; i < songs.length; i++) {
+			var item = document.createElement("div");
+			var text = document.createElement("div");
+			var txt = document.createTextNode(songs[i]["title"] + " - " + songs[i]["artist"]);
+
+			if (i % 2) {
+				item.className = "media-browser-item rounded-box odd-item";
+			} else {
+				item.className = "media-browser-item rounded-box even-item";
+			}
+			text.className = "media-browser-item-text";
+
+			text.appendChild(txt);
+			item.appendChild(text);
+
+			item.addEventListener("click", (function(song) {
+				return function() {
+					_thiz.AddSongsToPlaylist(song["artist"], song["album"], [song]);
+				}
+			})(songs[i]));
+			list.appendChild(item);
 		}
 	});
 }
 
 BasileusUI.prototype.SelectAlbum = function(artist, album)
 {
+	_view = { "type": "songs", "artist": artist, "album": album };
+	_load_more = null;
 	_core.GetSongs(artist, album, function(songs) {
 		var list = document.getElementById("media-browser");
 		var hdr = document.getElementById("media-browser-header");
@@ -255,7 +415,7 @@ BasileusUI.prototype.SelectAlbum = function(artist, album)
 			item.appendChild(text);
 			item.appendChild(add);
 
-			item.setAttribute('song-id', songs[i]["hash"]);
+			item.setAttribute('song-id', songs[i]["id"]);
 			item.setAttribute('song-length', songs[i]["length"]);
 
 			var queueSong = function(songNode) {
@@ -263,7 +423,7 @@ BasileusUI.prototype.SelectAlbum = function(artist, album)
 				list[0] = new Object();
 				list[0]["title"] = songNode.textContent;
 				list[0]["length"] = songNode.getAttribute('song-length');
-				list[0]["hash"] = songNode.getAttribute('song-id');
+				list[0]["id"] = songNode.getAttribute('song-id');
 				_thiz.AddSongsToPlaylist(_selectedArtist, album, list);
 			};
 
@@ -418,7 +578,7 @@ BasileusUI.prototype.Play = function(song)
 
 	playlist.children[_currentSong].className += " selected-item";
 
-	var songID = _playlist[_currentSong]["hash"];
+	var songID = _playlist[_currentSong]["id"];
 	if (_play_timer) {
 		window.clearTimeout(_play_timer);
 		_play_timer = null;